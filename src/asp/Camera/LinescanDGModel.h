@@ -30,6 +30,9 @@
 
 #include <asp/Core/StereoSettings.h>  // TESTING
 
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
 namespace asp {
 
 
@@ -45,6 +48,25 @@ namespace asp {
 
   // The useful load_dg_camera_model() function is at the end of the file.
 
+  /// The camera position, velocity and pose sampled at equal time
+  /// steps, one per image line. See LinescanDGModel::build_line_table().
+  struct LinescanLineTable {
+    double t0, dt; ///< Time of the first sample, and the step, which is negative for reverse scans
+    std::vector<vw::Vector3> positions, velocities;
+    std::vector<vw::Quat>    poses; ///< Consecutive ones have a non-negative dot product
+
+    /// Find the sample before the given time and the weight of the one
+    /// after it. Return false if the time is outside the table.
+    bool bracket(double t, size_t & k, double & w) const {
+      double s = (t - t0)/dt;
+      if (!(s >= 0.0) || s >= double(positions.size() - 1))
+        return false;
+      k = size_t(s);
+      w = s - double(k);
+      return true;
+    }
+  };
+
   /// Specialization of the generic LinescanModel for Digital Globe satellites.
   /// - Two template types are left floating so that AdjustedLinescanDGModel can modify them.
   template <class PositionFuncT, class PoseFuncT>
@@ -75,10 +97,11 @@ namespace asp {
 
     // -- This set of functions implements virtual functions from LinescanModel.h --
 
-    // Implement the functions from the LinescanModel class using functors
-    virtual vw::Vector3 get_camera_center_at_time  (double time) const { return m_position_func(time); }
-    virtual vw::Vector3 get_camera_velocity_at_time(double time) const { return m_velocity_func(time); }
-    virtual vw::Quat    get_camera_pose_at_time    (double time) const { return m_pose_func    (time); }
+    // Implement the functions from the LinescanModel class using functors,
+    // or the line table, if it was built.
+    virtual vw::Vector3 get_camera_center_at_time  (double time) const;
+    virtual vw::Vector3 get_camera_velocity_at_time(double time) const;
+    virtual vw::Quat    get_camera_pose_at_time    (double time) const;
     virtual double      get_time_at_line           (double line) const { return m_time_func    (line); }
     
     /// As pixel_to_vector, but in the local camera frame.
@@ -97,6 +120,19 @@ namespace asp {
     /// by extension at neighboring lines as well.
     vw::camera::PinholeModel linescan_to_pinhole(double y) const;
 
+    /// Tabulate the camera position, velocity and pose at the time of
+    /// each image line, over the image and a margin around it. These
+    /// are then interpolated from the table rather than evaluated from
+    /// the ephemeris and attitude, which is faster when the same lines
+    /// are looked up many times, as in triangulation and projection.
+    /// The results differ very slightly. The table is not modified
+    /// after it is built, so all copies of this model and all threads
+    /// share it. The velocity aberration and atmospheric refraction
+    /// corrections depend on the pixel, so they are still applied
+    /// per pixel.
+    void build_line_table();
+    bool has_line_table() const { return m_line_table.get() != NULL; }
+
 
     PositionFuncT const& get_position_func() const {return m_position_func;} ///< Access the position function
     vw::camera::LinearPiecewisePositionInterpolation
@@ -121,6 +157,16 @@ namespace asp {
     /// Low accuracy function used by point_to_pixel to get a good solver starting seed.
     vw::Vector2 point_to_pixel_uncorrected(vw::Vector3 const& point, double starty) const;
 
+    /// How far from the detector, along the image lines, the point
+    /// projects when the camera is at the given line. The uncorrected
+    /// projection is the line where this is zero.
+    double line_offset(vw::Vector3 const& point, double line) const;
+
+    /// Find the two lines between which line_offset() changes sign by
+    /// bisection, and interpolate between them. Return -1 if it does
+    /// not change sign within the image.
+    double bracket_line(vw::Vector3 const& point) const;
+
   protected: // Variables
   
     // Extrinsics
@@ -137,6 +183,8 @@ namespace asp {
     vw::Vector2  m_detector_origin; 
     double       m_focal_length;    ///< The focal length, also stored in pixels.
 
+    boost::shared_ptr<const LinescanLineTable> m_line_table; ///< Empty unless build_line_table() is called
+
     // Levenberg Marquardt solver for linescan number
     //
     // We solve for the line number of the image that position the
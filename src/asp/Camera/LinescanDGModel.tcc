@@ -17,6 +17,7 @@
 
 
 
+#include <vw/Core/Log.h>
 #include <vw/Math/EulerAngles.h>
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Core/StereoSettings.h>
@@ -40,6 +41,90 @@ vw::camera::PinholeModel LinescanDGModel<PositionFuncT, PoseFuncT>::linescan_to_
 }
 
 
+template <class PositionFuncT, class PoseFuncT>
+vw::Vector3 LinescanDGModel<PositionFuncT, PoseFuncT>::get_camera_center_at_time(double time) const {
+  size_t k;
+  double w;
+  if (m_line_table && m_line_table->bracket(time, k, w))
+    return (1.0 - w)*m_line_table->positions[k] + w*m_line_table->positions[k+1];
+  return m_position_func(time);
+}
+
+template <class PositionFuncT, class PoseFuncT>
+vw::Vector3 LinescanDGModel<PositionFuncT, PoseFuncT>::get_camera_velocity_at_time(double time) const {
+  size_t k;
+  double w;
+  if (m_line_table && m_line_table->bracket(time, k, w))
+    return (1.0 - w)*m_line_table->velocities[k] + w*m_line_table->velocities[k+1];
+  return m_velocity_func(time);
+}
+
+// The poses one line apart differ by a tiny rotation, so normalized
+// linear interpolation is as good as slerp.
+template <class PositionFuncT, class PoseFuncT>
+vw::Quat LinescanDGModel<PositionFuncT, PoseFuncT>::get_camera_pose_at_time(double time) const {
+  size_t k;
+  double w;
+  if (m_line_table && m_line_table->bracket(time, k, w)) {
+    vw::Quat const& a = m_line_table->poses[k];
+    vw::Quat const& b = m_line_table->poses[k+1];
+    double v = 1.0 - w;
+    vw::Quat q(v*a.w() + w*b.w(), v*a.x() + w*b.x(), v*a.y() + w*b.y(), v*a.z() + w*b.z());
+    double len = sqrt(q.w()*q.w() + q.x()*q.x() + q.y()*q.y() + q.z()*q.z());
+    return vw::Quat(q.w()/len, q.x()/len, q.y()/len, q.z()/len);
+  }
+  return m_pose_func(time);
+}
+
+template <class PositionFuncT, class PoseFuncT>
+void LinescanDGModel<PositionFuncT, PoseFuncT>::build_line_table() {
+
+  int num_lines = m_image_size.y();
+  if (num_lines < 2)
+    return;
+  double first = m_time_func(0), last = m_time_func(num_lines - 1);
+  double dt = (last - first)/(num_lines - 1.0);
+  if (dt == 0)
+    return;
+
+  // Points may project somewhat outside the image, so go beyond it if
+  // the ephemeris and attitude cover that.
+  int margins[] = {num_lines/10, 0};
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int margin = margins[attempt];
+    int num_samples = num_lines + 2*margin;
+    boost::shared_ptr<LinescanLineTable> table(new LinescanLineTable);
+    table->t0 = first - margin*dt;
+    table->dt = dt;
+    table->positions.resize(num_samples);
+    table->velocities.resize(num_samples);
+    table->poses.resize(num_samples);
+    try {
+      for (int k = 0; k < num_samples; k++) {
+        double t = table->t0 + k*dt;
+        table->positions [k] = m_position_func(t);
+        table->velocities[k] = m_velocity_func(t);
+        vw::Quat q = m_pose_func(t);
+        // Keep the same hemisphere as the previous sample, so that they
+        // can be interpolated component-wise.
+        if (k > 0) {
+          vw::Quat const& p = table->poses[k-1];
+          if (p.w()*q.w() + p.x()*q.x() + p.y()*q.y() + p.z()*q.z() < 0)
+            q = vw::Quat(-q.w(), -q.x(), -q.y(), -q.z());
+        }
+        table->poses[k] = q;
+      }
+    } catch (const vw::Exception&) {
+      continue; // Try again with no margin
+    }
+    m_line_table = table;
+    return;
+  }
+
+  vw::vw_out(vw::WarningMessage) << "Could not tabulate the linescan camera poses. "
+                                 << "Using the ephemeris and attitude directly.\n";
+}
+
 template <class PositionFuncT, class PoseFuncT>
 vw::Vector3 LinescanDGModel<PositionFuncT, PoseFuncT>::get_local_pixel_vector(vw::Vector2 const& pix) const {
   vw::Vector3 local_vec(pix[0]+m_detector_origin[0], m_detector_origin[1], m_focal_length);
@@ -79,7 +164,10 @@ vw::Vector2 LinescanDGModel<PositionFuncT, PoseFuncT>::point_to_pixel_uncorrecte
   int status;
   vw::Vector<double> objective(1), start(1);
   start[0] = m_image_size.y()/2; 
-  // Use a refined guess, if available, otherwise the center line.
+  // Use a refined guess, if available. Otherwise, if the line offsets
+  // are cheap to find, bracket the line, else use the center line.
+  if (starty < 0 && m_line_table)
+    starty = bracket_line(point);
   if (starty >= 0)
     start[0] = starty;
 
@@ -93,13 +181,53 @@ vw::Vector2 LinescanDGModel<PositionFuncT, PoseFuncT>::point_to_pixel_uncorrecte
   VW_ASSERT( status > 0, vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model" );
 
   // Solve for sample location now that we know the correct line
-  double      t  = m_time_func( solution[0] );
-  vw::Vector3 pt = inverse( m_pose_func(t) ).rotate( point - m_position_func(t) );
+  double      t  = get_time_at_line( solution[0] );
+  vw::Vector3 pt = inverse( get_camera_pose_at_time(t) ).rotate( point - get_camera_center_at_time(t) );
   pt *= m_focal_length / pt.z();
 
   return vw::Vector2(pt.x() - m_detector_origin[0], solution[0]);
 }
 
+template <class PositionFuncT, class PoseFuncT>
+double LinescanDGModel<PositionFuncT, PoseFuncT>::line_offset(vw::Vector3 const& point,
+                                                              double line) const {
+  double       t        = get_time_at_line(line);
+  vw::Quat     pose     = get_camera_pose_at_time(t);
+  vw::Vector3  position = get_camera_center_at_time(t);
+
+  // Get point in camera's frame and rescale to pixel units
+  vw::Vector3 pt = vw::camera::point_to_camera_coord(position, pose, point);
+  pt *= m_focal_length / pt.z();
+  return pt.y() - m_detector_origin[1]; // Error against the location of the detector
+}
+
+template <class PositionFuncT, class PoseFuncT>
+double LinescanDGModel<PositionFuncT, PoseFuncT>::bracket_line(vw::Vector3 const& point) const {
+
+  int lo = 0, hi = m_image_size.y() - 1;
+  if (hi <= lo)
+    return -1;
+  double f_lo = line_offset(point, lo), f_hi = line_offset(point, hi);
+  if (!(f_lo*f_hi <= 0)) // Also catches NaN
+    return -1;
+
+  while (hi - lo > 1) {
+    int mid = lo + (hi - lo)/2;
+    double f_mid = line_offset(point, mid);
+    if (f_lo*f_mid <= 0) {
+      hi   = mid;
+      f_hi = f_mid;
+    } else {
+      lo   = mid;
+      f_lo = f_mid;
+    }
+  }
+
+  if (f_lo == f_hi)
+    return lo;
+  return lo + f_lo/(f_lo - f_hi);
+}
+
 
 
 
@@ -116,15 +244,8 @@ vw::Vector2 LinescanDGModel<PositionFuncT, PoseFuncT>::point_to_pixel_uncorrecte
 template <class PositionFuncT, class PoseFuncT>
 typename LinescanDGModel<PositionFuncT, PoseFuncT>::LinescanLMA::result_type
 LinescanDGModel<PositionFuncT, PoseFuncT>::LinescanLMA::operator()( domain_type const& y ) const {
-  double       t        = m_model->get_time_at_line(y[0]);
-  vw::Quat     pose     = m_model->get_camera_pose_at_time(t);
-  vw::Vector3  position = m_model->m_position_func(t);
-
-  // Get point in camera's frame and rescale to pixel units
-  vw::Vector3 pt = vw::camera::point_to_camera_coord(position, pose, m_point);
-  pt *= m_model->m_focal_length / pt.z();
   result_type result(1);
-  result[0] = pt.y() - m_model->m_detector_origin[1]; // Error against the location of the detector
+  result[0] = m_model->line_offset(m_point, y[0]);
   return result;
 }
 
@@ -244,7 +365,7 @@ boost::shared_ptr<DGCameraModel> load_dg_camera_model_from_xml(std::string const
   // This is where we could set the Earth radius if we have that info.
 
   typedef boost::shared_ptr<DGCameraModel> CameraModelPtr;
-  return CameraModelPtr(new DGCameraModel(vw::camera::PiecewiseAPositionInterpolation(eph.position_vec, eph.velocity_vec, et0, edt ),
+  CameraModelPtr cam(new DGCameraModel(vw::camera::PiecewiseAPositionInterpolation(eph.position_vec, eph.velocity_vec, et0, edt ),
 					                                vw::camera::LinearPiecewisePositionInterpolation(eph.velocity_vec, et0, edt),
 					                                vw::camera::SLERPPoseInterpolation(att.quat_vec, at0, adt),
 					                                tlc_time_interpolation, img.image_size,
@@ -254,6 +375,11 @@ boost::shared_ptr<DGCameraModel> load_dg_camera_model_from_xml(std::string const
 					                                !stereo_settings().disable_correct_velocity_aberration,
 					                                !stereo_settings().disable_correct_atmospheric_refraction)
 		    );
+
+  if (stereo_settings().dg_line_table)
+    cam->build_line_table();
+
+  return cam;
 } // End function load_dg_camera_model()
 
 
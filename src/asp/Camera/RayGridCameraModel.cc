@@ -0,0 +1,301 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/RayGridCameraModel.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Math/Quaternion.h>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace asp {
+
+  namespace {
+    // Identifies the table files, and changes whenever their layout does
+    const char RAY_GRID_MAGIC[] = "ASPRAYGRID1";
+
+    // The angle between two directions, accurate also for small angles
+    double ray_angle(Vector3 const& a, Vector3 const& b) {
+      return atan2(norm_2(cross_prod(a, b)), dot_prod(a, b));
+    }
+  }
+
+  RayGridCameraModel::RayGridCameraModel(boost::shared_ptr<camera::CameraModel> exact_camera,
+                                         BBox2i const& pixel_box, int spacing, double tol,
+                                         std::string const& table_file,
+                                         std::string const& key):
+    m_exact_camera(exact_camera), m_pixel_box(pixel_box), m_spacing(spacing), m_tol(tol) {
+
+    if (m_spacing <= 0 || m_pixel_box.empty())
+      vw_throw(ArgumentErr() << "RayGridCameraModel: Expecting a positive grid spacing "
+                             << "and a non-empty pixel box.\n");
+
+    // Enough nodes to reach the last pixel, and at least one cell
+    m_num_x = std::max(2, int(ceil((m_pixel_box.width () - 1.0) / m_spacing)) + 1);
+    m_num_y = std::max(2, int(ceil((m_pixel_box.height() - 1.0) / m_spacing)) + 1);
+
+    if (table_file != "" && read(table_file, key)) {
+      vw_out() << "Read camera ray table: " << table_file << "\n";
+    } else {
+      tabulate();
+      if (table_file != "")
+        write(table_file, key);
+    }
+    VW_OUT(DebugMessage, "asp") << "Fraction of ray table cells using the exact camera: "
+                                << exact_cell_fraction() << "\n";
+  }
+
+  Vector2 RayGridCameraModel::node_pixel(int i, int j) const {
+    return Vector2(m_pixel_box.min().x() + double(i)*m_spacing,
+                   m_pixel_box.min().y() + double(j)*m_spacing);
+  }
+
+  double RayGridCameraModel::exact_cell_fraction() const {
+    if (m_use_exact.empty())
+      return 1.0;
+    return double(std::count(m_use_exact.begin(), m_use_exact.end(), 1)) / m_use_exact.size();
+  }
+
+  void RayGridCameraModel::tabulate() {
+
+    vw_out() << "Tabulating camera rays on a grid of " << m_num_x << " x " << m_num_y
+             << " nodes.\n";
+
+    int num_nodes = m_num_x*m_num_y;
+    m_centers.assign(num_nodes, Vector3());
+    m_dirs.assign   (num_nodes, Vector3());
+    std::vector<vw::uint8> node_ok(num_nodes, 0);
+    for (int j = 0; j < m_num_y; j++) {
+      for (int i = 0; i < m_num_x; i++) {
+        Vector2 pix = node_pixel(i, j);
+        try {
+          Vector3 ctr = m_exact_camera->camera_center(pix);
+          Vector3 dir = m_exact_camera->pixel_to_vector(pix);
+          m_centers[node_index(i, j)] = ctr;
+          m_dirs   [node_index(i, j)] = dir;
+          node_ok  [node_index(i, j)] = 1;
+        } catch (...) {}
+      }
+    }
+
+    // Check the interpolation at the center of each cell. The error
+    // allowed scales with how much the ray changes per pixel.
+    m_use_exact.assign((m_num_x - 1)*(m_num_y - 1), 1);
+    for (int j = 0; j < m_num_y - 1; j++) {
+      for (int i = 0; i < m_num_x - 1; i++) {
+        if (!node_ok[node_index(i, j    )] || !node_ok[node_index(i + 1, j    )] ||
+            !node_ok[node_index(i, j + 1)] || !node_ok[node_index(i + 1, j + 1)])
+          continue;
+
+        Vector2 pix = node_pixel(i, j) + Vector2(0.5, 0.5)*m_spacing;
+        Vector3 ctr, dir;
+        try {
+          ctr = m_exact_camera->camera_center(pix);
+          dir = m_exact_camera->pixel_to_vector(pix);
+        } catch (...) {
+          continue;
+        }
+
+        Vector3 const& c00 = m_centers[node_index(i,     j    )];
+        Vector3 const& c10 = m_centers[node_index(i + 1, j    )];
+        Vector3 const& c01 = m_centers[node_index(i,     j + 1)];
+        Vector3 const& d00 = m_dirs   [node_index(i,     j    )];
+        Vector3 const& d10 = m_dirs   [node_index(i + 1, j    )];
+        Vector3 const& d01 = m_dirs   [node_index(i,     j + 1)];
+        double angle_per_pix  = std::max(ray_angle(d00, d10), ray_angle(d00, d01)) / m_spacing;
+        double center_per_pix = std::max(norm_2(c10 - c00),   norm_2(c01 - c00))   / m_spacing;
+
+        Vector3 interp_ctr = interp(m_centers, i, j, 0.5, 0.5);
+        Vector3 interp_dir = normalize(interp(m_dirs, i, j, 0.5, 0.5));
+        bool good = (ray_angle(interp_dir, dir) <= m_tol*angle_per_pix &&
+                     norm_2(interp_ctr - ctr) <= m_tol*center_per_pix + 1e-8*norm_2(ctr));
+        m_use_exact[cell_index(i, j)] = !good;
+      }
+    }
+  }
+
+  bool RayGridCameraModel::locate(Vector2 const& pix, int & i, int & j,
+                                  double & fx, double & fy) const {
+    double x = (pix[0] - m_pixel_box.min().x()) / m_spacing;
+    double y = (pix[1] - m_pixel_box.min().y()) / m_spacing;
+    if (!(x >= 0 && y >= 0 && x <= m_num_x - 1 && y <= m_num_y - 1)) // also catches NaN
+      return false;
+    i = std::min(int(x), m_num_x - 2);
+    j = std::min(int(y), m_num_y - 2);
+    fx = x - i;
+    fy = y - j;
+    return !m_use_exact[cell_index(i, j)];
+  }
+
+  Vector3 RayGridCameraModel::interp(std::vector<Vector3> const& vals,
+                                     int i, int j, double fx, double fy) const {
+    return (1 - fy)*((1 - fx)*vals[node_index(i, j    )] + fx*vals[node_index(i + 1, j    )])
+      +         fy *((1 - fx)*vals[node_index(i, j + 1)] + fx*vals[node_index(i + 1, j + 1)]);
+  }
+
+  Vector2 RayGridCameraModel::point_to_pixel(Vector3 const& point) const {
+    return m_exact_camera->point_to_pixel(point);
+  }
+
+  Vector3 RayGridCameraModel::pixel_to_vector(Vector2 const& pix) const {
+    int i, j;
+    double fx, fy;
+    if (!locate(pix, i, j, fx, fy))
+      return m_exact_camera->pixel_to_vector(pix);
+    return normalize(interp(m_dirs, i, j, fx, fy));
+  }
+
+  Vector3 RayGridCameraModel::camera_center(Vector2 const& pix) const {
+    int i, j;
+    double fx, fy;
+    if (!locate(pix, i, j, fx, fy))
+      return m_exact_camera->camera_center(pix);
+    return interp(m_centers, i, j, fx, fy);
+  }
+
+  Quaternion<double> RayGridCameraModel::camera_pose(Vector2 const& pix) const {
+    return m_exact_camera->camera_pose(pix);
+  }
+
+  // The table file layout is the magic string, the key, the grid
+  // parameters, the node centers and directions, and the cell flags.
+  void RayGridCameraModel::write(std::string const& table_file, std::string const& key) const {
+
+    // Write under a temporary name and rename, so that other processes
+    // reading the same file never see a partial table.
+    std::string temp = fs::unique_path(table_file + ".%%%%-%%%%.tmp").string();
+    {
+      std::ofstream ofs(temp.c_str(), std::ios::binary);
+      if (!ofs.good()) {
+        vw_out(WarningMessage) << "Could not write camera ray table: " << table_file << "\n";
+        return;
+      }
+      vw::int32 key_len = key.size();
+      vw::int32 box[4] = {m_pixel_box.min().x(), m_pixel_box.min().y(),
+                          m_pixel_box.width(),   m_pixel_box.height()};
+      vw::int32 grid[3] = {m_spacing, m_num_x, m_num_y};
+      ofs.write(RAY_GRID_MAGIC, sizeof(RAY_GRID_MAGIC));
+      ofs.write((char const*)&key_len, sizeof(key_len));
+      ofs.write(key.data(), key_len);
+      ofs.write((char const*)box,  sizeof(box));
+      ofs.write((char const*)grid, sizeof(grid));
+      ofs.write((char const*)&m_tol, sizeof(m_tol));
+      for (size_t k = 0; k < m_centers.size(); k++)
+        ofs.write((char const*)&m_centers[k][0], 3*sizeof(double));
+      for (size_t k = 0; k < m_dirs.size(); k++)
+        ofs.write((char const*)&m_dirs[k][0], 3*sizeof(double));
+      ofs.write((char const*)&m_use_exact[0], m_use_exact.size());
+    }
+
+    boost::system::error_code ec;
+    fs::rename(temp, table_file, ec);
+    if (ec) {
+      fs::remove(temp, ec);
+      vw_out(WarningMessage) << "Could not write camera ray table: " << table_file << "\n";
+      return;
+    }
+    vw_out() << "Wrote camera ray table: " << table_file << "\n";
+  }
+
+  bool RayGridCameraModel::read(std::string const& table_file, std::string const& key) {
+
+    std::ifstream ifs(table_file.c_str(), std::ios::binary);
+    if (!ifs.good())
+      return false;
+
+    char magic[sizeof(RAY_GRID_MAGIC)];
+    vw::int32 key_len = 0, box[4], grid[3];
+    double tol = 0;
+    ifs.read(magic, sizeof(magic));
+    ifs.read((char*)&key_len, sizeof(key_len));
+    if (!ifs.good() || memcmp(magic, RAY_GRID_MAGIC, sizeof(magic)) != 0 ||
+        key_len != int(key.size()))
+      return false;
+    std::string file_key(key_len, ' ');
+    ifs.read(&file_key[0], key_len);
+    ifs.read((char*)box,  sizeof(box));
+    ifs.read((char*)grid, sizeof(grid));
+    ifs.read((char*)&tol, sizeof(tol));
+    if (!ifs.good() || file_key != key ||
+        box[0] != m_pixel_box.min().x() || box[1] != m_pixel_box.min().y() ||
+        box[2] != m_pixel_box.width()   || box[3] != m_pixel_box.height()  ||
+        grid[0] != m_spacing || grid[1] != m_num_x || grid[2] != m_num_y || tol != m_tol)
+      return false;
+
+    int num_nodes = m_num_x*m_num_y;
+    m_centers.assign(num_nodes, Vector3());
+    m_dirs.assign   (num_nodes, Vector3());
+    m_use_exact.assign((m_num_x - 1)*(m_num_y - 1), 1);
+    for (int k = 0; k < num_nodes; k++)
+      ifs.read((char*)&m_centers[k][0], 3*sizeof(double));
+    for (int k = 0; k < num_nodes; k++)
+      ifs.read((char*)&m_dirs[k][0], 3*sizeof(double));
+    ifs.read((char*)&m_use_exact[0], m_use_exact.size());
+    if (!ifs.good())
+      return false;
+
+    // The key can't capture every way in which the camera may have
+    // changed, so check the corners and the middle of the grid.
+    int check_i[5] = {0, m_num_x - 1, 0,           m_num_x - 1, m_num_x/2};
+    int check_j[5] = {0, 0,           m_num_y - 1, m_num_y - 1, m_num_y/2};
+    for (int k = 0; k < 5; k++) {
+      int n = node_index(check_i[k], check_j[k]);
+      Vector2 pix = node_pixel(check_i[k], check_j[k]);
+      Vector3 ctr, dir;
+      try {
+        Vector3 c = m_exact_camera->camera_center(pix);
+        Vector3 d = m_exact_camera->pixel_to_vector(pix);
+        ctr = c;
+        dir = d;
+      } catch (...) {} // Failed nodes were stored as zero
+      if (norm_2(ctr - m_centers[n]) > 1e-8*std::max(1.0, norm_2(ctr)) ||
+          norm_2(dir - m_dirs[n]) > 1e-10) {
+        vw_out() << "The camera ray table " << table_file
+                 << " does not match the camera. Recomputing it.\n";
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  boost::shared_ptr<camera::CameraModel>
+  unwrap_ray_grid(boost::shared_ptr<camera::CameraModel> cam) {
+    RayGridCameraModel const* grid_cam = dynamic_cast<RayGridCameraModel const*>(cam.get());
+    if (grid_cam == NULL)
+      return cam;
+    return grid_cam->exact_camera();
+  }
+
+  camera::CameraModel const* unwrap_ray_grid(camera::CameraModel const* cam) {
+    RayGridCameraModel const* grid_cam = dynamic_cast<RayGridCameraModel const*>(cam);
+    if (grid_cam == NULL)
+      return cam;
+    return grid_cam->exact_camera().get();
+  }
+
+} // end namespace asp
@@ -0,0 +1,113 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file RayGridCameraModel.h
+///
+/// A camera which tabulates the camera center and pointing direction
+/// of another camera on a grid of pixels, and interpolates them in
+/// between. Meant for cameras which are expensive to evaluate, such
+/// as ISIS, Digital Globe, and ASTER cameras.
+///
+#ifndef __ASP_CAMERA_RAY_GRID_CAMERA_MODEL_H__
+#define __ASP_CAMERA_RAY_GRID_CAMERA_MODEL_H__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+#include <vw/Camera/CameraModel.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// Rays are found by bilinear interpolation between the grid nodes.
+  /// When a grid cell is tabulated, the interpolated ray at its center
+  /// is compared with the exact one. If they differ by more than the
+  /// tolerance, or if the exact camera fails at a corner of the cell,
+  /// the whole cell goes to the exact camera instead. So do the pixels
+  /// outside the grid, and all calls to point_to_pixel().
+  class RayGridCameraModel : public vw::camera::CameraModel {
+
+  public:
+    /// Tabulate the camera on a grid of the given spacing, covering the
+    /// given box of pixels. The tolerance is in pixels, in the sense
+    /// that an error of one pixel is the change in the direction, or
+    /// in the camera center, from one pixel to the next. If a table
+    /// file is given, the table is read from it if it was made with
+    /// the same box, spacing, tolerance and key, and if it agrees with
+    /// the camera at a few of the grid nodes. Otherwise the camera is
+    /// tabulated and the table is saved to this file.
+    RayGridCameraModel(boost::shared_ptr<vw::camera::CameraModel> exact_camera,
+                       vw::BBox2i const& pixel_box, int spacing, double tol,
+                       std::string const& table_file = "",
+                       std::string const& key = "");
+
+    virtual ~RayGridCameraModel() {}
+    virtual std::string type() const { return "RayGrid"; }
+
+    virtual vw::Vector2 point_to_pixel (vw::Vector3 const& point) const;
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix  ) const;
+    virtual vw::Vector3 camera_center  (vw::Vector2 const& pix  ) const;
+    virtual vw::Quaternion<double> camera_pose(vw::Vector2 const& pix) const;
+
+    boost::shared_ptr<vw::camera::CameraModel> exact_camera() const { return m_exact_camera; }
+
+    /// The fraction of the grid cells which use the exact camera.
+    double exact_cell_fraction() const;
+
+  private:
+    vw::Vector2 node_pixel(int i, int j) const;
+    int node_index(int i, int j) const { return j*m_num_x + i; }
+    int cell_index(int i, int j) const { return j*(m_num_x - 1) + i; }
+
+    /// Find the cell containing the pixel, and the position within
+    /// it. Return false if the exact camera must be used.
+    bool locate(vw::Vector2 const& pix, int & i, int & j, double & fx, double & fy) const;
+
+    vw::Vector3 interp(std::vector<vw::Vector3> const& vals,
+                       int i, int j, double fx, double fy) const;
+
+    void tabulate();
+    bool read (std::string const& table_file, std::string const& key);
+    void write(std::string const& table_file, std::string const& key) const;
+
+    boost::shared_ptr<vw::camera::CameraModel> m_exact_camera;
+    vw::BBox2i m_pixel_box;
+    int        m_spacing;
+    double     m_tol;
+    int        m_num_x, m_num_y; // The number of grid nodes in each direction
+
+    // Per node. Nodes where the exact camera fails are set to zero.
+    std::vector<vw::Vector3> m_centers, m_dirs;
+
+    // Per cell, whether to use the exact camera
+    std::vector<vw::uint8> m_use_exact;
+  };
+
+  /// If the camera is a RayGridCameraModel, return the camera it
+  /// wraps. Otherwise return the camera itself.
+  boost::shared_ptr<vw::camera::CameraModel>
+  unwrap_ray_grid(boost::shared_ptr<vw::camera::CameraModel> cam);
+  vw::camera::CameraModel const* unwrap_ray_grid(vw::camera::CameraModel const* cam);
+
+} // end namespace asp
+
+#endif//__ASP_CAMERA_RAY_GRID_CAMERA_MODEL_H__
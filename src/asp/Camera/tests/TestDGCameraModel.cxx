@@ -158,3 +158,29 @@ TEST(DGCameraModel, CreateCamera) {
   XMLPlatformUtils::Terminate();
 }
 
+// The line table must give nearly the same rays and projections as
+// evaluating the ephemeris and attitude directly.
+TEST(DGCameraModel, LineTable) {
+
+  xercesc::XMLPlatformUtils::Initialize();
+
+  boost::shared_ptr<DGCameraModel> cam1 = load_dg_camera_model_from_xml("dg_example1.xml");
+  boost::shared_ptr<DGCameraModel> cam2 = load_dg_camera_model_from_xml("dg_example1.xml");
+  EXPECT_FALSE( cam2->has_line_table() );
+  cam2->build_line_table();
+  ASSERT_TRUE( cam2->has_line_table() );
+
+  for ( double i = 0; i < 30000; i += 2500.3 ) {
+    for ( double j = 0; j < 24000; j += 1999.7 ) {
+      Vector2 pix(i, j);
+      EXPECT_VECTOR_NEAR( cam1->camera_center(pix), cam2->camera_center(pix), 1e-3 );
+      EXPECT_VECTOR_NEAR( cam1->pixel_to_vector(pix), cam2->pixel_to_vector(pix), 1e-9 );
+
+      // The line is bracketed without a guess
+      Vector3 pt = cam1->camera_center(pix) + 2e4 * cam1->pixel_to_vector(pix);
+      EXPECT_VECTOR_NEAR( pix, cam2->point_to_pixel(pt), 1e-2 );
+    }
+  }
+
+  XMLPlatformUtils::Terminate();
+}
@@ -0,0 +1,113 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/RayGridCameraModel.h>
+#include <boost/filesystem/operations.hpp>
+#include <test/Helpers.h>
+
+using namespace vw;
+using namespace asp;
+using namespace vw::test;
+
+namespace {
+
+  // A narrow field of view linescan-like camera. The view direction
+  // has a kink at column 500, and the camera fails past column 900.
+  class KinkCamera : public camera::CameraModel {
+  public:
+    mutable int num_calls;
+    KinkCamera(): num_calls(0) {}
+    virtual std::string type() const { return "Kink"; }
+
+    virtual Vector2 point_to_pixel(Vector3 const& /*point*/) const {
+      vw_throw(NoImplErr() << "KinkCamera::point_to_pixel");
+      return Vector2();
+    }
+    virtual Vector3 pixel_to_vector(Vector2 const& pix) const {
+      num_calls++;
+      if (pix[0] > 900)
+        vw_throw(camera::PixelToRayErr() << "Outside the camera.");
+      double x = pix[0] < 500 ? pix[0]*1e-6 : 500e-6 + (pix[0] - 500)*3e-6;
+      return normalize(Vector3(x, pix[1]*1e-6, 1.0));
+    }
+    virtual Vector3 camera_center(Vector2 const& pix) const {
+      num_calls++;
+      return Vector3(0, 7.0*pix[1], 7e6);
+    }
+  };
+
+  double angle(Vector3 const& a, Vector3 const& b) {
+    return atan2(norm_2(cross_prod(a, b)), dot_prod(a, b));
+  }
+}
+
+TEST(RayGridCameraModel, Interpolation) {
+  boost::shared_ptr<KinkCamera> exact(new KinkCamera);
+  RayGridCameraModel grid(exact, BBox2i(0, 0, 1000, 800), 32, 0.01);
+
+  // Away from the kink, the interpolated rays are within the tolerance
+  // of 1e-6 radians per pixel.
+  for (double x = 3.7; x < 470; x += 41.3) {
+    for (double y = 1.1; y < 799; y += 37.9) {
+      Vector2 pix(x, y);
+      EXPECT_LT(angle(grid.pixel_to_vector(pix), exact->pixel_to_vector(pix)), 0.01*1e-6);
+      EXPECT_VECTOR_NEAR(grid.camera_center(pix), exact->camera_center(pix), 1e-6);
+    }
+  }
+
+  // The cell with the kink, and the cells next to the failing camera,
+  // use the exact camera.
+  Vector2 kink_pix(496, 100), edge_pix(899, 100);
+  EXPECT_VECTOR_NEAR(grid.pixel_to_vector(kink_pix), exact->pixel_to_vector(kink_pix), 0.0);
+  EXPECT_VECTOR_NEAR(grid.pixel_to_vector(edge_pix), exact->pixel_to_vector(edge_pix), 0.0);
+  EXPECT_THROW(grid.pixel_to_vector(Vector2(950, 100)), camera::PixelToRayErr);
+  EXPECT_GT(grid.exact_cell_fraction(), 0.0);
+  EXPECT_LT(grid.exact_cell_fraction(), 0.5);
+
+  // Outside the grid, too
+  Vector2 out_pix(-5, 100);
+  EXPECT_VECTOR_NEAR(grid.pixel_to_vector(out_pix), exact->pixel_to_vector(out_pix), 0.0);
+}
+
+TEST(RayGridCameraModel, TableFile) {
+  std::string table_file = "ray_grid_test.raygrid";
+  boost::filesystem::remove(table_file);
+
+  boost::shared_ptr<KinkCamera> exact(new KinkCamera);
+  RayGridCameraModel grid1(exact, BBox2i(0, 0, 1000, 800), 32, 0.01, table_file, "key1");
+  ASSERT_TRUE(boost::filesystem::exists(table_file));
+  int num_tabulate_calls = exact->num_calls;
+
+  // Reading the table back only checks a few nodes
+  exact->num_calls = 0;
+  RayGridCameraModel grid2(exact, BBox2i(0, 0, 1000, 800), 32, 0.01, table_file, "key1");
+  EXPECT_LE(exact->num_calls, 10);
+  EXPECT_NEAR(grid1.exact_cell_fraction(), grid2.exact_cell_fraction(), 1e-12);
+  Vector2 pix(123.4, 567.8);
+  EXPECT_VECTOR_NEAR(grid1.pixel_to_vector(pix), grid2.pixel_to_vector(pix), 1e-15);
+
+  // A different key or spacing makes a new table
+  exact->num_calls = 0;
+  RayGridCameraModel grid3(exact, BBox2i(0, 0, 1000, 800), 32, 0.01, table_file, "key2");
+  EXPECT_EQ(num_tabulate_calls, exact->num_calls);
+  exact->num_calls = 0;
+  RayGridCameraModel grid4(exact, BBox2i(0, 0, 1000, 800), 64, 0.01, table_file, "key2");
+  EXPECT_GT(exact->num_calls, 10);
+
+  boost::filesystem::remove(table_file);
+}
@@ -0,0 +1,161 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/BBoxRTree.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace vw;
+
+namespace asp {
+
+  // How many children, or boxes, each node has
+  const int RTREE_NODE_SIZE = 16;
+
+  namespace {
+
+    // Sort the indices of given boxes by the x or y coordinate of the box center
+    struct CenterLess {
+      std::vector<BBox2> const& m_boxes;
+      int m_coord;
+      CenterLess(std::vector<BBox2> const& boxes, int coord): m_boxes(boxes), m_coord(coord) {}
+      bool operator()(int a, int b) const {
+        return m_boxes[a].min()[m_coord] + m_boxes[a].max()[m_coord]
+          < m_boxes[b].min()[m_coord] + m_boxes[b].max()[m_coord];
+      }
+    };
+
+    // The Sort-Tile-Recursive order of the boxes. Sort them by x,
+    // cut them in vertical slices, and sort each slice by y. Then
+    // consecutive runs of RTREE_NODE_SIZE boxes are close together.
+    std::vector<int> str_order(std::vector<BBox2> const& boxes) {
+      int num = boxes.size();
+      std::vector<int> order(num);
+      for (int i = 0; i < num; i++)
+        order[i] = i;
+
+      int num_nodes  = (num + RTREE_NODE_SIZE - 1) / RTREE_NODE_SIZE;
+      int num_slices = (int)ceil(sqrt(double(num_nodes)));
+      int slice_len  = num_slices * RTREE_NODE_SIZE;
+
+      std::sort(order.begin(), order.end(), CenterLess(boxes, 0));
+      for (int beg = 0; beg < num; beg += slice_len) {
+        int end = std::min(beg + slice_len, num);
+        std::sort(order.begin() + beg, order.begin() + end, CenterLess(boxes, 1));
+      }
+      return order;
+    }
+
+  } // end anonymous namespace
+
+  void BBoxRTree::build(std::vector<BBox2> const& boxes) {
+
+    m_num_boxes = boxes.size();
+    m_levels.clear();
+    m_boxes.clear();
+    m_indices.clear();
+
+    std::vector<BBox2> valid_boxes;
+    std::vector<int>   valid_indices;
+    for (size_t i = 0; i < boxes.size(); i++) {
+      if (boxes[i].empty())
+        continue;
+      valid_boxes.push_back(boxes[i]);
+      valid_indices.push_back(i);
+    }
+    if (valid_boxes.empty())
+      return;
+
+    std::vector<int> order = str_order(valid_boxes);
+    for (size_t i = 0; i < order.size(); i++) {
+      m_boxes.push_back  (valid_boxes  [order[i]]);
+      m_indices.push_back(valid_indices[order[i]]);
+    }
+
+    // The leaves
+    int num = m_boxes.size();
+    m_levels.push_back(std::vector<Node>());
+    for (int beg = 0; beg < num; beg += RTREE_NODE_SIZE) {
+      Node node;
+      node.begin = beg;
+      node.end   = std::min(beg + RTREE_NODE_SIZE, num);
+      for (int i = node.begin; i < node.end; i++)
+        node.box.grow(m_boxes[i]);
+      m_levels.back().push_back(node);
+    }
+
+    // Pack the nodes of each level the same way, until only the root
+    // is left. Nothing refers yet to the nodes of the level being
+    // packed, so they can be reordered.
+    while (m_levels.back().size() > 1) {
+      std::vector<Node> & level = m_levels.back();
+      std::vector<BBox2> node_boxes;
+      for (size_t i = 0; i < level.size(); i++)
+        node_boxes.push_back(level[i].box);
+      order = str_order(node_boxes);
+      std::vector<Node> sorted_level;
+      for (size_t i = 0; i < order.size(); i++)
+        sorted_level.push_back(level[order[i]]);
+      level.swap(sorted_level);
+
+      std::vector<Node> parents;
+      int num_nodes = level.size();
+      for (int beg = 0; beg < num_nodes; beg += RTREE_NODE_SIZE) {
+        Node node;
+        node.begin = beg;
+        node.end   = std::min(beg + RTREE_NODE_SIZE, num_nodes);
+        for (int i = node.begin; i < node.end; i++)
+          node.box.grow(level[i].box);
+        parents.push_back(node);
+      }
+      m_levels.push_back(parents);
+    }
+  }
+
+  void BBoxRTree::query(BBox2 const& box, std::vector<int> & indices) const {
+
+    indices.clear();
+    if (m_levels.empty() || box.empty())
+      return;
+
+    // Pairs of level and node index within that level
+    std::vector< std::pair<int, int> > stack;
+    stack.push_back(std::make_pair(int(m_levels.size()) - 1, 0));
+    while (!stack.empty()) {
+      int level = stack.back().first;
+      Node const& node = m_levels[level][stack.back().second];
+      stack.pop_back();
+      if (!node.box.intersects(box))
+        continue;
+
+      if (level == 0) {
+        for (int i = node.begin; i < node.end; i++) {
+          if (m_boxes[i].intersects(box))
+            indices.push_back(m_indices[i]);
+        }
+      }else{
+        for (int i = node.begin; i < node.end; i++)
+          stack.push_back(std::make_pair(level - 1, i));
+      }
+    }
+
+    std::sort(indices.begin(), indices.end());
+  }
+
+} // end namespace asp
@@ -0,0 +1,63 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BBoxRTree.h
+///
+/// A static R-tree over a set of 2D boxes, to quickly find which of
+/// many boxes, such as the footprints of input DEMs, intersect a
+/// given box.
+
+#ifndef __ASP_CORE_BBOX_RTREE_H__
+#define __ASP_CORE_BBOX_RTREE_H__
+
+#include <vw/Math/BBox.h>
+#include <vector>
+
+namespace asp {
+
+  /// The tree is built once with Sort-Tile-Recursive packing, and
+  /// can't be modified later. Queries are thread-safe.
+  class BBoxRTree {
+  public:
+    BBoxRTree(): m_num_boxes(0) {}
+    explicit BBoxRTree(std::vector<vw::BBox2> const& boxes): m_num_boxes(0) { build(boxes); }
+
+    /// Index the given boxes. Empty boxes are never found.
+    void build(std::vector<vw::BBox2> const& boxes);
+
+    /// The indices of the boxes intersecting the given box, in
+    /// increasing order. Boxes which only touch it count as well.
+    void query(vw::BBox2 const& box, std::vector<int> & indices) const;
+
+    size_t size() const { return m_num_boxes; }
+
+  private:
+    struct Node {
+      vw::BBox2 box;
+      int begin, end; // Children in the level below, or entries for leaves
+    };
+
+    // m_levels[0] are the leaves, and the last level has the root.
+    std::vector< std::vector<Node> > m_levels;
+    std::vector<vw::BBox2>           m_boxes;   // The boxes, in leaf order
+    std::vector<int>                 m_indices; // Their original indices
+    size_t                           m_num_boxes;
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_BBOX_RTREE_H__
@@ -29,6 +29,7 @@
 #include <boost/filesystem/path.hpp>
 #include <boost/shared_ptr.hpp>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/Thread.h>
 #include <vw/Image/ImageIO.h>
 #include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/FileIO/DiskImageView.h>
@@ -38,6 +39,8 @@
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
+#include <limits>
+#include <sstream>
 #include <map>
 #include <string>
 
@@ -132,6 +135,12 @@ namespace asp {
   // Note: We use this constant in the python code as well
   const std::string ASP_POINT_OFFSET_TAG_STR = "POINT_OFFSET";
 
+  /// String we use in ASP written point cloud files to indicate that
+  /// the points are stored as integers, and must be multiplied by this
+  /// value, before the offset is added back.
+  // Note: We use this constant in the python code as well
+  const std::string ASP_POINT_SCALE_TAG_STR = "POINT_SCALE";
+
   // Specialized functions for reading/writing images with a shift.
   // The shift is meant to bring the pixel values closer to origin,
   // with goal of saving the pixels as float instead of double.
@@ -179,6 +188,77 @@ namespace asp {
   }
 
 
+  /// Number of points which quantize_pixels() could not fit in int32.
+  /// Shared among the copies of the functor made by the image tiles.
+  struct QuantizeOverflowCount {
+    vw::Mutex mutex;
+    size_t    count;
+    QuantizeOverflowCount(): count(0) {}
+  };
+
+  /// Divide all components of given vector image by the given scale
+  /// and round them to int32. Points whose first 3 components do not
+  /// fit are set to (0, 0, 0), and so are invalid, and are counted in
+  /// the given overflow count. The remaining components, such as the
+  /// triangulation error, are clamped.
+  template <class VecT>
+  struct QuantizePixels:
+    public vw::ReturnFixedType< vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> > {
+    typedef vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> result_type;
+    double m_scale;
+    boost::shared_ptr<QuantizeOverflowCount> m_overflow;
+    QuantizePixels(double scale, boost::shared_ptr<QuantizeOverflowCount> overflow):
+      m_scale(scale), m_overflow(overflow){
+      VW_ASSERT( m_scale > 0.0,
+                 vw::ArgumentErr() << "Quantization scale must be positive.");
+    }
+    result_type operator() (VecT const& pt) const {
+      const double max_val = std::numeric_limits<vw::int32>::max();
+      result_type result;
+      for (size_t i = 0; i < result.size(); i++) {
+        double val = round(pt[i]/m_scale);
+        if (std::abs(val) > max_val) {
+          if (i < 3) {
+            // Rare, so the lock does not slow down the writing
+            if (m_overflow) {
+              vw::Mutex::Lock lock(m_overflow->mutex);
+              m_overflow->count++;
+            }
+            return result_type();
+          }
+          val = (val > 0) ? max_val : -max_val;
+        }
+        result[i] = (vw::int32)val;
+      }
+      return result;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, QuantizePixels<typename ImageT::pixel_type> >
+  inline quantize_pixels( vw::ImageViewBase<ImageT> const& image, double scale,
+                          boost::shared_ptr<QuantizeOverflowCount> overflow
+                          = boost::shared_ptr<QuantizeOverflowCount>() ) {
+    return vw::UnaryPerPixelView<ImageT, QuantizePixels<typename ImageT::pixel_type> >
+      ( image.impl(), QuantizePixels<typename ImageT::pixel_type>(scale, overflow) );
+  }
+
+  /// Multiply all components of given vector image by the given scale.
+  /// Undoes quantize_pixels() when reading.
+  template <class VecT>
+  struct ScalePixels: public vw::ReturnFixedType<VecT> {
+    double m_scale;
+    ScalePixels(double scale):m_scale(scale){}
+    VecT operator() (VecT const& pt) const {
+      return m_scale*pt;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, ScalePixels<typename ImageT::pixel_type> >
+  inline scale_pixels( vw::ImageViewBase<ImageT> const& image, double scale ) {
+    return vw::UnaryPerPixelView<ImageT, ScalePixels<typename ImageT::pixel_type> >
+      ( image.impl(), ScalePixels<typename ImageT::pixel_type>(scale) );
+  }
+
   /// To help with compression, round to about 1mm, but
   /// use for rounding a number with few digits in binary.
   const double APPROX_ONE_MM = 1.0/1024.0;
@@ -226,6 +306,38 @@ namespace asp {
                                std::map<std::string, std::string>() );
 
 
+  /// Block write image while subtracting a given value from all pixels
+  /// and storing the result as int32 multiples of the rounding error.
+  /// This is lossless compared to block_write_approx_gdal_image(), but
+  /// with horizontal differencing it compresses much better. The shift
+  /// must be non-zero, as otherwise the points won't fit in int32.
+  template <class ImageT>
+  void block_write_quantized_gdal_image(const std::string &filename,
+                                        vw::Vector3 const& shift,
+                                        double rounding_error,
+                                        vw::ImageViewBase<ImageT> const& image,
+                                        bool has_georef,
+                                        vw::cartography::GeoReference const& georef,
+                                        vw::cartography::GdalWriteOptions const& opt,
+                                        vw::ProgressCallback const& progress_callback
+                                        = vw::ProgressCallback::dummy_instance(),
+                                        std::map<std::string, std::string> const& keywords =
+                                        std::map<std::string, std::string>() );
+
+  /// Single-threaded version of block_write_quantized_gdal_image().
+  template <class ImageT>
+  void write_quantized_gdal_image(const std::string &filename,
+                                  vw::Vector3 const& shift,
+                                  double rounding_error,
+                                  vw::ImageViewBase<ImageT> const& image,
+                                  bool has_georef,
+                                  vw::cartography::GeoReference const& georef,
+                                  vw::cartography::GdalWriteOptions const& opt,
+                                  vw::ProgressCallback const& progress_callback
+                                  = vw::ProgressCallback::dummy_instance(),
+                                  std::map<std::string, std::string> const& keywords =
+                                  std::map<std::string, std::string>() );
+
   /// Often times, we'd like to save an image to disk by using big
   /// blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
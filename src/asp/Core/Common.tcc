@@ -97,6 +97,102 @@ namespace asp {
     }
   }
 
+  namespace common_private {
+    // The keywords and options for writing a quantized point cloud.
+    // Horizontal differencing before compression is what makes the
+    // quantized values compress well.
+    inline void quantized_write_settings(vw::Vector3 const& shift, double scale,
+                                         std::map<std::string, std::string> const& keywords,
+                                         vw::cartography::GdalWriteOptions const& opt,
+                                         std::map<std::string, std::string> & local_keywords,
+                                         vw::cartography::GdalWriteOptions & local_opt){
+      VW_ASSERT(norm_2(shift) > 0, vw::ArgumentErr()
+                << "A quantized point cloud needs a non-zero shift.");
+      local_keywords = keywords;
+      local_keywords[ASP_POINT_OFFSET_TAG_STR] = vw::vec_to_str(shift);
+      std::ostringstream os;
+      os.precision(17);
+      os << scale;
+      local_keywords[ASP_POINT_SCALE_TAG_STR ] = os.str();
+      local_opt = opt;
+      if (local_opt.gdal_options.count("COMPRESS") &&
+          local_opt.gdal_options["COMPRESS"] != "NONE")
+        local_opt.gdal_options["PREDICTOR"] = "2";
+    }
+
+    // Points farther than about 2^31 times the scale from the shift
+    // do not fit in int32 and were written as invalid.
+    inline void warn_quantize_overflow(std::string const& filename, double scale,
+                                       QuantizeOverflowCount const& overflow) {
+      if (overflow.count == 0)
+        return;
+      vw::vw_out(vw::WarningMessage)
+        << "Could not quantize " << overflow.count << " point(s) in " << filename
+        << " as they are more than "
+        << scale*std::numeric_limits<vw::int32>::max()
+        << " meters from the point cloud center. They were saved as invalid. "
+        << "Run without --quantize-point-cloud to keep them.\n";
+    }
+  }
+
+  // Block write image while subtracting a given value from all pixels
+  // and saving the result as int32 multiples of the rounding error.
+  template <class ImageT>
+  void block_write_quantized_gdal_image(const std::string &filename,
+                                        vw::Vector3 const& shift,
+                                        double rounding_error,
+                                        vw::ImageViewBase<ImageT> const& image,
+                                        bool has_georef,
+                                        vw::cartography::GeoReference const& georef,
+                                        vw::cartography::GdalWriteOptions const& opt,
+                                        vw::ProgressCallback const& progress_callback,
+                                        std::map<std::string, std::string> const& keywords) {
+
+    double scale = get_rounding_error(shift, rounding_error);
+    std::map<std::string, std::string> local_keywords;
+    vw::cartography::GdalWriteOptions local_opt;
+    common_private::quantized_write_settings(shift, scale, keywords, opt,
+                                             local_keywords, local_opt);
+
+    // Zero vectors are invalid, and have no nodata value of their own.
+    bool has_nodata = false;
+    double nodata = 0;
+    boost::shared_ptr<QuantizeOverflowCount> overflow(new QuantizeOverflowCount);
+    block_write_gdal_image(filename,
+                           quantize_pixels(subtract_shift(image.impl(), shift), scale, overflow),
+                           has_georef, georef, has_nodata, nodata,
+                           local_opt, progress_callback, local_keywords);
+    common_private::warn_quantize_overflow(filename, scale, *overflow);
+  }
+
+  // Single-threaded version of the above.
+  template <class ImageT>
+  void write_quantized_gdal_image(const std::string &filename,
+                                  vw::Vector3 const& shift,
+                                  double rounding_error,
+                                  vw::ImageViewBase<ImageT> const& image,
+                                  bool has_georef,
+                                  vw::cartography::GeoReference const& georef,
+                                  vw::cartography::GdalWriteOptions const& opt,
+                                  vw::ProgressCallback const& progress_callback,
+                                  std::map<std::string, std::string> const& keywords) {
+
+    double scale = get_rounding_error(shift, rounding_error);
+    std::map<std::string, std::string> local_keywords;
+    vw::cartography::GdalWriteOptions local_opt;
+    common_private::quantized_write_settings(shift, scale, keywords, opt,
+                                             local_keywords, local_opt);
+
+    bool has_nodata = false;
+    double nodata = 0;
+    boost::shared_ptr<QuantizeOverflowCount> overflow(new QuantizeOverflowCount);
+    write_gdal_image(filename,
+                     quantize_pixels(subtract_shift(image.impl(), shift), scale, overflow),
+                     has_georef, georef, has_nodata, nodata,
+                     local_opt, progress_callback, local_keywords);
+    common_private::warn_quantize_overflow(filename, scale, *overflow);
+  }
+
   // Often times, we'd like to save an image to disk by using big
   // blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
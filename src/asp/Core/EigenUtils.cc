@@ -44,7 +44,8 @@ void null_check(const char* token, std::string const& line){
     vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
 }
 
-void pick_at_most_m_unique_elems_from_n_elems(int m, int n, std::vector<int>& elems){
+void pick_at_most_m_unique_elems_from_n_elems(int m, int n, std::mt19937 & generator,
+                                              std::vector<int>& elems){
 
   // Out of the elements 0, 1,..., n - 1, pick m unique
   // random elements and sort them in increasing order.
@@ -61,7 +62,7 @@ void pick_at_most_m_unique_elems_from_n_elems(int m, int n, std::vector<int>& el
   // at index j. Then decrement j. Done after m elements are
   // processed.
   for (int j = n-1; j >= n-m; j--){
-    int r = rand()%(j+1); // 0 <= r <= j
+    int r = std::uniform_int_distribution<int>(0, j)(generator); // 0 <= r <= j
     std::swap(all[r], all[j]);
   }
 
@@ -72,11 +73,11 @@ void pick_at_most_m_unique_elems_from_n_elems(int m, int n, std::vector<int>& el
 }
 
 // Return at most m random points out of the input point cloud.
-void random_pc_subsample(int m, DoubleMatrix& points){
+void random_pc_subsample(int m, std::mt19937 & generator, DoubleMatrix& points){
 
   int n = points.cols();
   std::vector<int> elems;
-  pick_at_most_m_unique_elems_from_n_elems(m, n, elems);
+  pick_at_most_m_unique_elems_from_n_elems(m, n, generator, elems);
   m = elems.size();
 
   for (int col = 0; col < m; col++){
@@ -86,12 +87,117 @@ void random_pc_subsample(int m, DoubleMatrix& points){
   points.conservativeResize(Eigen::NoChange, m);
 }
 
+// Sort points by the cube they fall in
+struct VoxelIndexLess {
+  std::vector<vw::int64> const& m_keys; // alias, three per point
+  VoxelIndexLess(std::vector<vw::int64> const& keys): m_keys(keys) {}
+  bool operator()(int a, int b) const {
+    for (int row = 0; row < DIM; row++) {
+      if (m_keys[DIM*a + row] != m_keys[DIM*b + row])
+        return m_keys[DIM*a + row] < m_keys[DIM*b + row];
+    }
+    return false;
+  }
+};
+
+void voxel_downsample(DoubleMatrix const& in_points, double voxel_size,
+                      DoubleMatrix & out_points){
+
+  if (voxel_size <= 0)
+    vw::vw_throw( vw::ArgumentErr() << "The voxel size must be positive.\n" );
+
+  int num_pts = in_points.cols();
+  std::vector<vw::int64> keys(DIM*num_pts);
+  std::vector<int> order(num_pts);
+  for (int col = 0; col < num_pts; col++) {
+    for (int row = 0; row < DIM; row++)
+      keys[DIM*col + row] = (vw::int64)floor(in_points(row, col)/voxel_size);
+    order[col] = col;
+  }
+  VoxelIndexLess less(keys);
+  std::sort(order.begin(), order.end(), less);
+
+  out_points.resize(DIM + 1, num_pts);
+  int num_out = 0;
+  for (int beg = 0; beg < num_pts; ) {
+    int end = beg + 1;
+    while (end < num_pts && !less(order[beg], order[end]))
+      end++;
+
+    Eigen::VectorXd sum = Eigen::VectorXd::Zero(DIM);
+    for (int it = beg; it < end; it++)
+      sum += in_points.col(order[it]).head(DIM);
+    out_points.col(num_out).head(DIM) = sum/double(end - beg);
+    out_points(DIM, num_out) = 1; // homogenous coordinate
+    num_out++;
+    beg = end;
+  }
+  out_points.conservativeResize(Eigen::NoChange, num_out);
+}
+
+double estimate_point_spacing(DoubleMatrix const& points){
+
+  int num_pts = points.cols();
+  if (num_pts < 2)
+    return 0.0;
+
+  // The principal axes of the cloud. The eigenvalues are increasing,
+  // so the last two axes span the surface.
+  Eigen::Vector3d mean = points.topRows(DIM).rowwise().mean();
+  Eigen::Matrix3d cov  = Eigen::Matrix3d::Zero();
+  for (int col = 0; col < num_pts; col++) {
+    Eigen::Vector3d diff = points.col(col).head(DIM) - mean;
+    cov += diff*diff.transpose();
+  }
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+  Eigen::Matrix<double, 2, 3> to_plane;
+  to_plane.row(0) = solver.eigenvectors().col(2).transpose();
+  to_plane.row(1) = solver.eigenvectors().col(1).transpose();
+
+  std::vector<Eigen::Vector2d> proj(num_pts);
+  Eigen::Vector2d beg = Eigen::Vector2d::Constant( std::numeric_limits<double>::max());
+  Eigen::Vector2d end = Eigen::Vector2d::Constant(-std::numeric_limits<double>::max());
+  for (int col = 0; col < num_pts; col++) {
+    proj[col] = to_plane*(points.col(col).head(DIM) - mean);
+    beg = beg.cwiseMin(proj[col]);
+    end = end.cwiseMax(proj[col]);
+  }
+
+  // A first guess from the box of the points in the plane. It is too
+  // large if the points do not fill the box.
+  Eigen::Vector2d extent = end - beg;
+  double spacing = sqrt(extent[0]*extent[1]/num_pts);
+  if (spacing <= 0)
+    return 0.0;
+
+  // Refine it with the area of the grid cells having points. Cells of
+  // a few times the spacing hold many points each, so few cells inside
+  // the footprint are empty, and those on its boundary add little.
+  const int    NUM_PASSES  = 3;
+  const double CELL_FACTOR = 4.0;
+  std::vector<vw::int64> keys(num_pts);
+  for (int pass = 0; pass < NUM_PASSES; pass++) {
+    double    cell_size = CELL_FACTOR*spacing;
+    vw::int64 num_cols  = (vw::int64)floor(extent[0]/cell_size) + 1;
+    for (int col = 0; col < num_pts; col++) {
+      vw::int64 ix = (vw::int64)floor((proj[col][0] - beg[0])/cell_size);
+      vw::int64 iy = (vw::int64)floor((proj[col][1] - beg[1])/cell_size);
+      keys[col] = iy*num_cols + ix;
+    }
+    std::sort(keys.begin(), keys.end());
+    vw::int64 num_cells = std::unique(keys.begin(), keys.end()) - keys.begin();
+    spacing = cell_size*sqrt(double(num_cells)/num_pts);
+  }
+
+  return spacing;
+}
+
 int load_csv_aux(std::string const& file_name, int num_points_to_load,
                  vw::BBox2 const& lonlat_box,
                  bool calc_shift, vw::Vector3 & shift,
                  vw::cartography::GeoReference const& geo, CsvConv const& csv_conv,
                  bool & is_lola_rdr_format, double & mean_longitude,
-                 bool verbose, DoubleMatrix & data){
+                 bool verbose, std::mt19937 & generator, DoubleMatrix & data){
 
   // Note: The input CsvConv object is responsible for parsing out the
   //       type of information contained in the CSV file.
@@ -176,7 +282,7 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
       continue;
 
     // Randomly skip a percentage of points
-    double r = (double)std::rand()/(double)RAND_MAX;
+    double r = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
     if (r > load_ratio)
       continue;
 
@@ -345,13 +451,14 @@ void load_csv(std::string const& file_name,
                  bool & is_lola_rdr_format,
                  double & mean_longitude,
                  bool verbose,
+                 std::mt19937 & generator,
                  DoubleMatrix & data){
 
   int num_total_points = load_csv_aux(file_name, num_points_to_load,
                                       lonlat_box,
                                       calc_shift, shift,
                                       geo, csv_conv, is_lola_rdr_format,
-                                      mean_longitude, verbose, data);
+                                      mean_longitude, verbose, generator, data);
   
   int num_loaded_points = data.cols();
   if (!lonlat_box.empty()                    &&
@@ -364,7 +471,7 @@ void load_csv(std::string const& file_name,
                  geo, csv_conv, is_lola_rdr_format,
                  mean_longitude,
                  false, // Skip repeating same messages
-                 data);
+                 generator, data);
   }
   
   return;
@@ -375,7 +482,7 @@ template<typename DemPixelType>
 void load_dem_pixel_type(std::string const& file_name,
                          int num_points_to_load, vw::BBox2 const& lonlat_box,
                          bool calc_shift, vw::Vector3 & shift,
-                         bool verbose, DoubleMatrix & data){
+                         bool verbose, std::mt19937 & generator, DoubleMatrix & data){
   
   data.conservativeResize(DIM+1, num_points_to_load);
 
@@ -431,7 +538,7 @@ void load_dem_pixel_type(std::string const& file_name,
       if (points_count >= num_points_to_load)
         break;
 
-      double r = (double)std::rand()/(double)RAND_MAX;
+      double r = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
       if (r > load_ratio)
         continue;
 
@@ -476,7 +583,7 @@ void load_dem_pixel_type(std::string const& file_name,
 void load_dem(std::string const& file_name,
               int num_points_to_load, vw::BBox2 const& lonlat_box,
               bool calc_shift, vw::Vector3 & shift,
-              bool verbose, DoubleMatrix & data){
+              bool verbose, std::mt19937 & generator, DoubleMatrix & data){
 
   boost::shared_ptr<vw::DiskImageResource> dem_rsrc( new vw::DiskImageResourceGDAL(file_name) );
   vw::ImageFormat image_fmt = dem_rsrc->format();
@@ -487,12 +594,12 @@ void load_dem(std::string const& file_name,
     load_dem_pixel_type<double>(file_name,  
                                 num_points_to_load, lonlat_box,  
                                 calc_shift, shift,  
-                                verbose, data);
+                                verbose, generator, data);
   }else{
     load_dem_pixel_type<float>(file_name,  
                                num_points_to_load, lonlat_box,  
                                calc_shift, shift,  
-                               verbose, data);
+                               verbose, generator, data);
   }
 }
 
@@ -502,7 +609,7 @@ vw::int64 load_pc_aux(std::string const& file_name,
                       bool calc_shift,
                       vw::Vector3 & shift,
                       vw::cartography::GeoReference const& geo,
-                      bool verbose, DoubleMatrix & data){
+                      bool verbose, std::mt19937 & generator, DoubleMatrix & data){
 
   data.conservativeResize(DIM+1, num_points_to_load);
 
@@ -527,7 +634,7 @@ vw::int64 load_pc_aux(std::string const& file_name,
       if (points_count >= num_points_to_load)
         break;
 
-      double r = (double)std::rand()/(double)RAND_MAX;
+      double r = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
       if (r > load_ratio)
         continue;
 
@@ -568,11 +675,11 @@ void load_pc(std::string const& file_name,
              bool calc_shift,
              vw::Vector3 & shift,
              vw::cartography::GeoReference const& geo,
-             bool verbose, DoubleMatrix & data){
+             bool verbose, std::mt19937 & generator, DoubleMatrix & data){
 
   vw::int64 num_total_points = load_pc_aux(file_name, num_points_to_load,
                                           lonlat_box, calc_shift, shift,
-                                          geo, verbose, data);
+                                          geo, verbose, generator, data);
 
   int num_loaded_points = data.cols();
   if (!lonlat_box.empty()                    &&
@@ -585,7 +692,7 @@ void load_pc(std::string const& file_name,
     if (verbose)
       vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
     load_pc_aux(file_name, num_points_to_load, lonlat_box,
-                calc_shift, shift, geo, verbose, data);
+                calc_shift, shift, geo, verbose, generator, data);
   }
 
 }
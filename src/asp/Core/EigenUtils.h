@@ -30,6 +30,7 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
 #include <Eigen/Dense>
+#include <random>
 
 // A set of routines kept here because they use Eigen, and a set of routine
 // auxiliary to the routines using Eigen. 
@@ -43,9 +44,25 @@ typedef typename Eigen::Matrix<RealT, Eigen::Dynamic, Eigen::Dynamic> DoubleMatr
 // work with 2D point clouds. There are some Vector3's all over the place.
 const int DIM = 3;
 
+// The functions below which subsample randomly draw from the given
+// generator rather than from std::rand(), so that each thread can
+// have its own and the result does not depend on the other threads.
+
 // Return at most m random points out of the input point cloud.
-void random_pc_subsample(int m, DoubleMatrix& points);
+void random_pc_subsample(int m, std::mt19937 & generator, DoubleMatrix& points);
   
+/// Replace the points in each cube of the given size by their
+/// centroid. The points are the columns, with a last row of ones.
+void voxel_downsample(DoubleMatrix const& in_points, double voxel_size,
+                      DoubleMatrix & out_points);
+
+/// Estimate the spacing of the points of a cloud sampling a surface,
+/// from the area the points cover and their number. The area is
+/// measured in the plane of the two principal axes of the cloud,
+/// which for terrain is the local horizontal plane, by counting the
+/// cells with points of a grid a few times coarser than the spacing.
+double estimate_point_spacing(DoubleMatrix const& points);
+
 // Load a csv file, perhaps sub-sampling it along the way
 void load_csv(std::string const& file_name,
               int num_points_to_load,
@@ -56,12 +73,14 @@ void load_csv(std::string const& file_name,
               CsvConv const& csv_conv,
               bool & is_lola_rdr_format,
               double & mean_longitude, bool verbose,
+              std::mt19937 & generator,
               DoubleMatrix & data);
   
 // Load a DEM, perhaps subsampling it along the way
 void load_dem(std::string const& file_name,
               int num_points_to_load, vw::BBox2 const& lonlat_box,
               bool calc_shift, vw::Vector3 & shift, bool verbose, 
+              std::mt19937 & generator,
               DoubleMatrix & data);
 
 // Load an ASP point cloud, perhaps subsampling it along the way  
@@ -71,7 +90,8 @@ void load_pc(std::string const& file_name,
              bool calc_shift,
              vw::Vector3 & shift,
              vw::cartography::GeoReference const& geo,
-             bool verbose, DoubleMatrix & data);
+             bool verbose, std::mt19937 & generator,
+             DoubleMatrix & data);
 
 
 } //end namespace asp
@@ -0,0 +1,241 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/InterestPointCache.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <utility>
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace asp {
+
+  // FNV-1a 64-bit constants
+  const vw::uint64 FNV_OFFSET_BASIS = 14695981039346656037ULL;
+  const vw::uint64 FNV_PRIME        = 1099511628211ULL;
+
+  CacheKeyHasher::CacheKeyHasher(): m_hash(FNV_OFFSET_BASIS) {}
+
+  void CacheKeyHasher::add_bytes(void const* data, size_t num_bytes) {
+    unsigned char const* bytes = static_cast<unsigned char const*>(data);
+    vw::uint64 h = m_hash;
+    for (size_t i = 0; i < num_bytes; i++) {
+      h ^= bytes[i];
+      h *= FNV_PRIME;
+    }
+    m_hash = h;
+  }
+
+  void CacheKeyHasher::add(std::string const& str) {
+    // Include the length so that consecutive strings can't run together
+    add(vw::uint64(str.size()));
+    add_bytes(str.data(), str.size());
+  }
+
+  std::string CacheKeyHasher::hex() const {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)m_hash);
+    return std::string(buf);
+  }
+
+  void hash_ip(CacheKeyHasher & hasher, vw::ip::InterestPoint const& ip) {
+    hasher.add(ip.x);
+    hasher.add(ip.y);
+    hasher.add(ip.scale);
+    hasher.add(ip.orientation);
+    hasher.add(ip.interest);
+    hasher.add(ip.polarity);
+    hasher.add(ip.octave);
+    hasher.add(ip.scale_lvl);
+    hasher.add(vw::uint64(ip.descriptor.size()));
+    for (size_t i = 0; i < ip.descriptor.size(); i++)
+      hasher.add(ip.descriptor[i]);
+  }
+
+  InterestPointCache::InterestPointCache(std::string const& cache_dir, double max_size_mb):
+    m_dir(cache_dir), m_max_bytes(0) {
+
+    if (max_size_mb > 0)
+      m_max_bytes = vw::uint64(max_size_mb * 1024.0 * 1024.0);
+
+    if (!enabled())
+      return;
+
+    // Other processes may be creating the same directory
+    boost::system::error_code ec;
+    fs::create_directories(m_dir, ec);
+    if (!fs::is_directory(m_dir))
+      vw_throw(ArgumentErr() << "Could not create the interest point cache directory: "
+                             << m_dir << "\n");
+  }
+
+  std::string InterestPointCache::entry_path(std::string const& key,
+                                             std::string const& ext) const {
+    return (fs::path(m_dir) / (key + ext)).string();
+  }
+
+  std::string InterestPointCache::temp_path(std::string const& path) const {
+    return fs::unique_path(path + ".%%%%-%%%%-%%%%.tmp").string();
+  }
+
+  // Move a fully written file into place. A rename within the same
+  // directory is atomic, and if another process got there first, the
+  // two files are identical anyway.
+  void InterestPointCache::publish(std::string const& temp, std::string const& path) const {
+    boost::system::error_code ec;
+    fs::rename(temp, path, ec);
+    if (ec) {
+      fs::remove(temp, ec);
+      vw_out(WarningMessage) << "Could not add to the interest point cache: " << path << "\n";
+      return;
+    }
+    evict();
+  }
+
+  // Mark an entry as recently used. The cache may be read-only, so
+  // a failure here is not an error.
+  void InterestPointCache::touch(std::string const& path) const {
+    boost::system::error_code ec;
+    fs::last_write_time(path, std::time(0), ec);
+  }
+
+  bool InterestPointCache::read_ip(std::string const& key,
+                                   vw::ip::InterestPointList & ip) const {
+    ip.clear();
+    if (!enabled())
+      return false;
+
+    std::string path = entry_path(key, ".vwip");
+    if (!fs::exists(path))
+      return false;
+
+    std::vector<vw::ip::InterestPoint> ip_vec;
+    try {
+      ip_vec = vw::ip::read_binary_ip_file(path);
+    } catch (std::exception const&) {
+      vw_out(WarningMessage) << "Ignoring unreadable interest point cache entry: "
+                             << path << "\n";
+      return false;
+    }
+    ip.assign(ip_vec.begin(), ip_vec.end());
+    touch(path);
+
+    vw_out() << "\t    Read cached interest points: " << path << "\n";
+    return true;
+  }
+
+  void InterestPointCache::write_ip(std::string const& key,
+                                    vw::ip::InterestPointList const& ip) const {
+    if (!enabled())
+      return;
+    std::string path = entry_path(key, ".vwip");
+    std::string temp = temp_path(path);
+    vw::ip::write_binary_ip_file(temp, ip);
+    publish(temp, path);
+  }
+
+  bool InterestPointCache::read_match(std::string const& key,
+                                      std::vector<vw::ip::InterestPoint> & ip1,
+                                      std::vector<vw::ip::InterestPoint> & ip2) const {
+    ip1.clear();
+    ip2.clear();
+    if (!enabled())
+      return false;
+
+    std::string path = entry_path(key, ".match");
+    if (!fs::exists(path))
+      return false;
+
+    try {
+      vw::ip::read_binary_match_file(path, ip1, ip2);
+    } catch (std::exception const&) {
+      vw_out(WarningMessage) << "Ignoring unreadable match cache entry: " << path << "\n";
+      ip1.clear();
+      ip2.clear();
+      return false;
+    }
+    touch(path);
+
+    vw_out() << "\t    Read cached matches: " << path << "\n";
+    return true;
+  }
+
+  void InterestPointCache::write_match(std::string const& key,
+                                       std::vector<vw::ip::InterestPoint> const& ip1,
+                                       std::vector<vw::ip::InterestPoint> const& ip2) const {
+    if (!enabled())
+      return;
+    std::string path = entry_path(key, ".match");
+    std::string temp = temp_path(path);
+    vw::ip::write_binary_match_file(temp, ip1, ip2);
+    publish(temp, path);
+  }
+
+  // Delete the least recently used entries until the cache fits
+  // within its size limit. Other processes may be deleting the same
+  // files, so errors are ignored.
+  void InterestPointCache::evict() const {
+    if (m_max_bytes == 0)
+      return;
+
+    std::vector< std::pair<std::time_t, fs::path> > entries;
+    std::vector<vw::uint64> sizes;
+    vw::uint64 total = 0;
+    boost::system::error_code ec;
+    for (fs::directory_iterator it(m_dir, ec), end; !ec && it != end; it.increment(ec)) {
+      fs::path p = it->path();
+      std::string ext = p.extension().string();
+      if (ext != ".vwip" && ext != ".match")
+        continue;
+      vw::uint64 size = fs::file_size(p, ec);
+      if (ec) { ec.clear(); continue; }
+      std::time_t stamp = fs::last_write_time(p, ec);
+      if (ec) { ec.clear(); continue; }
+      entries.push_back(std::make_pair(stamp, p));
+      sizes.push_back(size);
+      total += size;
+    }
+    if (total <= m_max_bytes)
+      return;
+
+    // Sort the entries by time, oldest first, keeping the sizes aligned
+    std::vector< std::pair<std::time_t, size_t> > order(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+      order[i] = std::make_pair(entries[i].first, i);
+    std::sort(order.begin(), order.end());
+
+    int num_removed = 0;
+    for (size_t i = 0; i < order.size() && total > m_max_bytes; i++) {
+      size_t index = order[i].second;
+      if (fs::remove(entries[index].second, ec))
+        num_removed++;
+      ec.clear();
+      total -= sizes[index];
+    }
+    VW_OUT(DebugMessage, "asp") << "Evicted " << num_removed
+                                << " entries from the interest point cache.\n";
+  }
+
+} // end namespace asp
@@ -0,0 +1,119 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file InterestPointCache.h
+///
+/// An on-disk cache of detected interest points and of descriptor
+/// matches. Entries are addressed by a hash of the input pixels and
+/// of every setting which affects the result, so the same image
+/// seen by several tools, or by several pairs in bundle adjustment,
+/// is processed only once.
+
+#ifndef __ASP_CORE_INTEREST_POINT_CACHE_H__
+#define __ASP_CORE_INTEREST_POINT_CACHE_H__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Math/BBox.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/InterestPoint/InterestData.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// Accumulate a 64-bit FNV-1a hash over arbitrary data. Used to
+  /// form the cache keys.
+  class CacheKeyHasher {
+  public:
+    CacheKeyHasher();
+
+    void add_bytes(void const* data, size_t num_bytes);
+    void add(std::string const& str);
+
+    /// Add a plain-old-data value, such as a number or a pixel.
+    template <class T>
+    void add(T const& val) { add_bytes(&val, sizeof(T)); }
+
+    vw::uint64  value() const { return m_hash; }
+    std::string hex  () const; ///< The hash as 16 hexadecimal digits
+
+  private:
+    vw::uint64 m_hash;
+  };
+
+  /// Hash the dimensions and all the pixels of an image. The image is
+  /// rasterized a band of rows at a time so that large on-disk images
+  /// are not loaded in memory all at once.
+  template <class ImageT>
+  void hash_image(CacheKeyHasher & hasher, vw::ImageViewBase<ImageT> const& image) {
+    typedef typename ImageT::pixel_type PixelT;
+    const int BAND_ROWS = 256;
+    ImageT const& img = image.impl();
+    hasher.add(vw::int32(img.cols()));
+    hasher.add(vw::int32(img.rows()));
+    hasher.add(vw::int32(sizeof(PixelT)));
+    for (int row = 0; row < img.rows(); row += BAND_ROWS) {
+      vw::BBox2i band(0, row, img.cols(), std::min(BAND_ROWS, img.rows() - row));
+      vw::ImageView<PixelT> buf = vw::crop(img, band);
+      hasher.add_bytes(buf.data(), sizeof(PixelT) * size_t(buf.cols()) * size_t(buf.rows()));
+    }
+  }
+
+  /// Hash the location, shape, and descriptor of an interest point.
+  void hash_ip(CacheKeyHasher & hasher, vw::ip::InterestPoint const& ip);
+
+  /// The cache itself. Each entry is a .vwip or .match file named
+  /// after its key. Files are first written under a temporary name
+  /// and then renamed, so concurrent processes sharing the directory
+  /// never see a partial entry. When the total size exceeds the
+  /// limit, the least recently used entries are deleted.
+  class InterestPointCache {
+  public:
+    /// An empty directory disables the cache. The size is in MB.
+    InterestPointCache(std::string const& cache_dir, double max_size_mb);
+
+    bool enabled() const { return !m_dir.empty(); }
+
+    /// Return false if there is no entry for this key.
+    bool read_ip(std::string const& key, vw::ip::InterestPointList & ip) const;
+    void write_ip(std::string const& key, vw::ip::InterestPointList const& ip) const;
+
+    bool read_match(std::string const& key,
+                    std::vector<vw::ip::InterestPoint> & ip1,
+                    std::vector<vw::ip::InterestPoint> & ip2) const;
+    void write_match(std::string const& key,
+                     std::vector<vw::ip::InterestPoint> const& ip1,
+                     std::vector<vw::ip::InterestPoint> const& ip2) const;
+
+  private:
+    std::string entry_path(std::string const& key, std::string const& ext) const;
+    std::string temp_path(std::string const& path) const;
+    void publish(std::string const& temp, std::string const& path) const;
+    void touch(std::string const& path) const;
+    void evict() const;
+
+    std::string m_dir;
+    vw::uint64  m_max_bytes;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_INTEREST_POINT_CACHE_H__
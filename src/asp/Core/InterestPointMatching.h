@@ -32,6 +32,7 @@
 #include <vw/Math/Geometry.h>
 
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/InterestPointCache.h>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
 
@@ -325,40 +326,25 @@ namespace asp {
   } // End function remove_ip_near_nodata
   
 
-  // Detect InterestPoints
+  // Detect InterestPoints in a single image
   //
-  /// This is not meant to be used directly. Please use ip_matching() or
-  /// the dumb homography_ip_matching().
-  template <class Image1T, class Image2T>
-  void detect_ip( vw::ip::InterestPointList& ip1,
-                  vw::ip::InterestPointList& ip2,
-                  vw::ImageViewBase<Image1T> const& image1,
-                  vw::ImageViewBase<Image2T> const& image2,
-                  int    ip_per_tile,
-                  double nodata1,
-                  double nodata2 ) {
+  // This runs detection, the removal of points near nodata and near the
+  // edge buffer, and the computation of the descriptors. It is
+  // deterministic given the image and the settings, which is what lets
+  // detect_ip() cache its results.
+  template <class ImageT>
+  void detect_ip_in_image( vw::ip::InterestPointList& ip,
+                           vw::ImageViewBase<ImageT> const& image,
+                           size_t points_per_tile,
+                           double nodata,
+                           bool   is_left ) {
     using namespace vw;
-    BBox2i box1 = bounding_box(image1.impl());
-    ip1.clear();
-    ip2.clear();
+    ip.clear();
 
     Stopwatch sw;
     sw.start();
 
-    // Automatically determine how many ip we need
-    float  number_boxes    = (box1.width() / 1024.f) * (box1.height() / 1024.f);
-    size_t points_per_tile = 5000.f / number_boxes;
-    if ( points_per_tile > 5000 ) points_per_tile = 5000;
-    if ( points_per_tile < 50   ) points_per_tile = 50;
-
-    // See if to override with manual value
-    if (ip_per_tile != 0)
-      points_per_tile = ip_per_tile;
-
-    const bool has_nodata1 = !boost::math::isnan(nodata1);
-    const bool has_nodata2 = !boost::math::isnan(nodata2);
-
-    vw_out() << "Using " << points_per_tile << " interest points per tile (1024^2 px).\n";
+    const bool has_nodata = !boost::math::isnan(nodata);
 
     // Load the detection method from stereo_settings.
     // - This relies on a direct match in the enum integer value.
@@ -372,24 +358,15 @@ namespace asp {
       if (num_scales <= 0) 
         num_scales = vw::ip::IntegralInterestPointDetector
           <vw::ip::OBALoGInterestOperator>::IP_DEFAULT_SCALES;
-      else
-        vw_out() << "Using " << num_scales << " scales in OBALoG interest point detection.\n";
 
       vw::ip::IntegralAutoGainDetector detector( points_per_tile, num_scales );
 
       // This detector can't handle a mask so if there is nodata just
       //  set those pixels to zero.
-
-      vw_out() << "\t    Processing left image" << std::endl;
-      if (!has_nodata1)
-        ip1 = detect_interest_points( image1.impl(), detector, points_per_tile );
-      else
-        ip1 = detect_interest_points( apply_mask(create_mask_less_or_equal(image1.impl(),nodata1)), detector, points_per_tile );
-      vw_out() << "\t    Processing right image" << std::endl;
-      if (!has_nodata2)
-        ip2 = detect_interest_points( image2.impl(), detector, points_per_tile );
+      if (!has_nodata)
+        ip = detect_interest_points( image.impl(), detector, points_per_tile );
       else
-        ip2 = detect_interest_points( apply_mask(create_mask_less_or_equal(image2.impl(),nodata2)), detector, points_per_tile );
+        ip = detect_interest_points( apply_mask(create_mask_less_or_equal(image.impl(),nodata)), detector, points_per_tile );
     } else {
 
       // Initialize the OpenCV detector.  Conveniently we can just pass in the type argument.
@@ -405,24 +382,15 @@ namespace asp {
       bool opencv_normalize = stereo_settings().skip_image_normalization;
       if (stereo_settings().ip_normalize_tiles)
         opencv_normalize = true;
-      if (opencv_normalize)
-        vw_out() << "Using per-tile image normalization for IP detection...\n";
 
       bool build_opencv_descriptors = true;
       vw::ip::OpenCvInterestPointDetector detector(cv_method, opencv_normalize, build_opencv_descriptors, points_per_tile);
 
       // These detectors do accept a mask so use one if applicable.
-
-      vw_out() << "\t    Processing left image" << std::endl;
-      if (!has_nodata1)
-        ip1 = detect_interest_points( image1.impl(), detector, points_per_tile );
-      else
-        ip1 = detect_interest_points( create_mask_less_or_equal(image1.impl(),nodata1), detector, points_per_tile );
-      vw_out() << "\t    Processing right image" << std::endl;
-      if (!has_nodata2)
-        ip2 = detect_interest_points( image2.impl(), detector, points_per_tile );
+      if (!has_nodata)
+        ip = detect_interest_points( image.impl(), detector, points_per_tile );
       else
-        ip2 = detect_interest_points( create_mask_less_or_equal(image2.impl(),nodata2), detector, points_per_tile );
+        ip = detect_interest_points( create_mask_less_or_equal(image.impl(),nodata), detector, points_per_tile );
     } // End OpenCV case
 
     sw.stop();
@@ -430,20 +398,17 @@ namespace asp {
                                << sw.elapsed_seconds() << " s." << std::endl;
 
     if (stereo_settings().ip_debug_images) {
-      vw_out() << "\t    Writing detected IP debug images. " << std::endl;
-      write_ip_debug_image("ASP_IP_detect_debug1.tif", image1, ip1, has_nodata1, nodata1);
-      write_ip_debug_image("ASP_IP_detect_debug2.tif", image2, ip2, has_nodata2, nodata2);
+      vw_out() << "\t    Writing detected IP debug image. " << std::endl;
+      write_ip_debug_image(is_left ? "ASP_IP_detect_debug1.tif" : "ASP_IP_detect_debug2.tif",
+                           image, ip, has_nodata, nodata);
     }
 
     sw.start();
 
     vw_out() << "\t    Removing IP near nodata" << std::endl;
     const int NODATA_RADIUS = 4;
-    if ( !boost::math::isnan(nodata1) )
-      remove_ip_near_nodata( image1.impl(), nodata1, ip1, NODATA_RADIUS );
-
-    if ( !boost::math::isnan(nodata2) )
-      remove_ip_near_nodata( image2.impl(), nodata2, ip2, NODATA_RADIUS );
+    if ( has_nodata )
+      remove_ip_near_nodata( image.impl(), nodata, ip, NODATA_RADIUS );
 
     sw.stop();
     vw_out(DebugMessage,"asp") << "Remove IP elapsed time: "
@@ -452,18 +417,20 @@ namespace asp {
     // Filter out IP from the opposite sides of the two images.
     // - Would be better to just pass an ROI into the IP detector!
     if (stereo_settings().ip_edge_buffer_percent > 0) {
-      // Figure out removal bboxes
-      double percent  = static_cast<double>(stereo_settings().ip_edge_buffer_percent)/100.0;
-      int width_left  = floor(static_cast<double>(image1.cols()) * percent);
-      int width_right = floor(static_cast<double>(image2.cols()) * percent);
-      BBox2 bbox_left (width_left, 0, image1.cols()-width_left,  image1.rows());
-      BBox2 bbox_right(0,          0, image2.cols()-width_right, image2.rows());
+      // Figure out the removal bbox
+      double percent = static_cast<double>(stereo_settings().ip_edge_buffer_percent)/100.0;
+      int width      = floor(static_cast<double>(image.impl().cols()) * percent);
+      BBox2 bbox;
+      if (is_left)
+        bbox = BBox2(width, 0, image.impl().cols()-width, image.impl().rows());
+      else
+        bbox = BBox2(0,     0, image.impl().cols()-width, image.impl().rows());
       bool remove_outside = true;
       // Remove the points
-      size_t num_removed_left  = remove_ip_bbox(bbox_left,  ip1, remove_outside);
-      size_t num_removed_right = remove_ip_bbox(bbox_right, ip2, remove_outside);
-      vw_out() << "Removed: " << num_removed_left << " points from the left side of the left image and "
-               << num_removed_right << " points from the right side of the right image.\n";
+      size_t num_removed = remove_ip_bbox(bbox, ip, remove_outside);
+      vw_out() << "Removed: " << num_removed << " points from the "
+               << (is_left ? "left side of the left" : "right side of the right")
+               << " image.\n";
     } // End side IP filtering
 
     sw.start();
@@ -472,18 +439,101 @@ namespace asp {
     if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
       vw_out() << "\t    Building descriptors" << std::endl;
       ip::SGradDescriptorGenerator descriptor;
-      if (!has_nodata1)
-        describe_interest_points( image1.impl(), descriptor, ip1 );
-      else
-        describe_interest_points( apply_mask(create_mask_less_or_equal(image1.impl(),nodata1)), descriptor, ip1 );
-      if (!has_nodata2)
-        describe_interest_points( image2.impl(), descriptor, ip2 );
+      if (!has_nodata)
+        describe_interest_points( image.impl(), descriptor, ip );
       else
-        describe_interest_points( apply_mask(create_mask_less_or_equal(image2.impl(),nodata2)), descriptor, ip2 );
+        describe_interest_points( apply_mask(create_mask_less_or_equal(image.impl(),nodata)), descriptor, ip );
 
       vw_out(DebugMessage,"asp") << "Building descriptors elapsed time: "
                                  << sw.elapsed_seconds() << " s." << std::endl;
     }
+  }
+
+  // The key under which the interest points of an image are cached.
+  // It covers the pixels, which includes any crop or ROI already
+  // applied to the image, and every setting used by detect_ip_in_image().
+  template <class ImageT>
+  std::string ip_cache_key( vw::ImageViewBase<ImageT> const& image,
+                            size_t points_per_tile,
+                            double nodata,
+                            bool   is_left ) {
+    const vw::int32 IP_CACHE_VERSION = 1; // Bump when the detection changes
+    CacheKeyHasher hasher;
+    hasher.add(std::string("vwip"));
+    hasher.add(IP_CACHE_VERSION);
+    hash_image(hasher, image);
+    hasher.add(vw::uint64(points_per_tile));
+    hasher.add(boost::math::isnan(nodata));
+    if (!boost::math::isnan(nodata))
+      hasher.add(nodata);
+    hasher.add(vw::int32(stereo_settings().ip_matching_method));
+    hasher.add(vw::int32(stereo_settings().num_scales));
+    hasher.add(stereo_settings().skip_image_normalization);
+    hasher.add(stereo_settings().ip_normalize_tiles);
+    hasher.add(vw::int32(stereo_settings().ip_edge_buffer_percent));
+    if (stereo_settings().ip_edge_buffer_percent > 0)
+      hasher.add(is_left);
+    return hasher.hex();
+  }
+
+  // Detect InterestPoints
+  //
+  /// This is not meant to be used directly. Please use ip_matching() or
+  /// the dumb homography_ip_matching().
+  template <class Image1T, class Image2T>
+  void detect_ip( vw::ip::InterestPointList& ip1,
+                  vw::ip::InterestPointList& ip2,
+                  vw::ImageViewBase<Image1T> const& image1,
+                  vw::ImageViewBase<Image2T> const& image2,
+                  int    ip_per_tile,
+                  double nodata1,
+                  double nodata2 ) {
+    using namespace vw;
+    BBox2i box1 = bounding_box(image1.impl());
+    ip1.clear();
+    ip2.clear();
+
+    // Automatically determine how many ip we need
+    float  number_boxes    = (box1.width() / 1024.f) * (box1.height() / 1024.f);
+    size_t points_per_tile = 5000.f / number_boxes;
+    if ( points_per_tile > 5000 ) points_per_tile = 5000;
+    if ( points_per_tile < 50   ) points_per_tile = 50;
+
+    // See if to override with manual value
+    if (ip_per_tile != 0)
+      points_per_tile = ip_per_tile;
+
+    vw_out() << "Using " << points_per_tile << " interest points per tile (1024^2 px).\n";
+
+    DetectIpMethod detect_method = static_cast<DetectIpMethod>(stereo_settings().ip_matching_method);
+    if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
+      if (stereo_settings().num_scales > 0)
+        vw_out() << "Using " << stereo_settings().num_scales
+                 << " scales in OBALoG interest point detection.\n";
+    } else if (stereo_settings().skip_image_normalization ||
+               stereo_settings().ip_normalize_tiles) {
+      vw_out() << "Using per-tile image normalization for IP detection...\n";
+    }
+
+    // Reuse the interest points from an earlier run if possible
+    InterestPointCache cache(stereo_settings().ip_cache_dir,
+                             stereo_settings().ip_cache_max_size);
+    std::string key1, key2;
+    if (cache.enabled()) {
+      key1 = ip_cache_key(image1, points_per_tile, nodata1, true);
+      key2 = ip_cache_key(image2, points_per_tile, nodata2, false);
+    }
+
+    vw_out() << "\t    Processing left image" << std::endl;
+    if (!cache.read_ip(key1, ip1)) {
+      detect_ip_in_image(ip1, image1, points_per_tile, nodata1, true);
+      cache.write_ip(key1, ip1);
+    }
+    vw_out() << "\t    Processing right image" << std::endl;
+    if (!cache.read_ip(key2, ip2)) {
+      detect_ip_in_image(ip2, image2, points_per_tile, nodata2, false);
+      cache.write_ip(key2, ip2);
+    }
 
     vw_out() << "\t    Found interest points:\n" << "\t      left: " << ip1.size() << std::endl;
     vw_out() << "\t     right: " << ip2.size() << std::endl;
@@ -522,21 +572,45 @@ namespace asp {
     // Best point must be closer than the next best point
     vw_out() << "Uniqueness threshold: " << stereo_settings().ip_uniqueness_thresh << "\n";
     const double uniqueness_threshold = (0.8/0.7)*stereo_settings().ip_uniqueness_thresh;  // adj
-    
-    if (detect_method != DETECT_IP_METHOD_ORB) {
-      // For all L2Norm distance metrics
-      ip::InterestPointMatcher<ip::L2NormMetric,ip::NullConstraint> matcher(uniqueness_threshold);
-      matcher( ip1_copy, ip2_copy, matched_ip1, matched_ip2,
-	       TerminalProgressCallback( "asp", "\t   Matching: " ));
-    }
-    else {
-      // For Hamming distance metrics
-      ip::InterestPointMatcher<ip::HammingMetric,ip::NullConstraint> matcher(uniqueness_threshold);
-      matcher( ip1_copy, ip2_copy, matched_ip1, matched_ip2,
-	       TerminalProgressCallback( "asp", "\t   Matching: " ));
+
+    // The matches depend only on the two sets of interest points and
+    // on the matcher settings, so key the cached matches on those.
+    InterestPointCache cache(stereo_settings().ip_cache_dir,
+                             stereo_settings().ip_cache_max_size);
+    std::string match_key;
+    if (cache.enabled()) {
+      const vw::int32 MATCH_CACHE_VERSION = 1; // Bump when the matching changes
+      CacheKeyHasher hasher;
+      hasher.add(std::string("match"));
+      hasher.add(MATCH_CACHE_VERSION);
+      hasher.add(vw::int32(detect_method));
+      hasher.add(uniqueness_threshold);
+      hasher.add(vw::uint64(ip1_copy.size()));
+      for (size_t i = 0; i < ip1_copy.size(); i++)
+        hash_ip(hasher, ip1_copy[i]);
+      hasher.add(vw::uint64(ip2_copy.size()));
+      for (size_t i = 0; i < ip2_copy.size(); i++)
+        hash_ip(hasher, ip2_copy[i]);
+      match_key = hasher.hex();
     }
 
-    ip::remove_duplicates( matched_ip1, matched_ip2 );
+    if (!cache.read_match(match_key, matched_ip1, matched_ip2)) {
+      if (detect_method != DETECT_IP_METHOD_ORB) {
+        // For all L2Norm distance metrics
+        ip::InterestPointMatcher<ip::L2NormMetric,ip::NullConstraint> matcher(uniqueness_threshold);
+        matcher( ip1_copy, ip2_copy, matched_ip1, matched_ip2,
+                 TerminalProgressCallback( "asp", "\t   Matching: " ));
+      }
+      else {
+        // For Hamming distance metrics
+        ip::InterestPointMatcher<ip::HammingMetric,ip::NullConstraint> matcher(uniqueness_threshold);
+        matcher( ip1_copy, ip2_copy, matched_ip1, matched_ip2,
+                 TerminalProgressCallback( "asp", "\t   Matching: " ));
+      }
+
+      ip::remove_duplicates( matched_ip1, matched_ip2 );
+      cache.write_match(match_key, matched_ip1, matched_ip2);
+    }
 
     if (stereo_settings().ip_debug_images) {
       vw_out() << "\t    Writing IP initial match debug image.\n";
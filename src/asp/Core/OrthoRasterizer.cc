@@ -39,6 +39,7 @@
 #include <boost/math/special_functions/next.hpp>
 #include <asp/Core/OrthoRasterizer.h>
 #include <valarray>
+#include <algorithm>
 
 namespace asp{
 
@@ -211,6 +212,120 @@ namespace asp{
   }; // End function operator()
 
 
+  void SubBlockGridIndex::cell_range(double min_x, double min_y, double max_x, double max_y,
+                                     int & c0, int & r0, int & c1, int & r1) const {
+    c0 = (int)floor((min_x - m_extent.min().x())/m_cell_x);
+    c1 = (int)floor((max_x - m_extent.min().x())/m_cell_x);
+    r0 = (int)floor((min_y - m_extent.min().y())/m_cell_y);
+    r1 = (int)floor((max_y - m_extent.min().y())/m_cell_y);
+    c0 = std::max(0, std::min(c0, m_cols-1));
+    c1 = std::max(0, std::min(c1, m_cols-1));
+    r0 = std::max(0, std::min(r0, m_rows-1));
+    r1 = std::max(0, std::min(r1, m_rows-1));
+  }
+
+  void SubBlockGridIndex::build(std::vector<BBoxPair> const& boundaries){
+
+    // A box covering more cells than this is kept in a separate list,
+    // so that a few wild outlier boxes cannot blow up the index size.
+    const size_t max_cells_per_box = 64;
+
+    m_extent = BBox2();
+    m_cell_start.clear();
+    m_cell_items.clear();
+    m_large_items.clear();
+    m_cols = 0;
+    m_rows = 0;
+
+    size_t num = boundaries.size();
+    if (num == 0)
+      return;
+
+    for (size_t i = 0; i < num; i++){
+      BBox3 const& b = boundaries[i].first;
+      m_extent.grow(Vector2(b.min().x(), b.min().y()));
+      m_extent.grow(Vector2(b.max().x(), b.max().y()));
+    }
+
+    // Aim for about as many cells as boxes. Sub-blocks mostly tile the
+    // plane, so then each cell holds only a handful of them.
+    double w = m_extent.width(), h = m_extent.height();
+    double cell = 1.0;
+    if (w > 0 && h > 0)
+      cell = sqrt(w*h/double(num));
+    else if (std::max(w, h) > 0)
+      cell = std::max(w, h)/double(num);
+    m_cols = (w > 0) ? std::max(1, (int)std::min(ceil(w/cell), double(num))) : 1;
+    m_rows = (h > 0) ? std::max(1, (int)std::min(ceil(h/cell), double(num))) : 1;
+    m_cell_x = (w > 0) ? w/m_cols : 1.0;
+    m_cell_y = (h > 0) ? h/m_rows : 1.0;
+
+    // Two passes, first count the boxes in each cell, then fill in
+    // their indices. Going through the boxes in order keeps each
+    // cell's list sorted.
+    size_t num_cells = size_t(m_cols)*size_t(m_rows);
+    m_cell_start.assign(num_cells + 1, 0);
+    int c0, r0, c1, r1;
+    for (size_t i = 0; i < num; i++){
+      BBox3 const& b = boundaries[i].first;
+      cell_range(b.min().x(), b.min().y(), b.max().x(), b.max().y(), c0, r0, c1, r1);
+      if (size_t(c1-c0+1)*size_t(r1-r0+1) > max_cells_per_box)
+        continue;
+      for (int r = r0; r <= r1; r++)
+        for (int c = c0; c <= c1; c++)
+          m_cell_start[size_t(r)*m_cols + c + 1]++;
+    }
+    for (size_t k = 0; k < num_cells; k++)
+      m_cell_start[k+1] += m_cell_start[k];
+
+    m_cell_items.resize(m_cell_start[num_cells]);
+    std::vector<size_t> fill_pos(m_cell_start.begin(), m_cell_start.end() - 1);
+    for (size_t i = 0; i < num; i++){
+      BBox3 const& b = boundaries[i].first;
+      cell_range(b.min().x(), b.min().y(), b.max().x(), b.max().y(), c0, r0, c1, r1);
+      if (size_t(c1-c0+1)*size_t(r1-r0+1) > max_cells_per_box){
+        m_large_items.push_back(i);
+        continue;
+      }
+      for (int r = r0; r <= r1; r++)
+        for (int c = c0; c <= c1; c++)
+          m_cell_items[fill_pos[size_t(r)*m_cols + c]++] = i;
+    }
+
+    VW_OUT(DebugMessage,"asp") << "Indexed " << num << " point cloud sub-blocks in a "
+                               << m_cols << " x " << m_rows << " grid, with "
+                               << m_large_items.size() << " oversized ones.\n";
+  }
+
+  void SubBlockGridIndex::query(BBox3 const& box, std::vector<size_t> & indices) const {
+
+    indices.clear();
+    if (m_cols <= 0 || m_rows <= 0)
+      return;
+
+    indices = m_large_items;
+
+    // Nothing else to find if the box is fully outside the indexed area
+    if (box.max().x() < m_extent.min().x() || box.min().x() > m_extent.max().x() ||
+        box.max().y() < m_extent.min().y() || box.min().y() > m_extent.max().y())
+      return;
+
+    int c0, r0, c1, r1;
+    cell_range(box.min().x(), box.min().y(), box.max().x(), box.max().y(), c0, r0, c1, r1);
+    for (int r = r0; r <= r1; r++){
+      for (int c = c0; c <= c1; c++){
+        size_t cell = size_t(r)*m_cols + c;
+        indices.insert(indices.end(),
+                       m_cell_items.begin() + m_cell_start[cell],
+                       m_cell_items.begin() + m_cell_start[cell+1]);
+      }
+    }
+
+    // A box spanning several cells is listed in each of them
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+  }
+
   void remove_outliers(ImageView<Vector3> & image, ImageViewRef<double> const& errors,
 		       double error_cutoff, BBox2i const& box){
 
@@ -248,29 +363,59 @@ namespace asp{
     int nc = image.cols(), nr = image.rows(); // shorten
     double nan = std::numeric_limits<double>::quiet_NaN();
 
-    ImageView<Vector3> image_out = copy(image);
-
-    for (int col = 0; col < image.cols(); col++){
-      for (int row = 0; row < image.rows(); row++){
-
-        if (boost::math::isnan(image(col, row).z()))
-          continue;
+    // Decide on all points before removing any of them
+    ImageView<uint8> is_outlier(nc, nr);
+    fill(is_outlier, 0);
+
+    // The valid heights in the window, kept sorted. When the window
+    // moves along a row, only the column leaving it and the column
+    // entering it are updated, rather than sorting it all again.
+    std::vector<double> window;
+    for (int row = 0; row < nr; row++){
+      int start_row = std::max(row-half, 0), stop_row = std::min(row+half, nr-1);
+      window.clear();
+      for (int col = 0; col < nc; col++){
 
-        std::vector<double> vals;
-        for (int c = std::max(col-half, 0); c <= std::min(col+half, nc-1); c++){
-          for (int r = std::max(row-half, 0); r <= std::min(row+half, nr-1); r++){
-            if (boost::math::isnan(image(c, r).z())) continue;
-            vals.push_back(image(c, r).z());
+        // The first window on the row has all the columns up to
+        // half; after that one column enters on the right.
+        int first_col = (col == 0) ? 0 : col + half;
+        int last_col  = std::min(col + half, nc-1);
+        for (int c = first_col; c <= last_col; c++){
+          for (int r = start_row; r <= stop_row; r++){
+            double z = image(c, r).z();
+            if (boost::math::isnan(z)) continue;
+            window.insert(std::upper_bound(window.begin(), window.end(), z), z);
           }
         }
-        double median = vw::math::destructive_median(vals);
-        if (fabs(median - image(col, row).z()) > thresh){
-          image_out(col, row).z() = nan;
+
+        // The column on the left leaves
+        int c = col - half - 1;
+        if (c >= 0){
+          for (int r = start_row; r <= stop_row; r++){
+            double z = image(c, r).z();
+            if (boost::math::isnan(z)) continue;
+            window.erase(std::lower_bound(window.begin(), window.end(), z));
+          }
         }
+
+        double z = image(col, row).z();
+        if (boost::math::isnan(z))
+          continue;
+
+        // Same as destructive_median() on the window
+        int len = window.size();
+        double median = (len % 2) ? window[len/2] : (window[len/2 - 1] + window[len/2]) / 2.0;
+        if (fabs(median - z) > thresh)
+          is_outlier(col, row) = 1;
       }
     }
 
-    image = copy(image_out);
+    for (int col = 0; col < nc; col++){
+      for (int row = 0; row < nr; row++){
+        if (is_outlier(col, row))
+          image(col, row).z() = nan;
+      }
+    }
   }
 
   // TODO: This function should live somewhere else!
@@ -283,56 +428,109 @@ namespace asp{
     int    nc      = image.cols(), 
            nr      = image.rows(); // shorten
     double nan     = std::numeric_limits<double>::quiet_NaN();
-    int    max_col = nc - 1;
-    int    max_row = nr - 1;
-
-    // Create a buffer to modify and a pointer to allow easy
-    //  swapping of which image we are writing to.
-    // - The first write is to the input image, so we don't have to do extra copies with one pass.
-    ImageView<Vector3>  buffer = copy(image);
-    ImageView<Vector3>* read_ptr  = &buffer; 
-    ImageView<Vector3>* write_ptr = &image; 
-    ImageView<Vector3>* temp_ptr = 0;
-    
-    // One pass per erode length    
-    for (int pass = 0; pass < erode_len; pass++){
 
-      // Loop through the entire image
+    // A pixel is eroded if an invalid pixel is within erode_len of it
+    // in the chessboard metric, which is the same as doing erode_len
+    // passes with a 3x3 window. Find that distance with one forward and
+    // one backward pass over the image. Beyond erode_len the distance
+    // does not matter, so it is capped.
+    int cap = erode_len + 1;
+    ImageView<int32> dist(nc, nr);
+    for (int row = 0; row < nr; row++){
       for (int col = 0; col < nc; col++){
-        int start_col = std::max(col-1, 0      );
-        int stop_col  = std::min(col+1, max_col);
-        for (int row = 0; row < nr; row++){
-          int start_row = std::max(row-1, 0      );
-          int stop_row  = std::min(row+1, max_row);
-
-          // Loop through bounds checked border 1 region around this pixel
-          for (int c = start_col; c <= stop_col; c++){
-            for (int r = start_row; r <= stop_row; r++){
-              // If any of these pixels are bad, throw out this pixel
-              if (boost::math::isnan(read_ptr->operator()(c, r).z()))
-                write_ptr->operator()(col, row).z() = nan;
-            }
-          } // End inner erode double loop
-          
+        if (boost::math::isnan(image(col, row).z())){
+          dist(col, row) = 0;
+          continue;
+        }
+        int d = cap;
+        if (col > 0)
+          d = std::min(d, dist(col-1, row) + 1);
+        if (row > 0){
+          for (int c = std::max(col-1, 0); c <= std::min(col+1, nc-1); c++)
+            d = std::min(d, dist(c, row-1) + 1);
+        }
+        dist(col, row) = d;
+      }
+    }
+    for (int row = nr-1; row >= 0; row--){
+      for (int col = nc-1; col >= 0; col--){
+        int d = dist(col, row);
+        if (col < nc-1)
+          d = std::min(d, dist(col+1, row) + 1);
+        if (row < nr-1){
+          for (int c = std::max(col-1, 0); c <= std::min(col+1, nc-1); c++)
+            d = std::min(d, dist(c, row+1) + 1);
         }
-      } // End double loop through image pixels
+        dist(col, row) = d;
+      }
+    }
 
-      // Swap the read and write buffer pointers for the next pass
-      // - No need to make copies each time, the nan regions will just keep expanding.
-      temp_ptr  = write_ptr;
-      write_ptr = read_ptr;
-      read_ptr  = temp_ptr;
-      
-    } // end passes
-    
-    // If we had an even number of erode passes, the last write was to the temp
-    //  buffer and we need to copy it back to the input image.
-    if ((erode_len % 2) == 0)
-      image = copy(buffer);
+    for (int col = 0; col < nc; col++){
+      for (int row = 0; row < nr; row++){
+        if (dist(col, row) <= erode_len)
+          image(col, row).z() = nan;
+      }
+    }
   }
 
+  /// The point cloud with outliers removed and eroded, as it is
+  /// needed for gridding. Each tile is computed from the tile
+  /// expanded by the reach of the filters, so its pixels do not
+  /// depend on how the cloud is tiled. This view is meant to be
+  /// cached, so that the filtered tiles are shared by all the DEM
+  /// tiles which overlap them.
+  class FilteredPointImageView: public ImageViewBase<FilteredPointImageView> {
+    ImageViewRef<Vector3> m_point_image;
+    ImageViewRef<double>  m_error_image;
+    double  m_error_cutoff;
+    Vector2 m_median_filter_params;
+    int     m_erode_len;
+
+  public:
+    typedef Vector3 pixel_type;
+    typedef Vector3 result_type;
+    typedef ProceduralPixelAccessor<FilteredPointImageView> pixel_accessor;
+
+    FilteredPointImageView(ImageViewRef<Vector3> const& point_image,
+                           ImageViewRef<double>  const& error_image,
+                           double error_cutoff, Vector2 const& median_filter_params,
+                           int erode_len):
+      m_point_image(point_image), m_error_image(error_image),
+      m_error_cutoff(error_cutoff), m_median_filter_params(median_filter_params),
+      m_erode_len(erode_len){}
+
+    inline int32 cols  () const { return m_point_image.cols(); }
+    inline int32 rows  () const { return m_point_image.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "FilteredPointImageView::operator() is not implemented.");
+      return result_type();
+    }
+
+    typedef CropView< ImageView<Vector3> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const {
 
+      // See far enough to filter the pixels at the tile boundary
+      BBox2i biased_box = bbox;
+      biased_box.expand(m_median_filter_params[0]/2 + m_erode_len);
+      biased_box.crop(bounding_box(m_point_image));
+      ImageView<Vector3> point_copy = crop(m_point_image, biased_box);
 
+      remove_outliers(point_copy, m_error_image, m_error_cutoff, biased_box);
+      filter_by_median(point_copy, m_median_filter_params);
+      erode_image(point_copy, m_erode_len);
+
+      return prerasterize_type(point_copy, BBox2i(-biased_box.min().x(), -biased_box.min().y(),
+                                                  cols(), rows()));
+    }
+
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
 
   OrthoRasterizerView::OrthoRasterizerView
   (ImageViewRef<Vector3> point_image, ImageViewRef<double> texture,
@@ -347,7 +545,7 @@ namespace asp{
    size_t *num_invalid_pixels, vw::Mutex *count_mutex,
    const ProgressCallback& progress):
     // Ensure all members are initiated, even if to temporary values
-    m_point_image(point_image), m_texture(ImageView<float>(1,1)),
+    m_point_image(point_image),
     m_bbox(BBox3()), m_snapped_bbox(BBox3()), m_spacing(0.0), m_default_spacing(0.0),
     m_default_spacing_x(0.0), m_default_spacing_y(0.0),
     m_search_radius_factor(search_radius_factor),
@@ -361,7 +559,7 @@ namespace asp{
     m_median_filter_params(median_filter_params), m_erode_len(erode_len),
     m_default_grid_size_multiplier(default_grid_size_multiplier),
     m_num_invalid_pixels(num_invalid_pixels),
-    m_count_mutex(count_mutex){
+    m_count_mutex(count_mutex), m_filter_in_blocks(false){
 
     *m_num_invalid_pixels = 0; // Init counter
     set_texture(texture.impl());
@@ -431,6 +629,11 @@ namespace asp{
     if ( m_bbox.empty() )
       vw_throw( ArgumentErr() << "OrthoRasterize: Input point cloud is empty!\n" );
 
+    // Bin the sub-block boxes so that each DEM tile can quickly
+    // look up the ones it overlaps.
+    m_subblock_index = boost::shared_ptr<SubBlockGridIndex>(new SubBlockGridIndex());
+    m_subblock_index->build(m_point_image_boundaries);
+
     // Override with user's projwin, if specified
     if (m_projwin != BBox2()){
       subvector(m_bbox.min(), 0, 2) = m_projwin.min();
@@ -503,9 +706,53 @@ namespace asp{
       }
     }
 
+    init_filtered_point_image();
+
     return;
   } // End OrthoRasterizerView Constructor
 
+  void OrthoRasterizerView::set_point_image(ImageViewRef<Vector3> point_image){
+    m_point_image = point_image;
+    init_filtered_point_image();
+  }
+
+  void OrthoRasterizerView::init_filtered_point_image(){
+
+    // Without median filtering or erosion each pixel is filtered on
+    // its own, and that is cheap enough to do for every DEM tile.
+    m_filter_in_blocks = ((m_median_filter_params[0]/2 > 0 && m_median_filter_params[1] > 0)
+                          || m_erode_len > 0);
+    if (!m_filter_in_blocks){
+      m_filtered_point_image = m_point_image;
+      return;
+    }
+
+    // Cache the filtered cloud in the same blocks the cloud was
+    // bounded in. This way neighboring DEM tiles, which need the same
+    // cloud blocks, do not filter them again.
+    m_filtered_point_image
+      = block_cache(FilteredPointImageView(m_point_image, m_error_image, m_error_cutoff,
+                                           m_median_filter_params, m_erode_len),
+                    Vector2i(m_block_size, m_block_size), 1);
+  }
+
+
+  void OrthoRasterizerView::set_textures(std::vector< ImageViewRef<float> > const& textures){
+
+    if (textures.empty())
+      vw_throw( ArgumentErr() << "Orthorasterizer: set_textures() needs at least one texture.\n" );
+    if (m_use_surface_sampling && textures.size() > 1)
+      vw_throw( ArgumentErr() << "Orthorasterizer: Surface sampling can rasterize "
+                              << "only one texture at a time.\n" );
+
+    for (size_t i = 0; i < textures.size(); i++){
+      VW_ASSERT(textures[i].cols() == m_point_image.cols() &&
+                textures[i].rows() == m_point_image.rows(),
+                ArgumentErr() << "Orthorasterizer: set_textures() failed."
+                << " Texture dimensions must match point image dimensions.");
+    }
+    m_textures = textures;
+  }
 
   // This is kind of like part 2 of the constructor
   // - This function finalizes the spacing and generates a spacing-snapped BBox.
@@ -604,8 +851,10 @@ namespace asp{
       search_radius = std::max(m_spacing, m_default_spacing);
     else
       search_radius = m_spacing*m_search_radius_factor;
+    int num_planes = planes();
     asp::Point2Grid point2grid(bbox_1.width(),
                                bbox_1.height(),
+                               num_planes,
                                d_buffer, weights,
                                local_3d_bbox.min().x(),
                                local_3d_bbox.min().y(),
@@ -644,7 +893,10 @@ namespace asp{
     typedef std::map<BBox2i, BBox2i, compare_bboxes> BlockMapType;
     typedef BlockMapType::iterator MapIterType;
     BlockMapType blocks_map;
-    BOOST_FOREACH( BBoxPair const& boundary, m_point_image_boundaries ) {
+    std::vector<size_t> candidates;
+    m_subblock_index->query(local_3d_bbox, candidates);
+    for (size_t k = 0; k < candidates.size(); k++) {
+      BBoxPair const& boundary = m_point_image_boundaries[candidates[k]];
       if (! local_3d_bbox.intersects(boundary.first) )
         continue;
 
@@ -687,22 +939,20 @@ namespace asp{
       block.max() += Vector2i(d, d);
       block.crop(vw::bounding_box(m_point_image));
 
-      // Pull a copy of the input image in memory.  Expand the image
-      // to be able to see a bit beyond when filling holes.
-      BBox2i biased_block = block;
-      int bias = m_median_filter_params[0]/2 + m_erode_len;
-      biased_block.expand(bias);
-      biased_block.crop(vw::bounding_box(m_point_image));
-      ImageView<Vector3> point_copy = crop(m_point_image, biased_block);
-
-      remove_outliers(point_copy, m_error_image, m_error_cutoff, biased_block);
-      filter_by_median(point_copy, m_median_filter_params);
-      erode_image(point_copy, m_erode_len);
-
-      // Crop back to the area of interest
-      point_copy = crop(point_copy, block - biased_block.min());
+      // Pull a filtered copy of the input image in memory
+      ImageView<Vector3> point_copy;
+      if (m_filter_in_blocks){
+        point_copy = crop(m_filtered_point_image, block);
+      }else{
+        point_copy = crop(m_point_image, block);
+        remove_outliers(point_copy, m_error_image, m_error_cutoff, block);
+      }
 
-      ImageView<float> texture_copy = crop(m_texture, block );
+      ImageView<float> texture_copy = crop(m_textures[0], block );
+      std::vector< ImageView<float> > aux_copies(num_planes - 1);
+      for (int p = 1; p < num_planes; p++)
+        aux_copies[p-1] = crop(m_textures[p], block);
+      std::vector<double> vals(num_planes);
 
       typedef ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
@@ -751,9 +1001,12 @@ namespace asp{
           }else{
             // The new engine
             if ( !boost::math::isnan(point_copy(col, row).z()) ){
+              vals[0] = texture_copy(col, row);
+              for (int p = 1; p < num_planes; p++)
+                vals[p] = aux_copies[p-1](col, row);
               point2grid.AddPoint(point_copy(col, row).x(),
                                   point_copy(col, row).y(),
-                                  texture_copy(col,  row));
+                                  &vals[0]);
             }
           }
           point_ul.next_col();
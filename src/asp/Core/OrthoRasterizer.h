@@ -32,12 +32,54 @@
 #include <vw/Math/BBox.h>
 #include <asp/Core/Point2Grid.h>
 
+#include <boost/shared_ptr.hpp>
+
 namespace asp{
 
   using namespace vw;
 
   typedef std::pair<BBox3, BBox2i> BBoxPair;
 
+  /// A uniform bucket grid over the (x, y) extents of the point cloud
+  /// sub-blocks. It is built once, after all sub-block boundaries are
+  /// known, and is read-only afterwards, so a DEM tile can find the
+  /// sub-blocks it overlaps without testing each one of them.
+  class SubBlockGridIndex {
+  public:
+    SubBlockGridIndex(): m_cell_x(1.0), m_cell_y(1.0), m_cols(0), m_rows(0) {}
+
+    /// Bin the given boundaries. The index refers to them by position,
+    /// so the vector must not be modified after this.
+    void build(std::vector<BBoxPair> const& boundaries);
+
+    /// Find the indices of the boundaries whose (x, y) extent may
+    /// intersect the given box, in increasing order. The caller must
+    /// still do the exact intersection test.
+    void query(BBox3 const& box, std::vector<size_t> & indices) const;
+
+  private:
+    BBox2  m_extent;
+    double m_cell_x, m_cell_y;
+    int    m_cols, m_rows;
+    std::vector<size_t> m_cell_start;  ///< Offsets into m_cell_items, one per cell plus one.
+    std::vector<size_t> m_cell_items;  ///< Boundary indices, grouped by cell.
+    std::vector<size_t> m_large_items; ///< Boundaries spanning too many cells, always returned.
+
+    // Find the range of cells, inclusive, overlapped by the given box.
+    void cell_range(double min_x, double min_y, double max_x, double max_y,
+                    int & c0, int & r0, int & c1, int & r1) const;
+  };
+
+  /// If the point cloud height at a point differs by more than the
+  /// threshold from the median of the valid heights in the window
+  /// of given size centered at it, make the point invalid. The
+  /// parameters are the window size and the threshold.
+  void filter_by_median(ImageView<Vector3> & image, Vector2 const& median_filter_params);
+
+  /// Make invalid all points within erode_len pixels, in the
+  /// chessboard metric, from an invalid point.
+  void erode_image(ImageView<Vector3> & image, int erode_len);
+
   /// Given a point image and corresponding texture, this class
   /// bins and averages the point cloud on a regular grid over the [x,y]
   /// plane of the point image; producing an evenly sampled ortho-image
@@ -45,7 +87,7 @@ namespace asp{
   class OrthoRasterizerView:
     public ImageViewBase<OrthoRasterizerView> {
     ImageViewRef<Vector3> m_point_image;
-    ImageViewRef<float>   m_texture;
+    std::vector< ImageViewRef<float> > m_textures; // one per output plane
     BBox3   m_bbox, m_snapped_bbox; // bounding box of point cloud
     double  m_spacing;         // point cloud units (usually m or deg) per pixel
     double  m_default_spacing; // if user did not specify spacing
@@ -69,14 +111,24 @@ namespace asp{
     size_t     *m_num_invalid_pixels; ///< Keep a count of nodata output pixels, needs to be pointer due to VW weirdness.
     vw::Mutex  *m_count_mutex;        ///< A lock for m_num_invalid_pixels, needs to be pointer due to C++ weirdness.
 
-    // We could actually use a quadtree here .. but this should be a
-    // good enough improvement.
     std::vector<BBoxPair> m_point_image_boundaries;
     // These boundaries describe a point cloud 3D boundaries and then
     // their location in the the point cloud image. These boxes are
     // overlapping in the pc image X/Y domain to insure that
     // everything is triangulated.
 
+    // Spatial index of the boxes above. It does not depend on the DEM
+    // spacing, so it is shared by all copies of this view and by all
+    // initialize_spacing() passes.
+    boost::shared_ptr<SubBlockGridIndex> m_subblock_index;
+
+    // The point image after outlier removal, median filtering and
+    // erosion. When the last two are on, it is computed and cached a
+    // block at a time.
+    bool m_filter_in_blocks;
+    ImageViewRef<Vector3> m_filtered_point_image;
+    void init_filtered_point_image();
+
     // Function to convert pixel coordinates to the point domain
     BBox3 pixel_to_point_bbox( BBox2 const& px ) const;
 
@@ -121,13 +173,21 @@ namespace asp{
                 texture.impl().rows() == m_point_image.rows(),
       ArgumentErr() << "Orthorasterizer: set_texture() failed."
                     << " Texture dimensions must match point image dimensions.");
-      m_texture = channel_cast<float>(channels_to_planes(texture.impl()));
+      m_textures.assign(1, channel_cast<float>(channels_to_planes(texture.impl())));
     }
 
+    /// Rasterize several textures in the same pass over the point
+    /// cloud, each into its own plane of the output. This way, for
+    /// example, the heights, the intersection error and the
+    /// orthoimage can be produced without re-reading and re-filtering
+    /// the cloud for each of them. The same conditions as for
+    /// set_texture() apply to each texture.
+    void set_textures(std::vector< ImageViewRef<float> > const& textures);
+
     inline int32 cols() const {return (int)round((fabs(m_snapped_bbox.max().x() - m_snapped_bbox.min().x()) / m_spacing)) + 1;}
     inline int32 rows() const {return (int)round((fabs(m_snapped_bbox.max().y() - m_snapped_bbox.min().y()) / m_spacing)) + 1;}
 
-    inline int32 planes() const { return 1; }
+    inline int32 planes() const { return m_textures.size(); }
 
     inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
@@ -193,7 +253,7 @@ namespace asp{
 
     ImageViewRef<Vector3> get_point_image() { return m_point_image; }
     
-    void set_point_image(ImageViewRef<Vector3> point_image) {m_point_image = point_image;}
+    void set_point_image(ImageViewRef<Vector3> point_image);
     
   };
 
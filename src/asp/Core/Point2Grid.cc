@@ -23,6 +23,7 @@
 #include <vw/Math/Functors.h>
 
 #include <iostream>
+#include <limits>
 
 using namespace std;
 using namespace vw;
@@ -33,20 +34,23 @@ namespace asp {
 // Class Member Functions
 // ===========================================================================
 
-Point2Grid::Point2Grid(int width, int height,
+Point2Grid::Point2Grid(int width, int height, int num_planes,
                        ImageView<double> & buffer, ImageView<double> & weights,
                        double x0, double y0, double grid_size, double min_spacing,
                        double radius, double sigma_factor,
                        FilterType filter, double percentile):
-  m_width(width), m_height(height),
+  m_width(width), m_height(height), m_num_planes(num_planes),
   m_buffer(buffer), m_weights(weights),
   m_x0(x0), m_y0(y0), m_grid_size(grid_size),
-  m_radius(radius), m_filter(filter), m_percentile(percentile){
+  m_radius(radius), m_radius2(radius*radius), m_inv_d2(0.0),
+  m_nodata(0.0), m_filter(filter), m_percentile(percentile){
   
   if (m_grid_size <= 0)
     vw_throw( ArgumentErr() << "Point2Grid: Grid size must be > 0.\n" );
   if (m_radius <= 0)
     vw_throw( ArgumentErr() << "Point2Grid: Search radius must be > 0.\n" );
+  if (m_num_planes <= 0)
+    vw_throw( ArgumentErr() << "Point2Grid: Number of planes must be > 0.\n" );
 
   if (m_filter == f_percentile && (m_percentile < 0 || m_percentile > 100.0) )  
     vw_throw( ArgumentErr() << "Point2Grid: Expecting the percentile in the range 0.0 to 100.0.\n" );
@@ -68,37 +72,87 @@ Point2Grid::Point2Grid(int width, int height,
   if (sigma_factor > 0)
     sigma = sigma_factor/spacing/spacing;
   
-  // Sample the gaussian for speed
-  int num_samples = 1000;
-  m_dx = m_radius/(num_samples - 1.0);
-  m_sampled_gauss.resize(num_samples);
-  for (int k = 0; k < num_samples; k++){
-    double dist = k*m_dx;
-    m_sampled_gauss[k] = exp(-sigma*dist*dist);
-  }
-  
+  // Sample the gaussian for speed. Sample it at equally spaced squared
+  // distances, so that no square root is needed to look it up. The
+  // table extends with zeros to the corners of the square around the
+  // radius, so any node visited can be looked up.
+  int num_samples = 4096;
+  double d2 = m_radius2/(num_samples - 1.0);
+  m_inv_d2 = 1.0/d2;
+  m_sampled_gauss.resize(2*num_samples, 0.0);
+  for (int k = 0; k < num_samples; k++)
+    m_sampled_gauss[k] = exp(-sigma*k*d2);
+
+  // Room for the weights of the widest grid row within the square
+  m_row_weights.resize(2*(int)ceil(m_radius/m_grid_size) + 3);
 }
 
 void Point2Grid::Clear(const float value) {
-  m_buffer.set_size (m_width, m_height);
+  m_buffer.set_size (m_width, m_height, m_num_planes);
   m_weights.set_size (m_width, m_height);
-  for (int c = 0; c < m_buffer.cols(); c++){
+  m_nodata = value;
+
+  // The filters which accumulate start from a neutral value, so that
+  // their kernels need not check if a node was touched before. Nodes
+  // which are never touched are set to no-data in normalize().
+  double start = value; // usually this is the no-data value
+  if (m_filter == f_weighted_average || m_filter == f_mean)
+    start = 0.0;
+  else if (m_filter == f_min)
+    start = std::numeric_limits<double>::max();
+  else if (m_filter == f_max)
+    start = -std::numeric_limits<double>::max();
+  
+  for (int p = 0; p < m_num_planes; p++){
     for (int r = 0; r < m_buffer.rows(); r++){
-      m_buffer (c, r) = value; // usually this is the no-data value
-      m_weights(c, r) = 0.0;
+      double * row = &m_buffer(0, r, p);
+      for (int c = 0; c < m_buffer.cols(); c++)
+        row[c] = start;
     }
   }
+  for (int r = 0; r < m_weights.rows(); r++){
+    double * row = &m_weights(0, r);
+    for (int c = 0; c < m_weights.cols(); c++)
+      row[c] = 0.0;
+  }
 
   // For these we need to keep all values (in fact, for stddev we could get away with less,
   // but it is not worth trying so hard).
-  if (m_filter == f_median || m_filter == f_stddev ||
-      m_filter == f_nmad   || m_filter == f_percentile) {
-    m_vals.set_size(m_width, m_height);
-  }
+  m_points.clear();
+  m_vals.clear();
   
 }
 
 void Point2Grid::AddPoint(double x, double y, double z){
+  // The kernels read one value per plane
+  if (m_num_planes != 1)
+    vw_throw( ArgumentErr() << "Point2Grid: Expecting a value for each of the "
+              << m_num_planes << " planes.\n" );
+  AddPoint(x, y, &z);
+}
+
+void Point2Grid::AddPoint(double x, double y, double const* z){
+
+  // Pick the kernel once per point rather than once per grid node
+  switch (m_filter) {
+  case f_weighted_average: add_point<f_weighted_average>(x, y, z); break;
+  case f_mean:             add_point<f_mean>            (x, y, z); break;
+  case f_min:              add_point<f_min>             (x, y, z); break;
+  case f_max:              add_point<f_max>             (x, y, z); break;
+  case f_count:            add_point<f_count>           (x, y, z); break;
+  default:
+    // Count the values per node, and keep the point to fill in its
+    // values once the counts are known.
+    add_point<f_count>(x, y, z);
+    m_points.push_back(x);
+    m_points.push_back(y);
+    m_points.insert(m_points.end(), z, z + m_num_planes);
+    break;
+  }
+}
+
+template <FilterType F>
+void Point2Grid::add_point(double x, double y, double const* z){
 
   int minx = std::max( (int)ceil( (x - m_radius - m_x0)/m_grid_size ), 0 );
   int miny = std::max( (int)ceil( (y - m_radius - m_y0)/m_grid_size ), 0 );
@@ -106,103 +160,178 @@ void Point2Grid::AddPoint(double x, double y, double z){
   int maxx = std::min( (int)floor( (x + m_radius - m_x0)/m_grid_size ), m_buffer.cols() - 1 );
   int maxy = std::min( (int)floor( (y + m_radius - m_y0)/m_grid_size ), m_buffer.rows() - 1 );
 
-  // Add the contribution of current point to all grid points within radius
-  for (int ix = minx; ix <= maxx; ix++){
-    for (int iy = miny; iy <= maxy; iy++){
-      
-      double gx   = m_x0 + ix*m_grid_size;
-      double gy   = m_y0 + iy*m_grid_size;
-      double dist = sqrt( (x-gx)*(x-gx) + (y-gy)*(y-gy) );
-      if ( dist > m_radius ) continue;
-
-      if (m_filter == f_weighted_average) {
-        double wt = m_sampled_gauss[(int)round(dist/m_dx)];
-        if (wt <= 0)
+  // Add the contribution of current point to all grid points within
+  // radius. The grid is stored by rows, so traverse it that way. The
+  // radius test is folded into the arithmetic rather than branched
+  // on, so that the loops over a row can be vectorized.
+  for (int iy = miny; iy <= maxy; iy++){
+
+    double dy  = y - (m_y0 + iy*m_grid_size);
+    double dy2 = dy*dy;
+    double * wrow = &m_weights(0, iy);
+
+    if (F == f_weighted_average) {
+      // Past the radius the lookup table is padded with zeros, but the
+      // test is still needed for the nodes right at the radius.
+      // The weight of node ix is stored at ix - minx.
+      double * wt = &m_row_weights[0];
+      for (int ix = minx; ix <= maxx; ix++) {
+        double dx = x - (m_x0 + ix*m_grid_size);
+        double d2 = dx*dx + dy2;
+        wt[ix - minx] = (d2 <= m_radius2) * m_sampled_gauss[(int)(d2*m_inv_d2 + 0.5)];
+      }
+      for (int ix = minx; ix <= maxx; ix++)
+        wrow[ix] += wt[ix - minx];
+      for (int p = 0; p < m_num_planes; p++) {
+        double * brow = &m_buffer(0, iy, p);
+        double zp = z[p];
+        for (int ix = minx; ix <= maxx; ix++)
+          brow[ix] += zp*wt[ix - minx];
+      }
+
+    } else if (F == f_mean || F == f_count) {
+      for (int ix = minx; ix <= maxx; ix++) {
+        double dx = x - (m_x0 + ix*m_grid_size);
+        wrow[ix] += (dx*dx + dy2 <= m_radius2);
+      }
+      for (int p = 0; F == f_mean && p < m_num_planes; p++) {
+        double * brow = &m_buffer(0, iy, p);
+        double zp = z[p];
+        for (int ix = minx; ix <= maxx; ix++) {
+          double dx = x - (m_x0 + ix*m_grid_size);
+          brow[ix] += (dx*dx + dy2 <= m_radius2) ? zp : 0.0;
+        }
+      }
+
+    } else if (F == f_min || F == f_max) {
+      for (int p = 0; p < m_num_planes; p++) {
+        double * brow = &m_buffer(0, iy, p);
+        double zp = z[p];
+        for (int ix = minx; ix <= maxx; ix++) {
+          double dx = x - (m_x0 + ix*m_grid_size);
+          bool inside = (dx*dx + dy2 <= m_radius2);
+          wrow[ix] = inside ? 1.0 : wrow[ix]; // mark the fact that the node was touched
+          if (F == f_min)
+            brow[ix] = inside ? std::min(brow[ix], zp) : brow[ix];
+          else
+            brow[ix] = inside ? std::max(brow[ix], zp) : brow[ix];
+        }
+      }
+
+    } else {
+      // Median, stddev, nmad, and percentile. The values were already
+      // counted, so each goes to its place in the array of all values.
+      // The test for being inside the radius must be the same as when
+      // counting.
+      size_t num_vals = m_vals.size()/m_num_planes;
+      for (int ix = minx; ix <= maxx; ix++) {
+        double dx = x - (m_x0 + ix*m_grid_size);
+        if (!(dx*dx + dy2 <= m_radius2))
           continue;
-        if (m_weights(ix, iy) == 0)
-          m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
-        m_buffer(ix, iy)  += z*wt;
-        m_weights(ix, iy) += wt;
-
-      }else if (m_filter == f_mean){
-        if (m_weights(ix, iy) == 0)
-          m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
-        m_buffer(ix, iy)  += z;
-        m_weights(ix, iy) += 1;
-        
-      }else if (m_filter == f_min){
-        if (m_weights(ix, iy) == 0) {
-          m_buffer(ix, iy)  = z; // first time we set the value
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
-        }else
-          m_buffer(ix, iy) = std::min(m_buffer(ix, iy), z);
-      
-      }else if (m_filter == f_max){
-        if (m_weights(ix, iy) == 0) {
-          m_buffer(ix, iy)  = z; // first time we set the value
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
-        }else
-          m_buffer(ix, iy) = std::max(m_buffer(ix, iy), z);
-        
-      }else if (m_filter == f_count){
-        if (m_weights(ix, iy) == 0) {
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
-        }else
-          m_weights(ix, iy) += 1;
-        
-      }else if (m_filter == f_stddev || m_filter == f_median ||
-                m_filter == f_nmad   || m_filter == f_percentile){
-        m_vals(ix, iy).push_back(z); // not strictly needed for stddev
+        size_t pos = m_fill_pos[size_t(iy)*m_width + ix]++;
+        for (int p = 0; p < m_num_planes; p++)
+          m_vals[p*num_vals + pos] = z[p];
       }
-      
     }
     
   }
 }
 
 void Point2Grid::normalize(){
-  for (int c = 0; c < m_buffer.cols(); c++){
-    for (int r = 0; r < m_buffer.rows(); r++){
 
-      if (m_filter == f_weighted_average || m_filter == f_mean) {
-        if (m_weights(c, r) > 0)
-          m_buffer (c, r) /= m_weights(c, r);
+  if (m_filter == f_median || m_filter == f_stddev ||
+      m_filter == f_nmad   || m_filter == f_percentile) {
+    normalize_kept_values();
+    return;
+  }
+  
+  for (int p = 0; p < m_num_planes; p++){
+    for (int c = 0; c < m_buffer.cols(); c++){
+      for (int r = 0; r < m_buffer.rows(); r++){
 
-      }else if (m_filter == f_count)
-        m_buffer(c, r) = m_weights(c, r); // hence instead of no-data we will have always 0
+        if (m_filter == f_weighted_average || m_filter == f_mean) {
+          if (m_weights(c, r) > 0)
+            m_buffer (c, r, p) /= m_weights(c, r);
+          else
+            m_buffer (c, r, p) = m_nodata;
 
-      else if (m_filter == f_stddev){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        vw::math::StdDevAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
-        m_buffer(c, r) = V.value();
-      }
-      
-      else if (m_filter == f_median){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        vw::math::MedianAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
-        m_buffer(c, r) = V.value();
+        }else if (m_filter == f_min || m_filter == f_max) {
+          if (m_weights(c, r) == 0)
+            m_buffer (c, r, p) = m_nodata;
+
+        }else if (m_filter == f_count)
+          m_buffer(c, r, p) = m_weights(c, r); // hence instead of no-data we will have always 0
       }
+    }
+  }
+}
 
-      else if (m_filter == f_nmad){
-        if (m_vals(c, r).empty())
+void Point2Grid::normalize_kept_values(){
+
+  // Where the values of each node start. The weights hold the number
+  // of values per node.
+  size_t num_nodes = size_t(m_width)*m_height;
+  std::vector<size_t> start(num_nodes + 1, 0);
+  for (int r = 0; r < m_height; r++){
+    for (int c = 0; c < m_width; c++){
+      size_t node = size_t(r)*m_width + c;
+      start[node + 1] = start[node] + size_t(m_weights(c, r));
+    }
+  }
+
+  // Fill in the values, in the order the points arrived
+  size_t num_vals = start[num_nodes];
+  m_vals.resize(num_vals*m_num_planes);
+  m_fill_pos.assign(start.begin(), start.end() - 1);
+  size_t point_len = 2 + m_num_planes;
+  for (size_t it = 0; it < m_points.size(); it += point_len)
+    add_point<f_median>(m_points[it], m_points[it + 1], &m_points[it + 2]);
+  for (size_t node = 0; node < num_nodes; node++){
+    if (m_fill_pos[node] != start[node + 1])
+      vw_throw( LogicErr() << "Point2Grid: Book-keeping failure for the cloud values.\n" );
+  }
+  std::vector<size_t>().swap(m_fill_pos);
+  std::vector<double>().swap(m_points);
+
+  std::vector<double> vals;
+  for (int p = 0; p < m_num_planes; p++){
+    for (int r = 0; r < m_height; r++){
+      for (int c = 0; c < m_width; c++){
+        size_t node = size_t(r)*m_width + c;
+        if (start[node] == start[node + 1])
           continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_nmad(m_vals(c, r));
-      }
+        double const* beg = &m_vals[p*num_vals + start[node]];
+        double const* end = beg + (start[node + 1] - start[node]);
+
+        if (m_filter == f_stddev){
+          vw::math::StdDevAccumulator<double> V;
+          for (double const* it = beg; it != end; it++)
+            V(*it);
+          m_buffer(c, r, p) = V.value();
+        }
       
-      else if (m_filter == f_percentile){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_percentile(m_vals(c, r), m_percentile);
-      }
+        else if (m_filter == f_median){
+          vw::math::MedianAccumulator<double> V;
+          for (double const* it = beg; it != end; it++)
+            V(*it);
+          m_buffer(c, r, p) = V.value();
+        }
+
+        else if (m_filter == f_nmad){
+          vals.assign(beg, end);
+          m_buffer(c, r, p) = vw::math::destructive_nmad(vals);
+        }
       
+        else if (m_filter == f_percentile){
+          vals.assign(beg, end);
+          m_buffer(c, r, p) = vw::math::destructive_percentile(vals, m_percentile);
+        }
+      }
     }
   }
+
+  // Give back the memory, the grid is not added to after this
+  std::vector<double>().swap(m_vals);
 }
   
 } // end namespace asp
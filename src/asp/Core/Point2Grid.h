@@ -23,6 +23,7 @@
 #define __VW_POINT2GRID_H__
 
 #include <vw/Image/ImageView.h>
+#include <vector>
 
 namespace asp {
 
@@ -33,10 +34,15 @@ namespace asp {
   /// Given a set of xyz points, create an xy grid. For every node in the
   /// grid, combine all points within given radius of the grid point and
   /// calculate a single z value at the grid point.
+  /// - Several values can be gridded at once for each point, one per
+  ///   plane of the output buffer. They share the point location,
+  ///   hence the weights, and each is filtered on its own.
+  /// - Each filter has its own accumulation kernel, chosen once per
+  ///   point, which walks the grid a row at a time.
   class Point2Grid {
 
   public:
-    Point2Grid(int width, int height,
+    Point2Grid(int width, int height, int num_planes,
                vw::ImageView<double> & buffer, vw::ImageView<double> & weights,
                double x0, double y0,
                double grid_size, double min_spacing, double radius,
@@ -44,19 +50,40 @@ namespace asp {
                FilterType filter, double percentile);
     ~Point2Grid(){}
     void Clear    (const float val);
+    /// Add a point with a single value. Only for a grid with one plane.
     void AddPoint (double x, double y, double z);
+    /// Add a point with one value per plane.
+    void AddPoint (double x, double y, double const* z);
     void normalize();
 
   private:
-    int m_width, m_height; // DEM dimensions
+    /// The accumulation kernel for the given filter. Filters which keep
+    /// all values share the f_median kernel.
+    template <FilterType F>
+    void add_point(double x, double y, double const* z);
+
+    /// Fill in the values kept for each node, and find the median,
+    /// stddev, nmad, or percentile at each node.
+    void normalize_kept_values();
+
+    int m_width, m_height, m_num_planes; // DEM dimensions
     vw::ImageView<double> & m_buffer;
     vw::ImageView<double> & m_weights;
-    vw::ImageView< std::vector<double> > m_vals; // when need to keep all individual values
+    // When need to keep all individual values, the values per node are
+    // counted as the points arrive, and the points are kept. Once all
+    // are in, the values are filled in an array of exact size, with
+    // those of each node next to each other, for each plane in turn.
+    std::vector<double> m_points;   // x, y, and the value for each plane
+    std::vector<double> m_vals;
+    std::vector<size_t> m_fill_pos; // where the next value of each node goes
     double     m_x0, m_y0; // lower-left corner
     double     m_grid_size;  // spacing between output DEM pixels
     double     m_radius;   // how far to search for cloud points
-    double     m_dx;       // spacing between samples
-    std::vector<double> m_sampled_gauss;
+    double     m_radius2;  // squared search radius
+    double     m_inv_d2;   // inverse of the squared distance between samples
+    std::vector<double> m_sampled_gauss; // indexed by squared distance
+    std::vector<double> m_row_weights;   // weights along the current grid row
+    double     m_nodata;   // value of grid nodes no point contributed to
     FilterType m_filter;
     double     m_percentile; // The actual value of the percentile to use if in that mode
 
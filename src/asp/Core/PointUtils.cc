@@ -25,6 +25,7 @@
 #include <asp/Core/PointUtils.h>
 #include <vw/Cartography/Chipper.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <boost/math/special_functions/fpclassify.hpp>
 
 using namespace vw;
@@ -277,75 +278,138 @@ namespace asp{
 
   };
 
-  class CsvReader: public BaseReader{
-    std::string  m_csv_file;
-    asp::CsvConv m_csv_conv;
-    bool         m_is_first_line;
-    bool         m_has_valid_point;
-    Vector3      m_curr_point;
-    std::ifstream * m_ifs;
+  /// Parse and convert a range of CSV lines. The tasks write to
+  /// disjoint ranges of the outputs, so they can run in parallel.
+  /// Each task has its own copy of the georeference, as its proj4
+  /// handle must not be used from several threads at once.
+  class CsvParseTask: public Task, private boost::noncopyable {
+    std::vector<std::string> const& m_lines;
+    std::vector<Vector3>          & m_points;
+    std::vector<char>             & m_valid;
+    asp::CsvConv             const& m_csv_conv;
+    GeoReference                    m_georef;
+    size_t m_beg, m_end;
+    bool   m_is_first_line;
   public:
+    CsvParseTask(std::vector<std::string> const& lines,
+                 std::vector<Vector3> & points, std::vector<char> & valid,
+                 asp::CsvConv const& csv_conv, GeoReference const& georef,
+                 size_t beg, size_t end, bool is_first_line):
+      m_lines(lines), m_points(points), m_valid(valid),
+      m_csv_conv(csv_conv), m_georef(georef),
+      m_beg(beg), m_end(end), m_is_first_line(is_first_line){}
+
+    void operator()(){
+      // See CsvReader::ReadNextPoint() for why we prefer the projected point.
+      bool return_point_height = true;
+      for (size_t i = m_beg; i < m_end; i++){
+        bool success = false;
+        asp::CsvConv::CsvRecord vals
+          = m_csv_conv.parse_csv_line(m_is_first_line, success, m_lines[i]);
+        m_valid[i] = success;
+        if (success)
+          m_points[i] = m_csv_conv.csv_to_cartesian_or_point_height(vals, m_georef,
+                                                                    return_point_height);
+      }
+    }
+  };
 
-    CsvReader(std::string const & csv_file,
-              asp::CsvConv const& csv_conv,
-              GeoReference const& georef)
-      : m_csv_file(csv_file), m_csv_conv(csv_conv),
-        m_is_first_line(true), m_has_valid_point(false){
+  CsvReader::CsvReader(std::string const & csv_file,
+                       asp::CsvConv const& csv_conv,
+                       GeoReference const& georef)
+    : m_csv_file(csv_file), m_csv_conv(csv_conv),
+      m_is_first_line(true), m_has_valid_point(false){
 
-      // We will convert from projected space to xyz, unless points
-      // are already in this format.
-      m_has_georef = (m_csv_conv.format != asp::CsvConv::XYZ);
+    // We will convert from projected space to xyz, unless points
+    // are already in this format.
+    m_has_georef = (m_csv_conv.format != asp::CsvConv::XYZ);
 
-      m_georef      = georef;
-      m_num_points  = asp::csv_file_size(m_csv_file);
+    m_georef      = georef;
+    m_num_points  = asp::csv_file_size(m_csv_file);
 
-      m_ifs = new std::ifstream ( m_csv_file.c_str() );
-      if ( !*m_ifs ) {
-        vw_throw( vw::IOErr() << "Unable to open file \"" << m_csv_file << "\"" );
-      }
+    m_ifs = new std::ifstream ( m_csv_file.c_str() );
+    if ( !*m_ifs ) {
+      vw_throw( vw::IOErr() << "Unable to open file \"" << m_csv_file << "\"" );
+    }
 
-      VW_ASSERT(m_csv_conv.csv_format_str != "",
-                ArgumentErr() << "CsvReader: The CSV format was not specified.\n");
+    VW_ASSERT(m_csv_conv.csv_format_str != "",
+              ArgumentErr() << "CsvReader: The CSV format was not specified.\n");
 
-    }
+  }
 
-    virtual bool ReadNextPoint(){
+  bool CsvReader::ReadNextPoint(){
 
-      std::string line;
-      asp::CsvConv::CsvRecord vals;
+    std::string line;
+    asp::CsvConv::CsvRecord vals;
 
-      // Keep on reading, until a valid point is hit or the end of the file
-      // is reached.
-      while (1){
+    // Keep on reading, until a valid point is hit or the end of the file
+    // is reached.
+    while (1){
 	
-        m_has_valid_point = getline(*m_ifs, line, '\n');
-        if (!m_has_valid_point) return m_has_valid_point; // reached end of file
+      m_has_valid_point = getline(*m_ifs, line, '\n');
+      if (!m_has_valid_point) return m_has_valid_point; // reached end of file
 
-        vals = m_csv_conv.parse_csv_line(m_is_first_line, m_has_valid_point, line);
-        if (m_has_valid_point) break;
-      }
+      vals = m_csv_conv.parse_csv_line(m_is_first_line, m_has_valid_point, line);
+      if (m_has_valid_point) break;
+    }
 
-      // Will return projected point and height or xyz. We really
-      // prefer projected points, as then the chipper will have an
-      // easier time grouping spatially points close together, as it
-      // operates the first two coordinates.
-      bool return_point_height = true;
-      m_curr_point
-	= m_csv_conv.csv_to_cartesian_or_point_height(vals, m_georef, return_point_height);
+    // Will return projected point and height or xyz. We really
+    // prefer projected points, as then the chipper will have an
+    // easier time grouping spatially points close together, as it
+    // operates the first two coordinates.
+    bool return_point_height = true;
+    m_curr_point
+      = m_csv_conv.csv_to_cartesian_or_point_height(vals, m_georef, return_point_height);
 
-      return m_has_valid_point;
-    }
+    return m_has_valid_point;
+  }
 
-    virtual Vector3 GetPoint(){
-      return m_curr_point;
-    }
+  Vector3 CsvReader::GetPoint(){
+    return m_curr_point;
+  }
 
-    virtual ~CsvReader(){
-      delete m_ifs;
-      m_ifs = NULL;
+  size_t CsvReader::ReadPoints(size_t max_num_points, std::vector<Vector3> & points){
+
+    const size_t LINES_PER_TASK = 50000;
+    size_t count = 0;
+    while (count < max_num_points){
+
+      size_t num_lines = 0;
+      m_lines.resize(max_num_points - count);
+      while (num_lines < m_lines.size() && getline(*m_ifs, m_lines[num_lines], '\n'))
+        num_lines++;
+      if (num_lines == 0)
+        break; // reached end of file
+
+      m_parsed.resize(num_lines);
+      m_valid.resize(num_lines);
+      FifoWorkQueue queue( vw_settings().default_num_threads() );
+      for (size_t beg = 0; beg < num_lines; beg += LINES_PER_TASK){
+        bool is_first_line = (m_is_first_line && beg == 0);
+        boost::shared_ptr<CsvParseTask>
+          task(new CsvParseTask(m_lines, m_parsed, m_valid, m_csv_conv, m_georef,
+                                beg, std::min(beg + LINES_PER_TASK, num_lines),
+                                is_first_line));
+        queue.add_task(task);
+      }
+      queue.join_all();
+      m_is_first_line = false;
+
+      for (size_t i = 0; i < num_lines; i++){
+        if (!m_valid[i])
+          continue;
+        points.push_back(m_parsed[i]);
+        count++;
+      }
     }
 
-  }; // End class CsvReader
+    return count;
+  }
+
+  CsvReader::~CsvReader(){
+    delete m_ifs;
+    m_ifs = NULL;
+  }
 
 
 
@@ -558,15 +622,12 @@ namespace asp{
 
       // Read the specified number of points from the file
       int max_num_pts_to_read = num_cols*num_rows;
-      int count = 0;
+      std::vector<Vector3> points;
+      points.reserve(max_num_pts_to_read);
+      m_reader->ReadPoints(max_num_pts_to_read, points);
       PointBuffer in;
-      std::vector<PointBuffer> outVec;
-      while (m_reader->ReadNextPoint()){
-        in.push_back(m_reader->GetPoint());
-        count++;
-        if (count >= max_num_pts_to_read)
-          break;
-      }
+      for (size_t i = 0; i < points.size(); i++)
+        in.push_back(points[i]);
 
       // Take the points just read, and put them in groups by spatial
       // location, so that later point2dem does not need to read every
@@ -811,12 +872,14 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
     return values;
   }
 
+  // Use strtok_r rather than strtok, as lines are parsed from multiple threads.
   char * ptr = temp;
+  char * save_ptr = NULL;
   while(1){
 
     col_index++; // Increment the column counter
-    const char* token = strtok(ptr, sep.c_str());  // Split line on seperator char
-    ptr = NULL; // After the first call, strtok expects a null pointer as input.
+    const char* token = strtok_r(ptr, sep.c_str(), &save_ptr);  // Split line on seperator char
+    ptr = NULL; // After the first call, strtok_r expects a null pointer as input.
     if ( token == NULL ) break; // no more tokens
     if ( num_values_read >= this->num_targets ) break; // read enough values
 
@@ -828,9 +891,9 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
       values.file = token;
     else {
       // Parse the floating point value from the token
-      double val;
-      int flag = sscanf(token, "%lg", &val);
-      if (flag == 0){ // Handle parsing failure
+      char * end_ptr = NULL;
+      double val = strtod(token, &end_ptr);
+      if (end_ptr == token){ // Handle parsing failure
         success = false;
         break;
       }
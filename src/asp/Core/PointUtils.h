@@ -96,6 +96,8 @@ namespace asp {
 
     bool      is_configured() const {return csv_format_str != "";}
     CsvFormat get_format   () const {return format;}
+    std::string get_format_str() const {return csv_format_str;}
+    std::string get_proj4_str () const {return csv_proj4_str; }
 
     /// Writes out a header string containing each of the extracted column names
     /// in the order they were specified.
@@ -248,6 +250,7 @@ namespace asp {
   /// Given a point cloud with n channels, return the first m channels.
   /// We must have 1 <= m <= n <= 6.
   /// If the image was written by subtracting a shift, put that shift back.
+  /// If it was written as integers, first multiply them by their unit.
   template<int m>
   vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename);
 
@@ -359,9 +362,50 @@ namespace asp {
     
     virtual bool        ReadNextPoint() = 0;
     virtual vw::Vector3 GetPoint() = 0;
+
+    /// Append up to the given number of points to the list, and
+    /// return how many were read. Readers which can parse in
+    /// parallel override this.
+    virtual size_t ReadPoints(size_t max_num_points, std::vector<vw::Vector3> & points){
+      size_t count = 0;
+      while (count < max_num_points && ReadNextPoint()){
+        points.push_back(GetPoint());
+        count++;
+      }
+      return count;
+    }
+    
     virtual ~BaseReader(){}
   };
  
+  /// Reader for CSV files, in the format given by a CsvConv. The
+  /// points are returned projected in the georeference, with their
+  /// height, unless the format is XYZ.
+  class CsvReader: public BaseReader{
+    std::string  m_csv_file;
+    asp::CsvConv m_csv_conv;
+    bool         m_is_first_line;
+    bool         m_has_valid_point;
+    vw::Vector3  m_curr_point;
+    std::ifstream * m_ifs;
+    std::vector<std::string> m_lines;  // Buffers used by ReadPoints()
+    std::vector<vw::Vector3> m_parsed;
+    std::vector<char>        m_valid;
+  public:
+    CsvReader(std::string const & csv_file,
+              asp::CsvConv const& csv_conv,
+              vw::cartography::GeoReference const& georef);
+    virtual bool ReadNextPoint();
+    virtual vw::Vector3 GetPoint();
+
+    /// Read the lines serially, then parse them and convert them to
+    /// points in parallel. Invalid lines are skipped, as in
+    /// ReadNextPoint(), so keep going until enough points are found.
+    virtual size_t ReadPoints(size_t max_num_points, std::vector<vw::Vector3> & points);
+
+    virtual ~CsvReader();
+  }; // End class CsvReader
+
  // In the header file for the test, the others would ideally also have a test.
  /// Reader for .pcd files created by the PCL library.
  /// - Supports ascii and binary, but only three element GCC data.
@@ -401,10 +445,23 @@ vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const
     shift = vw::str_to_vec<vw::Vector3>(shift_str);
   }
 
+  // If the points were saved as integers, this is their unit
+  double scale = 1.0;
+  std::string scale_str;
+  if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_SCALE_TAG_STR, scale_str)){
+    scale = atof(scale_str.c_str());
+    if (scale <= 0.0)
+      vw_throw( vw::ArgumentErr() << "Invalid " << asp::ASP_POINT_SCALE_TAG_STR
+                << " value in: " << filename << "\n" );
+  }
+
   // Read the first m channels
   vw::ImageViewRef< vw::Vector<double, m> > out_image
     = vw::read_channels<m, double>(filename, 0);
 
+  if (scale != 1.0)
+    out_image = scale_pixels(out_image, scale);
+
   // Add the shift back to the first several channels.
   if (shift != vw::Vector3())
     out_image = subtract_shift(out_image, -shift);
@@ -92,6 +92,9 @@ namespace asp {
     // to get a camera pointer, and there we don't parse stereo.default
     disable_correct_velocity_aberration    = false;
     disable_correct_atmospheric_refraction = false;
+    dg_line_table                          = false;
+    ray_grid_spacing                       = 0;
+    ray_grid_tol                           = 0.01;
     
 
     double nan = std::numeric_limits<double>::quiet_NaN();
@@ -136,6 +139,10 @@ namespace asp {
      "Outlier removal based on the disparity of interest points, when more than one bundle adjustment pass is used. Points with x or y disparity not within the 100-'pct' to 'pct' percentile interval expanded by 'factor' will be removed as outliers. Default: pct = 100.0 and factor = 3.0, hence by default this is not enabled.")
       ("ip-debug-images",     po::value(&global.ip_debug_images)->default_value(false)->implicit_value(true),
                       "Write debug images to disk when detecting and matching interest points.")
+      ("ip-cache-dir",        po::value(&global.ip_cache_dir)->default_value(""),
+       "Save detected interest points and matches in this directory, keyed by the image contents and the detection settings, and reuse them in later runs.")
+      ("ip-cache-max-size",   po::value(&global.ip_cache_max_size)->default_value(2048),
+       "When the interest point cache grows beyond this size (in MB), delete the least recently used entries. Set to 0 for no limit.")
       ("num-obalog-scales",              po::value(&global.num_scales)->default_value(-1),
        "How many scales to use if detecting interest points with OBALoG. If not specified, 8 will be used. More can help for images with high frequency artifacts.")
       ("nodata-value",             po::value(&global.nodata_value)->default_value(nan),
@@ -343,12 +350,16 @@ namespace asp {
                                             "How much to round the output point cloud values, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. Default: 1/2^10 for Earth and proportionally less for smaller bodies.")
       ("save-double-precision-point-cloud", po::bool_switch(&global.save_double_precision_point_cloud)->default_value(false)->implicit_value(true),
                                             "Save the final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at twice the storage).")
+      ("quantize-point-cloud",              po::bool_switch(&global.quantize_point_cloud)->default_value(false)->implicit_value(true),
+                                            "Save the final point cloud as integer multiples of the point cloud rounding error, rather than as float. Same precision, but compresses better. Points which do not fit in 32 bits are saved as invalid, with a warning.")
       ("compute-point-cloud-center-only",   po::bool_switch(&global.compute_point_cloud_center_only)->default_value(false)->implicit_value(true),
                                             "Only compute the center of triangulated point cloud and exit.")
       ("skip-point-cloud-center-comp", po::bool_switch(&global.skip_point_cloud_center_comp)->default_value(false)->implicit_value(true),
        "Skip the computation of the point cloud center. This option is used in parallel_stereo.")
       ("compute-error-vector",              po::bool_switch(&global.compute_error_vector)->default_value(false)->implicit_value(true),
                                             "Compute the triangulation error vector, not just its length.")
+      ("fused-pipeline",                    po::bool_switch(&global.fused_pipeline)->default_value(false)->implicit_value(true),
+                                            "Run correlation, refinement, and filtering in memory as part of triangulation, without writing D.tif, RD.tif, and F.tif. Needs the low-resolution disparity.")
       ("compute-piecewise-adjustments-only", po::bool_switch(&global.compute_piecewise_adjustments_only)->default_value(false)->implicit_value(true),
        "Compute the piecewise adjustments as part of jitter correction, and then stop.")
       ("skip-computing-piecewise-adjustments", po::bool_switch(&global.skip_computing_piecewise_adjustments)->default_value(false)->implicit_value(true),
@@ -393,7 +404,13 @@ namespace asp {
       ("disable-correct-velocity-aberration", po::bool_switch(&global.disable_correct_velocity_aberration)->default_value(false)->implicit_value(true),
        "Turn off velocity aberration correction for non-ISIS linescan cameras.")
       ("disable-correct-atmospheric-refraction", po::bool_switch(&global.disable_correct_atmospheric_refraction)->default_value(false)->implicit_value(true),
-       "Turn off atmospheric refraction correction for non-ISIS linescan cameras.");
+       "Turn off atmospheric refraction correction for non-ISIS linescan cameras.")
+      ("dg-line-table", po::bool_switch(&global.dg_line_table)->default_value(false)->implicit_value(true),
+       "For Digital Globe cameras, tabulate the camera position, velocity, and orientation once per image line, and interpolate in this table rather than in the satellite ephemeris and attitude. This is faster, with very small differences in the results.")
+      ("ray-grid-spacing", po::value(&global.ray_grid_spacing)->default_value(0),
+       "For ISIS, Digital Globe, ASTER, and other cameras which are slow to evaluate, tabulate the camera center and ray direction on a grid of pixels with this spacing, and interpolate in between. The table is saved next to the other outputs and reused by later stereo steps. Set to 0 to not use it.")
+      ("ray-grid-tol", po::value(&global.ray_grid_tol)->default_value(0.01),
+       "With --ray-grid-spacing, the maximum allowed interpolation error at the center of a grid cell, in pixels. Cells with a larger error use the exact camera.");
   }
 
   UndocOptsDescription::UndocOptsDescription() : po::options_description("Undocumented Options") {
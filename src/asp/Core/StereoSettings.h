@@ -107,6 +107,8 @@ namespace asp {
                                             ///  of the left/right edges of the images being matched.
     bool   ip_normalize_tiles;              ///< Individually normalize tiles for IP detection.
     bool   ip_debug_images;                 ///< Write debug interest point images.
+    std::string ip_cache_dir;               ///< Directory of cached interest points and matches, if not empty.
+    double ip_cache_max_size;               ///< Size in MB above which old cache entries are deleted.
     
     double nodata_value;                    ///< Pixels with values less than or equal to this number are treated as no-data.
                                             //  This overrides the nodata values from input images.
@@ -221,11 +223,13 @@ namespace asp {
     bool   compute_piecewise_adjustments_only;
 
     bool   compute_error_vector;              // Compute the triangulation error vector, not just its length
+    bool   fused_pipeline;                    // Correlate, refine, and filter in memory while triangulating
 
     double min_triangulation_angle;           // min angle for valid triangulation
     bool   use_least_squares;                 // Use a more rigorous triangulation
     bool   save_double_precision_point_cloud; // Save final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at 2x the storage).
     double point_cloud_rounding_error;        // How much to round the output point cloud values
+    bool   quantize_point_cloud;              // Save the point cloud as integer multiples of the rounding error
     bool   compute_point_cloud_center_only;   // Only compute the center of triangulated point cloud and exit.
     bool   skip_point_cloud_center_comp;
     bool   unalign_disparity;                 // Compute disparity between unaligned images
@@ -244,6 +248,9 @@ namespace asp {
 
     bool disable_correct_velocity_aberration;
     bool disable_correct_atmospheric_refraction;
+    bool dg_line_table;
+    int    ray_grid_spacing;                ///< If positive, tabulate camera rays on a grid with this spacing.
+    double ray_grid_tol;                    ///< Max ray interpolation error, in pixels.
 
     // Undocumented options. We don't want these exposed to the user.
     vw::BBox2i trans_crop_win;        // Left image crop window in respect to L.tif.
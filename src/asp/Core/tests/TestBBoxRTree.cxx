@@ -0,0 +1,81 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/BBoxRTree.h>
+#include <test/Helpers.h>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  double rand_val(double scale) {
+    return scale * double(rand()) / double(RAND_MAX);
+  }
+}
+
+TEST(BBoxRTree, MatchesBruteForce) {
+
+  // Boxes of very different sizes, and a few empty ones
+  srand(7);
+  std::vector<BBox2> boxes;
+  for (int i = 0; i < 2000; i++) {
+    if (i % 97 == 0) {
+      boxes.push_back(BBox2());
+      continue;
+    }
+    double len = (i % 10 == 0) ? 300.0 : 20.0;
+    boxes.push_back(BBox2(rand_val(1000), rand_val(1000), rand_val(len), rand_val(len)));
+  }
+  BBoxRTree tree(boxes);
+  EXPECT_EQ(boxes.size(), tree.size());
+
+  std::vector<int> found;
+  for (int q = 0; q < 200; q++) {
+    BBox2 box(rand_val(1100) - 50, rand_val(1100) - 50, rand_val(100), rand_val(100));
+    tree.query(box, found);
+
+    std::vector<int> expected;
+    for (int i = 0; i < (int)boxes.size(); i++) {
+      if (boxes[i].intersects(box))
+        expected.push_back(i);
+    }
+    ASSERT_EQ(expected.size(), found.size());
+    for (size_t i = 0; i < expected.size(); i++)
+      EXPECT_EQ(expected[i], found[i]);
+  }
+
+  // Touching boxes count, and empty queries find nothing
+  tree.query(BBox2(boxes[1].max()[0], boxes[1].max()[1], 1, 1), found);
+  EXPECT_TRUE(std::find(found.begin(), found.end(), 1) != found.end());
+  tree.query(BBox2(), found);
+  EXPECT_TRUE(found.empty());
+}
+
+TEST(BBoxRTree, Empty) {
+  BBoxRTree tree;
+  std::vector<int> found(3, 0);
+  tree.query(BBox2(0, 0, 10, 10), found);
+  EXPECT_TRUE(found.empty());
+
+  tree.build(std::vector<BBox2>(1, BBox2(0, 0, 1, 1)));
+  tree.query(BBox2(0.5, 0.5, 10, 10), found);
+  ASSERT_EQ(1u, found.size());
+  EXPECT_EQ(0, found[0]);
+}
@@ -0,0 +1,94 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/EigenUtils.h>
+#include <Eigen/Geometry>
+
+using namespace vw;
+using namespace asp;
+
+// Form a cloud with a last row of ones out of the given points
+DoubleMatrix form_cloud(std::vector<Eigen::Vector3d> const& points) {
+  DoubleMatrix cloud(DIM + 1, points.size());
+  for (size_t col = 0; col < points.size(); col++) {
+    cloud.col(col).head(DIM) = points[col];
+    cloud(DIM, col) = 1;
+  }
+  return cloud;
+}
+
+TEST( EigenUtils, VoxelDownsample ) {
+
+  // Three points in the voxel with corner (-2, 0, 4), one in the voxel
+  // with corner (0, 0, 0), for voxels of size 2.
+  std::vector<Eigen::Vector3d> points;
+  points.push_back(Eigen::Vector3d(-1.5, 0.5, 4.5));
+  points.push_back(Eigen::Vector3d( 0.5, 1.5, 0.5));
+  points.push_back(Eigen::Vector3d(-0.5, 1.5, 5.5));
+  points.push_back(Eigen::Vector3d(-1.0, 1.0, 4.0));
+  DoubleMatrix out;
+  voxel_downsample(form_cloud(points), 2.0, out);
+
+  ASSERT_EQ(DIM + 1, out.rows());
+  ASSERT_EQ(2, out.cols());
+  // The voxels are sorted by their indices, so the one with the
+  // negative x comes first.
+  EXPECT_NEAR(-1.0,     out(0, 0), 1e-12);
+  EXPECT_NEAR( 1.0,     out(1, 0), 1e-12);
+  EXPECT_NEAR(14.0/3.0, out(2, 0), 1e-12);
+  EXPECT_NEAR( 0.5,     out(0, 1), 1e-12);
+  EXPECT_NEAR( 1.5,     out(1, 1), 1e-12);
+  EXPECT_NEAR( 0.5,     out(2, 1), 1e-12);
+  EXPECT_EQ(1.0, out(DIM, 0));
+  EXPECT_EQ(1.0, out(DIM, 1));
+
+  EXPECT_THROW(voxel_downsample(form_cloud(points), 0.0, out), ArgumentErr);
+}
+
+TEST( EigenUtils, EstimatePointSpacing ) {
+
+  // Neither the orientation of the surface nor its distance from the
+  // origin should matter.
+  Eigen::Matrix3d rot;
+  rot = Eigen::AngleAxisd(0.7, Eigen::Vector3d(1, 2, 3).normalized());
+  Eigen::Vector3d offset(1.7e6, -5.2e6, 2.9e6);
+
+  // A rectangular grid with a spacing of 2, on gently rolling terrain
+  std::vector<Eigen::Vector3d> points;
+  for (int i = 0; i < 300; i++) {
+    for (int j = 0; j < 200; j++)
+      points.push_back(offset + rot*Eigen::Vector3d(2.0*i, 2.0*j, 0.3*sin(0.1*i)));
+  }
+  EXPECT_NEAR(2.0, estimate_point_spacing(form_cloud(points)), 0.1);
+
+  // An L-shaped footprint with a spacing of 1.5, which fills less than
+  // a third of its bounding box.
+  points.clear();
+  for (int i = 0; i < 400; i++) {
+    for (int j = 0; j < 400; j++) {
+      if (i < 50 || j < 50)
+        points.push_back(rot*Eigen::Vector3d(1.5*i, 1.5*j, 0.0));
+    }
+  }
+  EXPECT_NEAR(1.5, estimate_point_spacing(form_cloud(points)), 0.15);
+
+  // Too few points
+  points.resize(1);
+  EXPECT_EQ(0.0, estimate_point_spacing(form_cloud(points)));
+}
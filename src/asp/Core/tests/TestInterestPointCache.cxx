@@ -0,0 +1,135 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/InterestPointCache.h>
+#include <boost/filesystem/operations.hpp>
+#include <ctime>
+
+using namespace vw;
+using namespace asp;
+namespace fs = boost::filesystem;
+
+namespace {
+  ip::InterestPointList make_ip(int num, float offset) {
+    ip::InterestPointList ip_list;
+    for (int i = 0; i < num; i++) {
+      ip::InterestPoint ip(i + offset, 2*i + offset, 1.5, 0.25);
+      ip.descriptor = Vector<float>(4);
+      for (int d = 0; d < 4; d++)
+        ip.descriptor[d] = i + d;
+      ip_list.push_back(ip);
+    }
+    return ip_list;
+  }
+}
+
+TEST( InterestPointCache, HashImage ) {
+  ImageView<float> image1(300, 600), image2(300, 600);
+  for (int col = 0; col < image1.cols(); col++) {
+    for (int row = 0; row < image1.rows(); row++) {
+      image1(col, row) = col + 0.5*row;
+      image2(col, row) = col + 0.5*row;
+    }
+  }
+
+  CacheKeyHasher h1, h2;
+  hash_image(h1, image1);
+  hash_image(h2, image2);
+  EXPECT_EQ(h1.hex(), h2.hex());
+  EXPECT_EQ(16u, h1.hex().size());
+
+  // A single changed pixel in the second band of rows changes the key
+  image2(7, 500) += 1;
+  CacheKeyHasher h3;
+  hash_image(h3, image2);
+  EXPECT_NE(h1.hex(), h3.hex());
+
+  // So does a crop with the same pixels in the overlap
+  CacheKeyHasher h4;
+  hash_image(h4, crop(image1, BBox2i(0, 0, 300, 599)));
+  EXPECT_NE(h1.hex(), h4.hex());
+}
+
+TEST( InterestPointCache, ReadWrite ) {
+  std::string dir = "ip_cache_test_rw";
+  fs::remove_all(dir);
+
+  InterestPointCache disabled("", 0);
+  EXPECT_FALSE(disabled.enabled());
+
+  InterestPointCache cache(dir, 0);
+  EXPECT_TRUE(cache.enabled());
+
+  ip::InterestPointList ip_in = make_ip(10, 0.5), ip_out;
+  EXPECT_FALSE(cache.read_ip("0123456789abcdef", ip_out));
+  cache.write_ip("0123456789abcdef", ip_in);
+  ASSERT_TRUE(cache.read_ip("0123456789abcdef", ip_out));
+  ASSERT_EQ(ip_in.size(), ip_out.size());
+  EXPECT_NEAR(ip_in.back().x, ip_out.back().x, 1e-6);
+  EXPECT_NEAR(ip_in.back().y, ip_out.back().y, 1e-6);
+  EXPECT_EQ(ip_in.back().descriptor.size(), ip_out.back().descriptor.size());
+
+  std::vector<ip::InterestPoint> m1(ip_in.begin(), ip_in.end()), m2, r1, r2;
+  ip::InterestPointList ip2 = make_ip(10, 3.0);
+  m2.assign(ip2.begin(), ip2.end());
+  EXPECT_FALSE(cache.read_match("fedcba9876543210", r1, r2));
+  cache.write_match("fedcba9876543210", m1, m2);
+  ASSERT_TRUE(cache.read_match("fedcba9876543210", r1, r2));
+  ASSERT_EQ(m1.size(), r1.size());
+  ASSERT_EQ(m2.size(), r2.size());
+  EXPECT_NEAR(m2[3].x, r2[3].x, 1e-6);
+
+  // No temporary files are left behind
+  int num_files = 0;
+  for (fs::directory_iterator it(dir), end; it != end; ++it)
+    num_files++;
+  EXPECT_EQ(2, num_files);
+
+  fs::remove_all(dir);
+}
+
+TEST( InterestPointCache, Eviction ) {
+  std::string dir = "ip_cache_test_evict";
+  fs::remove_all(dir);
+
+  // Room for about two entries
+  ip::InterestPointList ip = make_ip(1000, 0);
+  InterestPointCache sizer(dir, 0);
+  sizer.write_ip("0000000000000000", ip);
+  double entry_mb = fs::file_size(fs::path(dir) / "0000000000000000.vwip") / (1024.0 * 1024.0);
+  fs::remove_all(dir);
+
+  InterestPointCache cache(dir, 2.5 * entry_mb);
+  cache.write_ip("0000000000000001", ip);
+  cache.write_ip("0000000000000002", ip);
+
+  // Make the first entry the oldest, then use the second one
+  fs::last_write_time(fs::path(dir) / "0000000000000001.vwip", std::time(0) - 100);
+  fs::last_write_time(fs::path(dir) / "0000000000000002.vwip", std::time(0) - 50);
+  ip::InterestPointList ip_out;
+  EXPECT_TRUE(cache.read_ip("0000000000000002", ip_out));
+
+  // Adding a third entry evicts the least recently used one
+  cache.write_ip("0000000000000003", ip);
+  EXPECT_FALSE(cache.read_ip("0000000000000001", ip_out));
+  EXPECT_TRUE (cache.read_ip("0000000000000002", ip_out));
+  EXPECT_TRUE (cache.read_ip("0000000000000003", ip_out));
+
+  fs::remove_all(dir);
+}
@@ -0,0 +1,138 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/OrthoRasterizer.h>
+#include <vw/Math/Statistics.h>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+// The grid index must find every sub-block box which a brute force
+// search over all boxes finds.
+TEST( OrthoRasterizer, SubBlockGridIndex ) {
+
+  std::vector<BBoxPair> boundaries;
+  for (int row = 0; row < 40; row++){
+    for (int col = 0; col < 30; col++){
+      BBox3 box(Vector3(10.0*col, 5.0*row, 0), Vector3(10.0*col + 12.0, 5.0*row + 6.0, 1));
+      boundaries.push_back(std::make_pair(box, BBox2i(16*col, 16*row, 16, 16)));
+    }
+  }
+  // An outlier box spanning the whole cloud
+  boundaries.push_back(std::make_pair(BBox3(Vector3(-100, -100, 0), Vector3(500, 300, 1)),
+                                      BBox2i(0, 0, 16, 16)));
+
+  SubBlockGridIndex index;
+  index.build(boundaries);
+
+  std::vector<BBox3> queries;
+  queries.push_back(BBox3(Vector3(0, 0, 0),        Vector3(1, 1, 1)));
+  queries.push_back(BBox3(Vector3(55.5, 33.2, 0),  Vector3(120.1, 64.9, 1)));
+  queries.push_back(BBox3(Vector3(-50, -50, 0),    Vector3(400, 400, 1)));
+  queries.push_back(BBox3(Vector3(1000, 1000, 0),  Vector3(1100, 1100, 1)));
+
+  std::vector<size_t> indices;
+  for (size_t q = 0; q < queries.size(); q++){
+    index.query(queries[q], indices);
+    for (size_t i = 0; i < boundaries.size(); i++){
+      if (!queries[q].intersects(boundaries[i].first))
+        continue;
+      EXPECT_TRUE(std::binary_search(indices.begin(), indices.end(), i));
+    }
+  }
+
+  // The far away query should only see the outlier box
+  index.query(queries[3], indices);
+  ASSERT_EQ(1u, indices.size());
+  EXPECT_EQ(boundaries.size() - 1, indices[0]);
+}
+
+namespace {
+
+  // A cloud with random heights, some big outliers, and a few holes
+  ImageView<Vector3> make_cloud(int cols, int rows) {
+    srand(3);
+    ImageView<Vector3> image(cols, rows);
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    for (int col = 0; col < cols; col++) {
+      for (int row = 0; row < rows; row++) {
+        double z = 0.1*col + rand()/double(RAND_MAX);
+        if (rand() % 20 == 0) z += 10;
+        if (rand() % 25 == 0) z = nan;
+        image(col, row) = Vector3(col, row, z);
+      }
+    }
+    return image;
+  }
+
+  bool same_heights(ImageView<Vector3> const& a, ImageView<Vector3> const& b) {
+    for (int col = 0; col < a.cols(); col++) {
+      for (int row = 0; row < a.rows(); row++) {
+        double za = a(col, row).z(), zb = b(col, row).z();
+        if (boost::math::isnan(za) != boost::math::isnan(zb)) return false;
+        if (!boost::math::isnan(za) && za != zb) return false;
+      }
+    }
+    return true;
+  }
+}
+
+// Compare with the definition: the median of the window around
+// each point, found anew for each of them.
+TEST( OrthoRasterizer, FilterByMedian ) {
+  ImageView<Vector3> image = make_cloud(37, 23), expected = copy(image);
+  Vector2 params(5, 2.0);
+  int half = 2;
+  for (int col = 0; col < image.cols(); col++) {
+    for (int row = 0; row < image.rows(); row++) {
+      if (boost::math::isnan(image(col, row).z())) continue;
+      std::vector<double> vals;
+      for (int c = std::max(col-half, 0); c <= std::min(col+half, image.cols()-1); c++)
+        for (int r = std::max(row-half, 0); r <= std::min(row+half, image.rows()-1); r++)
+          if (!boost::math::isnan(image(c, r).z()))
+            vals.push_back(image(c, r).z());
+      if (fabs(math::destructive_median(vals) - image(col, row).z()) > params[1])
+        expected(col, row).z() = std::numeric_limits<double>::quiet_NaN();
+    }
+  }
+
+  filter_by_median(image, params);
+  EXPECT_TRUE(same_heights(expected, image));
+}
+
+// Compare with the definition: erode_len passes with a 3x3 window.
+TEST( OrthoRasterizer, ErodeImage ) {
+  for (int erode_len = 1; erode_len <= 3; erode_len++) {
+    ImageView<Vector3> image = make_cloud(31, 19), expected = copy(image);
+    for (int pass = 0; pass < erode_len; pass++) {
+      ImageView<Vector3> prev = copy(expected);
+      for (int col = 0; col < image.cols(); col++)
+        for (int row = 0; row < image.rows(); row++)
+          for (int c = std::max(col-1, 0); c <= std::min(col+1, image.cols()-1); c++)
+            for (int r = std::max(row-1, 0); r <= std::min(row+1, image.rows()-1); r++)
+              if (boost::math::isnan(prev(c, r).z()))
+                expected(col, row).z() = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    erode_image(image, erode_len);
+    EXPECT_TRUE(same_heights(expected, image));
+  }
+}
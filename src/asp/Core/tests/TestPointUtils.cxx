@@ -18,6 +18,10 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/PointUtils.h>
+#include <boost/filesystem/operations.hpp>
+#include <vw/Core/Settings.h>
+#include <fstream>
+#include <cstdlib>
 
 using namespace vw;
 using namespace asp;
@@ -93,6 +97,11 @@ TEST( PointUtils, CsvConv ) {
   EXPECT_EQ(69.3737799999999964,  point[1]); // lat
   EXPECT_EQ(658.4780,             point[2]); // height
 
+  // A non-numeric value makes the line invalid
+  line = "658.4780, 69.37, abc";
+  vals = conv.parse_csv_line(is_first_line, success, line);
+  EXPECT_FALSE(success);
+
 
   // Check format parsing
   conv.parse_csv_format("4:lat 2:lon 3:radius_km", "");
@@ -152,3 +161,103 @@ TEST( PointUtils, PcdReader ) {
 }
 
 
+
+TEST( PointUtils, QuantizedPointCloud ) {
+
+  Vector3 shift(-1.7e6, 5.2e6, 2.9e6);
+  double scale = get_rounding_error(shift, 0.0);
+
+  ImageView<Vector4> cloud(20, 10);
+  for (int col = 0; col < cloud.cols(); col++) {
+    for (int row = 0; row < cloud.rows(); row++) {
+      Vector3 xyz = shift + Vector3(3.1*col, -2.7*row, 0.011*col*row);
+      cloud(col, row) = Vector4(xyz[0], xyz[1], xyz[2], 0.01*row);
+    }
+  }
+  cloud(3, 4) = Vector4();                        // invalid
+  cloud(5, 6) = Vector4(1e+7, 1e+7, 1e+7, 1);     // far away from the shift
+  cloud(7, 8)[3] = 1e+10;                         // huge error
+
+  std::string file = "quantized_cloud.tif";
+  bool has_georef = false;
+  cartography::GeoReference georef;
+  cartography::GdalWriteOptions opt;
+  block_write_quantized_gdal_image(file, shift, 0.0, cloud, has_georef, georef, opt);
+  EXPECT_EQ(VW_CHANNEL_INT32, DiskImageResourceGDAL(file).channel_type());
+
+  ImageViewRef<Vector4> out = read_asp_point_cloud<4>(file);
+  ASSERT_EQ(cloud.cols(), out.cols());
+  ASSERT_EQ(cloud.rows(), out.rows());
+  for (int col = 0; col < cloud.cols(); col++) {
+    for (int row = 0; row < cloud.rows(); row++) {
+      if (col == 7 && row == 8) {
+        EXPECT_VECTOR_NEAR(subvector(out(col, row), 0, 3),
+                           subvector(cloud(col, row), 0, 3), scale/2);
+        EXPECT_GT(out(col, row)[3], 1e+6);
+        continue;
+      }
+      if ((col == 3 && row == 4) || (col == 5 && row == 6)) {
+        EXPECT_VECTOR_NEAR(out(col, row), Vector4(), 0.0);
+        continue;
+      }
+      EXPECT_VECTOR_NEAR(out(col, row), cloud(col, row), scale/2);
+    }
+  }
+
+  // Only the point far away from the shift is counted as overflowing
+  boost::shared_ptr<QuantizeOverflowCount> overflow(new QuantizeOverflowCount);
+  ImageView<Vector<int32, 4> > quantized
+    = quantize_pixels(subtract_shift(cloud, shift), scale, overflow);
+  EXPECT_EQ(1u, overflow->count);
+
+  boost::filesystem::remove(file);
+}
+
+// Reading a CSV file in parallel must give the same points, in the
+// same order, as reading it a point at a time.
+TEST( PointUtils, CsvReaderParallel ) {
+
+  // A header, a comment, and invalid lines among many valid ones, so
+  // that the lines are split among several tasks and several reads.
+  std::string file = "csv_reader_test.csv";
+  {
+    std::ofstream ofs(file.c_str());
+    ofs.precision(17);
+    ofs << "lon, lat, height\n";
+    ofs << "# A comment\n";
+    srand(3);
+    for (int i = 0; i < 130000; i++) {
+      if (i % 20011 == 5)
+        ofs << "bad, line\n";
+      ofs << -122.0 + rand()/double(RAND_MAX) << ", "
+          <<   37.0 + rand()/double(RAND_MAX) << ", "
+          <<  100.0*rand()/double(RAND_MAX)   << "\n";
+    }
+  }
+
+  vw::cartography::GeoReference georef;
+  georef.set_well_known_geogcs("WGS84");
+  CsvConv conv;
+  conv.parse_csv_format("1:lon 2:lat 3:height_above_datum", "");
+
+  std::vector<Vector3> serial_points;
+  CsvReader serial_reader(file, conv, georef);
+  while (serial_reader.ReadNextPoint())
+    serial_points.push_back(serial_reader.GetPoint());
+  ASSERT_EQ(130000u, serial_points.size());
+
+  int num_threads = vw_settings().default_num_threads();
+  vw_settings().set_default_num_threads(4);
+  std::vector<Vector3> parallel_points;
+  CsvReader parallel_reader(file, conv, georef);
+  EXPECT_EQ(70000u, parallel_reader.ReadPoints(70000, parallel_points));
+  EXPECT_EQ(60000u, parallel_reader.ReadPoints(70000, parallel_points));
+  EXPECT_EQ(0u,     parallel_reader.ReadPoints(70000, parallel_points));
+  vw_settings().set_default_num_threads(num_threads);
+
+  ASSERT_EQ(serial_points.size(), parallel_points.size());
+  for (size_t i = 0; i < serial_points.size(); i++)
+    EXPECT_EQ(serial_points[i], parallel_points[i]);
+
+  boost::filesystem::remove(file);
+}
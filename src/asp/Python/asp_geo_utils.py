@@ -145,6 +145,13 @@ def getImageGeoInfo(imagePath, getStats=True):
     except:
         pass # In most cases this line will not be present
 
+    # Present if the point cloud was saved as integers
+    try:
+        pointScaleLine = asp_string_utils.getLineAfterText(textOutput, 'POINT_SCALE=') # Tag name must be synced with C++ code
+        outputDict['point_scale'] = float(pointScaleLine.split(' ')[0])
+    except:
+        pass
+
     # TODO: Currently this does not find much information, and there
     #       is another function in image_utils dedicated to returning statistics.
     if getStats:
@@ -474,7 +481,11 @@ def build_vrt( fullImageSize, tileLocs, tilePaths, outputPath ):
     # This special metadata value is only used for ASP stereo point cloud files!    
     if 'point_offset' in gdalInfo:
         f.write("  <Metadata>\n    <MDI key=\"" + 'POINT_OFFSET' + "\">" +
-                gdalInfo['point_offset'][0] + "</MDI>\n  </Metadata>\n")
+                " ".join([repr(v) for v in gdalInfo['point_offset']]) + "</MDI>\n")
+        if 'point_scale' in gdalInfo:
+            f.write("    <MDI key=\"" + 'POINT_SCALE' + "\">" +
+                    repr(gdalInfo['point_scale']) + "</MDI>\n")
+        f.write("  </Metadata>\n")
       
 
     # Write each band
@@ -29,13 +29,18 @@
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Cartography/Map2CamTrans.h>
+#include <vw/Camera/PinholeModel.h>
 
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Camera/AdjustedLinescanDGModel.h>
+#include <asp/Camera/RayGridCameraModel.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Core/InterestPointCache.h>
 
 #include <boost/filesystem/operations.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <map>
 #include <utility>
@@ -44,6 +49,7 @@
 #include <limits>
 
 using namespace vw;
+namespace fs = boost::filesystem;
 
 
 namespace asp {
@@ -351,10 +357,72 @@ StereoSession::camera_model(std::string const& image_file, std::string const& ca
                                                  m_right_image_file,
                                                  image_file);
   
+  boost::shared_ptr<vw::camera::CameraModel> cam;
   if (camera_file == "") // No camera file provided, use the image file.
-    return load_camera_model(image_file, image_file, pixel_offset);
+    cam = load_camera_model(image_file, image_file, pixel_offset);
   else // Camera file provided
-    return load_camera_model(image_file, camera_file, pixel_offset);
+    cam = load_camera_model(image_file, camera_file, pixel_offset);
+
+  if (stereo_settings().ray_grid_spacing > 0)
+    cam = ray_grid_camera_model(cam, image_file, camera_file, pixel_offset);
+  return cam;
+}
+
+boost::shared_ptr<vw::camera::CameraModel>
+StereoSession::ray_grid_camera_model(boost::shared_ptr<vw::camera::CameraModel> cam,
+                                     std::string const& image_file,
+                                     std::string const& camera_file,
+                                     vw::Vector2 const& pixel_offset) const {
+
+  // Pinhole and RPC cameras are fast already, and some code expects
+  // to find them under at most an adjustment.
+  const vw::camera::CameraModel* ucam = vw::camera::unadjusted_model(cam.get());
+  if (dynamic_cast<const vw::camera::PinholeModel*>(ucam) != NULL ||
+      dynamic_cast<const asp::RPCModel*>(ucam) != NULL)
+    return cam;
+
+  // The grid covers the image. If it was cropped, the camera pixels
+  // are relative to the crop corner.
+  Vector2i image_size;
+  try {
+    boost::scoped_ptr<vw::DiskImageResource> rsrc(vw::DiskImageResource::open(image_file));
+    image_size = Vector2i(rsrc->cols(), rsrc->rows());
+  } catch (...) {
+    vw_out(WarningMessage) << "Could not read the size of " << image_file
+                           << ". Not tabulating its camera rays.\n";
+    return cam;
+  }
+  Vector2i corner(round(-pixel_offset[0]), round(-pixel_offset[1]));
+  BBox2i pixel_box(corner, corner + image_size);
+
+  // Anything which changes the camera goes in the key. What is missed
+  // here is caught when the table is checked against the camera.
+  std::string table_file;
+  CacheKeyHasher hasher;
+  if (m_out_prefix != "") {
+    // Images in different directories may have the same name, and an
+    // image may be used with more than one camera or crop, so tell
+    // their tables apart by a hash of the full paths and the pixel box.
+    CacheKeyHasher name_hasher;
+    name_hasher.add(fs::absolute(image_file).string());
+    name_hasher.add(camera_file == "" ? std::string() : fs::absolute(camera_file).string());
+    name_hasher.add(pixel_box.min());
+    name_hasher.add(pixel_box.max());
+    table_file = m_out_prefix + "-" + fs::path(image_file).stem().string() + "-"
+      + name_hasher.hex().substr(0, 8) + ".raygrid";
+    hasher.add(image_file);
+    hasher.add(camera_file);
+    hasher.add(stereo_settings().bundle_adjust_prefix);
+    hasher.add(stereo_settings().disable_correct_velocity_aberration);
+    hasher.add(stereo_settings().disable_correct_atmospheric_refraction);
+    hasher.add(stereo_settings().dg_line_table);
+    boost::system::error_code ec;
+    hasher.add(vw::int64(fs::last_write_time(camera_file == "" ? image_file : camera_file, ec)));
+  }
+
+  return boost::shared_ptr<vw::camera::CameraModel>
+    (new RayGridCameraModel(cam, pixel_box, stereo_settings().ray_grid_spacing,
+                            stereo_settings().ray_grid_tol, table_file, hasher.hex()));
 }
 
 
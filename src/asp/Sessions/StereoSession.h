@@ -277,6 +277,14 @@ namespace asp {
                                                                          std::string const& camera_file,
                                                                          vw::Vector2 pixel_offset) const = 0;
 
+    /// With --ray-grid-spacing, wrap a camera which is slow to evaluate
+    /// in a RayGridCameraModel, with the table saved at the output prefix.
+    boost::shared_ptr<vw::camera::CameraModel>
+    ray_grid_camera_model(boost::shared_ptr<vw::camera::CameraModel> cam,
+                          std::string const& image_file,
+                          std::string const& camera_file,
+                          vw::Vector2 const& pixel_offset) const;
+
     /// Load an RPC camera model with a pixel offset
     /// - We define it here so it can be used for reading RPC map projection models and also
     ///   so it does not get duplicated in derived RPC sessions.
@@ -28,6 +28,7 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/AffineEpipolar.h>
 #include <asp/Camera/LinescanASTERModel.h>
+#include <asp/Camera/RayGridCameraModel.h>
 #include <asp/Sessions/StereoSessionASTER.h>
 
 
@@ -53,6 +54,8 @@ namespace asp {
 
     boost::shared_ptr<vw::camera::CameraModel> base_cam1, base_cam2;
     this->camera_models(base_cam1, base_cam2);
+    base_cam1 = unwrap_ray_grid(base_cam1);
+    base_cam2 = unwrap_ray_grid(base_cam2);
 
     // Strip the adjustments
     boost::shared_ptr<vw::camera::CameraModel> unadj_cam1, unadj_cam2;
@@ -46,6 +46,7 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/AffineEpipolar.h>
 #include <asp/Core/PhotometricOutlier.h>
+#include <asp/Camera/RayGridCameraModel.h>
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/IsisIO/DiskImageResourceIsis.h>
 #include <asp/IsisIO/Equation.h>
@@ -208,7 +209,7 @@ void write_preprocessed_isis_image( vw::cartography::GdalWriteOptions const& opt
 vw::cartography::Datum StereoSessionIsis::get_datum(const vw::camera::CameraModel* cam, bool use_sphere_for_isis) const
 {
   const IsisCameraModel * isis_cam
-    = dynamic_cast<const IsisCameraModel*>(vw::camera::unadjusted_model(cam));
+    = dynamic_cast<const IsisCameraModel*>(vw::camera::unadjusted_model(unwrap_ray_grid(cam)));
   VW_ASSERT(isis_cam != NULL, ArgumentErr() << "StereoSessionISIS: Invalid left camera.\n");
   Vector3 radii = isis_cam->target_radii();
   double radius1 = (radii[0] + radii[1]) / 2;
@@ -59,7 +59,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
   int    report_level, min_matches, max_iterations, overlap_limit;
   bool   save_iteration, create_pinhole, approximate_pinhole_intrinsics,
          fix_gcp_xyz, solve_intrinsics,
-         disable_tri_filtering, ip_normalize_tiles, ip_debug_images;
+         disable_tri_filtering, ip_normalize_tiles, ip_debug_images, dg_line_table;
   std::string datum_str, camera_position_file, initial_transform_file,
     csv_format_str, csv_proj4_str, reference_terrain, disparity_list, intrinsics_to_float_str,
     heights_from_dem;
@@ -74,7 +74,10 @@ struct Options : public vw::cartography::GdalWriteOptions {
   int    ip_detect_method, num_scales;
   double epipolar_threshold; // Max distance from epipolar line to search for IP matches.
   double ip_inlier_factor, ip_uniqueness_thresh, nodata_value, max_disp_error;
+  std::string ip_cache_dir;
+  double ip_cache_max_size;
   bool   skip_rough_homography, individually_normalize, use_llh_error, save_cnet_as_csv;
+  bool   linearized_jacobians;
   vw::Vector2  elevation_limit;     // Expected range of elevation to limit results to.
   vw::BBox2    lon_lat_limit;       // Limit the triangulated interest points to this lonlat range
   std::set<std::string> intrinsics_to_float;
@@ -96,8 +99,10 @@ struct Options : public vw::cartography::GdalWriteOptions {
              num_ba_passes(1), max_num_reference_points(-1),
              datum(cartography::Datum(UNSPECIFIED_DATUM, "User Specified Spheroid",
                                       "Reference Meridian", 1, 1, 0)),
-             ip_detect_method(0), num_scales(-1), skip_rough_homography(false),
-             individually_normalize(false), use_llh_error(false){}
+             ip_detect_method(0), num_scales(-1), ip_cache_max_size(0),
+             skip_rough_homography(false),
+             individually_normalize(false), use_llh_error(false),
+             linearized_jacobians(false){}
 };
 
 // This is for the BundleAdjustmentModel class where the camera parameters
@@ -194,12 +199,17 @@ void add_residual_block(ModelT & ba_model,
                         size_t icam, size_t ipt,
                         double * camera, double * point, double * scaled_intrinsics,
                         std::set<std::string> const& intrinsics_to_float,
+                        bool linearized_jacobians,
                         ceres::LossFunction* loss_function,
                         ceres::Problem & problem){
 
-  ceres::CostFunction* cost_function =
-    BaReprojectionError<ModelT>::Create(observation, pixel_sigma,
-                                        &ba_model, icam, ipt);
+  ceres::CostFunction* cost_function;
+  if (linearized_jacobians)
+    cost_function = BaLinearizedReprojectionError::Create(observation, pixel_sigma,
+                                                          &ba_model, icam, ipt);
+  else
+    cost_function = BaReprojectionError<ModelT>::Create(observation, pixel_sigma,
+                                                        &ba_model, icam, ipt);
   problem.AddResidualBlock(cost_function, loss_function, camera, point);
 }
 
@@ -211,8 +221,11 @@ void add_residual_block<BAPinholeModel>
                    size_t icam, size_t ipt,
                    double * camera, double * point, double * scaled_intrinsics,
                    std::set<std::string> const& intrinsics_to_float,
+                   bool linearized_jacobians,
                    ceres::LossFunction* loss_function,
                    ceres::Problem & problem){
+  // Note: linearized_jacobians is not used, as that is only implemented
+  // for BundleAdjustmentModel.
   // If the intrinsics are constant use the default method above
   if (ba_model.are_intrinsics_constant()) {
     ceres::CostFunction* cost_function =
@@ -941,7 +954,7 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
       // Call function to select the appropriate Ceres residual block to add.
       add_residual_block(ba_model, observation, pixel_sigma, icam, ipt,
                          camera, point, scaled_intrinsics_ptr, opt.intrinsics_to_float,
-                         loss_function, problem);
+                         opt.linearized_jacobians, loss_function, problem);
 
       // Fix this camera if requested
       if (opt.fixed_cameras_indices.find(icam) != opt.fixed_cameras_indices.end()) 
@@ -1105,6 +1118,7 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
     double mean_longitude;
     bool verbose = true;
     asp::DoubleMatrix data;
+    std::mt19937 generator(0);
     
     // Read the reference terrain
     vw_out() << "Loading at most " << opt.max_num_reference_points << " points from "
@@ -1112,13 +1126,13 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
     if (file_type == "DEM") 
       asp::load_dem(opt.reference_terrain,  
                opt.max_num_reference_points, lonlat_box,  
-               calc_shift, shift, verbose, data);
+               calc_shift, shift, verbose, generator, data);
       
     else if (file_type == "CSV")
       asp::load_csv(opt.reference_terrain,  opt.max_num_reference_points,
                     lonlat_box, calc_shift, shift, geo,  
                     csv_conv, is_lola_rdr_format, mean_longitude, verbose,  
-                    data);
+                    generator, data);
     else
       vw_throw( ArgumentErr() << "Unsupported file: " << opt.reference_terrain << " of type" <<
     file_type << ".\n");
@@ -2347,6 +2361,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "Skip tri_ip filtering.")
     ("ip-debug-images",     po::value(&opt.ip_debug_images)->default_value(false)->implicit_value(true),
                     "Write debug images to disk when detecting and matching interest points.")
+    ("ip-cache-dir",        po::value(&opt.ip_cache_dir)->default_value(""),
+     "Save detected interest points and matches in this directory, keyed by the image contents and the detection settings, and reuse them in later runs.")
+    ("ip-cache-max-size",   po::value(&opt.ip_cache_max_size)->default_value(2048),
+     "When the interest point cache grows beyond this size (in MB), delete the least recently used entries. Set to 0 for no limit.")
+    ("dg-line-table",       po::bool_switch(&opt.dg_line_table)->default_value(false)->implicit_value(true),
+     "For Digital Globe cameras, tabulate the camera position, velocity, and orientation once per image line, and interpolate in this table rather than in the satellite ephemeris and attitude. This is faster, with very small differences in the results.")
     ("elevation-limit",        po::value(&opt.elevation_limit)->default_value(Vector2(0,0), "auto"),
      "Limit on expected elevation range: Specify as two values: min max.")
     // Note that we count later on the default for lon_lat_limit being BBox2(0,0,0,0).
@@ -2362,6 +2382,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                         "Individually normalize the input images instead of using common values.")
     ("max-iterations",   po::value(&opt.max_iterations)->default_value(1000),
                          "Set the maximum number of iterations.")
+    ("linearized-jacobians", po::bool_switch(&opt.linearized_jacobians)->default_value(false)->implicit_value(true),
+     "Find the Jacobians of the reprojection error by the chain rule, differentiating numerically only the camera projection. This is much faster for linescan and ISIS cameras. Not used with pinhole cameras when floating the intrinsics.")
     ("parameter-tolerance",   po::value(&opt.parameter_tolerance)->default_value(1e-8),
      "Making this smaller will result in more iterations.")
     ("overlap-limit",    po::value(&opt.overlap_limit)->default_value(0),
@@ -2515,7 +2537,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   asp::stereo_settings().disable_tri_filtering   = opt.disable_tri_filtering;
   asp::stereo_settings().ip_edge_buffer_percent  = opt.ip_edge_buffer_percent;
   asp::stereo_settings().ip_debug_images         = opt.ip_debug_images;
+  asp::stereo_settings().ip_cache_dir            = opt.ip_cache_dir;
+  asp::stereo_settings().ip_cache_max_size       = opt.ip_cache_max_size;
   asp::stereo_settings().ip_normalize_tiles      = opt.ip_normalize_tiles;
+  asp::stereo_settings().dg_line_table           = opt.dg_line_table;
 
   // Ensure good order
   if ( asp::stereo_settings().lon_lat_limit != BBox2(0,0,0,0) ) {
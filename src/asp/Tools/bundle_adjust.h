@@ -121,6 +121,9 @@ public:
   unsigned num_points ()            const { return m_point_vec.size();       }
   unsigned num_pixel_observations() const { return m_num_pixel_observations; }
 
+  /// The camera model for the j'th image, before adjustments are applied.
+  cam_ptr_t base_camera(int j) const { return m_cameras[j]; }
+
 
   /// Copy both extrinsics and intrinsics into a presized parameter vector.
   void concat_extrinsics_intrinsics(const double* const extrinsics,
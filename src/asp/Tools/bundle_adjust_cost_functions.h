@@ -44,6 +44,7 @@
 
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
+#include <ceres/rotation.h>
 
 #if defined(__GNUC__) || defined(__GNUG__)
 #if LOCAL_GCC_VERSION >= 40600
@@ -152,6 +153,158 @@ struct BaReprojectionError {
   size_t m_icam, m_ipt;
 };
 
+/// A ceres cost function for BundleAdjustmentModel, with the same
+/// residual as BaReprojectionError, but with Jacobians found by the
+/// chain rule rather than numerically differentiating the whole
+/// adjusted projection over all 9 parameters.
+/// - The adjusted camera sends a point X to the base camera's
+///   point_to_pixel(y), with y = R^T*(X - C - T) + C, where T and R are
+///   the translation and rotation adjustments and C is the rotation
+///   center. The derivatives of y are found with ceres Jets, and the
+///   only numerical part is the 2x3 Jacobian of the base camera at y.
+/// - That takes 6 projections, plus one for the residual itself,
+///   instead of 19. This matters for linescan and ISIS cameras, where
+///   each projection is an iterative solve.
+struct BaLinearizedReprojectionError: public ceres::SizedCostFunction<2, 6, 3> {
+  BaLinearizedReprojectionError(Vector2 const& observation, Vector2 const& pixel_sigma,
+                                BundleAdjustmentModel * const ba_model, size_t icam, size_t ipt):
+    m_observation(observation),
+    m_pixel_sigma(pixel_sigma),
+    m_ba_model(ba_model),
+    m_icam(icam), m_ipt(ipt){
+    // This is how AdjustedCameraModel picks its rotation center
+    m_rotation_center = m_ba_model->base_camera(m_icam)->camera_center(Vector2());
+  }
+
+  virtual bool Evaluate(double const* const* parameters,
+                        double* residuals,
+                        double** jacobians) const {
+
+    const double * camera = parameters[0];
+    const double * point  = parameters[1];
+
+    try{
+
+      size_t num_cameras = m_ba_model->num_cameras();
+      size_t num_points  = m_ba_model->num_points();
+      VW_ASSERT(m_icam < num_cameras, ArgumentErr() << "Out of bounds in the number of cameras.");
+      VW_ASSERT(m_ipt  < num_points , ArgumentErr() << "Out of bounds in the number of points." );
+
+      // The residual comes from the adjusted camera, exactly as in BaReprojectionError
+      BundleAdjustmentModel::camera_intr_vector_t cam_intr_vec;
+      double * intrinsics = NULL; // part of the interface
+      m_ba_model->concat_extrinsics_intrinsics(camera, intrinsics, cam_intr_vec);
+      BundleAdjustmentModel::point_vector_t point_vec;
+      for (size_t p = 0; p < point_vec.size(); p++)
+        point_vec[p] = point[p];
+
+      Vector2 prediction = m_ba_model->cam_pixel(m_ipt, m_icam, cam_intr_vec, point_vec);
+      residuals[0] = (prediction[0] - m_observation[0])/m_pixel_sigma[0];
+      residuals[1] = (prediction[1] - m_observation[1])/m_pixel_sigma[1];
+
+      if (jacobians == NULL)
+        return true;
+
+      // The inverse rotation is the rotation by the negated axis-angle vector
+      double neg_angle_axis[3], offset_pt[3], base_pt[3];
+      for (int k = 0; k < 3; k++){
+        neg_angle_axis[k] = -camera[3+k];
+        offset_pt[k]      = point[k] - m_rotation_center[k] - camera[k];
+      }
+
+      // Columns of R^T, which is the derivative of y with respect to X
+      double rot_inv[3][3]; // rot_inv[k] is column k
+      for (int k = 0; k < 3; k++){
+        double unit[3] = {0.0, 0.0, 0.0};
+        unit[k] = 1.0;
+        ceres::AngleAxisRotatePoint(neg_angle_axis, unit, rot_inv[k]);
+      }
+
+      // Derivative of y with respect to the axis-angle vector
+      typedef ceres::Jet<double, 3> JetT;
+      JetT jet_angle_axis[3], jet_offset_pt[3], jet_rotated[3];
+      for (int k = 0; k < 3; k++){
+        jet_angle_axis[k] = JetT(neg_angle_axis[k], k);
+        jet_angle_axis[k].v[k] = -1.0; // since the angle is negated
+        jet_offset_pt[k] = JetT(offset_pt[k]);
+      }
+      ceres::AngleAxisRotatePoint(jet_angle_axis, jet_offset_pt, jet_rotated);
+      for (int k = 0; k < 3; k++)
+        base_pt[k] = jet_rotated[k].a + m_rotation_center[k];
+
+      // Jacobian of the base camera at y, by central differences, with
+      // the same relative step as ceres uses by default.
+      boost::shared_ptr<CameraModel> cam = m_ba_model->base_camera(m_icam);
+      double cam_jac[2][3];
+      for (int k = 0; k < 3; k++){
+        double step = 1e-6*std::max(std::abs(base_pt[k]), 1.0);
+        Vector3 plus (base_pt[0], base_pt[1], base_pt[2]);
+        Vector3 minus(base_pt[0], base_pt[1], base_pt[2]);
+        plus[k]  += step;
+        minus[k] -= step;
+        Vector2 diff = (cam->point_to_pixel(plus) - cam->point_to_pixel(minus))/(2.0*step);
+        cam_jac[0][k] = diff[0];
+        cam_jac[1][k] = diff[1];
+      }
+
+      // Chain rule. The jacobians are row-major, one row per residual.
+      for (int r = 0; r < 2; r++){
+        for (int k = 0; k < 3; k++){
+          double d_point = 0, d_rot = 0;
+          for (int m = 0; m < 3; m++){
+            d_point += cam_jac[r][m]*rot_inv[k][m];
+            d_rot   += cam_jac[r][m]*jet_rotated[m].v[k];
+          }
+          d_point /= m_pixel_sigma[r];
+          d_rot   /= m_pixel_sigma[r];
+          if (jacobians[0] != NULL){
+            jacobians[0][6*r + k    ] = -d_point; // translation
+            jacobians[0][6*r + k + 3] =  d_rot;   // rotation
+          }
+          if (jacobians[1] != NULL)
+            jacobians[1][3*r + k] = d_point;
+        }
+      }
+
+    } catch (std::exception const& e) {
+      // Failed to compute residuals
+
+      Mutex::Lock lock( g_ba_mutex );
+      g_ba_num_errors++;
+      if (g_ba_num_errors < 100) {
+        vw_out(ErrorMessage) << e.what() << std::endl;
+      }else if (g_ba_num_errors == 100) {
+        vw_out() << "Will print no more error messages about "
+                 << "failing to compute residuals.\n";
+      }
+
+      residuals[0] = 1e+20;
+      residuals[1] = 1e+20;
+      return false;
+    }
+
+    return true;
+  }
+
+  // Factory to hide the construction of the CostFunction object from
+  // the client code.
+  static ceres::CostFunction* Create(Vector2 const& observation,
+                                     Vector2 const& pixel_sigma,
+                                     BundleAdjustmentModel * const ba_model,
+                                     size_t icam, // camera index
+                                     size_t ipt // point index
+                                     ){
+    return new BaLinearizedReprojectionError(observation, pixel_sigma,
+                                             ba_model, icam, ipt);
+  }
+
+  Vector2 m_observation;
+  Vector2 m_pixel_sigma;
+  BundleAdjustmentModel * const m_ba_model;
+  size_t m_icam, m_ipt;
+  Vector3 m_rotation_center;
+};
+
 /// A ceres cost function. Here we float a pinhole camera's intrinsic
 /// and extrinsic parameters. The result is the residual, the
 /// difference in the observation and the projection of the point into
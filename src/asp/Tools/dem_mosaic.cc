@@ -46,8 +46,12 @@
 #include <vw/Image/Algorithms2.h>
 #include <vw/Image/Filter.h>
 #include <vw/Cartography/GeoTransform.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/BBoxRTree.h>
+#include <asp/Core/InterestPointCache.h>
+#include <asp/Tools/dem_mosaic.h>
 
 
 #include <boost/math/special_functions/fpclassify.hpp>
@@ -69,102 +73,6 @@ typedef float RealT;
 // This is used for various tolerances
 double g_tol = 1e-6;
 
-// TODO: Fold modifications into VW!
-template<class ImageT>
-void centerline_weights2(ImageT const& img, ImageView<double> & weights,
-                         double hole_fill_value=0, double border_fill_value=-1, 
-                         BBox2i roi=BBox2i()){
-
-  int numRows = img.rows();
-  int numCols = img.cols();
-
-  // Arrays to be returned out of this function
-  std::vector<double> hCenterLine  (numRows, 0);
-  std::vector<double> hMaxDistArray(numRows, 0);
-  std::vector<double> vCenterLine  (numCols, 0);
-  std::vector<double> vMaxDistArray(numCols, 0);
-
-  std::vector<int> minValInRow(numRows, 0);
-  std::vector<int> maxValInRow(numRows, 0);
-  std::vector<int> minValInCol(numCols, 0);
-  std::vector<int> maxValInCol(numCols, 0);
-
-  for (int k = 0; k < numRows; k++){
-    minValInRow[k] = numCols;
-    maxValInRow[k] = 0;
-  }
-  for (int col = 0; col < numCols; col++){
-    minValInCol[col] = numRows;
-    maxValInCol[col] = 0;
-  }
-
-  // Note that we do just a single pass through the image to compute
-  // both the horizontal and vertical min/max values.
-  for (int row = 0 ; row < numRows; row++) {
-    for (int col = 0; col < numCols; col++) {
-
-      if ( !is_valid(img(col,row)) ) continue;
-      
-      // Record the first and last valid column in each row
-      if (col < minValInRow[row]) minValInRow[row] = col;
-      if (col > maxValInRow[row]) maxValInRow[row] = col;
-      
-      // Record the first and last valid row in each column
-      if (row < minValInCol[col]) minValInCol[col] = row;
-      if (row > maxValInCol[col]) maxValInCol[col] = row;   
-    }
-  }
-  
-  // For each row, record central column and the column width
-  for (int row = 0; row < numRows; row++) {
-    hCenterLine   [row] = (minValInRow[row] + maxValInRow[row])/2.0;
-    hMaxDistArray [row] =  maxValInRow[row] - minValInRow[row];
-    if (hMaxDistArray[row] < 0){
-      hMaxDistArray[row]=0;
-    }
-  }
-
-  // For each row, record central column and the column width
-  for (int col = 0 ; col < numCols; col++) {
-    vCenterLine   [col] = (minValInCol[col] + maxValInCol[col])/2.0;
-    vMaxDistArray [col] =  maxValInCol[col] - minValInCol[col];
-    if (vMaxDistArray[col] < 0){
-      vMaxDistArray[col]=0;
-    }
-  }
-
-  BBox2i output_bbox = roi;
-  if (roi.empty())
-    output_bbox = bounding_box(img);
-
-  // Compute the weighting for each pixel in the image
-  weights.set_size(output_bbox.width(), output_bbox.height());
-  fill(weights, 0);
-  
-  for (int row = output_bbox.min().y(); row < output_bbox.max().y(); row++){
-    for (int col = output_bbox.min().x(); col < output_bbox.max().x(); col++){
-      bool inner_row = ((row >= minValInCol[col]) && (row <= maxValInCol[col]));
-      bool inner_col = ((col >= minValInRow[row]) && (col <= maxValInRow[row]));
-      bool inner_pixel = inner_row && inner_col;
-      Vector2 pix(col, row);
-      double new_weight = 0; // Invalid pixels usually get zero weight
-      if (is_valid(img(col,row))) {
-        double weight_h = compute_line_weights(pix, true,  hCenterLine, hMaxDistArray);
-        double weight_v = compute_line_weights(pix, false, vCenterLine, vMaxDistArray);
-        new_weight = weight_h*weight_v;
-      }
-      else { // Invalid pixel
-        if (inner_pixel)
-          new_weight = hole_fill_value;
-        else // Border pixel
-          new_weight = border_fill_value;
-      }
-      weights(col-output_bbox.min().x(), row-output_bbox.min().y()) = new_weight;
-      
-    }
-  }
-
-} // End function weights_from_centerline
 
 
 
@@ -179,31 +87,6 @@ double S_shape(double x, double M, double L){
   return 0.5*M*( 1 + boost::math::erf (0.5*sqrt(M_PI) * (2*x*L/M - L) ) );
 }
 
-// Function for highlighting spots of data
-template<class PixelT>
-class NotNoDataFunctor {
-  typedef typename CompoundChannelType<PixelT>::type channel_type;
-  channel_type m_nodata;
-  typedef ChannelRange<channel_type> range_type;
-public:
-  NotNoDataFunctor( channel_type nodata ) : m_nodata(nodata) {}
-
-  template <class Args> struct result {
-    typedef channel_type type;
-  };
-
-  inline channel_type operator()( channel_type const& val ) const {
-    return (val != m_nodata && !isnan(val))? range_type::max() : range_type::min();
-  }
-};
-
-template <class ImageT, class NoDataT>
-UnaryPerPixelView<ImageT,UnaryCompoundFunctor<NotNoDataFunctor<typename ImageT::pixel_type>, typename ImageT::pixel_type>  >
-inline notnodata( ImageViewBase<ImageT> const& image, NoDataT nodata ) {
-  typedef UnaryCompoundFunctor<NotNoDataFunctor<typename ImageT::pixel_type>, typename ImageT::pixel_type> func_type;
-  func_type func( nodata );
-  return UnaryPerPixelView<ImageT,func_type>( image.impl(), func );
-}
 
 // Set nodata pixels to 0 and valid data pixels to something big.
 template<class PixelT>
@@ -216,51 +99,6 @@ struct BigOrZero: public ReturnFixedType<PixelT> {
   }
 };
 
-void blur_weights(ImageView<double> & weights, double sigma){
-
-  if (sigma <= 0)
-    return;
-
-  // Blur the weights. To try to make the weights not drop much at the
-  // boundary, expand the weights with zero, blur, crop back to the
-  // original region.
-
-  // It is highly important to note that blurring can increase the weights
-  // at the boundary, even with the extension done above. Erosion before
-  // blurring does not help with that, as for weights with complicated
-  // boundary erosion can wipe things in a non-uniform way leaving
-  // huge holes. To get smooth weights, if really desired one should
-  // use the weights-exponent option.
-
-  int half_kernel = vw::compute_kernel_size(sigma)/2;
-  int extra = half_kernel + 1; // to guarantee we stay zero at boundary
-
-  int cols = weights.cols(), rows = weights.rows();
-
-  ImageView<double> extra_wts(cols + 2*extra, rows + 2*extra);
-  fill(extra_wts, 0);
-  for (int col = 0; col < cols; col++) {
-    for (int row = 0; row < rows; row++) {
-      if (weights(col,row) > 0)
-        extra_wts(col + extra, row + extra) = weights(col, row);
-      else
-        extra_wts(col + extra, row + extra) = 0;
-    }
-  }
-
-  ImageView<double> blurred_wts = gaussian_filter(extra_wts, sigma);
-
-  // Copy back.  The weights must not grow. In particular, where the
-  // original weights were zero, the new weights must also be zero, as
-  // at those points there is no DEM data.
-  for (int col = 0; col < cols; col++) {
-    for (int row = 0; row < rows; row++) {
-      if (weights(col, row) > 0) {
-        weights(col, row) = blurred_wts(col + extra, row + extra);
-      }
-      //weights(col, row) = std::min(weights(col, row), blurred_wts(col + extra, row + extra));
-    }
-  }
 
 }
 
@@ -317,27 +155,29 @@ std::string processed_proj4(std::string const& srs){
   return georef.overall_proj4_str();
 }
 
-struct Options : vw::cartography::GdalWriteOptions {
-  string dem_list_file, out_prefix, target_srs_string, output_type, tile_list_str, this_dem_as_reference;
+struct Options : vw::cartography::GdalWriteOptions, asp::DemWeightOptions {
+  string dem_list_file, out_prefix, target_srs_string, output_type, tile_list_str, this_dem_as_reference,
+    footprint_index, weights_cache_dir;
   vector<string> dem_files;
   double tr, geo_tile_size;
   bool   has_out_nodata;
   double out_nodata_value;
-  int    tile_size, tile_index, erode_len, priority_blending_len, extra_crop_len, hole_fill_len, block_size, save_dem_weight;
-  double weights_exp, weights_blur_sigma, dem_blur_sigma;
+  int    tile_size, tile_index, extra_crop_len, hole_fill_len, block_size, save_dem_weight;
+  int    approx_grid_spacing;
+  double dem_blur_sigma;
+  double approx_pixel_tol;
   double nodata_threshold;
-  bool   first, last, min, max, block_max, mean, stddev, median, nmad, count, save_index_map, use_centerline_weights, first_dem_as_reference, propagate_nodata;
+  bool   first, last, min, max, block_max, mean, stddev, median, nmad, count, save_index_map, first_dem_as_reference, propagate_nodata;
   std::set<int> tile_list;
   BBox2 projwin;
   Options(): tr(0), geo_tile_size(0), has_out_nodata(false), tile_index(-1),
-             erode_len(0), priority_blending_len(0), extra_crop_len(0),
-             hole_fill_len(0), block_size(0), save_dem_weight(-1), 
-             weights_exp(0), weights_blur_sigma(0.0), dem_blur_sigma(0.0),
+             extra_crop_len(0), hole_fill_len(0), block_size(0), save_dem_weight(-1),
+             approx_grid_spacing(0), dem_blur_sigma(0.0), approx_pixel_tol(0.01),
              nodata_threshold(std::numeric_limits<double>::quiet_NaN()),
              first(false), last(false), min(false), max(false), block_max(false),
              mean(false), stddev(false), median(false), nmad(false),
              count(false), save_index_map(false),
-             use_centerline_weights(false), first_dem_as_reference(false), projwin(BBox2()) {}
+             first_dem_as_reference(false), projwin(BBox2()) {}
 };
 
 /// Return the number of no-blending options selected.
@@ -365,32 +205,351 @@ std::string tile_suffix(Options const& opt){
   return ans;
 }
 
+/// If the nodata_threshold is specified, all values no more than this
+/// will be invalidated. Return the no-data value to use.
+double apply_nodata_threshold(Options const& opt, double nodata_value,
+                              ImageView< PixelGrayA<double> > & dem){
+  if (boost::math::isnan(opt.nodata_threshold))
+    return nodata_value;
+
+  nodata_value = opt.nodata_threshold;
+  for (int col = 0; col < dem.cols(); col++) {
+    for (int row = 0; row < dem.rows(); row++) {
+      if (dem(col, row)[0] <= nodata_value) {
+        dem(col, row)[0] = nodata_value;
+      }
+    }
+  }
+  return nodata_value;
+}
+
+/// The weights of a whole input DEM, computed a block at a time. Each
+/// block is computed from a region expanded by the weights halo, so
+/// the result does not depend on the block boundaries, and is the same
+/// as the weights computed for a mosaic block, which are read with
+/// the same halo. Centerline weights are not supported, as those depend
+/// on the extent of the region they are computed on. The weights are
+/// kept in double precision, as when not cached.
+class DemWeightsView: public ImageViewBase<DemWeightsView>{
+  DiskImageView<RealT> m_dem;
+  Options       const& m_opt; // alias
+  int                  m_bias, m_halo;
+  double               m_nodata_value;
+
+public:
+  DemWeightsView(std::string const& dem_file, Options const& opt, int bias,
+                 double nodata_value):
+    m_dem(dem_file), m_opt(opt), m_bias(bias), m_nodata_value(nodata_value) {
+    m_halo = asp::dem_weights_halo(opt, bias);
+  }
+
+  // Boilerplate
+  typedef double     pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<DemWeightsView> pixel_accessor;
+  inline int cols  () const { return m_dem.cols(); }
+  inline int rows  () const { return m_dem.rows(); }
+  inline int planes() const { return 1; }
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double/*i*/, double/*j*/, int/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "DemWeightsView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    BBox2i big_box = bbox;
+    big_box.expand(m_halo);
+    big_box.crop(bounding_box(m_dem));
+
+    ImageViewRef<double> disk_dem = pixel_cast<double>(m_dem);
+    ImageView< PixelGrayA<double> > dem = crop(disk_dem, big_box);
+    double nodata_value = apply_nodata_threshold(m_opt, m_nodata_value, dem);
+
+    ImageView<double> local_wts;
+    asp::compute_dem_weights(m_opt, m_bias, nodata_value, dem, local_wts);
+
+    ImageView<pixel_type> tile = crop(local_wts, bbox - big_box.min());
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+}; // End class DemWeightsView
+
+/// Write the weights of one DEM. Many of these run at the same time.
+class DemWeightsTask: public Task, private boost::noncopyable {
+  std::string    m_dem_file, m_weight_file;
+  Options const& m_opt; // alias
+  int            m_bias;
+  double         m_nodata_value;
+  std::string  & m_error; // alias
+
+public:
+  DemWeightsTask(std::string const& dem_file, std::string const& weight_file,
+                 Options const& opt, int bias, double nodata_value, std::string & error):
+    m_dem_file(dem_file), m_weight_file(weight_file), m_opt(opt), m_bias(bias),
+    m_nodata_value(nodata_value), m_error(error) {}
+
+  void operator()() {
+    // Write under a temporary name and rename, so that other processes
+    // using the same directory never see a partial file.
+    std::string temp = fs::unique_path(m_weight_file + ".%%%%-%%%%.tmp.tif").string();
+    try {
+      bool has_georef = true, has_nodata = false;
+      GeoReference georef = read_georef(m_dem_file);
+      write_gdal_image(temp, DemWeightsView(m_dem_file, m_opt, m_bias, m_nodata_value),
+                       has_georef, georef, has_nodata, 0, m_opt,
+                       ProgressCallback::dummy_instance());
+      fs::rename(temp, m_weight_file);
+    }catch(std::exception const& e){
+      boost::system::error_code ec;
+      fs::remove(temp, ec);
+      m_error = e.what();
+    }
+  }
+};
+
+/// Find the weights of the given DEMs in the directory set by
+/// --weights-cache-dir, or compute them there if missing. The file
+/// name is a hash of the DEM file and of the options the weights
+/// depend on. Return the weight file of each DEM.
+std::vector<std::string> prepare_weight_files(Options const& opt, int bias,
+                                              std::vector<std::string> const& dem_files,
+                                              std::vector<double> const& nodata_values) {
+
+  fs::create_directories(opt.weights_cache_dir);
+
+  std::vector<std::string> weight_files(dem_files.size());
+  std::vector<int> missing;
+  for (size_t dem_iter = 0; dem_iter < dem_files.size(); dem_iter++) {
+    std::string const& file = dem_files[dem_iter];
+    asp::CacheKeyHasher hasher;
+    hasher.add(fs::absolute(file).string());
+    hasher.add(vw::uint64(fs::file_size(file)));
+    hasher.add(vw::int64(fs::last_write_time(file)));
+    hasher.add(nodata_values[dem_iter]);
+    hasher.add(opt.nodata_threshold);
+    hasher.add(bias);
+    hasher.add(opt.erode_len);
+    hasher.add(opt.weights_blur_sigma);
+    hasher.add(opt.weights_exp);
+    weight_files[dem_iter] = (fs::path(opt.weights_cache_dir) /
+                              (hasher.hex() + "-weights.tif")).string();
+    if (!fs::exists(weight_files[dem_iter]))
+      missing.push_back(dem_iter);
+  }
+
+  vw_out() << "Found the weights of " << dem_files.size() - missing.size()
+           << " DEM(s) in " << opt.weights_cache_dir << ", computing the weights of "
+           << missing.size() << " DEM(s).\n";
+  if (missing.empty())
+    return weight_files;
+
+  std::vector<std::string> errors(missing.size());
+  FifoWorkQueue queue(opt.num_threads);
+  for (size_t i = 0; i < missing.size(); i++) {
+    int dem_iter = missing[i];
+    boost::shared_ptr<DemWeightsTask>
+      task(new DemWeightsTask(dem_files[dem_iter], weight_files[dem_iter], opt, bias,
+                              nodata_values[dem_iter], errors[i]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+  for (size_t i = 0; i < errors.size(); i++) {
+    if (errors[i] != "")
+      vw_throw(ArgumentErr() << "Failed to compute the weights of "
+               << dem_files[missing[i]] << ": " << errors[i] << "\n");
+  }
+
+  return weight_files;
+}
+
+/// The map from the pixels of the output mosaic to the pixels of an
+/// input DEM. When the DEM and the mosaic have the same projection,
+/// this map is affine, and it is found once per DEM rather than
+/// going through the GeoTransform for each pixel.
+struct DemPixelMap {
+  bool    is_affine;
+  Vector2 origin;     // The DEM pixel at mosaic pixel (0, 0)
+  Vector2 dcol, drow; // Its change per mosaic column and row
+  DemPixelMap(): is_affine(false) {}
+};
+
+DemPixelMap find_dem_pixel_map(GeoReference const& georef, GeoReference const& out_georef,
+                               BBox2i const& dem_pixel_box, int out_cols, int out_rows) {
+
+  DemPixelMap pixel_map;
+
+  // Same logic as when finding the DEM bounding boxes. With longlat
+  // the GeoTransform may need to shift by 360 degrees.
+  bool has_lonat = (georef.proj4_str().find("+proj=longlat") != std::string::npos ||
+                    out_georef.proj4_str().find("+proj=longlat") != std::string::npos );
+  if (has_lonat || georef.overall_proj4_str() != out_georef.overall_proj4_str())
+    return pixel_map;
+
+  // Sample the map at far away pixels, so that numerical error is not
+  // magnified when extrapolating.
+  out_cols = std::max(out_cols, 1);
+  out_rows = std::max(out_rows, 1);
+  GeoTransform geotrans(georef, out_georef, dem_pixel_box, BBox2i(0, 0, out_cols, out_rows));
+  pixel_map.origin = geotrans.reverse(Vector2(0, 0));
+  pixel_map.dcol   = (geotrans.reverse(Vector2(out_cols, 0)) - pixel_map.origin) / double(out_cols);
+  pixel_map.drow   = (geotrans.reverse(Vector2(0, out_rows)) - pixel_map.origin) / double(out_rows);
+
+  // Sanity check at the far corner and the center
+  Vector2 samples[] = {Vector2(out_cols, out_rows), Vector2(out_cols, out_rows)/2.0};
+  for (int s = 0; s < 2; s++) {
+    Vector2 affine_pix = pixel_map.origin + samples[s][0]*pixel_map.dcol + samples[s][1]*pixel_map.drow;
+    if (norm_2(affine_pix - geotrans.reverse(samples[s])) > g_tol)
+      return pixel_map;
+  }
+
+  pixel_map.is_affine = true;
+  return pixel_map;
+}
+
+/// Find the input DEM pixels for the output pixels of a tile, a row
+/// at a time. For an affine map this takes a multiply-add per pixel.
+/// Otherwise, with a positive grid spacing, the GeoTransform is
+/// evaluated only at the nodes of a grid over the tile, and
+/// interpolated bilinearly in between, except in the grid cells where
+/// the interpolated pixel at the cell center is off by more than the
+/// tolerance. With no grid, each pixel goes through the GeoTransform.
+class TileDemPixels {
+public:
+  TileDemPixels(GeoTransform const& geotrans, DemPixelMap const& pixel_map,
+                BBox2i const& bbox, int grid_spacing, double pixel_tol):
+    m_geotrans(geotrans), m_pixel_map(pixel_map), m_bbox(bbox),
+    m_spacing(grid_spacing), m_num_x(0), m_num_y(0) {
+
+    if (m_pixel_map.is_affine || m_bbox.width() < 2 || m_bbox.height() < 2)
+      m_spacing = 0;
+    if (m_spacing <= 0)
+      return;
+
+    // The last node is at the last pixel, so the last cell may be smaller
+    m_num_x = (m_bbox.width()  - 2)/m_spacing + 2;
+    m_num_y = (m_bbox.height() - 2)/m_spacing + 2;
+    for (int i = 0; i < m_num_x; i++)
+      m_node_x.push_back(std::min(i*m_spacing, m_bbox.width() - 1));
+    for (int j = 0; j < m_num_y; j++)
+      m_node_y.push_back(std::min(j*m_spacing, m_bbox.height() - 1));
+
+    m_nodes.resize(m_num_x*m_num_y);
+    for (int j = 0; j < m_num_y; j++) {
+      for (int i = 0; i < m_num_x; i++)
+        m_nodes[j*m_num_x + i] = m_geotrans.reverse(out_pix(m_node_x[i], m_node_y[j]));
+    }
+
+    m_use_exact.resize((m_num_x - 1)*(m_num_y - 1), 0);
+    for (int j = 0; j < m_num_y - 1; j++) {
+      for (int i = 0; i < m_num_x - 1; i++) {
+        Vector2 center = 0.5*(Vector2(m_node_x[i], m_node_y[j]) +
+                              Vector2(m_node_x[i+1], m_node_y[j+1]));
+        Vector2 exact = m_geotrans.reverse(out_pix(center[0], center[1]));
+        if (norm_2(exact - interp(i, j, 0.5, 0.5)) > pixel_tol)
+          m_use_exact[j*(m_num_x - 1) + i] = 1;
+      }
+    }
+  }
+
+  /// The input DEM pixels for the given row of the tile
+  void row(int r, std::vector<Vector2> & in_pix) const {
+
+    int width = m_bbox.width();
+    in_pix.resize(width);
+
+    if (m_pixel_map.is_affine) {
+      Vector2 start = m_pixel_map.origin + m_bbox.min().x()*m_pixel_map.dcol
+        + (m_bbox.min().y() + r)*m_pixel_map.drow;
+      for (int c = 0; c < width; c++)
+        in_pix[c] = start + c*m_pixel_map.dcol;
+      return;
+    }
+
+    if (m_spacing <= 0) {
+      for (int c = 0; c < width; c++)
+        in_pix[c] = m_geotrans.reverse(out_pix(c, r));
+      return;
+    }
+
+    int    j  = std::min(r/m_spacing, m_num_y - 2);
+    double fy = double(r - m_node_y[j])/(m_node_y[j+1] - m_node_y[j]);
+    for (int c = 0; c < width; c++) {
+      int i = std::min(c/m_spacing, m_num_x - 2);
+      if (m_use_exact[j*(m_num_x - 1) + i]) {
+        in_pix[c] = m_geotrans.reverse(out_pix(c, r));
+      }else{
+        double fx = double(c - m_node_x[i])/(m_node_x[i+1] - m_node_x[i]);
+        in_pix[c] = interp(i, j, fx, fy);
+      }
+    }
+  }
+
+private:
+
+  // The output mosaic pixel, given a pixel relative to the tile
+  Vector2 out_pix(double c, double r) const {
+    return Vector2(c + m_bbox.min().x(), r + m_bbox.min().y());
+  }
+
+  Vector2 interp(int i, int j, double fx, double fy) const {
+    Vector2 const& p00 = m_nodes[j*m_num_x + i];
+    Vector2 const& p10 = m_nodes[j*m_num_x + i + 1];
+    Vector2 const& p01 = m_nodes[(j + 1)*m_num_x + i];
+    Vector2 const& p11 = m_nodes[(j + 1)*m_num_x + i + 1];
+    return (1 - fy)*((1 - fx)*p00 + fx*p10) + fy*((1 - fx)*p01 + fx*p11);
+  }
+
+  GeoTransform const& m_geotrans;  // alias
+  DemPixelMap  const& m_pixel_map; // alias
+  BBox2i m_bbox;
+  int    m_spacing, m_num_x, m_num_y;
+  std::vector<int>     m_node_x, m_node_y; // Node positions relative to the tile
+  std::vector<Vector2> m_nodes;            // The DEM pixel at each node
+  std::vector<uint8>   m_use_exact;        // Per cell, whether to use the GeoTransform
+};
+
 /// Class that does the actual image processing work
 class DemMosaicView: public ImageViewBase<DemMosaicView>{
   int m_cols, m_rows, m_bias;
   Options                 const& m_opt;              // alias
   DiskImageManager<RealT>      & m_imgMgr;           // alias
+  DiskImageManager<double>     & m_weightMgr;        // alias, the precomputed weights, if any
+  vector<std::string>     const& m_weight_files;     // alias
   vector<GeoReference>    const& m_georefs;          // alias
   GeoReference                   m_out_georef;
   vector<double>          const& m_nodata_values;    // alias
   vector<BBox2i>          const& m_dem_pixel_bboxes; // alias
+  asp::BBoxRTree          const& m_dem_reach_tree;   // alias, where each DEM may be used
   long long int                & m_num_valid_pixels; // alias, to populate on output
   vw::Mutex                    & m_count_mutex;      // alias, a lock for m_num_valid_pixels
+  vector<DemPixelMap>            m_pixel_maps;       // from mosaic pixels to DEM pixels
 
 public:
   DemMosaicView(int cols, int rows, int bias,
                 Options                const& opt,
                 DiskImageManager<RealT>     & imgMgr,
+                DiskImageManager<double>    & weightMgr,
+                vector<std::string>    const& weight_files,
                 vector<GeoReference>   const& georefs,
                 GeoReference           const& out_georef,
                 vector<double>         const& nodata_values,
                 vector<BBox2i>         const& dem_pixel_bboxes,
+                asp::BBoxRTree         const& dem_reach_tree,
                 long long int               & num_valid_pixels,
                 vw::Mutex                   & count_mutex):
     m_cols(cols), m_rows(rows), m_bias(bias), m_opt(opt),
-    m_imgMgr(imgMgr), m_georefs(georefs),
+    m_imgMgr(imgMgr), m_weightMgr(weightMgr), m_weight_files(weight_files),
+    m_georefs(georefs),
     m_out_georef(out_georef), m_nodata_values(nodata_values),
-    m_dem_pixel_bboxes(dem_pixel_bboxes), m_num_valid_pixels(num_valid_pixels),
+    m_dem_pixel_bboxes(dem_pixel_bboxes), m_dem_reach_tree(dem_reach_tree),
+    m_num_valid_pixels(num_valid_pixels),
     m_count_mutex(count_mutex) {
 
     // How many valid pixels we will have
@@ -398,9 +557,21 @@ public:
     
     if (imgMgr.size() != georefs.size()       ||
         imgMgr.size() != nodata_values.size() ||
-        imgMgr.size() != dem_pixel_bboxes.size())
+        imgMgr.size() != dem_pixel_bboxes.size()  ||
+        imgMgr.size() != dem_reach_tree.size()    ||
+        (!weight_files.empty() && imgMgr.size() != weight_files.size()))
       vw_throw(ArgumentErr() << "Inputs expected to have the same size do not.\n");
 
+    // Find which DEMs have an affine map from the mosaic pixels
+    int num_affine = 0;
+    for (size_t i = 0; i < m_georefs.size(); i++) {
+      m_pixel_maps.push_back(find_dem_pixel_map(m_georefs[i], m_out_georef,
+                                                m_dem_pixel_bboxes[i], m_cols, m_rows));
+      num_affine += int(m_pixel_maps.back().is_affine);
+    }
+    VW_OUT(DebugMessage,"asp") << "DEMs with the same projection as the mosaic: "
+                               << num_affine << " out of " << m_georefs.size() << ".\n";
+
     // Sanity check, see if datums differ, then the tool won't work
     const double out_major_axis = m_out_georef.datum().semi_major_axis();
     const double out_minor_axis = m_out_georef.datum().semi_minor_axis();
@@ -506,10 +677,12 @@ public:
     }
 
     ImageView<double> first_dem;
-    ImageView<double> local_wts_orig;
     
-    // Loop through all input DEMs
-    for (int dem_iter = 0; dem_iter < (int)m_imgMgr.size(); dem_iter++){
+    // Loop through the input DEMs which may be used for this block, in order
+    std::vector<int> dem_indices;
+    m_dem_reach_tree.query(bbox, dem_indices);
+    for (size_t index_iter = 0; index_iter < dem_indices.size(); index_iter++){
+      int dem_iter = dem_indices[index_iter];
 
       // Load the information for this DEM
       GeoReference georef        = m_georefs         [dem_iter];
@@ -522,10 +695,13 @@ public:
       // Get the tile bbox in the frame of the current input DEM
       BBox2 in_box = geotrans.reverse_bbox(bbox);
 
-      // Grow to account for blending and erosion length, etc.  If
-      // priority blending length was positive, we've already done that.
+      // Grow to account for blending and erosion length, etc., and for
+      // the blur of the weights, so that the weights at the pixels used
+      // do not depend on where the DEM was cropped.  If priority
+      // blending length was positive, we've already done that.
       if (m_opt.priority_blending_len <= 0)
-        in_box.expand(m_bias + BilinearInterpolation::pixel_buffer + 1);
+        in_box.expand(asp::dem_weights_halo(m_opt, m_bias)
+                      + BilinearInterpolation::pixel_buffer + 1);
 
       in_box.crop(dem_pixel_box);
       if (in_box.width() == 1 || in_box.height() == 1){
@@ -555,19 +731,7 @@ public:
       
       std::string dem_name = m_imgMgr.get_file_name(dem_iter);
       
-      // If the nodata_threshold is specified, all values no more than this
-      // will be invalidated.
-      double nodata_value = m_nodata_values[dem_iter];
-      if (!boost::math::isnan(m_opt.nodata_threshold)) {
-        nodata_value = m_opt.nodata_threshold;
-        for (int col = 0; col < dem.cols(); col++) {
-          for (int row = 0; row < dem.rows(); row++) {
-            if (dem(col, row)[0] <= nodata_value) {
-              dem(col, row)[0] = nodata_value;
-            }
-          }
-        }
-      }
+      double nodata_value = apply_nodata_threshold(m_opt, m_nodata_values[dem_iter], dem);
 
       if (m_opt.first_dem_as_reference && dem_iter == 0) {
         //TODO: Should be a function!
@@ -591,61 +755,13 @@ public:
         continue;
       }
       
-      // Compute linear weights
-      ImageView<double> local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value));
-      local_wts_orig = local_wts;
-      if (m_opt.use_centerline_weights) {
-        // Erode based on grassfire weights, and then overwrite the grassfire
-        // weights with centerline weights
-        ImageView<DoubleGrayA> dem2 = copy(dem);
-        for (int col = 0; col < dem2.cols(); col++) {
-          for (int row = 0; row < dem2.rows(); row++) {
-            if (local_wts(col, row) <= m_opt.erode_len) {
-              dem2(col, row) = DoubleGrayA(nodata_value);
-            }
-          }
-        }
-        // TODO: Generalize this modification and move it to VW!!!
-        centerline_weights2
-                (create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
-                 local_wts, -1.0);
-      }
-
-      // If we don't limit the weights from above, we will have tiling artifacts,
-      // as in different tiles the weights grow to different heights since
-      // they are cropped to different regions. for priority blending length,
-      // we'll do this process later, as the bbox is obtained differently in that case.
-      if (m_opt.priority_blending_len <= 0) {
-        for (int col = 0; col < local_wts.cols(); col++) {
-          for (int row = 0; row < local_wts.rows(); row++) {
-            local_wts(col, row) = std::min(local_wts(col, row), double(m_bias));
-          }
-        }
-      }
-      
-      // Erode. We already did that if centerline weights are used.
-      if (!m_opt.use_centerline_weights){
-        int max_cutoff = max_pixel_value(local_wts);
-        int min_cutoff = m_opt.erode_len;
-        if (max_cutoff <= min_cutoff)
-          max_cutoff = min_cutoff + 1; // precaution
-        local_wts = clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
-      }
-      
-      // Blur the weights. If priority blending length is on, we'll do the blur later,
-      // after weights from different DEMs are combined.
-      if (m_opt.weights_blur_sigma > 0 && m_opt.priority_blending_len <= 0)
-        blur_weights(local_wts, m_opt.weights_blur_sigma);
-
-      // Raise to the power. Note that when priority blending length is positive, we
-      // delay this process.
-      if (m_opt.weights_exp != 1 && m_opt.priority_blending_len <= 0) {
-        for (int col = 0; col < dem.cols(); col++){
-          for (int row = 0; row < dem.rows(); row++){
-            if (local_wts(col, row) > 0)
-              local_wts(col, row) = pow(local_wts(col, row), m_opt.weights_exp);
-          }
-        }
+      // Compute the weights, or read the ones computed before
+      ImageView<double> local_wts;
+      if (!m_weight_files.empty()) {
+        local_wts = crop(m_weightMgr.get_handle(dem_iter, bbox), in_box);
+        m_weightMgr.release(dem_iter);
+      }else{
+        asp::compute_dem_weights(m_opt, m_bias, nodata_value, dem, local_wts);
       }
 
 #if 0
@@ -669,18 +785,18 @@ public:
         }
       }
 
-      // Prepare the DEM for interpolation
-      ImageViewRef<DoubleGrayA> interp_dem
-        = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
+      // The pixels in this input DEM for the output pixels, a row at a time
+      TileDemPixels tile_dem_pixels(geotrans, m_pixel_maps[dem_iter], bbox,
+                                    m_opt.approx_grid_spacing, m_opt.approx_pixel_tol);
+      std::vector<Vector2> in_pix_row;
 
-      // Loop through each output pixel
-      for (int c = 0; c < bbox.width(); c++){
-        for (int r = 0; r < bbox.height(); r++){
+      // Loop through each output pixel, in the order they are stored
+      for (int r = 0; r < bbox.height(); r++){
+        tile_dem_pixels.row(r, in_pix_row);
+        for (int c = 0; c < bbox.width(); c++){
 
-          // Coordinates in the output mosaic
-          Vector2 out_pix(c +  bbox.min().x(), r +  bbox.min().y());
           // Coordinate in this input DEM
-          Vector2 in_pix = geotrans.reverse(out_pix);
+          Vector2 const& in_pix = in_pix_row[c];
 
           // Input DEM pixel relative to loaded bbox
           double x = in_pix[0] - in_box.min().x();
@@ -713,10 +829,14 @@ public:
             // If we have weights of 0, that means there are invalid pixels, so skip this point.
             int i0 = (int)floor(x), j0 = (int)floor(y);
             int i1 = (int)ceil(x),  j1 = (int)ceil(y);
-            bool nodata = ((dem(i0, j0).a() == 0) || (dem(i1, j0).a() == 0) ||
-                           (dem(i0, j1).a() == 0) || (dem(i1, j1).a() == 0));
-            bool border = ((dem(i0, j0).a() <  0) || (dem(i1, j0).a() <  0) ||
-                           (dem(i0, j1).a() <  0) || (dem(i1, j1).a() <  0));
+            DoubleGrayA const& p00 = dem(i0, j0);
+            DoubleGrayA const& p10 = dem(i1, j0);
+            DoubleGrayA const& p01 = dem(i0, j1);
+            DoubleGrayA const& p11 = dem(i1, j1);
+            bool nodata = ((p00.a() == 0) || (p10.a() == 0) ||
+                           (p01.a() == 0) || (p11.a() == 0));
+            bool border = ((p00.a() <  0) || (p10.a() <  0) ||
+                           (p01.a() <  0) || (p11.a() <  0));
             
             if (nodata || border) {
               pval.v() = 0;
@@ -725,8 +845,13 @@ public:
               if (m_opt.propagate_nodata && !border)
                 pval.a() = 0; // Flag as nodata
               
-            } else
-              pval = interp_dem(x, y); // Things checked out, do the interpolation.
+            } else {
+              // Things checked out, do the bilinear interpolation. All
+              // four neighbors are within the loaded DEM, so no edge
+              // extension is needed.
+              double fx = x - i0, fy = y - j0;
+              pval = (1 - fy)*((1 - fx)*p00 + fx*p10) + fy*((1 - fx)*p01 + fx*p11);
+            }
           }
           // Seperate the value and alpha for this pixel.
           double val = pval.v();
@@ -951,7 +1076,7 @@ public:
           }
         }
         
-        weight_vec[clip_iter] = grassfire(notnodata(tile_vec[clip_iter],
+        weight_vec[clip_iter] = grassfire(asp::notnodata(tile_vec[clip_iter],
                                                       m_opt.out_nodata_value));
       }
       
@@ -967,7 +1092,7 @@ public:
 
       // Blur the weights.
       for (size_t clip_iter = 0; clip_iter < weight_vec.size(); clip_iter++) {
-        blur_weights(weight_vec[clip_iter], m_opt.weights_blur_sigma);
+        asp::blur_weights(weight_vec[clip_iter], m_opt.weights_blur_sigma);
       }
 
       // Raise to power
@@ -1122,6 +1247,128 @@ public:
 }; // End class DemMosaicView
 
 
+/// Read the pixel box, georeference, and projected box of a DEM. Many
+/// of these run at the same time, as opening thousands of files one
+/// after another takes a while.
+class DemFootprintTask: public Task, private boost::noncopyable {
+  std::string    m_dem_file;
+  BBox2i       & m_pixel_box;    // alias
+  GeoReference & m_georef;       // alias
+  BBox2        & m_own_proj_box; // alias, the box in the DEM's own projection
+  std::string  & m_error;        // alias
+
+public:
+  DemFootprintTask(std::string const& dem_file, BBox2i & pixel_box,
+                   GeoReference & georef, BBox2 & own_proj_box, std::string & error):
+    m_dem_file(dem_file), m_pixel_box(pixel_box), m_georef(georef),
+    m_own_proj_box(own_proj_box), m_error(error) {}
+
+  void operator()() {
+    try {
+      DiskImageView<RealT> img(m_dem_file);
+      m_georef       = read_georef(m_dem_file);
+      m_pixel_box    = bounding_box(img);
+      m_own_proj_box = m_georef.bounding_box(img);
+    }catch(std::exception const& e){
+      m_error = e.what();
+    }
+  }
+};
+
+/// A hash of everything the DEM bounding boxes depend on. The
+/// files are identified by their name, size, and modification time,
+/// so that they need not be opened.
+std::string footprint_index_key(Options const& opt, GeoReference const& mosaic_georef) {
+  asp::CacheKeyHasher hasher;
+  hasher.add(mosaic_georef.overall_proj4_str());
+  Matrix3x3 transform = mosaic_georef.transform();
+  for (int row = 0; row < 3; row++)
+    for (int col = 0; col < 3; col++)
+      hasher.add(transform(row, col));
+  hasher.add(vw::uint64(opt.dem_files.size()));
+  for (size_t dem_iter = 0; dem_iter < opt.dem_files.size(); dem_iter++) {
+    std::string const& file = opt.dem_files[dem_iter];
+    hasher.add(file);
+    hasher.add(vw::uint64(fs::file_size(file)));
+    hasher.add(vw::int64(fs::last_write_time(file)));
+  }
+  return hasher.hex();
+}
+
+const std::string FOOTPRINT_INDEX_MAGIC = "dem_mosaic_footprint_index_v1";
+
+/// Read the DEM bounding boxes saved by an earlier run. Return false
+/// if the file is missing, or was made for other inputs.
+bool read_footprint_index(std::string const& index_file, std::string const& key,
+                          int num_dems, BBox2 & first_dem_proj_box,
+                          std::vector<BBox2> & dem_proj_bboxes,
+                          std::vector<BBox2i> & dem_pixel_bboxes) {
+
+  std::ifstream ifs(index_file.c_str());
+  std::string magic, file_key;
+  int num = 0;
+  if (!(ifs >> magic >> file_key >> num) || magic != FOOTPRINT_INDEX_MAGIC ||
+      file_key != key || num != num_dems)
+    return false;
+
+  BBox2 first_box;
+  if (!(ifs >> first_box.min().x() >> first_box.min().y()
+            >> first_box.max().x() >> first_box.max().y()))
+    return false;
+
+  std::vector<BBox2>  proj_boxes(num);
+  std::vector<BBox2i> pixel_boxes(num);
+  for (int dem_iter = 0; dem_iter < num; dem_iter++) {
+    BBox2  & p = proj_boxes [dem_iter];
+    BBox2i & q = pixel_boxes[dem_iter];
+    if (!(ifs >> p.min().x() >> p.min().y() >> p.max().x() >> p.max().y()
+              >> q.min().x() >> q.min().y() >> q.max().x() >> q.max().y()))
+      return false;
+  }
+
+  first_dem_proj_box = first_box;
+  dem_proj_bboxes.swap(proj_boxes);
+  dem_pixel_bboxes.swap(pixel_boxes);
+  return true;
+}
+
+/// Save the DEM bounding boxes. Write to a temporary file first, as
+/// several dem_mosaic processes, each making some tiles, may be
+/// started at the same time with the same index.
+void write_footprint_index(std::string const& index_file, std::string const& key,
+                           BBox2 const& first_dem_proj_box,
+                           std::vector<BBox2>  const& dem_proj_bboxes,
+                           std::vector<BBox2i> const& dem_pixel_bboxes) {
+
+  std::string temp = fs::unique_path(index_file + ".%%%%-%%%%.tmp").string();
+  {
+    std::ofstream ofs(temp.c_str());
+    ofs.precision(17);
+    ofs << FOOTPRINT_INDEX_MAGIC << ' ' << key << ' ' << dem_proj_bboxes.size() << "\n";
+    ofs << first_dem_proj_box.min().x() << ' ' << first_dem_proj_box.min().y() << ' '
+        << first_dem_proj_box.max().x() << ' ' << first_dem_proj_box.max().y() << "\n";
+    for (size_t dem_iter = 0; dem_iter < dem_proj_bboxes.size(); dem_iter++) {
+      BBox2  const& p = dem_proj_bboxes [dem_iter];
+      BBox2i const& q = dem_pixel_bboxes[dem_iter];
+      ofs << p.min().x() << ' ' << p.min().y() << ' ' << p.max().x() << ' ' << p.max().y() << ' '
+          << q.min().x() << ' ' << q.min().y() << ' ' << q.max().x() << ' ' << q.max().y() << "\n";
+    }
+    if (!ofs.good()) {
+      vw_out(WarningMessage) << "Could not write: " << index_file << "\n";
+      return;
+    }
+  }
+
+  boost::system::error_code ec;
+  fs::rename(temp, index_file, ec);
+  if (ec) {
+    fs::remove(temp, ec);
+    vw_out(WarningMessage) << "Could not write: " << index_file << "\n";
+    return;
+  }
+  vw_out() << "Wrote: " << index_file << "\n";
+}
+
 /// Find the bounding box of all DEMs in the projected space.
 /// - mosaic_bbox is the output bounding box in projected space
 /// - dem_proj_bboxes and dem_pixel_bboxes are the locations of
@@ -1132,32 +1379,67 @@ void load_dem_bounding_boxes(Options       const& opt,
                              std::vector<BBox2> & dem_proj_bboxes,
                              std::vector<BBox2i> & dem_pixel_bboxes) {
 
-  vw_out() << "Determining the bounding boxes of the input DEMs.\n";
-
   // Initialize the outputs
   mosaic_bbox = BBox2();
   dem_proj_bboxes.clear();
   dem_pixel_bboxes.clear();
-  
+
+  int num_dems = opt.dem_files.size();
+  BBox2 first_dem_proj_box;
+
+  std::string key;
+  if (opt.footprint_index != "") {
+    key = footprint_index_key(opt, mosaic_georef);
+    if (read_footprint_index(opt.footprint_index, key, num_dems, first_dem_proj_box,
+                             dem_proj_bboxes, dem_pixel_bboxes)) {
+      vw_out() << "Read the bounding boxes of the input DEMs from: "
+               << opt.footprint_index << "\n";
+      for (int dem_iter = 0; dem_iter < num_dems; dem_iter++)
+        mosaic_bbox.grow(dem_proj_bboxes[dem_iter]);
+      if (opt.first_dem_as_reference)
+        mosaic_bbox = first_dem_proj_box;
+      return;
+    }
+  }
+
+  vw_out() << "Determining the bounding boxes of the input DEMs.\n";
+
+  // Open all the DEMs in parallel
+  std::vector<BBox2i>       pixel_boxes(num_dems);
+  std::vector<GeoReference> georefs(num_dems);
+  std::vector<BBox2>        own_proj_boxes(num_dems);
+  std::vector<std::string>  errors(num_dems);
+  {
+    FifoWorkQueue queue(opt.num_threads);
+    for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+      boost::shared_ptr<DemFootprintTask>
+        task(new DemFootprintTask(opt.dem_files[dem_iter], pixel_boxes[dem_iter],
+                                  georefs[dem_iter], own_proj_boxes[dem_iter],
+                                  errors[dem_iter]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+    if (errors[dem_iter] != "")
+      vw_throw(ArgumentErr() << errors[dem_iter]);
+  }
+
   TerminalProgressCallback tpc("", "\t--> ");
   tpc.report_progress(0);
   double inc_amount = 1.0 / double(opt.dem_files.size() );
 
-  BBox2 first_dem_proj_box;
-  
-  // Loop through all DEMs
-  for (int dem_iter = 0; dem_iter < (int)opt.dem_files.size(); dem_iter++){ 
+  // Loop through all DEMs. This is done in order, as the box of a DEM
+  // may depend on the mosaic box formed by the earlier ones.
+  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++){ 
 
-    // Open a handle to this DEM file
-    DiskImageResourceGDAL in_rsrc(opt.dem_files[dem_iter]);
-    DiskImageView<RealT>  img(opt.dem_files[dem_iter]);
-    GeoReference          georef = read_georef(opt.dem_files[dem_iter]);
-    BBox2i                pixel_box = bounding_box(img);
+    GeoReference const& georef    = georefs    [dem_iter];
+    BBox2i       const& pixel_box = pixel_boxes[dem_iter];
 
     dem_pixel_bboxes.push_back(pixel_box);
 
     if (dem_iter == 0) 
-      first_dem_proj_box = georef.bounding_box(img);
+      first_dem_proj_box = own_proj_boxes[dem_iter];
     
     bool has_lonat = (georef.proj4_str().find("+proj=longlat") != std::string::npos ||
                       mosaic_georef.proj4_str().find("+proj=longlat") != std::string::npos );
@@ -1166,7 +1448,7 @@ void load_dem_bounding_boxes(Options       const& opt,
     // the same projection, and it is not longlat, as then we need to worry about
     // a 360 degree shift.
     if ( (!has_lonat) && mosaic_georef.overall_proj4_str() == georef.overall_proj4_str() ){
-      BBox2 proj_box = georef.bounding_box(img);
+      BBox2 proj_box = own_proj_boxes[dem_iter];
       mosaic_bbox.grow(proj_box);
       dem_proj_bboxes.push_back(proj_box);
     }else{
@@ -1175,7 +1457,7 @@ void load_dem_bounding_boxes(Options       const& opt,
       // lonlat of the mosaic so far and of the current DEM will be
       // offset by 360 degrees. Try to deal with that.
       BBox2 proj_box;
-      BBox2 imgbox = bounding_box(img);
+      BBox2 imgbox = pixel_box;
       BBox2 mosaic_pixel_box;
       
       // Get the bbox of current mosaic in pixels.
@@ -1209,6 +1491,10 @@ void load_dem_bounding_boxes(Options       const& opt,
   } // End loop through DEM files
   tpc.report_finished();
 
+  if (opt.footprint_index != "")
+    write_footprint_index(opt.footprint_index, key, first_dem_proj_box,
+                          dem_proj_bboxes, dem_pixel_bboxes);
+
   // If the first dem is used as reference, no matter what use its own box
   if (opt.first_dem_as_reference) 
     mosaic_bbox = first_dem_proj_box;
@@ -1290,6 +1576,14 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "The output DEM will have the same size, grid, and georeference as this one, but it will not be used in the mosaic.")
     ("save-index-map",   po::bool_switch(&opt.save_index_map)->default_value(false),
      "For each output pixel, save the index of the input DEM it came from (applicable only for --first, --last, --min, --max, --median, and --nmad). A text file with the index assigned to each input DEM is saved as well.")
+    ("footprint-index", po::value(&opt.footprint_index)->default_value(""),
+     "Save the bounding boxes of the input DEMs to this file, and read them from it in later runs with the same DEMs and output grid, rather than opening all DEMs. Useful when creating many tiles of a mosaic of many DEMs with separate invocations of this tool.")
+    ("weights-cache-dir", po::value(&opt.weights_cache_dir)->default_value(""),
+     "Compute the blending weights of each input DEM once, in parallel, and save them in this directory, rather than computing them for each block of the mosaic. They are reused in later runs with the same DEMs and weight options. The mosaic is the same as without this option. Cannot be used with --priority-blending-length or --use-centerline-weights.")
+    ("approx-grid-spacing", po::value(&opt.approx_grid_spacing)->default_value(0),
+     "If positive, for input DEMs whose projection differs from the output one, find the input pixel for a given output pixel exactly only at output pixels on a grid with this spacing (such as 16 to 64), and interpolate bilinearly in between. Grid cells failing the --approx-pixel-tol check use the exact transform. Input DEMs with the same projection as the output always use a fast exact transform.")
+    ("approx-pixel-tol", po::value(&opt.approx_pixel_tol)->default_value(0.01),
+     "With --approx-grid-spacing, the maximum allowed difference, in input DEM pixels, between the interpolated and exact transform at the center of a grid cell.")
     ("threads",             po::value<int>(&opt.num_threads)->default_value(4),
      "Number of threads to use.")
     ("help,h", "Display this help message.");
@@ -1329,6 +1623,20 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw(ArgumentErr() << "The priority blending length must not be negative.\n"
                            << usage << general_options );
 
+  if (opt.approx_grid_spacing < 0)
+    vw_throw(ArgumentErr() << "The value of --approx-grid-spacing must be non-negative.\n"
+                           << usage << general_options );
+  if (opt.approx_grid_spacing > 0 && opt.approx_pixel_tol <= 0)
+    vw_throw(ArgumentErr() << "The value of --approx-pixel-tol must be positive.\n"
+                           << usage << general_options );
+
+  if (opt.priority_blending_len > 0 && opt.weights_cache_dir != "")
+    vw_throw(ArgumentErr() << "Cannot use --weights-cache-dir with priority blending.\n"
+                           << usage << general_options );
+  if (opt.use_centerline_weights && opt.weights_cache_dir != "")
+    vw_throw(ArgumentErr() << "Cannot use --weights-cache-dir with centerline weights.\n"
+                           << usage << general_options );
+
   // If priority blending is used, need to adjust extra_crop_len accordingly
   opt.extra_crop_len = std::max(opt.extra_crop_len, 3*opt.priority_blending_len);
 
@@ -1674,15 +1982,12 @@ int main( int argc, char *argv[] ) {
     DiskImageManager<RealT> imgMgr;
 
     BBox2i output_dem_box = BBox2i(0, 0, cols, rows); // output DEM box
-    
-    // Loop through all DEMs
-    for (int dem_iter = 0; dem_iter < (int)opt.dem_files.size(); dem_iter++){
-
-      // Get the DEM bounding box that we previously computed (output projected coords)
-      BBox2 dem_bbox = dem_proj_bboxes[dem_iter];
 
-      // Go through each of the tile bounding boxes and see they intersect this DEM
-      bool use_this_dem = false;
+    // Find the DEMs intersecting the tiles to make. Only those will be opened.
+    std::vector<bool> use_dem(opt.dem_files.size(), false);
+    {
+      asp::BBoxRTree dem_tree(dem_proj_bboxes);
+      std::vector<int> found;
       for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
 
         if (!opt.tile_list.empty() && opt.tile_list.find(tile_id) == opt.tile_list.end()) 
@@ -1692,12 +1997,20 @@ int main( int argc, char *argv[] ) {
         BBox2i tile_pixel_box = tile_pixel_bboxes[tile_id - start_tile];
         BBox2  tile_proj_box  = mosaic_georef.pixel_to_point_bbox(tile_pixel_box);
 
-        if (tile_proj_box.intersects(dem_bbox)) {
-          use_this_dem = true;
-          break;
-        }
+        dem_tree.query(tile_proj_box, found);
+        for (size_t i = 0; i < found.size(); i++)
+          use_dem[found[i]] = true;
       }
-      if (use_this_dem == false)
+    }
+
+    // The region of the mosaic, in pixels, a DEM may affect. This
+    // is used to skip quickly the DEMs far from a given block.
+    vector<BBox2> dem_reach_bboxes, loaded_dem_out_bboxes;
+    
+    // Loop through all DEMs
+    for (int dem_iter = 0; dem_iter < (int)opt.dem_files.size(); dem_iter++){
+
+      if (!use_dem[dem_iter])
         continue; // Skip to the next DEM if we don't need this one.
 
       // The GeoTransform will hide the messy details of conversions
@@ -1710,6 +2023,22 @@ int main( int argc, char *argv[] ) {
       BBox2 curr_box = geotrans.forward_bbox(dem_pixel_box);
       curr_box.crop(output_dem_box);
 
+      // A DEM is used for a block if it is no further from it than the
+      // bias, in its own pixels. Be generous, this is only a first pass.
+      BBox2 reach_box;
+      try {
+        BBox2i reach_pixel_box = dem_pixel_box;
+        reach_pixel_box.expand(bias + BilinearInterpolation::pixel_buffer + 3);
+        reach_box = geotrans.forward_bbox(reach_pixel_box);
+        reach_box.expand(2);
+      }catch(...){
+        // Then it is never skipped
+        reach_box = BBox2(-std::numeric_limits<double>::max()/4.0,
+                          -std::numeric_limits<double>::max()/4.0,
+                          std::numeric_limits<double>::max()/2.0,
+                          std::numeric_limits<double>::max()/2.0);
+      }
+
       // This is a fix for GDAL crashing when there are too many open
       // file handles. In such situation, just selectively close the
       // handles furthest from the current location.
@@ -1739,8 +2068,23 @@ int main( int argc, char *argv[] ) {
       nodata_values.push_back(curr_nodata_value);
       georefs.push_back(georef);
       loaded_dem_pixel_bboxes.push_back(dem_pixel_box);
+      dem_reach_bboxes.push_back(reach_box);
+      loaded_dem_out_bboxes.push_back(curr_box);
     } // End loop through DEM files
 
+    asp::BBoxRTree dem_reach_tree(dem_reach_bboxes);
+
+    // Compute the weights of each DEM once, rather than for each block
+    // of the mosaic.
+    std::vector<std::string> weight_files;
+    DiskImageManager<double> weightMgr;
+    if (opt.weights_cache_dir != "") {
+      weight_files = prepare_weight_files(opt, bias, loaded_dems, nodata_values);
+      for (size_t dem_iter = 0; dem_iter < weight_files.size(); dem_iter++)
+        weightMgr.add_file_handle_not_thread_safe(weight_files[dem_iter],
+                                                  loaded_dem_out_bboxes[dem_iter]);
+    }
+
     // If there are 17 tiles, let them be tile-00, ..., tile-16.
     int num_digits = 1;
     int tens = 10;
@@ -1774,9 +2118,9 @@ int main( int argc, char *argv[] ) {
 
       ImageViewRef<RealT> out_dem
         = crop(DemMosaicView(cols, rows, bias, opt,
-                             imgMgr, georefs,
+                             imgMgr, weightMgr, weight_files, georefs,
                              mosaic_georef, nodata_values,
-                             loaded_dem_pixel_bboxes,
+                             loaded_dem_pixel_bboxes, dem_reach_tree,
                              num_valid_pixels, count_mutex),
                tile_box);
       GeoReference crop_georef = crop(mosaic_georef, tile_box.min().x(),
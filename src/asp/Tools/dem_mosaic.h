@@ -0,0 +1,307 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#ifndef __ASP_TOOLS_DEM_MOSAIC_H__
+#define __ASP_TOOLS_DEM_MOSAIC_H__
+
+/**
+  This file breaks out the blending weights of the DEMs in dem_mosaic.cc.
+*/
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/Algorithms2.h>
+#include <vw/Image/Filter.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/MaskViews.h>
+#include <vw/Image/Statistics.h>
+#include <boost/math/special_functions/fpclassify.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace asp {
+
+// TODO: Fold modifications into VW!
+template<class ImageT>
+void centerline_weights2(ImageT const& img, vw::ImageView<double> & weights,
+                         double hole_fill_value=0, double border_fill_value=-1, 
+                         vw::BBox2i roi=vw::BBox2i()){
+
+  int numRows = img.rows();
+  int numCols = img.cols();
+
+  // Arrays to be returned out of this function
+  std::vector<double> hCenterLine  (numRows, 0);
+  std::vector<double> hMaxDistArray(numRows, 0);
+  std::vector<double> vCenterLine  (numCols, 0);
+  std::vector<double> vMaxDistArray(numCols, 0);
+
+  std::vector<int> minValInRow(numRows, 0);
+  std::vector<int> maxValInRow(numRows, 0);
+  std::vector<int> minValInCol(numCols, 0);
+  std::vector<int> maxValInCol(numCols, 0);
+
+  for (int k = 0; k < numRows; k++){
+    minValInRow[k] = numCols;
+    maxValInRow[k] = 0;
+  }
+  for (int col = 0; col < numCols; col++){
+    minValInCol[col] = numRows;
+    maxValInCol[col] = 0;
+  }
+
+  // Note that we do just a single pass through the image to compute
+  // both the horizontal and vertical min/max values.
+  for (int row = 0 ; row < numRows; row++) {
+    for (int col = 0; col < numCols; col++) {
+
+      if ( !is_valid(img(col,row)) ) continue;
+      
+      // Record the first and last valid column in each row
+      if (col < minValInRow[row]) minValInRow[row] = col;
+      if (col > maxValInRow[row]) maxValInRow[row] = col;
+      
+      // Record the first and last valid row in each column
+      if (row < minValInCol[col]) minValInCol[col] = row;
+      if (row > maxValInCol[col]) maxValInCol[col] = row;   
+    }
+  }
+  
+  // For each row, record central column and the column width
+  for (int row = 0; row < numRows; row++) {
+    hCenterLine   [row] = (minValInRow[row] + maxValInRow[row])/2.0;
+    hMaxDistArray [row] =  maxValInRow[row] - minValInRow[row];
+    if (hMaxDistArray[row] < 0){
+      hMaxDistArray[row]=0;
+    }
+  }
+
+  // For each row, record central column and the column width
+  for (int col = 0 ; col < numCols; col++) {
+    vCenterLine   [col] = (minValInCol[col] + maxValInCol[col])/2.0;
+    vMaxDistArray [col] =  maxValInCol[col] - minValInCol[col];
+    if (vMaxDistArray[col] < 0){
+      vMaxDistArray[col]=0;
+    }
+  }
+
+  vw::BBox2i output_bbox = roi;
+  if (roi.empty())
+    output_bbox = vw::bounding_box(img);
+
+  // Compute the weighting for each pixel in the image
+  weights.set_size(output_bbox.width(), output_bbox.height());
+  vw::fill(weights, 0);
+  
+  for (int row = output_bbox.min().y(); row < output_bbox.max().y(); row++){
+    for (int col = output_bbox.min().x(); col < output_bbox.max().x(); col++){
+      bool inner_row = ((row >= minValInCol[col]) && (row <= maxValInCol[col]));
+      bool inner_col = ((col >= minValInRow[row]) && (col <= maxValInRow[row]));
+      bool inner_pixel = inner_row && inner_col;
+      vw::Vector2 pix(col, row);
+      double new_weight = 0; // Invalid pixels usually get zero weight
+      if (is_valid(img(col,row))) {
+        double weight_h = vw::compute_line_weights(pix, true,  hCenterLine, hMaxDistArray);
+        double weight_v = vw::compute_line_weights(pix, false, vCenterLine, vMaxDistArray);
+        new_weight = weight_h*weight_v;
+      }
+      else { // Invalid pixel
+        if (inner_pixel)
+          new_weight = hole_fill_value;
+        else // Border pixel
+          new_weight = border_fill_value;
+      }
+      weights(col-output_bbox.min().x(), row-output_bbox.min().y()) = new_weight;
+      
+    }
+  }
+
+} // End function weights_from_centerline
+
+// Function for highlighting spots of data
+template<class PixelT>
+class NotNoDataFunctor {
+  typedef typename vw::CompoundChannelType<PixelT>::type channel_type;
+  channel_type m_nodata;
+  typedef vw::ChannelRange<channel_type> range_type;
+public:
+  NotNoDataFunctor( channel_type nodata ) : m_nodata(nodata) {}
+
+  template <class Args> struct result {
+    typedef channel_type type;
+  };
+
+  inline channel_type operator()( channel_type const& val ) const {
+    return (val != m_nodata && !boost::math::isnan(val))? range_type::max() : range_type::min();
+  }
+};
+
+template <class ImageT, class NoDataT>
+vw::UnaryPerPixelView<ImageT,vw::UnaryCompoundFunctor<NotNoDataFunctor<typename ImageT::pixel_type>, typename ImageT::pixel_type>  >
+inline notnodata( vw::ImageViewBase<ImageT> const& image, NoDataT nodata ) {
+  typedef vw::UnaryCompoundFunctor<NotNoDataFunctor<typename ImageT::pixel_type>, typename ImageT::pixel_type> func_type;
+  func_type func( nodata );
+  return vw::UnaryPerPixelView<ImageT,func_type>( image.impl(), func );
+}
+
+/// Blur the blending weights of a DEM.
+inline void blur_weights(vw::ImageView<double> & weights, double sigma){
+
+  if (sigma <= 0)
+    return;
+
+  // Blur the weights. To try to make the weights not drop much at the
+  // boundary, expand the weights with zero, blur, crop back to the
+  // original region.
+
+  // It is highly important to note that blurring can increase the weights
+  // at the boundary, even with the extension done above. Erosion before
+  // blurring does not help with that, as for weights with complicated
+  // boundary erosion can wipe things in a non-uniform way leaving
+  // huge holes. To get smooth weights, if really desired one should
+  // use the weights-exponent option.
+
+  int half_kernel = vw::compute_kernel_size(sigma)/2;
+  int extra = half_kernel + 1; // to guarantee we stay zero at boundary
+
+  int cols = weights.cols(), rows = weights.rows();
+
+  vw::ImageView<double> extra_wts(cols + 2*extra, rows + 2*extra);
+  vw::fill(extra_wts, 0);
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      if (weights(col,row) > 0)
+        extra_wts(col + extra, row + extra) = weights(col, row);
+      else
+        extra_wts(col + extra, row + extra) = 0;
+    }
+  }
+
+  vw::ImageView<double> blurred_wts = vw::gaussian_filter(extra_wts, sigma);
+
+  // Copy back.  The weights must not grow. In particular, where the
+  // original weights were zero, the new weights must also be zero, as
+  // at those points there is no DEM data.
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      if (weights(col, row) > 0) {
+        weights(col, row) = blurred_wts(col + extra, row + extra);
+      }
+      //weights(col, row) = std::min(weights(col, row), blurred_wts(col + extra, row + extra));
+    }
+  }
+
+}
+
+/// The options the blending weights of a DEM depend on
+struct DemWeightOptions {
+  int    erode_len, priority_blending_len;
+  double weights_exp, weights_blur_sigma;
+  bool   use_centerline_weights;
+  DemWeightOptions(): erode_len(0), priority_blending_len(0), weights_exp(0),
+                      weights_blur_sigma(0.0), use_centerline_weights(false) {}
+};
+
+/// The blending weights of a DEM region. These grow with the distance
+/// from the DEM boundary, and are capped, eroded, blurred, and raised
+/// to a power as set by the options. With priority blending, the
+/// blurring and the power are applied later, after the weights of
+/// all DEMs are combined.
+inline void compute_dem_weights(DemWeightOptions const& opt, int bias, double nodata_value,
+                                vw::ImageView< vw::PixelGrayA<double> > const& dem,
+                                vw::ImageView<double> & local_wts){
+
+  typedef vw::PixelGrayA<double> DoubleGrayA;
+
+  // Compute linear weights
+  local_wts = vw::grassfire(notnodata(vw::select_channel(dem, 0), nodata_value));
+  if (opt.use_centerline_weights) {
+    // Erode based on vw::grassfire weights, and then overwrite the vw::grassfire
+    // weights with centerline weights
+    vw::ImageView<DoubleGrayA> dem2 = vw::copy(dem);
+    for (int col = 0; col < dem2.cols(); col++) {
+      for (int row = 0; row < dem2.rows(); row++) {
+        if (local_wts(col, row) <= opt.erode_len) {
+          dem2(col, row) = DoubleGrayA(nodata_value);
+        }
+      }
+    }
+    // TODO: Generalize this modification and move it to VW!!!
+    centerline_weights2
+      (vw::create_mask_less_or_equal(vw::select_channel(dem2, 0), nodata_value),
+       local_wts, -1.0);
+  }
+
+  // If we don't limit the weights from above, we will have tiling artifacts,
+  // as in different tiles the weights grow to different heights since
+  // they are cropped to different regions. for priority blending length,
+  // we'll do this process later, as the bbox is obtained differently in that case.
+  if (opt.priority_blending_len <= 0) {
+    for (int col = 0; col < local_wts.cols(); col++) {
+      for (int row = 0; row < local_wts.rows(); row++) {
+        local_wts(col, row) = std::min(local_wts(col, row), double(bias));
+      }
+    }
+  }
+  
+  // Erode. We already did that if centerline weights are used.
+  if (!opt.use_centerline_weights){
+    int max_cutoff = vw::max_pixel_value(local_wts);
+    int min_cutoff = opt.erode_len;
+    if (max_cutoff <= min_cutoff)
+      max_cutoff = min_cutoff + 1; // precaution
+    local_wts = vw::clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
+  }
+  
+  // Blur the weights. If priority blending length is on, we'll do the blur later,
+  // after weights from different DEMs are combined.
+  if (opt.weights_blur_sigma > 0 && opt.priority_blending_len <= 0)
+    blur_weights(local_wts, opt.weights_blur_sigma);
+
+  // Raise to the power. Note that when priority blending length is positive, we
+  // delay this process.
+  if (opt.weights_exp != 1 && opt.priority_blending_len <= 0) {
+    for (int col = 0; col < dem.cols(); col++){
+      for (int row = 0; row < dem.rows(); row++){
+        if (local_wts(col, row) > 0)
+          local_wts(col, row) = std::pow(local_wts(col, row), opt.weights_exp);
+      }
+    }
+  }
+}
+
+/// The weights of a whole input DEM
+
+/// How far past a region the DEM must be read for the weights
+/// computed in the region not to depend on where the reading
+/// stopped. The distances to the DEM boundary are capped at the bias,
+/// and those within half a kernel are blurred into each weight.
+/// Centerline weights are not covered, as they depend on the extent of
+/// the DEM read.
+inline int dem_weights_halo(DemWeightOptions const& opt, int bias) {
+  int halo = bias + 1;
+  if (opt.weights_blur_sigma > 0)
+    halo += vw::compute_kernel_size(opt.weights_blur_sigma)/2;
+  return halo;
+}
+
+} // end namespace asp
+
+#endif // __ASP_TOOLS_DEM_MOSAIC_H__
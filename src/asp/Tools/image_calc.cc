@@ -39,6 +39,7 @@
 #include <asp/Core/Macros.h>
 
 #include <vector>
+#include <algorithm>
 
 #include <boost/program_options.hpp>
 #include <boost/spirit/include/qi.hpp>
@@ -108,26 +109,6 @@ void tab(int indent) {
     std::cout << ' ';
 }
 
-// TODO: Are there pixel functions for these?
-template <typename T>
-T manual_min(const std::vector<T> &vec) {
-
-  T minVal = vec[0];
-  for (size_t i=1; i<vec.size(); ++i)
-    if (vec[i] < minVal)
-      minVal = vec[i];
-  return minVal;
-}
-template <typename T>
-T manual_max(const std::vector<T> &vec) {
-
-  T maxVal = vec[0];
-  for (size_t i=1; i<vec.size(); ++i)
-    if (vec[i] > maxVal)
-      maxVal = vec[i];
-  return maxVal;
-}
-
 
 // This type represents an operation performed on one or more inputs.
 struct calc_operation {
@@ -192,45 +173,6 @@ struct calc_operation {
       std::vector<calc_operation> temp = inputs[0].inputs;
       inputs = temp;
     }
-
-
-    /// Apply the operation tree to the input parameters and return a result
-    template <typename T>
-    T applyOperation(const std::vector<T> &params) const {
-      // Get the results from each input node.
-      // - This is a recursive call.
-      const size_t numInputs = inputs.size();
-      std::vector<T> inputResults(numInputs);
-      for (size_t i=0; i<numInputs; ++i)
-        inputResults[i] = inputs[i].applyOperation(params);
-
-      // Now perform the operation for this node
-      switch(opType) {
-        // Unary
-        case OP_number:   return T(value);
-        case OP_variable: if (varName >= static_cast<int>(params.size()))
-                            vw_throw(ArgumentErr() << "Unrecognized variable input!\n");
-                          return params[varName];
-        if (numInputs < 1)
-          vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
-        case OP_negate:   return T(-1 * inputResults[0]);
-        case OP_abs:      return T(std::abs(inputResults[0])); // regular abs casts to integer!
-        // Binary
-        if (numInputs < 2)
-          vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
-        case OP_add:      return (inputResults[0] + inputResults[1]);
-        case OP_subtract: return (inputResults[0] - inputResults[1]);
-        case OP_divide:   return (inputResults[0] / inputResults[1]);
-        case OP_multiply: return (inputResults[0] * inputResults[1]);
-        case OP_power:    return (pow(inputResults[0], inputResults[1]));
-        // Multi
-        case OP_min:      return manual_min(inputResults); // TODO: Do these functions exist?
-        case OP_max:      return manual_max(inputResults);
-
-        default:
-          vw_throw(LogicErr() << "Unexpected operation type!\n");
-      }
-    }
 };
 
 
@@ -244,6 +186,128 @@ BOOST_FUSION_ADAPT_STRUCT(
     (std::vector<calc_operation>, inputs)
 )
 
+/// A calc_operation tree flattened into a list of instructions, each of
+/// which is applied to a whole row of pixels at a time. This avoids
+/// walking the tree and allocating vectors for every pixel.
+/// - Slots 0 to num_vars-1 hold the input rows, the rest of the slots
+///   are scratch registers, reused as the tree is traversed.
+struct calc_program {
+
+  struct instruction {
+    OperationType opType;
+    int    dst, src0, src1; // Slot indices
+    double value;           // Ignored unless OP_number
+  };
+
+  int num_vars, num_slots, result_slot;
+  std::vector<instruction> code;
+
+  calc_program(): num_vars(0), num_slots(0), result_slot(0) {}
+
+  calc_program(calc_operation const& tree, int num_vars_in):
+    num_vars(num_vars_in), num_slots(num_vars_in) {
+    result_slot = compile(tree, num_vars);
+  }
+
+  /// Apply the program to rows of length len. The first num_vars slots
+  /// must contain the input rows. Returns the index of the slot with the result.
+  int run(std::vector< std::vector<double> > & slots, int len) const {
+
+    for (size_t k = 0; k < code.size(); k++) {
+      instruction const& ins = code[k];
+      double       * d = &slots[ins.dst][0];
+      double const * a = (ins.src0 >= 0) ? &slots[ins.src0][0] : NULL;
+      double const * b = (ins.src1 >= 0) ? &slots[ins.src1][0] : NULL;
+      switch(ins.opType) {
+        case OP_number:   for (int c = 0; c < len; c++) d[c] = ins.value;             break;
+        case OP_negate:   for (int c = 0; c < len; c++) d[c] = -1 * a[c];             break;
+        case OP_abs:      for (int c = 0; c < len; c++) d[c] = std::abs(a[c]);        break;
+        case OP_add:      for (int c = 0; c < len; c++) d[c] = a[c] + b[c];           break;
+        case OP_subtract: for (int c = 0; c < len; c++) d[c] = a[c] - b[c];           break;
+        case OP_divide:   for (int c = 0; c < len; c++) d[c] = a[c] / b[c];           break;
+        case OP_multiply: for (int c = 0; c < len; c++) d[c] = a[c] * b[c];           break;
+        case OP_power:    for (int c = 0; c < len; c++) d[c] = pow(a[c], b[c]);       break;
+        case OP_min:      for (int c = 0; c < len; c++) d[c] = (b[c] < a[c]) ? b[c] : a[c]; break;
+        case OP_max:      for (int c = 0; c < len; c++) d[c] = (b[c] > a[c]) ? b[c] : a[c]; break;
+        default:
+          vw_throw(LogicErr() << "Unexpected operation type!\n");
+      }
+    }
+    return result_slot;
+  }
+
+private:
+
+  void emit(OperationType opType, int dst, int src0, int src1, double value = 0) {
+    instruction ins;
+    ins.opType = opType;
+    ins.dst    = dst;
+    ins.src0   = src0;
+    ins.src1   = src1;
+    ins.value  = value;
+    code.push_back(ins);
+    num_slots = std::max(num_slots, dst + 1);
+  }
+
+  /// Recursive function which emits the instructions for the given node,
+  /// using scratch slots starting at free_slot. Returns the slot with the result.
+  int compile(calc_operation const& node, int free_slot) {
+
+    const size_t numInputs = node.inputs.size();
+    switch(node.opType) {
+      case OP_pass:
+        if (numInputs != 1)
+          vw_throw(LogicErr() << "Pass node with " << numInputs << " inputs!\n");
+        return compile(node.inputs[0], free_slot);
+      case OP_number:
+        emit(OP_number, free_slot, -1, -1, node.value);
+        return free_slot;
+      case OP_variable:
+        if (node.varName < 0 || node.varName >= num_vars)
+          vw_throw(ArgumentErr() << "Unrecognized variable input: var_" << node.varName << "\n");
+        return node.varName;
+      // Unary
+      case OP_negate:
+      case OP_abs: {
+        if (numInputs < 1)
+          vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
+        int a = compile(node.inputs[0], free_slot);
+        emit(node.opType, free_slot, a, -1);
+        return free_slot;
+      }
+      // Binary
+      case OP_add:
+      case OP_subtract:
+      case OP_divide:
+      case OP_multiply:
+      case OP_power: {
+        if (numInputs < 2)
+          vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
+        int a = compile(node.inputs[0], free_slot);
+        int b = compile(node.inputs[1], free_slot + 1);
+        emit(node.opType, free_slot, a, b);
+        return free_slot;
+      }
+      // Multi, done as a chain of binary operations
+      case OP_min:
+      case OP_max: {
+        if (numInputs < 1)
+          vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
+        int a = compile(node.inputs[0], free_slot);
+        for (size_t i=1; i<numInputs; ++i) {
+          int b = compile(node.inputs[i], free_slot + 1);
+          emit(node.opType, free_slot, a, b);
+          a = free_slot;
+        }
+        return a;
+      }
+      default:
+        vw_throw(LogicErr() << "Unexpected operation type!\n");
+    }
+    return free_slot; // Not reached
+  }
+};
+
 //================================================================================
 // - Boost::Spirit equation parsing
 
@@ -409,7 +473,7 @@ private: // Variables
   std::vector<bool      > m_has_nodata_vec;
   std::vector<input_pixel_type> m_nodata_vec;
   result_type    m_output_nodata;
-  calc_operation m_operation_tree;
+  calc_program   m_program;
   int m_num_rows;
   int m_num_cols;
   int m_num_channels;
@@ -424,7 +488,7 @@ public: // Functions
                  calc_operation const& operation_tree)
                   : m_image_vec(imageVec),   m_has_nodata_vec(has_nodata_vec),
                     m_nodata_vec(nodata_vec), m_output_nodata(outputNodata),
-                    m_operation_tree(operation_tree) {
+                    m_program(operation_tree, imageVec.size()) {
     const size_t numImages = imageVec.size();
     VW_ASSERT( (numImages > 0), ArgumentErr() << "ImageCalcView: One or more images required!." );
     VW_ASSERT( (has_nodata_vec.size() == numImages), LogicErr() << "ImageCalcView: Incorrect hasNodata count passed in!." );
@@ -462,54 +526,50 @@ public: // Functions
     // Set up the output image tile
     ImageView<result_type> tile(bbox.width(), bbox.height());
 
-    // TODO: Left to right processing!
-
-    // Set up for pixel calculations
-    const size_t num_images = m_image_vec.size();
-    std::vector<input_pixel_type> input_pixels(num_images);
-    std::vector<double>           input_doubles(num_images);
-
     // Rasterize all the input images at this particular tile
+    const size_t num_images = m_image_vec.size();
     std::vector<ImageView<input_pixel_type> > input_tiles(num_images);
     for (size_t i=0; i<num_images; ++i)
       input_tiles[i] = crop(m_image_vec[i], bbox);
 
-    // Loop through each output pixel and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      for (int r = 0; r < bbox.height(); r++) {
-        // Fetch all the input pixels for this location
-        bool isNodata = false;
-        for (size_t i=0; i<num_images; ++i) {
-          input_pixels[i] = (input_tiles[i])(c,r);
+    // Each row is processed at once, one operation at a time
+    const int width = bbox.width();
+    std::vector< std::vector<double> > slots(m_program.num_slots, std::vector<double>(width));
+    std::vector<uint8> is_nodata(width);
 
-          // If any of the input pixels are nodata, the output is nodata.
-          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_pixels[i])) {
-            isNodata = true;
-            break;
-          }
-        } // End image loop
+    for (int r = 0; r < bbox.height(); r++) {
 
-        if (isNodata) { // Output is nodata, move on to the next pixel
-          tile(c, r) = m_output_nodata;
+      // If any of the input pixels are nodata, the output is nodata.
+      std::fill(is_nodata.begin(), is_nodata.end(), 0);
+      for (size_t i=0; i<num_images; ++i) {
+        if (!m_has_nodata_vec[i])
           continue;
+        for (int c = 0; c < width; c++) {
+          if (m_nodata_vec[i] == input_tiles[i](c, r))
+            is_nodata[c] = 1;
         }
+      } // End image loop
 
+      for (int chan=0; chan<m_num_channels; ++chan) {
+        for (size_t i=0; i<num_images; ++i) {
+          double * row = &slots[i][0];
+          for (int c = 0; c < width; c++)
+            row[c] = input_tiles[i](c, r)[chan];
+        } // End image loop
 
-        for (int chan=0; chan<m_num_channels; ++chan) {
-          for (size_t i=0; i<num_images; ++i) {
-            input_doubles[i] = input_pixels[i][chan];
-          } // End image loop
+        // Apply the operations to this row and store in the output pixels
+        double const* result = &slots[m_program.run(slots, width)][0];
+        for (int c = 0; c < width; c++)
+          tile(c, r, chan) = clamp_and_cast<output_channel_type>(result[c]);
 
-          // Apply the operation tree to this pixel and store in the output pixel
-          double newVal = m_operation_tree.applyOperation<double>(input_doubles);
-          //if (newVal > 255)
-          //  std::cout << "Value: " << newVal << " --> " << static_cast<double>(clamp_and_cast<output_channel_type>(newVal)) << "\n";
-          tile(c, r, chan) = clamp_and_cast<output_channel_type>(newVal);
+      } // End channel loop
 
-        } // End channel loop
+      for (int c = 0; c < width; c++) {
+        if (is_nodata[c])
+          tile(c, r) = m_output_nodata;
+      }
 
-      } // End row loop
-    } // End column loop
+    } // End row loop
 
   // Return the tile we created with fake borders to make it look the size of the entire output image
   return prerasterize_type(tile,
@@ -23,6 +23,7 @@
 
 #include <asp/Core/Macros.h>
 #include <asp/Camera/AdjustedLinescanDGModel.h>
+#include <asp/Camera/RayGridCameraModel.h>
 #include <asp/Core/StereoSettings.h>
 #include <vw/BundleAdjustment/ControlNetwork.h>
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
@@ -577,11 +578,15 @@ void jitter_adjust(std::vector<std::string> const& image_files,
       start_index += num_adj_per_cam[icam - 1];
     int end_index = start_index + num_adj_per_cam[icam];
 
-    AdjustedCameraModel* adj_cam
-      = dynamic_cast<AdjustedCameraModel*>(input_camera_models[icam].get());
+    // With --ray-grid-spacing the camera is wrapped in a ray grid,
+    // outside of any bundle adjustment. The piecewise adjustments
+    // are applied to the exact camera, so unwrap it first.
+    boost::shared_ptr<vw::camera::CameraModel> input_cam
+      = unwrap_ray_grid(input_camera_models[icam]);
+    AdjustedCameraModel* adj_cam = dynamic_cast<AdjustedCameraModel*>(input_cam.get());
 
     if (adj_cam == NULL) {
-      camera_models.push_back(input_camera_models[icam]);
+      camera_models.push_back(input_cam);
     }else{
       camera_models.push_back(adj_cam->unadjusted_model());
 
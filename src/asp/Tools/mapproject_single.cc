@@ -28,6 +28,7 @@
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/Image/Algorithms2.h>
 #include <vw/Image/Filter.h>
+#include <vw/Core/Thread.h>
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
@@ -113,6 +114,227 @@ public:
   }
 }; // End class Datum2CamTrans
 
+// Map2CamTrans caches the portion of the DEM it needs in reverse_bbox(), and
+// that must happen before reverse() is called on pixels of that box.
+// Datum2CamTrans needs no such preparation.
+inline void prepare_exact_trans(Map2CamTrans const& trans, vw::BBox2i const& bbox) {
+  trans.reverse_bbox(bbox);
+}
+inline void prepare_exact_trans(Datum2CamTrans const& trans, vw::BBox2i const& bbox) {}
+
+/// Approximate a map-to-camera transform by evaluating it exactly only
+/// on a sparse grid of output pixels, and interpolating bilinearly in
+/// between. Each grid cell is validated by comparing the interpolated
+/// and exact camera pixel at its center. Cells failing the tolerance,
+/// or having a corner which does not project into the camera, are
+/// evaluated exactly at every pixel.
+/// - With a grid spacing of 0 this just forwards to the exact transform.
+/// - The grid is shared among copies of this transform and is filled
+///   lazily, tile by tile, in reverse_bbox(), which the transform view
+///   calls before reverse() on the pixels of that tile.
+template <class TransT>
+class ApproxCamTrans : public vw::TransformBase< ApproxCamTrans<TransT> > {
+
+  enum CellState { CELL_EMPTY = 0, CELL_APPROX, CELL_EXACT };
+
+  struct Grid {
+    vw::Mutex mutex;
+    int num_cols, num_rows;          // Number of cells in each direction
+    std::vector<Vector2> nodes;      // (num_cols+1)*(num_rows+1) camera pixels
+    std::vector<uint8>   node_ready;
+    std::vector<uint8>   cell_state;
+  };
+
+  TransT  m_trans;
+  int     m_spacing;
+  double  m_pixel_tol;
+  Vector2 m_invalid_pix;
+  boost::shared_ptr<Grid> m_grid;
+
+  size_t node_index(int col, int row) const {
+    return size_t(row)*(m_grid->num_cols + 1) + col;
+  }
+  
+  /// Make sure all cells with indices in [col0, col1] x [row0, row1]
+  /// are computed and validated. The exact transforms are done without
+  /// holding the lock, so different tiles are processed in parallel.
+  void fill_cells(int col0, int col1, int row0, int row1) const {
+
+    Grid & grid = *m_grid;
+    int num_local_cols = col1 - col0 + 1, num_local_rows = row1 - row0 + 1;
+    std::vector<Vector2> nodes((num_local_cols + 1)*(num_local_rows + 1));
+    std::vector<uint8>   have_node(nodes.size(), 0);
+    std::vector<uint8>   states(num_local_cols*num_local_rows, CELL_EMPTY);
+    bool any_empty = false;
+
+    // Fetch what other tiles have computed already
+    {
+      vw::Mutex::Lock lock(grid.mutex);
+      for (int row = row0; row <= row1 + 1; row++) {
+        for (int col = col0; col <= col1 + 1; col++) {
+          size_t k = node_index(col, row);
+          if (!grid.node_ready[k]) continue;
+          size_t l = size_t(row - row0)*(num_local_cols + 1) + (col - col0);
+          nodes[l]     = grid.nodes[k];
+          have_node[l] = 1;
+        }
+      }
+      for (int row = row0; row <= row1; row++) {
+        for (int col = col0; col <= col1; col++) {
+          uint8 state = grid.cell_state[size_t(row)*grid.num_cols + col];
+          states[size_t(row - row0)*num_local_cols + (col - col0)] = state;
+          if (state == CELL_EMPTY)
+            any_empty = true;
+        }
+      }
+    }
+    if (!any_empty)
+      return;
+
+    // Evaluate the missing nodes and validate the new cells
+    for (int row = 0; row < num_local_rows; row++) {
+      for (int col = 0; col < num_local_cols; col++) {
+        size_t c = size_t(row)*num_local_cols + col;
+        if (states[c] != CELL_EMPTY)
+          continue;
+
+        Vector2 corners[4];
+        bool all_valid = true;
+        for (int k = 0; k < 4; k++) {
+          int dc = k % 2, dr = k / 2;
+          size_t l = size_t(row + dr)*(num_local_cols + 1) + (col + dc);
+          if (!have_node[l]) {
+            nodes[l] = m_trans.reverse(Vector2(double(col0 + col + dc)*m_spacing,
+                                               double(row0 + row + dr)*m_spacing));
+            have_node[l] = 1;
+          }
+          corners[k] = nodes[l];
+          if (corners[k] == m_invalid_pix)
+            all_valid = false;
+        }
+
+        states[c] = CELL_EXACT;
+        if (!all_valid)
+          continue;
+        
+        Vector2 ctr_pix = Vector2(col0 + col + 0.5, row0 + row + 0.5)*m_spacing;
+        Vector2 exact   = m_trans.reverse(ctr_pix);
+        Vector2 approx  = 0.25*(corners[0] + corners[1] + corners[2] + corners[3]);
+        if (exact != m_invalid_pix && norm_2(exact - approx) <= m_pixel_tol)
+          states[c] = CELL_APPROX;
+      }
+    }
+
+    // Publish the results. Values already published are left untouched,
+    // as other threads may be reading them.
+    vw::Mutex::Lock lock(grid.mutex);
+    for (int row = row0; row <= row1 + 1; row++) {
+      for (int col = col0; col <= col1 + 1; col++) {
+        size_t l = size_t(row - row0)*(num_local_cols + 1) + (col - col0);
+        size_t k = node_index(col, row);
+        if (!have_node[l] || grid.node_ready[k]) continue;
+        grid.nodes[k]      = nodes[l];
+        grid.node_ready[k] = 1;
+      }
+    }
+    for (int row = row0; row <= row1; row++) {
+      for (int col = col0; col <= col1; col++) {
+        size_t k = size_t(row)*grid.num_cols + col;
+        if (grid.cell_state[k] == CELL_EMPTY)
+          grid.cell_state[k] = states[size_t(row - row0)*num_local_cols + (col - col0)];
+      }
+    }
+  }
+
+public:
+  ApproxCamTrans(TransT const& trans, vw::Vector2i const& image_size,
+                 int spacing, double pixel_tol):
+    m_trans(trans), m_spacing(spacing), m_pixel_tol(pixel_tol) {
+
+    m_invalid_pix = vw::camera::CameraModel::invalid_pixel();
+    if (m_spacing <= 0)
+      return;
+
+    m_grid = boost::shared_ptr<Grid>(new Grid);
+    m_grid->num_cols = (image_size[0] + m_spacing - 1)/m_spacing;
+    m_grid->num_rows = (image_size[1] + m_spacing - 1)/m_spacing;
+    size_t num_nodes = size_t(m_grid->num_cols + 1)*(m_grid->num_rows + 1);
+    m_grid->nodes.resize(num_nodes);
+    m_grid->node_ready.resize(num_nodes, 0);
+    m_grid->cell_state.resize(size_t(m_grid->num_cols)*m_grid->num_rows, CELL_EMPTY);
+  }
+
+  /// Convert Map Projected pixel to camera pixel
+  vw::Vector2 reverse(const vw::Vector2 &p) const {
+    if (!m_grid)
+      return m_trans.reverse(p);
+
+    int col = (int)floor(p[0]/m_spacing), row = (int)floor(p[1]/m_spacing);
+    if (col < 0 || col >= m_grid->num_cols || row < 0 || row >= m_grid->num_rows ||
+        m_grid->cell_state[size_t(row)*m_grid->num_cols + col] != CELL_APPROX)
+      return m_trans.reverse(p);
+    
+    // Bilinear interpolation within the cell
+    double dx = p[0]/m_spacing - col, dy = p[1]/m_spacing - row;
+    Vector2 const& n00 = m_grid->nodes[node_index(col,     row    )];
+    Vector2 const& n10 = m_grid->nodes[node_index(col + 1, row    )];
+    Vector2 const& n01 = m_grid->nodes[node_index(col,     row + 1)];
+    Vector2 const& n11 = m_grid->nodes[node_index(col + 1, row + 1)];
+    return (1 - dy)*((1 - dx)*n00 + dx*n10) + dy*((1 - dx)*n01 + dx*n11);
+  }
+
+  /// The camera pixel box is found from the grid. Interpolated
+  /// values are convex combinations of the cell corners, so only
+  /// the corners of approximated cells need to be considered.
+  vw::BBox2i reverse_bbox( vw::BBox2i const& bbox ) const {
+    if (!m_grid || bbox.empty())
+      return m_trans.reverse_bbox(bbox);
+
+    int col0 = (int)floor(double(bbox.min().x())/m_spacing);
+    int row0 = (int)floor(double(bbox.min().y())/m_spacing);
+    int col1 = (int)floor(double(bbox.max().x() - 1)/m_spacing);
+    int row1 = (int)floor(double(bbox.max().y() - 1)/m_spacing);
+    if (col0 < 0 || row0 < 0 || col1 >= m_grid->num_cols || row1 >= m_grid->num_rows)
+      return m_trans.reverse_bbox(bbox); // Outside of the grid, should not happen
+
+    prepare_exact_trans(m_trans, vw::BBox2i(col0*m_spacing, row0*m_spacing,
+                                            (col1 - col0 + 1)*m_spacing + 1,
+                                            (row1 - row0 + 1)*m_spacing + 1));
+    fill_cells(col0, col1, row0, row1);
+
+    vw::BBox2 out_box;
+    for (int row = row0; row <= row1; row++) {
+      for (int col = col0; col <= col1; col++) {
+        if (m_grid->cell_state[size_t(row)*m_grid->num_cols + col] == CELL_APPROX) {
+          out_box.grow(m_grid->nodes[node_index(col,     row    )]);
+          out_box.grow(m_grid->nodes[node_index(col + 1, row    )]);
+          out_box.grow(m_grid->nodes[node_index(col,     row + 1)]);
+          out_box.grow(m_grid->nodes[node_index(col + 1, row + 1)]);
+          continue;
+        }
+        // Exact cell, visit its pixels within the box
+        vw::BBox2i cell_box(col*m_spacing, row*m_spacing, m_spacing, m_spacing);
+        cell_box.crop(bbox);
+        for (int32 y = cell_box.min().y(); y < cell_box.max().y(); ++y) {
+          for (int32 x = cell_box.min().x(); x < cell_box.max().x(); ++x) {
+            Vector2 p = m_trans.reverse(Vector2(x, y));
+            if (p == m_invalid_pix) 
+              continue;
+            out_box.grow(p);
+          }
+        }
+      }
+    }
+    out_box = grow_bbox_to_int(out_box);
+
+    // Need the check below as to not try to create images with negative dimensions.
+    if (out_box.empty())
+      out_box = vw::BBox2i(0, 0, 0, 0);
+
+    return out_box;
+  }
+}; // End class ApproxCamTrans
+
 
 
 
@@ -124,11 +346,12 @@ struct Options : vw::cartography::GdalWriteOptions {
   // Input
   std::string dem_file, image_file, camera_file, output_file, stereo_session,
     bundle_adjust_prefix;
-  bool isQuery, noGeoHeaderInfo;
+  bool isQuery, noGeoHeaderInfo, dg_line_table;
 
   // Settings
   std::string target_srs_string, output_type, metadata;
-  double nodata_value, tr, mpp, ppd, datum_offset;
+  double nodata_value, tr, mpp, ppd, datum_offset, approx_pixel_tol;
+  int    approx_grid_spacing;
   BBox2 target_projwin, target_pixelwin;
 };
 
@@ -161,7 +384,13 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("ot",  po::value(&opt.output_type)->default_value("Float32"), "Output data type, when the input is single channel. Supported types: Byte, UInt16, Int16, UInt32, Int32, Float32. If the output type is a kind of integer, values are rounded and then clamped to the limits of that type. This option will be ignored for multi-channel images, when the output type is set to be the same as the input type.")
     ("mo",  po::value(&opt.metadata)->default_value(""), "Write metadata to the output file. Provide as a string in quotes if more than one item, separated by a space, such as 'VAR1=VALUE1 VAR2=VALUE2'. Neither the variable names nor the values should contain spaces.")
     ("no-geoheader-info", po::bool_switch(&opt.noGeoHeaderInfo)->default_value(false),
-     "Suppress writing some auxiliary information in geoheaders.");
+     "Suppress writing some auxiliary information in geoheaders.")
+    ("approx-grid-spacing", po::value(&opt.approx_grid_spacing)->default_value(0),
+     "If positive, project into the camera exactly only at output pixels on a grid with this spacing (such as 16 to 64), and interpolate bilinearly in between. Much faster for linescan and ISIS cameras. Grid cells failing the --approx-pixel-tol check are projected exactly.")
+    ("approx-pixel-tol", po::value(&opt.approx_pixel_tol)->default_value(0.1),
+     "With --approx-grid-spacing, the maximum allowed difference, in camera pixels, between the interpolated and exact projection at the center of a grid cell.")
+    ("dg-line-table", po::bool_switch(&opt.dg_line_table)->default_value(false)->implicit_value(true),
+     "For Digital Globe cameras, tabulate the camera position, velocity, and orientation once per image line, and interpolate in this table rather than in the satellite ephemeris and attitude. This is faster, with very small differences in the results.");
   
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -189,6 +418,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if ( !vm.count("dem") || !vm.count("camera-image") || !vm.count("camera-model") )
     vw_throw( ArgumentErr() << usage << general_options );
 
+  if (opt.approx_grid_spacing < 0)
+    vw_throw( ArgumentErr() << "The value of --approx-grid-spacing must be non-negative.\n" );
+  if (opt.approx_grid_spacing > 0 && opt.approx_pixel_tol <= 0)
+    vw_throw( ArgumentErr() << "The value of --approx-pixel-tol must be positive.\n" );
+
   // We support map-projecting using the DG camera model, however, these images
   // cannot be used later to do stereo, as that process expects the images
   // to be map-projected using the RPC model.
@@ -204,6 +438,7 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   // Need this to be able to load adjusted camera models. That will happen
   // in the stereo session.
   asp::stereo_settings().bundle_adjust_prefix = opt.bundle_adjust_prefix;
+  asp::stereo_settings().dg_line_table        = opt.dg_line_table;
 
   if (fs::path(opt.dem_file).extension() != "") {
     // A path to a real DEM file was provided, load it!
@@ -583,23 +818,29 @@ void project_image_nodata_pick_transform(Options & opt,
     // A DEM file was provided
     return project_image_nodata<ImagePixelT>(opt, croppedGeoRef,
                                              virtual_image_size, croppedImageBB, camera_model, 
-                                             Map2CamTrans( // Converts coordinates in DEM
-                                                           // georeference to camera pixels
-                                                          camera_model.get(), target_georef,
-                                                          dem_georef, opt.dem_file, image_size,
-                                                          call_from_mapproject
-                                                          )
+                                             ApproxCamTrans<Map2CamTrans>
+                                             (Map2CamTrans( // Converts coordinates in DEM
+                                                            // georeference to camera pixels
+                                                           camera_model.get(), target_georef,
+                                                           dem_georef, opt.dem_file, image_size,
+                                                           call_from_mapproject
+                                                           ),
+                                              virtual_image_size, opt.approx_grid_spacing,
+                                              opt.approx_pixel_tol)
                                             );
   } else {
     // A constant datum elevation was provided
     return project_image_nodata<ImagePixelT>(opt, croppedGeoRef,
                                              virtual_image_size, croppedImageBB, camera_model, 
-                                             Datum2CamTrans( // Converts coordinates in DEM
-                                                             // georeference to camera pixels
-                                                            camera_model.get(), target_georef,
-                                                            dem_georef, opt.datum_offset, image_size,
-                                                            call_from_mapproject
-                                                            )
+                                             ApproxCamTrans<Datum2CamTrans>
+                                             (Datum2CamTrans( // Converts coordinates in DEM
+                                                              // georeference to camera pixels
+                                                             camera_model.get(), target_georef,
+                                                             dem_georef, opt.datum_offset, image_size,
+                                                             call_from_mapproject
+                                                             ),
+                                              virtual_image_size, opt.approx_grid_spacing,
+                                              opt.approx_pixel_tol)
                                             );
   }
 }
@@ -618,23 +859,29 @@ void project_image_alpha_pick_transform(Options & opt,
     // A DEM file was provided
     return project_image_alpha<ImagePixelT>(opt, croppedGeoRef,
                                             virtual_image_size, croppedImageBB, camera_model, 
-                                            Map2CamTrans( // Converts coordinates in DEM
-                                                          // georeference to camera pixels
-                                                         camera_model.get(), target_georef,
-                                                         dem_georef, opt.dem_file, image_size,
-                                                         call_from_mapproject
-                                                         )
+                                            ApproxCamTrans<Map2CamTrans>
+                                            (Map2CamTrans( // Converts coordinates in DEM
+                                                           // georeference to camera pixels
+                                                          camera_model.get(), target_georef,
+                                                          dem_georef, opt.dem_file, image_size,
+                                                          call_from_mapproject
+                                                          ),
+                                             virtual_image_size, opt.approx_grid_spacing,
+                                             opt.approx_pixel_tol)
                                            );
   } else {
     // A constant datum elevation was provided
     return project_image_alpha<ImagePixelT>(opt, croppedGeoRef,
                                             virtual_image_size, croppedImageBB, camera_model, 
-                                            Datum2CamTrans( // Converts coordinates in DEM
-                                                            // georeference to camera pixels
-                                                           camera_model.get(), target_georef,
-                                                           dem_georef, opt.datum_offset, image_size,
-                                                           call_from_mapproject
-                                                           )
+                                            ApproxCamTrans<Datum2CamTrans>
+                                            (Datum2CamTrans( // Converts coordinates in DEM
+                                                             // georeference to camera pixels
+                                                            camera_model.get(), target_georef,
+                                                            dem_georef, opt.datum_offset, image_size,
+                                                            call_from_mapproject
+                                                            ),
+                                             virtual_image_size, opt.approx_grid_spacing,
+                                             opt.approx_pixel_tol)
                                            );
   }
 }
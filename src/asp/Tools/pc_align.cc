@@ -54,6 +54,7 @@
 #include <vw/Cartography/PointImageManipulation.h>
 #include <vw/FileIO/DiskImageUtils.h>
 #include <vw/Core/CmdUtils.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
@@ -62,6 +63,8 @@
 
 #include <limits>
 #include <cstring>
+#include <set>
+#include <sstream>
 
 #include <pointmatcher/PointMatcher.h>
 #include <ceres/ceres.h>
@@ -95,20 +98,23 @@ struct Options : public vw::cartography::GdalWriteOptions {
   PointMatcher<RealT>::Matrix init_transform;
   int    num_iter,
          max_num_reference_points,
-         max_num_source_points;
+         max_num_source_points,
+         pyramid_levels;
   double diff_translation_err,
          diff_rotation_err,
          max_disp,
          outlier_ratio,
          semi_major,
-         semi_minor;
+         semi_minor,
+         pyramid_voxel_size;
   bool   compute_translation_only,
          dont_use_dem_distances,
          save_trans_source,
          save_trans_ref,
          highest_accuracy,
          verbose;
-  std::string initial_ned_translation, hillshading_transform;
+  std::string initial_ned_translation, hillshading_transform, reference_cache, source_list;
+  std::vector<std::string> source_files; // From the source list
   
   // Output
   string out_prefix;
@@ -137,8 +143,16 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                                  "Fraction of source (movable) points considered inliers (after gross outliers further than max-displacement from reference points are removed).")
     ("max-num-reference-points", po::value(&opt.max_num_reference_points)->default_value(100000000),
                                  "Maximum number of (randomly picked) reference points to use.")
+    ("reference-cache",          po::value(&opt.reference_cache)->default_value(""),
+                                 "Load the reference points from this file, which stores them grouped in lon-lat buckets, reading only the buckets overlapping the source cloud. Create it (and its index, with the .index suffix) if it does not exist, or if the reference, the datum, or the CSV format or projection changed. Useful when aligning many source clouds to the same reference.")
+    ("source-list",              po::value(&opt.source_list)->default_value(""),
+                                 "Align each of the source clouds listed in this file, one per line, to the reference cloud, in place of a single source cloud. The reference is loaded only once, for the union of the regions of all sources, with --max-num-reference-points scaled by the ratio of the area of that union to the largest region of one source, so that the reference points are about as dense as when aligning that source alone. The sources are aligned in parallel, and each thread builds its own tree of the reference points, so each of the --threads threads needs the memory for a tree and for a source cloud. The outputs for each source are saved with the output prefix followed by a dash and the name of the source file without its extension.")
     ("max-num-source-points",    po::value(&opt.max_num_source_points)->default_value(100000),
                                  "Maximum number of (randomly picked) source points to use (after discarding gross outliers).")
+    ("pyramid-levels",           po::value(&opt.pyramid_levels)->default_value(0),
+                                 "If positive, first align voxel-downsampled versions of the clouds at this many levels of increasing voxel size, from the coarsest to the finest, and finish with the clouds at full density. Each level starts with the transform of the previous one, and ignores source points farther from the reference than a few voxels of the previous level. Helps with large initial offsets. Not used with the least squares methods.")
+    ("pyramid-voxel-size",       po::value(&opt.pyramid_voxel_size)->default_value(0),
+                                 "The voxel size of the finest coarse level of the pyramid, in meters. Each coarser level has twice the voxel size of the previous one. If not set, use four times the estimated spacing of the reference points.")
     ("alignment-method",         po::value(&opt.alignment_method)->default_value("point-to-plane"),
                                  "The type of iterative closest point method to use. [point-to-plane, point-to-point, similarity-point-to-point, least-squares, similarity-least-squares]")
     ("highest-accuracy",         po::bool_switch(&opt.highest_accuracy)->default_value(false)->implicit_value(true),
@@ -198,9 +212,28 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                              positional, positional_desc, usage,
                              allow_unregistered, unregistered );
 
-  if ( opt.reference.empty() || opt.source.empty() )
+  if ( opt.reference.empty() || (opt.source.empty() && opt.source_list.empty()) )
     vw_throw( ArgumentErr() << "Missing input files.\n" << usage << general_options );
 
+  if (opt.source_list != "") {
+    if (!opt.source.empty())
+      vw_throw( ArgumentErr() << "Cannot specify both a source cloud and a source list.\n"
+                << usage << general_options );
+    if (opt.hillshading_transform != "" || opt.match_file != "" || opt.save_trans_ref)
+      vw_throw( ArgumentErr() << "The options --initial-transform-from-hillshading, "
+                << "--match-file, and --save-inv-transformed-reference-points "
+                << "cannot be used with a source list.\n" );
+
+    ifstream is(opt.source_list.c_str());
+    string file;
+    while (is >> file)
+      opt.source_files.push_back(file);
+    if (opt.source_files.empty())
+      vw_throw( ArgumentErr() << "No source clouds were found in: " << opt.source_list << ".\n" );
+  }else{
+    opt.source_files.push_back(opt.source);
+  }
+
   if ( opt.out_prefix.empty() )
     vw_throw( ArgumentErr() << "Missing output prefix.\n" << usage << general_options );
 
@@ -281,6 +314,16 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 	      << "least-squares, and similarity-least-squares.\n"
 	      << usage << general_options );
 
+  if (opt.pyramid_levels < 0 || opt.pyramid_voxel_size < 0)
+    vw_throw( ArgumentErr() << "The number of pyramid levels and the pyramid voxel size "
+              << "must be non-negative.\n" << usage << general_options );
+
+  if (opt.pyramid_levels > 0 &&
+      (opt.alignment_method == "least-squares" ||
+       opt.alignment_method == "similarity-least-squares"))
+    vw_throw( ArgumentErr() << "The pyramid of clouds can be used only with "
+              << "the iterative closest point methods.\n" );
+
   if ( (opt.alignment_method == "least-squares" ||
 	opt.alignment_method == "similarity-least-squares")
        && asp::get_cloud_type(opt.reference) != "DEM")
@@ -587,33 +630,23 @@ void debug_save_point_cloud(DP const& point_cloud, GeoReference const& geo,
 /// - If there is a problem computing the point error, a very large number is used as a flag.
 void calcErrorsWithDem(DP          const& point_cloud,
                        vw::Vector3 const& point_cloud_shift,
-                       vw::cartography::GeoReference        const& georef,
-                       vw::ImageViewRef< PixelMask<float> > const& dem,
+                       DemHeightLookup const& dem,
+                       int num_threads,
                        std::vector<double> &errors) {
 
-  // Initialize output error storage
-  const int num_pts = point_cloud.features.cols();
-  errors.resize(num_pts);
+  std::vector<vw::uint8> is_valid;
+  dem.heights_above_dem(point_cloud, point_cloud_shift, num_threads, errors, is_valid);
 
-  // Loop through every point in the point cloud
-  double dem_height_here;
+  const int num_pts = errors.size();
   for(int i=0; i<num_pts; ++i){
-    // Extract and un-shift the point to get the real GCC coordinate
-    Vector3 gcc_coord = get_cloud_gcc_coord(point_cloud, point_cloud_shift, i);
-
-    // Convert from GDC to GCC
-    Vector3 llh = georef.datum().cartesian_to_geodetic(gcc_coord); // lon-lat-height
-
-    // Interpolate the point at this location
-    if (!interp_dem_height(dem, georef, llh, dem_height_here)) {
+    if (!is_valid[i]) {
       // If we did not intersect the DEM, record a flag error value here.
       errors[i] = BIG_NUMBER;
     }
     else { // Success, the error is the absolute height difference
-      errors[i] = std::abs(llh[2] - dem_height_here);
+      errors[i] = std::abs(errors[i]);
     }
-
-  } // End loop through all points
+  }
 
 }
 
@@ -634,12 +667,11 @@ void extract_rotation_translation(F       * transform,
 // Discrepancy between a 3D point with the rotation to be solved
 // applied to it, and its projection straight down onto the DEM. Used
 // with the least squares method of finding the best transform between
-// clouds.
+// clouds. The DEM lookup is thread-safe, so Ceres can evaluate the
+// residuals in parallel.
 struct PointToDemError {
-  PointToDemError(Vector3 const& point,
-		 ImageViewRef< PixelMask<float> > const& dem,
-		 cartography::GeoReference const& geo):
-    m_point(point), m_dem(dem), m_geo(geo){}
+  PointToDemError(Vector3 const& point, DemHeightLookup const& dem):
+    m_point(point), m_dem(dem){}
 
   template <typename F>
   bool operator()(const F* const transform, const F* const scale, F* residuals) const {
@@ -653,43 +685,37 @@ struct PointToDemError {
     extract_rotation_translation(transform, rotation, translation);
 
     Vector3 trans_point = scale[0]*rotation.rotate(m_point) + translation;
-    
-    // Convert from GDC to GCC
-    Vector3 llh = m_geo.datum().cartesian_to_geodetic(trans_point); // lon-lat-height
 
-    // Interpolate the point at this location
-    double dem_height_here;
-    if (!interp_dem_height(m_dem, m_geo, llh, dem_height_here)) {
+    // The height of the point above the DEM
+    double height;
+    if (!m_dem.height_above_dem(trans_point, height)) {
       // If we did not intersect the DEM, record a flag error value here.
       residuals[0] = F(0.0);
       return true;
     }
-    
-    residuals[0] = llh[2] - dem_height_here;
+
+    residuals[0] = height;
     return true;
   }
   
   // Factory to hide the construction of the CostFunction object from
   // the client code.
   static ceres::CostFunction* Create(Vector3 const& point,
-				     ImageViewRef< PixelMask<float> > const& dem,
-				     vw::cartography::GeoReference const& geo){
+				     DemHeightLookup const& dem){
     return (new ceres::NumericDiffCostFunction<PointToDemError,
 	    ceres::CENTRAL, 1, 6, 1>
-	    (new PointToDemError(point, dem, geo)));
+	    (new PointToDemError(point, dem)));
   }
 
-  Vector3                                  m_point;
-  ImageViewRef< PixelMask<float> > const & m_dem;    // alias
-  cartography::GeoReference        const & m_geo;    // alias
+  Vector3                 m_point;
+  DemHeightLookup const & m_dem;    // alias
 };
 
 /// Compute alignment using least squares
 PointMatcher<RealT>::Matrix
 least_squares_alignment(DP & source_point_cloud, // Should not be modified
 			vw::Vector3 const& point_cloud_shift,
-			vw::cartography::GeoReference        const& dem_georef,
-			vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+			DemHeightLookup const& dem,
 			Options const& opt) {
 
   ceres::Problem problem;
@@ -709,7 +735,7 @@ least_squares_alignment(DP & source_point_cloud, // Should not be modified
     Vector3 gcc_coord = get_cloud_gcc_coord(source_point_cloud, point_cloud_shift, i);
 
     ceres::CostFunction* cost_function =
-      PointToDemError::Create(gcc_coord, dem_ref, dem_georef);
+      PointToDemError::Create(gcc_coord, dem);
     ceres::LossFunction* loss_function = new ceres::CauchyLoss(0.5); // NULL;
     problem.AddResidualBlock(cost_function, loss_function, &transform[0], &scale);
     
@@ -818,8 +844,7 @@ double compute_registration_error(DP          const& ref_point_cloud,
                                   DP               & source_point_cloud, // Should not be modified
                                   PM::ICP          & pm_icp_object, // Must already be initialized
                                   vw::Vector3 const& shift,
-                                  vw::cartography::GeoReference        const& dem_georef,
-                                  vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+                                  DemHeightLookup const* dem, // Must be set if using DEM distances
                                   Options const& opt,
                                   PointMatcher<RealT>::Matrix &error_matrix) {
   Stopwatch sw;
@@ -833,7 +858,7 @@ double compute_registration_error(DP          const& ref_point_cloud,
   if (opt.use_dem_distances()) {
     // Compute the distance from each point to the DEM
     std::vector<double> dem_errors;
-    calcErrorsWithDem(source_point_cloud, shift, dem_georef, dem_ref, dem_errors);
+    calcErrorsWithDem(source_point_cloud, shift, *dem, opt.num_threads, dem_errors);
 
     // For each point use the lower of the two calculated errors.
     update_best_error(dem_errors, error_matrix);
@@ -852,8 +877,7 @@ void filter_source_cloud(DP          const& ref_point_cloud,
                          DP               & source_point_cloud,
                          PM::ICP          & pm_icp_object, // Must already be initialized
                          vw::Vector3 const& shift,
-                         vw::cartography::GeoReference        const& dem_georef,
-                         vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+                         DemHeightLookup const* dem, // Must be set if using DEM distances
                          Options const& opt) {
 
   // Filter gross outliers
@@ -867,8 +891,8 @@ void filter_source_cloud(DP          const& ref_point_cloud,
   try {
     if (opt.use_dem_distances()) {
       // Compute the registration error using the best available means
-      compute_registration_error(ref_point_cloud, source_point_cloud, pm_icp_object, shift,
-                                 dem_georef, dem_ref, opt, error_matrix);
+      compute_registration_error(ref_point_cloud, source_point_cloud, pm_icp_object,
+                                 shift, dem, opt, error_matrix);
 
       filterPointsByError(source_point_cloud, error_matrix, opt.max_disp);
     } else { // LPM only method
@@ -1136,9 +1160,10 @@ vw::Vector3 estimate_ref_cloud_centroid(vw::cartography::GeoReference const& geo
   // Load a sample of points, hopefully enough to estimate the centroid
   // reliably.
   int num_sample_pts = 1000000;
+  std::mt19937 generator(0);
   load_cloud(file_name, num_sample_pts, dummy_box,
 	     calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-	     mean_longitude, verbose, points);
+	     mean_longitude, verbose, generator, points);
 
 
   int numRefPts = points.features.cols();
@@ -1185,6 +1210,506 @@ void adjust_and_intersect_ref_source_boxes(BBox2 & ref_box, BBox2 & source_box,
   adjust_lonlat_bbox(source, source_box);
 }
 
+/// A source cloud to align, and where to save the results
+struct SourceJob {
+  std::string source, out_prefix;
+  BBox2       source_box; // The source points to load, in lon-lat
+  BBox2       ref_box;    // The reference points needed for this source
+  int         seed;       // Of the random subsampling of the source points
+};
+
+/// The libpointmatcher ICP objects used to align one source. Each
+/// holds its own tree of the reference points, at full density and at
+/// each coarse level of the pyramid. They are not thread-safe, so
+/// each source aligned at the same time needs its own set.
+struct IcpSet {
+  PM::ICP                                   icp;
+  std::vector< boost::shared_ptr<PM::ICP> > pyramid_icps;
+};
+typedef boost::shared_ptr<IcpSet> IcpSetPtr;
+
+/// The reference cloud, and all else shared by the alignment of the
+/// source clouds. It is only read while the sources are aligned,
+/// except for the pool of ICP objects, which is used under the mutex.
+struct AlignmentReference {
+  GeoReference                geo;
+  asp::CsvConv                csv_conv;
+  DP                          ref_point_cloud;
+  Vector3                     load_shift;   // The points are loaded with this subtracted
+  Eigen::VectorXd             ref_centroid; // Then this is subtracted as well
+  Vector3                     shift;        // The sum of the two
+  bool                        is_lola_rdr_format;
+  PointMatcher<RealT>::Matrix initT;        // The initial transform, in shifted coordinates
+  boost::shared_ptr<DemHeightLookup> ref_dem; // Set if the DEM is needed
+
+  // The coarse levels of the pyramid, from the finest to the coarsest
+  std::vector<double> pyramid_voxel_sizes;
+  std::vector<DP>     pyramid_refs;
+
+  // The ICP objects not in use by any source
+  std::vector<IcpSetPtr> free_icps;
+  vw::Mutex              icp_mutex;
+};
+
+// At each level of the pyramid, source points farther than this many
+// voxels of the previous, coarser, level from the reference are ignored.
+const double PYRAMID_OUTLIER_FACTOR = 3.0;
+
+/// Set the ICP parameters from the command line or the configuration file
+void set_icp_params(Options const& opt, PM::ICP & icp){
+  if (opt.config_file == ""){
+    // Read the options from the command line
+    icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
+                  (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
+                  opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
+                  false/*opt.verbose*/);
+  }else{
+    vw_out() << "Will read the options from: " << opt.config_file << endl;
+    ifstream ifs(opt.config_file.c_str());
+    if (!ifs.good())
+      vw_throw( ArgumentErr() << "Cannot open configuration file: "
+                << opt.config_file << "\n" );
+    icp.loadFromYaml(ifs);
+  }
+}
+
+/// Voxel-downsample the reference for each coarse level of the pyramid
+void build_reference_pyramid(Options const& opt, AlignmentReference & ref){
+
+  double voxel_size = opt.pyramid_voxel_size;
+  if (voxel_size <= 0) {
+    voxel_size = 4.0*estimate_point_spacing(ref.ref_point_cloud.features);
+    if (voxel_size <= 0)
+      vw_throw( ArgumentErr() << "Cannot estimate the spacing of the reference points. "
+                << "Set --pyramid-voxel-size.\n" );
+  }
+
+  // The ICP objects may keep pointers to these clouds
+  ref.pyramid_refs.reserve(opt.pyramid_levels);
+  for (int level = 1; level <= opt.pyramid_levels; level++) {
+    Stopwatch sw;
+    sw.start();
+    ref.pyramid_voxel_sizes.push_back(voxel_size);
+    ref.pyramid_refs.push_back(DP());
+    voxel_downsample(ref.ref_point_cloud, voxel_size, ref.pyramid_refs.back());
+    sw.stop();
+    vw_out() << "Pyramid level " << level << ": voxel size " << voxel_size << " m, "
+             << ref.pyramid_refs.back().features.cols() << " reference points. "
+             << "Building it took " << sw.elapsed_seconds() << " [s]" << endl;
+    voxel_size *= 2.0;
+  }
+}
+
+/// Build the trees of the reference points, at full density and at
+/// each level of the pyramid. The reference clouds are only read.
+IcpSetPtr build_icp_set(Options const& opt, AlignmentReference & ref){
+  IcpSetPtr icps(new IcpSet);
+  icps->icp.initRefTree(ref.ref_point_cloud, alignment_method_fallback(opt.alignment_method),
+                        opt.highest_accuracy, false /*opt.verbose*/);
+  for (size_t level = 0; level < ref.pyramid_refs.size(); level++) {
+    boost::shared_ptr<PM::ICP> icp(new PM::ICP);
+    icp->initRefTree(ref.pyramid_refs[level], alignment_method_fallback(opt.alignment_method),
+                     opt.highest_accuracy, false /*opt.verbose*/);
+    icps->pyramid_icps.push_back(icp);
+  }
+  return icps;
+}
+
+/// Take ICP objects not in use by another source, or build new ones
+/// if all are in use. So there are as many sets of trees as sources
+/// aligned at the same time, at most one per thread.
+IcpSetPtr acquire_icp_set(Options const& opt, AlignmentReference & ref){
+  {
+    vw::Mutex::Lock lock(ref.icp_mutex);
+    if (!ref.free_icps.empty()) {
+      IcpSetPtr icps = ref.free_icps.back();
+      ref.free_icps.pop_back();
+      return icps;
+    }
+  }
+  vw_out() << "Building another copy of the reference cloud tree, "
+           << "to align more sources at the same time." << endl;
+  return build_icp_set(opt, ref);
+}
+
+void release_icp_set(AlignmentReference & ref, IcpSetPtr icps){
+  vw::Mutex::Lock lock(ref.icp_mutex);
+  ref.free_icps.push_back(icps);
+}
+
+/// Align the source to the reference at the coarse levels of the
+/// pyramid, from the coarsest to the finest. Return the transform
+/// found, and the source points, with it applied, which are close
+/// enough to the reference to be used at full density.
+PointMatcher<RealT>::Matrix
+pyramid_alignment(Options const& opt, AlignmentReference const& ref, IcpSet & icps,
+                  DP const& source_point_cloud, DP & full_source){
+
+  PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+  PointMatcher<RealT>::Matrix T  = Id;
+  PointMatcher<RealT>::Matrix errors;
+  int num_levels = ref.pyramid_refs.size();
+  for (int level = num_levels; level >= 0; level--) {
+
+    Stopwatch sw;
+    sw.start();
+    DP level_source;
+    if (level > 0)
+      voxel_downsample(source_point_cloud, ref.pyramid_voxel_sizes[level-1], level_source);
+    else
+      level_source = source_point_cloud;
+    apply_transform_to_cloud(T, level_source);
+
+    DP      const& level_ref = (level > 0) ? ref.pyramid_refs[level-1]  : ref.ref_point_cloud;
+    PM::ICP      & level_icp = (level > 0) ? *icps.pyramid_icps[level-1] : icps.icp;
+
+    // Ignore the source points which are still far from the reference.
+    // At the coarsest level, only --max-displacement applies.
+    if (level < num_levels) {
+      double max_dist = PYRAMID_OUTLIER_FACTOR*ref.pyramid_voxel_sizes[level];
+      try {
+        level_icp.filterGrossOutliersAndCalcErrors(level_ref, max_dist, level_source, errors);
+      }catch(const PointMatcher<RealT>::ConvergenceError & e){
+        vw_throw( ArgumentErr() << "No source points are within " << max_dist
+                  << " m of the reference at pyramid level " << level
+                  << ". The pyramid voxel size may be too small.\n");
+      }
+    }
+
+    // At full density, the caller does the rest
+    if (level == 0) {
+      full_source = level_source;
+      break;
+    }
+
+    set_icp_params(opt, level_icp);
+    PointMatcher<RealT>::Matrix levelT = level_icp(level_source, level_ref, Id,
+                                                   opt.compute_translation_only);
+    T = levelT*T;
+    apply_transform_to_cloud(levelT, level_source);
+    level_icp.filterGrossOutliersAndCalcErrors(level_ref, BIG_NUMBER, level_source, errors);
+    sw.stop();
+
+    std::ostringstream label;
+    label << "Pyramid level " << level;
+    vw_out() << label.str() << ": voxel size " << ref.pyramid_voxel_sizes[level-1]
+             << " m, " << level_source.features.cols() << " source points. "
+             << "Alignment took " << sw.elapsed_seconds() << " [s]" << endl;
+    calc_stats(label.str(), errors);
+  }
+
+  return T;
+}
+
+/// Find the region of the source cloud to load, and the region of
+/// the reference cloud it needs, given the extended box of the
+/// reference cloud, and that box transformed to the source cloud.
+void find_source_boxes(Options const& opt, GeoReference const& geo,
+                       asp::CsvConv const& csv_conv, int num_sample_pts,
+                       BBox2 ref_box, BBox2 trans_ref_box, SourceJob & job){
+
+  BBox2 source_box, trans_source_box;
+  calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
+                            job.source, opt.max_disp, opt.init_transform,
+                            source_box, trans_source_box);
+
+  // When boxes are huge, it is hard to do the optimization of intersecting
+  // them, as they may differ not by 0 or 360, but by 180. Better do nothing
+  // in that case. The solution may degrade a bit, as we may load points
+  // not in the intersection of the boxes, but at least it won't be wrong.
+  // In this case, there is a chance the boxes were computed wrong anyway.
+  if (ref_box.width() > 180.0 || source_box.width() > 180.0) {
+    vw_out() << "Warning: Your input point clouds are spread over more than half the planet. "
+             << "It is suggested that they be cropped, to get more accurate results.\n";
+    ref_box = BBox2();
+    source_box = BBox2();
+  }
+    
+  vw_out() << "Reference box: " << ref_box << std::endl;
+  vw_out() << "Source box:    " << source_box << std::endl;
+
+  if (!ref_box.empty() && !source_box.empty()) {
+    adjust_and_intersect_ref_source_boxes(ref_box, trans_source_box, opt.reference, job.source);
+    adjust_and_intersect_ref_source_boxes(trans_ref_box, source_box, opt.reference, job.source);
+  }
+
+  vw_out() << "Intersection reference box:  " << ref_box    << std::endl;
+  vw_out() << "Intersection source    box:  " << source_box << std::endl;
+
+  job.ref_box    = ref_box;
+  job.source_box = source_box;
+}
+
+/// Align one source cloud to the reference, and save the transform,
+/// the errors, and the other outputs with the prefix of this source.
+/// The ICP objects must not be in use by other sources.
+void align_source(Options const& batch_opt, AlignmentReference const& ref, IcpSet & icps,
+                  SourceJob const& job){
+
+  Options opt = batch_opt;
+  opt.source     = job.source;
+  opt.out_prefix = job.out_prefix;
+
+  // When many sources are aligned at once, each already runs on one
+  // of the --threads threads, so it should not start more of its own
+  // for the DEM errors and the least squares solver.
+  if (batch_opt.source_files.size() > 1)
+    opt.num_threads = 1;
+
+  // A copy of the georeference for each source, as its projection
+  // is not thread-safe. Likewise, a random generator for each source.
+  GeoReference        geo      = ref.geo;
+  asp::CsvConv const& csv_conv = ref.csv_conv;
+  Vector3             shift    = ref.shift;
+  std::mt19937        generator(job.seed);
+  double elapsed_time;
+
+  // Load the subsampled source point cloud. If the user wants
+  // to filter gross outliers in the source points based on
+  // max_disp, load a lot more points than asked, filter based on
+  // max_disp, then resample to the number desired by the user.
+  int num_source_pts = opt.max_num_source_points;
+  if (opt.max_disp > 0.0)
+    num_source_pts = max(num_source_pts, 50000000);
+  bool    calc_shift            = false; // Use the same shift used for the reference point cloud
+  Vector3 load_shift            = ref.load_shift;
+  bool    is_lola_rdr_format    = ref.is_lola_rdr_format; // may get overwritten
+  double  mean_source_longitude = 0.0;                    // may get overwritten
+  Stopwatch sw2;
+  sw2.start();
+  DP source_point_cloud;
+  load_cloud(opt.source, num_source_pts, job.source_box, 
+             calc_shift, load_shift, geo, csv_conv, is_lola_rdr_format,
+             mean_source_longitude, opt.verbose, generator, source_point_cloud);
+  sw2.stop();
+  if (opt.verbose)
+    vw_out() << "Loading the source point cloud took "
+             << sw2.elapsed_seconds() << " [s]" << endl;
+
+  // Place the centroid of the reference at the origin, as was done
+  // for the reference points.
+  source_point_cloud.features.topRows(DIM).colwise() -= ref.ref_centroid.head(DIM);
+
+  // Apply the initial guess transform to the source point cloud.
+  apply_transform_to_cloud(ref.initT, source_point_cloud);
+    
+  PointMatcher<RealT>::Matrix beg_errors;
+  if (opt.max_disp > 0.0){
+    // Filter gross outliers
+    filter_source_cloud(ref.ref_point_cloud, source_point_cloud, icps.icp,
+                        shift, ref.ref_dem.get(), opt);
+  }
+
+  random_pc_subsample(opt.max_num_source_points, generator, source_point_cloud.features);
+  vw_out() << "Reducing number of source points to "
+           << source_point_cloud.features.cols() << endl;
+
+  //dump_llh("ref.csv", datum, ref_point_cloud,    shift);
+  //dump_llh("src.csv", datum, source, shift);
+
+  elapsed_time = compute_registration_error(ref.ref_point_cloud, source_point_cloud,
+                                            icps.icp, shift,
+                                            ref.ref_dem.get(), opt, beg_errors);
+  calc_stats("Input", beg_errors);
+  if (opt.verbose)
+    vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
+
+  // Compute the transformation to align the source to reference.
+  Stopwatch sw4;
+  sw4.start();
+  PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+
+  // We bypass calling ICP if the user explicitely asks for 0 iterations.
+  PointMatcher<RealT>::Matrix T = Id;
+  if (opt.num_iter > 0){
+    if (opt.alignment_method != "least-squares" &&
+        opt.alignment_method != "similarity-least-squares") {
+
+      // With a pyramid, start from the transform found at the coarse
+      // levels, with the points still far from the reference removed.
+      PointMatcher<RealT>::Matrix pyramidT = Id;
+      DP pyramid_source;
+      if (!ref.pyramid_refs.empty())
+        pyramidT = pyramid_alignment(opt, ref, icps, source_point_cloud, pyramid_source);
+      DP & icp_source = ref.pyramid_refs.empty() ? source_point_cloud : pyramid_source;
+
+      set_icp_params(opt, icps.icp);
+      T = icps.icp(icp_source, ref.ref_point_cloud, Id,
+                   opt.compute_translation_only)*pyramidT;
+      vw_out() << "Match ratio: "
+               << icps.icp.errorMinimizer->getWeightedPointUsedRatio() << endl;
+    }else{
+      T = least_squares_alignment(source_point_cloud, shift, *ref.ref_dem, opt);
+    }
+  }
+  sw4.stop();
+  if (opt.verbose)
+    vw_out() << "Alignment took " << sw4.elapsed_seconds() << " [s]" << endl;
+
+  // Transform the source to make it close to reference.
+  DP trans_source_point_cloud(source_point_cloud);
+  apply_transform_to_cloud(T, trans_source_point_cloud);
+
+  // Calculate by how much points move as result of T
+  double max_obtained_disp = calc_max_displacment(source_point_cloud, trans_source_point_cloud);
+  Vector3 source_ctr_vec, source_ctr_llh;
+  Vector3 trans_xyz, trans_ned, trans_llh;
+  vw::Matrix3x3 NED2ECEF;
+  calc_translation_vec(ref.initT, source_point_cloud, trans_source_point_cloud, shift,
+                       geo.datum(), source_ctr_vec, source_ctr_llh,
+                       trans_xyz, trans_ned, trans_llh, NED2ECEF);
+
+  // For each point, compute the distance to the nearest reference point.
+  PointMatcher<RealT>::Matrix end_errors;
+  elapsed_time = compute_registration_error(ref.ref_point_cloud, trans_source_point_cloud,
+                                            icps.icp, shift,
+                                            ref.ref_dem.get(), opt, end_errors);
+  calc_stats("Output", end_errors);
+  if (opt.verbose)
+    vw_out() << "Final error computation took " << elapsed_time << " [s]" << endl;
+
+  // We must apply to T the initial guess transform
+  PointMatcher<RealT>::Matrix combinedT = T*ref.initT;
+
+  // Go back to the original coordinate system, undoing the shift
+  PointMatcher<RealT>::Matrix globalT = apply_shift(combinedT, -shift);
+
+  // Print statistics. Collect them first, so that when several
+  // sources are aligned at the same time their reports do not mix.
+  std::ostringstream report;
+  if (batch_opt.source_list != "")
+    report << "Results for source: " << opt.source << std::endl;
+  report << "Alignment transform (origin is planet center):" << endl << globalT << endl;
+  report << "Centroid of source points (Cartesian, meters): " << source_ctr_vec << std::endl;
+  // Swap lat and lon, as we want to print lat first
+  std::swap(source_ctr_llh[0], source_ctr_llh[1]);
+  report << "Centroid of source points (lat,lon,z): " << source_ctr_llh << std::endl;
+  report << std::endl;
+
+  report << "Translation vector (Cartesian, meters): " << trans_xyz << std::endl;
+  report << "Translation vector (North-East-Down, meters): "
+         << trans_ned << std::endl;
+  report << "Translation vector magnitude (meters): " << norm_2(trans_xyz)
+         << std::endl;
+  report << "Maximum displacement of points between the source "
+         << "cloud with any initial transform applied to it and the "
+         << "source cloud after alignment to the reference: " 
+         << max_obtained_disp << " m" << std::endl;
+  if (opt.max_disp > 0 && opt.max_disp < max_obtained_disp) {
+    report << "Warning: The input --max-displacement value is smaller than the "
+           << "final observed displacement. It may be advised to increase the former "
+           << "and rerun the tool.\n";
+  }
+
+  // Swap lat and lon, as we want to print lat first
+  std::swap(trans_llh[0], trans_llh[1]);
+  report << "Translation vector (lat,lon,z): " << trans_llh << std::endl;
+  report << std::endl;
+
+  Matrix3x3 rot;
+  for (int r = 0; r < DIM; r++)
+    for (int c = 0; c < DIM; c++)
+      rot(r, c) = globalT(r, c);
+
+  double scale = pow(det(rot), 1.0/3.0);
+  for (int r = 0; r < DIM; r++)
+    for (int c = 0; c < DIM; c++)
+      rot(r, c) /= scale;
+  report << "Transform scale - 1 = " << (scale-1.0) << std::endl;
+    
+  Matrix3x3 rot_NED = inverse(NED2ECEF) * rot * NED2ECEF;
+   
+  Vector3 euler_angles = math::rotation_matrix_to_euler_xyz(rot) * 180/M_PI;
+  Vector3 euler_angles_NED = math::rotation_matrix_to_euler_xyz(rot_NED) * 180/M_PI;
+  Vector3 axis_angles = math::matrix_to_axis_angle(rot) * 180/M_PI;
+  report << "Euler angles (degrees): " << euler_angles  << endl;
+  report << "Euler angles (North-East-Down, degrees): " << euler_angles_NED  << endl;
+  report << "Axis of rotation and angle (degrees): "
+         << axis_angles/norm_2(axis_angles) << ' '
+         << norm_2(axis_angles) << endl;
+  vw_out() << report.str();
+
+  Stopwatch sw5;
+  sw5.start();
+  save_transforms(opt, globalT);
+
+  if (opt.save_trans_ref){
+    string trans_ref_prefix = opt.out_prefix + "-trans_reference";
+    save_trans_point_cloud(opt, opt.reference, trans_ref_prefix,
+                           geo, csv_conv, globalT.inverse());
+  }
+
+  if (opt.save_trans_source){
+    string trans_source_prefix = opt.out_prefix + "-trans_source";
+    save_trans_point_cloud(opt, opt.source, trans_source_prefix,
+                           geo, csv_conv, globalT);
+  }
+
+  save_errors(source_point_cloud, beg_errors,  opt.out_prefix + "-beg_errors.csv",
+              shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
+  save_errors(trans_source_point_cloud, end_errors,  opt.out_prefix + "-end_errors.csv",
+              shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
+
+  if (opt.verbose) vw_out() << "Writing: " << opt.out_prefix
+    + "-iterationInfo.csv" << std::endl;
+
+  sw5.stop();
+  if (opt.verbose) vw_out() << "Saving to disk took "
+                            << sw5.elapsed_seconds() << " [s]" << endl;
+}
+
+/// Find the boxes of one of many source clouds
+class SourceBoxTask: public Task, private boost::noncopyable {
+  Options      const& m_opt;      // alias
+  GeoReference        m_geo;      // a copy, as its projection is not thread-safe
+  asp::CsvConv const& m_csv_conv; // alias
+  int                 m_num_sample_pts;
+  BBox2               m_ref_box, m_trans_ref_box;
+  SourceJob         & m_job;      // alias
+  std::string       & m_error;    // alias
+
+public:
+  SourceBoxTask(Options const& opt, GeoReference const& geo, asp::CsvConv const& csv_conv,
+                int num_sample_pts, BBox2 const& ref_box, BBox2 const& trans_ref_box,
+                SourceJob & job, std::string & error):
+    m_opt(opt), m_geo(geo), m_csv_conv(csv_conv), m_num_sample_pts(num_sample_pts),
+    m_ref_box(ref_box), m_trans_ref_box(trans_ref_box), m_job(job), m_error(error) {}
+
+  void operator()() {
+    try {
+      find_source_boxes(m_opt, m_geo, m_csv_conv, m_num_sample_pts,
+                        m_ref_box, m_trans_ref_box, m_job);
+    }catch(std::exception const& e){
+      m_error = e.what();
+    }
+  }
+};
+
+/// Align one of many source clouds
+class AlignSourceTask: public Task, private boost::noncopyable {
+  Options            const& m_opt;   // alias
+  AlignmentReference      & m_ref;   // alias
+  SourceJob          const& m_job;   // alias
+  std::string             & m_error; // alias
+
+public:
+  AlignSourceTask(Options const& opt, AlignmentReference & ref, SourceJob const& job,
+                  std::string & error):
+    m_opt(opt), m_ref(ref), m_job(job), m_error(error) {}
+
+  void operator()() {
+    IcpSetPtr icps;
+    try {
+      icps = acquire_icp_set(m_opt, m_ref);
+      align_source(m_opt, m_ref, *icps, m_job);
+    }catch(std::exception const& e){
+      m_error = e.what();
+    }
+    if (icps)
+      release_icp_set(m_ref, icps);
+  }
+};
+
 int main( int argc, char *argv[] ) {
 
   // Mandatory line for Eigen
@@ -1231,6 +1756,22 @@ int main( int argc, char *argv[] ) {
                                                      centroid);
     }
 
+    // The sources to align, and their output prefixes. With a source
+    // list, the outputs of each are distinguished by its name.
+    std::vector<SourceJob> jobs(opt.source_files.size());
+    std::set<std::string> out_prefixes;
+    for (size_t it = 0; it < jobs.size(); it++) {
+      jobs[it].source = opt.source_files[it];
+      jobs[it].out_prefix = opt.out_prefix;
+      jobs[it].seed = it;
+      if (opt.source_list != "")
+        jobs[it].out_prefix += "-" + fs::path(jobs[it].source).stem().string();
+      if (!out_prefixes.insert(jobs[it].out_prefix).second)
+        vw_throw( ArgumentErr() << "The source list has more than one file with the name "
+                  << fs::path(jobs[it].source).stem().string()
+                  << " (without extension), so their outputs would overwrite each other.\n");
+    }
+
     // We will use ref_box to bound the source points, and vice-versa.
     // Decide how many samples to pick to estimate these boxes.
     Stopwatch sw0;
@@ -1244,297 +1785,167 @@ int main( int argc, char *argv[] ) {
     vw_out() << "Computing the intersection of the bounding boxes "
              << "of the reference and source points using " 
              << num_sample_pts << " sample points.\n";
-    BBox2 ref_box, source_box, trans_ref_box, trans_source_box;
+    BBox2 ref_box, trans_ref_box;
+
+    // If a reference cache is used, read from it the reference points from
+    // now on. Only the buckets near the source points will be read.
+    std::string ref_file = opt.reference;
+    if (opt.reference_cache != "") {
+      if (!bucketed_cloud_is_current(opt.reference_cache, opt.reference, geo, csv_conv))
+        build_bucketed_cloud(opt.reference, opt.reference_cache, geo, csv_conv, opt.verbose);
+      ref_file = opt.reference_cache;
+    }
 
     PointMatcher<RealT>::Matrix inv_init_trans = opt.init_transform.inverse();
     calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
-                              opt.reference, opt.max_disp, inv_init_trans,
+                              ref_file, opt.max_disp, inv_init_trans,
                               ref_box, trans_ref_box);
-    calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
-                              opt.source, opt.max_disp, opt.init_transform,
-                              source_box, trans_source_box);
-
-
-    // When boxes are huge, it is hard to do the optimization of intersecting
-    // them, as they may differ not by 0 or 360, but by 180. Better do nothing
-    // in that case. The solution may degrade a bit, as we may load points
-    // not in the intersection of the boxes, but at least it won't be wrong.
-    // In this case, there is a chance the boxes were computed wrong anyway.
-    if (ref_box.width() > 180.0 || source_box.width() > 180.0) {
-      vw_out() << "Warning: Your input point clouds are spread over more than half the planet. "
-               << "It is suggested that they be cropped, to get more accurate results.\n";
-      ref_box = BBox2();
-      source_box = BBox2();
+
+    if (jobs.size() == 1) {
+      find_source_boxes(opt, geo, csv_conv, num_sample_pts, ref_box, trans_ref_box, jobs[0]);
+    }else{
+      std::vector<std::string> errors(jobs.size());
+      FifoWorkQueue queue(opt.num_threads);
+      for (size_t it = 0; it < jobs.size(); it++) {
+        boost::shared_ptr<SourceBoxTask>
+          task(new SourceBoxTask(opt, geo, csv_conv, num_sample_pts,
+                                 ref_box, trans_ref_box, jobs[it], errors[it]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+      for (size_t it = 0; it < jobs.size(); it++) {
+        if (errors[it] != "")
+          vw_throw( ArgumentErr() << "Failed to find the bounding box of "
+                    << jobs[it].source << ": " << errors[it] << "\n");
+      }
     }
-    
-    vw_out() << "Reference box: " << ref_box << std::endl;
-    vw_out() << "Source box:    " << source_box << std::endl;
 
-    if (!ref_box.empty() && !source_box.empty()) {
-      adjust_and_intersect_ref_source_boxes(ref_box, trans_source_box, opt.reference, opt.source);
-      adjust_and_intersect_ref_source_boxes(trans_ref_box, source_box, opt.reference, opt.source);
+    // The reference points needed by all sources. An empty box means
+    // that all points are needed.
+    ref_box = BBox2();
+    for (size_t it = 0; it < jobs.size(); it++) {
+      if (jobs[it].ref_box.empty()) {
+        ref_box = BBox2();
+        break;
+      }
+      ref_box.grow(jobs[it].ref_box);
     }
-    
+
+    // The same number of reference points spread over the union of the
+    // regions of all sources would be sparser than for one source.
+    // Load more, so that they are about as dense as for the source
+    // with the largest region aligned alone.
+    int num_ref_pts = opt.max_num_reference_points;
+    if (jobs.size() > 1 && !ref_box.empty()) {
+      double max_job_area = 0.0;
+      for (size_t it = 0; it < jobs.size(); it++)
+        max_job_area = std::max(max_job_area, jobs[it].ref_box.area());
+      if (max_job_area > 0.0) {
+        double scale = std::min(double(jobs.size()), ref_box.area()/max_job_area);
+        num_ref_pts = (int)std::min(double(std::numeric_limits<int>::max()),
+                                    scale*opt.max_num_reference_points);
+      }
+      vw_out() << "Loading at most " << num_ref_pts << " reference points for all sources.\n";
+    }
+
     sw0.stop();
-    vw_out() << "Intersection reference box:  " << ref_box    << std::endl;
-    vw_out() << "Intersection source    box:  " << source_box << std::endl;
     vw_out() << "Intersection of bounding boxes took " << sw0.elapsed_seconds() << " [s]" << endl;
 
     // Load the point clouds. We will shift both point clouds by the
     // centroid of the first one to bring them closer to origin.
 
     // Load the subsampled reference point cloud.
-    Vector3 shift;
+    AlignmentReference ref;
+    ref.geo      = geo;
+    ref.csv_conv = csv_conv;
     bool   calc_shift = true; // Shift points so the first point is (0,0,0)
-    bool   is_lola_rdr_format = false;   // may get overwritten
-    double mean_ref_longitude    = 0.0;  // may get overwritten
-    double mean_source_longitude = 0.0;  // may get overwritten
+    double mean_ref_longitude = 0.0;   // may get overwritten
+    ref.is_lola_rdr_format    = false; // may get overwritten
+    std::mt19937 generator(0);
     Stopwatch sw1;
     sw1.start();
-    DP ref_point_cloud;
-    load_cloud(opt.reference, opt.max_num_reference_points, ref_box,
-               calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-               mean_ref_longitude, opt.verbose, ref_point_cloud);
+    load_cloud(ref_file, num_ref_pts, ref_box,
+               calc_shift, ref.load_shift, geo, csv_conv, ref.is_lola_rdr_format,
+               mean_ref_longitude, opt.verbose, generator, ref.ref_point_cloud);
     sw1.stop();
     if (opt.verbose)
       vw_out() << "Loading the reference point cloud took "
                << sw1.elapsed_seconds() << " [s]" << endl;
     //ref_point_cloud.save(outputBaseFile + "_ref.vtk");
 
-    // Load the subsampled source point cloud. If the user wants
-    // to filter gross outliers in the source points based on
-    // max_disp, load a lot more points than asked, filter based on
-    // max_disp, then resample to the number desired by the user.
-    int num_source_pts = opt.max_num_source_points;
-    if (opt.max_disp > 0.0)
-      num_source_pts = max(num_source_pts, 50000000);
-    calc_shift = false; // Use the same shift used for the reference point cloud
-    Stopwatch sw2;
-    sw2.start();
-    DP source_point_cloud;
-    load_cloud(opt.source, num_source_pts, source_box, 
-	      calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-	      mean_source_longitude, opt.verbose, source_point_cloud);
-    sw2.stop();
-    if (opt.verbose)
-      vw_out() << "Loading the source point cloud took "
-               << sw2.elapsed_seconds() << " [s]" << endl;
-
     // So far we shifted by first point in reference point cloud to reduce
-    // the magnitude of all loaded points. Now that we have loaded all
-    // points, shift one more time, to place the centroid of the
-    // reference at the origin.
+    // the magnitude of all loaded points. Now shift one more time, to
+    // place the centroid of the reference at the origin. The source
+    // points will be shifted the same way once loaded.
     // Note: If this code is ever converting to using floats,
     // the operation below needs to be re-implemented to be accurate.
-    int numRefPts = ref_point_cloud.features.cols();
-    Eigen::VectorXd meanRef = ref_point_cloud.features.rowwise().sum() / numRefPts;
-    ref_point_cloud.features.topRows(DIM).colwise()    -= meanRef.head(DIM);
-    source_point_cloud.features.topRows(DIM).colwise() -= meanRef.head(DIM);
+    int numRefPts = ref.ref_point_cloud.features.cols();
+    ref.ref_centroid = ref.ref_point_cloud.features.rowwise().sum() / numRefPts;
+    ref.ref_point_cloud.features.topRows(DIM).colwise() -= ref.ref_centroid.head(DIM);
+    ref.shift = ref.load_shift;
     for (int row = 0; row < DIM; row++)
-      shift[row] += meanRef(row); // Update the shift variable as well as the points
+      ref.shift[row] += ref.ref_centroid(row); // Update the shift variable as well as the points
     if (opt.verbose)
-      vw_out() << "Data shifted internally by subtracting: " << shift << std::endl;
+      vw_out() << "Data shifted internally by subtracting: " << ref.shift << std::endl;
 
     // The point clouds are shifted, so shift the initial transform as well.
-    PointMatcher<RealT>::Matrix initT = apply_shift(opt.init_transform, shift);
+    ref.initT = apply_shift(opt.init_transform, ref.shift);
 
     // If the reference point cloud came from a DEM, also load the data in DEM format.
-    cartography::GeoReference dem_georef;
-    vw::ImageViewRef< PixelMask<float> > reference_dem_ref;
-    if (opt.use_dem_distances()) {
+    // The least squares methods always need it.
+    if (opt.use_dem_distances() ||
+        opt.alignment_method == "least-squares" ||
+        opt.alignment_method == "similarity-least-squares") {
       vw_out() << "Loading reference as DEM." << endl;
-      // Load the dem, then wrap it inside an ImageViewRef object.
-      // - This is done because the actual DEM type cannot be created without being initialized.
-      InterpolationReadyDem reference_dem(load_interpolation_ready_dem(opt.reference, dem_georef));
-      reference_dem_ref.reset(reference_dem);
+      ref.ref_dem.reset(new DemHeightLookup(opt.reference));
     }
 
     // Now all of the input data is loaded.
 
-    // Filter the reference and initialize the reference tree
-    double elapsed_time;
-    PM::ICP icp; // LibpointMatcher object
+    if (opt.pyramid_levels > 0)
+      build_reference_pyramid(opt, ref);
 
+    // Initialize the reference trees. More copies are built if many
+    // sources are aligned at the same time.
     Stopwatch sw3;
     if (opt.verbose)
       vw_out() << "Building the reference cloud tree." << endl;
     sw3.start();
-    icp.initRefTree(ref_point_cloud, alignment_method_fallback(opt.alignment_method),
-		    opt.highest_accuracy, false /*opt.verbose*/);
+    IcpSetPtr icps = build_icp_set(opt, ref);
     sw3.stop();
     if (opt.verbose)
       vw_out() << "Reference point cloud processing took " << sw3.elapsed_seconds() << " [s]" << endl;
 
-    // Apply the initial guess transform to the source point cloud.
-    apply_transform_to_cloud(initT, source_point_cloud);
-    
-    PointMatcher<RealT>::Matrix beg_errors;
-    if (opt.max_disp > 0.0){
-      // Filter gross outliers
-      filter_source_cloud(ref_point_cloud, source_point_cloud, icp,
-                          shift, dem_georef, reference_dem_ref, opt);
-    }
-
-    random_pc_subsample(opt.max_num_source_points, source_point_cloud.features);
-    vw_out() << "Reducing number of source points to "
-             << source_point_cloud.features.cols() << endl;
-
-    //dump_llh("ref.csv", datum, ref_point_cloud,    shift);
-    //dump_llh("src.csv", datum, source, shift);
-
-    elapsed_time = compute_registration_error(ref_point_cloud, source_point_cloud, icp,
-                                              shift, dem_georef, reference_dem_ref,
-					      opt, beg_errors);
-    calc_stats("Input", beg_errors);
-    if (opt.verbose)
-      vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
-
-
-    // Compute the transformation to align the source to reference.
-    Stopwatch sw4;
-    sw4.start();
-    PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
-    if (opt.config_file == ""){
-      // Read the options from the command line
-      icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
-                    (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
-                    opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
-                    false/*opt.verbose*/);
+    if (jobs.size() == 1) {
+      align_source(opt, ref, *icps, jobs[0]);
     }else{
-      vw_out() << "Will read the options from: " << opt.config_file << endl;
-      ifstream ifs(opt.config_file.c_str());
-      if (!ifs.good())
-        vw_throw( ArgumentErr() << "Cannot open configuration file: "
-                  << opt.config_file << "\n" );
-      icp.loadFromYaml(ifs);
-    }
-
-    // We bypass calling ICP if the user explicitely asks for 0 iterations.
-    PointMatcher<RealT>::Matrix T = Id;
-    if (opt.num_iter > 0){
-      if (opt.alignment_method != "least-squares" &&
-	  opt.alignment_method != "similarity-least-squares") {
-	T = icp(source_point_cloud, ref_point_cloud, Id,
-		opt.compute_translation_only);
-	vw_out() << "Match ratio: "
-		 << icp.errorMinimizer->getWeightedPointUsedRatio() << endl;
-      }else{
-	T = least_squares_alignment(source_point_cloud, shift,
-				    dem_georef, reference_dem_ref, opt);
+      // Align the sources in parallel. A source which fails does not
+      // stop the others.
+      vw_out() << "Aligning " << jobs.size() << " source clouds.\n";
+      ref.free_icps.push_back(icps);
+      icps.reset();
+      std::vector<std::string> errors(jobs.size());
+      FifoWorkQueue queue(opt.num_threads);
+      for (size_t it = 0; it < jobs.size(); it++) {
+        boost::shared_ptr<AlignSourceTask>
+          task(new AlignSourceTask(opt, ref, jobs[it], errors[it]));
+        queue.add_task(task);
       }
-      
-    }
-    sw4.stop();
-    if (opt.verbose)
-      vw_out() << "Alignment took " << sw4.elapsed_seconds() << " [s]" << endl;
-
-    // Transform the source to make it close to reference.
-    DP trans_source_point_cloud(source_point_cloud);
-    apply_transform_to_cloud(T, trans_source_point_cloud);
-
-    // Calculate by how much points move as result of T
-    double max_obtained_disp = calc_max_displacment(source_point_cloud, trans_source_point_cloud);
-    Vector3 source_ctr_vec, source_ctr_llh;
-    Vector3 trans_xyz, trans_ned, trans_llh;
-    vw::Matrix3x3 NED2ECEF;
-    calc_translation_vec(initT, source_point_cloud, trans_source_point_cloud, shift,
-			 geo.datum(), source_ctr_vec, source_ctr_llh,
-                         trans_xyz, trans_ned, trans_llh, NED2ECEF);
-
-    // For each point, compute the distance to the nearest reference point.
-    PointMatcher<RealT>::Matrix end_errors;
-    elapsed_time = compute_registration_error(ref_point_cloud, trans_source_point_cloud, icp,
-                                              shift, dem_georef, reference_dem_ref, opt,
-					      end_errors);
-    calc_stats("Output", end_errors);
-    if (opt.verbose)
-      vw_out() << "Final error computation took " << elapsed_time << " [s]" << endl;
-
-    // We must apply to T the initial guess transform
-    PointMatcher<RealT>::Matrix combinedT = T*initT;
-
-    // Go back to the original coordinate system, undoing the shift
-    PointMatcher<RealT>::Matrix globalT = apply_shift(combinedT, -shift);
-
-    // Print statistics
-    vw_out() << "Alignment transform (origin is planet center):" << endl << globalT << endl;
-    vw_out() << "Centroid of source points (Cartesian, meters): " << source_ctr_vec << std::endl;
-    // Swap lat and lon, as we want to print lat first
-    std::swap(source_ctr_llh[0], source_ctr_llh[1]);
-    vw_out() << "Centroid of source points (lat,lon,z): " << source_ctr_llh << std::endl;
-    vw_out() << std::endl;
-
-    vw_out() << "Translation vector (Cartesian, meters): " << trans_xyz << std::endl;
-    vw_out() << "Translation vector (North-East-Down, meters): "
-             << trans_ned << std::endl;
-    vw_out() << "Translation vector magnitude (meters): " << norm_2(trans_xyz)
-             << std::endl;
-    vw::vw_out() << "Maximum displacement of points between the source "
-                 << "cloud with any initial transform applied to it and the "
-                 << "source cloud after alignment to the reference: " 
-                 << max_obtained_disp << " m" << std::endl;
-    if (opt.max_disp > 0 && opt.max_disp < max_obtained_disp) {
-      vw_out() << "Warning: The input --max-displacement value is smaller than the "
-               << "final observed displacement. It may be advised to increase the former "
-               << "and rerun the tool.\n";
-    }
-
-    // Swap lat and lon, as we want to print lat first
-    std::swap(trans_llh[0], trans_llh[1]);
-    vw_out() << "Translation vector (lat,lon,z): " << trans_llh << std::endl;
-    vw_out() << std::endl;
-
-    Matrix3x3 rot;
-    for (int r = 0; r < DIM; r++)
-      for (int c = 0; c < DIM; c++)
-        rot(r, c) = globalT(r, c);
-
-    double scale = pow(det(rot), 1.0/3.0);
-    for (int r = 0; r < DIM; r++)
-      for (int c = 0; c < DIM; c++)
-        rot(r, c) /= scale;
-    vw_out() << "Transform scale - 1 = " << (scale-1.0) << std::endl;
-    
-    Matrix3x3 rot_NED = inverse(NED2ECEF) * rot * NED2ECEF;
-   
-    Vector3 euler_angles = math::rotation_matrix_to_euler_xyz(rot) * 180/M_PI;
-    Vector3 euler_angles_NED = math::rotation_matrix_to_euler_xyz(rot_NED) * 180/M_PI;
-    Vector3 axis_angles = math::matrix_to_axis_angle(rot) * 180/M_PI;
-    vw_out() << "Euler angles (degrees): " << euler_angles  << endl;
-    vw_out() << "Euler angles (North-East-Down, degrees): " << euler_angles_NED  << endl;
-    vw_out() << "Axis of rotation and angle (degrees): "
-             << axis_angles/norm_2(axis_angles) << ' '
-             << norm_2(axis_angles) << endl;
-
-    
-    Stopwatch sw5;
-    sw5.start();
-    save_transforms(opt, globalT);
-
-    if (opt.save_trans_ref){
-      string trans_ref_prefix = opt.out_prefix + "-trans_reference";
-      save_trans_point_cloud(opt, opt.reference, trans_ref_prefix,
-                             geo, csv_conv, globalT.inverse());
-    }
-
-    if (opt.save_trans_source){
-      string trans_source_prefix = opt.out_prefix + "-trans_source";
-      save_trans_point_cloud(opt, opt.source, trans_source_prefix,
-                             geo, csv_conv, globalT);
+      queue.join_all();
+
+      int num_failed = 0;
+      for (size_t it = 0; it < jobs.size(); it++) {
+        if (errors[it] == "")
+          continue;
+        vw_out(WarningMessage) << "Failed to align " << jobs[it].source << ": "
+                               << errors[it] << "\n";
+        num_failed++;
+      }
+      if (num_failed > 0)
+        vw_throw( ArgumentErr() << "Failed to align " << num_failed << " out of "
+                  << jobs.size() << " source clouds.\n");
     }
 
-    save_errors(source_point_cloud, beg_errors,  opt.out_prefix + "-beg_errors.csv",
-                shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
-    save_errors(trans_source_point_cloud, end_errors,  opt.out_prefix + "-end_errors.csv",
-                shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
-
-    if (opt.verbose) vw_out() << "Writing: " << opt.out_prefix
-      + "-iterationInfo.csv" << std::endl;
-
-    sw5.stop();
-    if (opt.verbose) vw_out() << "Saving to disk took "
-                              << sw5.elapsed_seconds() << " [s]" << endl;
-
   } ASP_STANDARD_CATCHES;
 
   return 0;
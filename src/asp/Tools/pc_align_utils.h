@@ -49,6 +49,9 @@
 #ifndef __PC_ALIGN_UTILS_H__
 #define __PC_ALIGN_UTILS_H__
 
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Cartography/Datum.h>
 #include <vw/Cartography/GeoReference.h>
@@ -59,9 +62,17 @@
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/EigenUtils.h>
 #include <liblas/liblas.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
+#include <algorithm>
+#include <list>
 #include <limits>
+#include <random>
 #include <cstring>
+#include <ctime>
 
 #include <pointmatcher/PointMatcher.h>
 
@@ -99,6 +110,7 @@ void load_cloud(std::string const& file_name,
                bool & is_lola_rdr_format,
                double & mean_longitude,
                bool verbose,
+               std::mt19937 & generator,
                DoubleMatrix & data);
 
 /// Load a file from disk and convert to libpointmatcher's format
@@ -112,8 +124,78 @@ void load_cloud(std::string const& file_name,
 		bool   & is_lola_rdr_format,
 		double & mean_longitude,
 		bool verbose,
+		std::mt19937 & generator,
 		typename PointMatcher<RealT>::DataPoints & data);
 
+/// A spatially bucketed copy of a reference cloud, for aligning many
+/// source clouds against the same reference. The points are stored as
+/// raw xyz doubles, grouped by lon-lat bucket, and shuffled within
+/// each bucket, so that the start of a bucket is a random sample of
+/// it. A text index next to the data records where each bucket
+/// starts and the lon-lat box of its points, and what load_cloud()
+/// found about the format of the source.
+struct BucketedCloudIndex {
+  std::string source_file;
+  vw::uint64  source_size;
+  std::time_t source_time;
+  std::string csv_format, csv_proj4, datum; // How the points were converted to xyz
+  bool        is_lola_rdr_format;
+  double      mean_longitude;
+  std::vector<vw::uint64> offsets, counts;  // in points
+  std::vector<vw::BBox2>  boxes;
+
+  BucketedCloudIndex(): source_size(0), source_time(0),
+                        is_lola_rdr_format(false), mean_longitude(0.0){}
+
+  /// Record the current version of the source file, and the options
+  /// used to convert its points.
+  void set_source(std::string const& source_file,
+                  vw::cartography::GeoReference const& geo,
+                  CsvConv const& csv_conv);
+
+  /// Return true if the points came from the same source and options.
+  bool same_source(BucketedCloudIndex const& other) const;
+
+  /// Return false if the index is missing or not in the right format.
+  bool read (std::string const& index_file);
+  void write(std::string const& index_file) const;
+};
+
+/// The index of a bucketed cloud is stored in <cloud_file>.index.
+std::string bucketed_cloud_index(std::string const& cloud_file);
+
+/// Return true if the file has a bucketed cloud index next to it.
+bool is_bucketed_cloud(std::string const& file);
+
+/// Return true if this is a bucketed cloud made from the current
+/// version of the given source file, with the same datum and CSV options.
+bool bucketed_cloud_is_current(std::string const& cloud_file,
+                               std::string const& source_file,
+                               vw::cartography::GeoReference const& geo,
+                               CsvConv const& csv_conv);
+
+/// Load all points from the source cloud and write them as a bucketed cloud.
+void build_bucketed_cloud(std::string const& source_file,
+                          std::string const& cloud_file,
+                          vw::cartography::GeoReference const& geo,
+                          CsvConv const& csv_conv,
+                          bool verbose);
+
+/// Load points from a bucketed cloud, reading only the buckets which
+/// intersect the given box. The same fraction of the points in the box
+/// is taken from each bucket. The format information of the source
+/// cloud is returned as well.
+void load_bucketed_cloud(std::string const& cloud_file,
+                         int num_points_to_load,
+                         vw::BBox2 const& lonlat_box,
+                         bool calc_shift,
+                         vw::Vector3 & shift,
+                         vw::cartography::GeoReference const& geo,
+                         bool   & is_lola_rdr_format,
+                         double & mean_longitude,
+                         bool verbose,
+                         DoubleMatrix & data);
+
 /// Calculate the lon-lat bounding box of the points and bias it based
 /// on max displacement (which is in meters). This is used to throw
 /// away points in the other cloud which are not within this box.
@@ -157,6 +239,9 @@ void calc_translation_vec(DP const& source, DP const& trans_source,
 /// Calculate max distance between any two points of two point clouds.
 double calc_max_displacment(DP const& source, DP const& trans_source);
 
+/// Replace the points in each cube of the given size by their centroid.
+void voxel_downsample(DP const& in_cloud, double voxel_size, DP & out_cloud);
+
 /// Apply a transformation matrix to a Vector3 in homogenous coordinates
 vw::Vector3 apply_transform(PointMatcher<RealT>::Matrix const& T, vw::Vector3 const& P);
 
@@ -224,21 +309,83 @@ void save_trans_point_cloud_n(vw::cartography::GdalWriteOptions const& opt,
 // Stuff pulled up from point_to_dem_dist in the Tools repository.
 
 
-/// A type for interpolation from a masked DEM object.
-typedef vw::InterpolationView< vw::EdgeExtensionView< vw::ImageViewRef< vw::PixelMask<float> >,
-                                                      vw::ConstantEdgeExtension>,
-                               vw::BilinearInterpolation> InterpolationReadyDem;
-
-/// Get ready to interpolate points on a DEM existing on disk.
-InterpolationReadyDem load_interpolation_ready_dem(std::string                  const& dem_path,
-                                                   vw::cartography::GeoReference     & georef);
-
-/// Interpolates the DEM height at the input coordinate.
-/// - Returns false if the coordinate falls outside the valid DEM area.
-bool interp_dem_height(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
-                       vw::cartography::GeoReference const & georef,
-                       vw::Vector3                   const & lonlat,
-                       double                              & dem_height);
+/// Find the heights of points above a DEM existing on disk. The DEM
+/// is read in tiles when first needed. The most recently used tiles
+/// are kept in memory, within the VW cache size (--cache-size-mb).
+/// Thread-safe, so it can be used from the Ceres threads as well.
+class DemHeightLookup: private boost::noncopyable {
+public:
+  typedef vw::ImageView< vw::PixelMask<float> > Tile;
+
+  explicit DemHeightLookup(std::string const& dem_path);
+
+  vw::cartography::GeoReference const& georef() const { return m_georef; }
+
+  /// The height of the point above the DEM, negative if below it.
+  /// Return false if the point is not above the valid DEM area.
+  bool height_above_dem(vw::Vector3 const& xyz, double & height) const;
+
+  /// The same for all points in a cloud, which must be shifted by the
+  /// given amount to get the real GCC coordinates. The points are
+  /// sorted by the DEM tile they fall in, and processed in batches
+  /// using the given number of threads. With one thread, all is done
+  /// in the calling thread, as when that is one of many threads
+  /// already. Where the point is not above the valid DEM area,
+  /// is_valid is set to zero.
+  void heights_above_dem(DP const& point_cloud, vw::Vector3 const& shift, int num_threads,
+                         std::vector<double> & heights,
+                         std::vector<vw::uint8> & is_valid) const;
+
+  /// Find the DEM pixel below a point, and the height of the point
+  /// above the datum. Return false if the pixel is outside the DEM.
+  /// The georeference must be a copy of georef() used only by the
+  /// calling thread, as its projection is not thread-safe.
+  bool find_pixel(vw::cartography::GeoReference const& georef, vw::Vector3 const& xyz,
+                  vw::Vector2 & pix, double & height) const;
+
+  /// The index of the tile having the given pixel, which must be in the DEM.
+  int tile_index(vw::Vector2 const& pix) const;
+
+  /// The tile with the given index, read from disk if not in memory.
+  /// Callers with many pixels in the same tile should get it once.
+  boost::shared_ptr<Tile> get_tile(int tile_index) const;
+
+  /// The DEM height at a pixel, which must be in the given tile, with
+  /// the given index. This is the value of the DEM pixel at the
+  /// truncated coordinates. Return false if that pixel is invalid.
+  bool dem_height(Tile const& tile, int tile_index, vw::Vector2 const& pix,
+                  double & dem_height) const;
+
+  /// The number of tiles in memory.
+  size_t num_tiles_in_memory() const;
+
+  static const int TILE_SIZE = 256;
+
+private:
+  typedef boost::shared_ptr<vw::cartography::GeoReference> GeoRefPtr;
+
+  /// Take a copy of the georeference not used by other threads, and
+  /// give it back when done.
+  GeoRefPtr acquire_georef() const;
+  void      release_georef(GeoRefPtr georef) const;
+
+  vw::cartography::GeoReference            m_georef;
+  vw::ImageViewRef< vw::PixelMask<float> > m_dem;
+  int    m_num_tiles_x, m_num_tiles_y;
+  size_t m_max_num_tiles;
+
+  // The tiles in memory, with the most recently used first in the
+  // list. Tiles not in memory are null. A tile dropped from the list
+  // is freed once the threads using it are done with it.
+  mutable std::vector< boost::shared_ptr<Tile> > m_tiles;
+  mutable std::list<int>                         m_recent_tiles;
+  mutable std::vector<std::list<int>::iterator>  m_recent_pos;
+  mutable vw::Mutex                              m_tile_mutex;
+
+  // Copies of the georeference not in use by any thread
+  mutable std::vector<GeoRefPtr> m_free_georefs;
+  mutable vw::Mutex              m_georef_mutex;
+};
 
 }
 
@@ -71,7 +71,7 @@ vw::int64 load_las_aux(std::string const& file_name,
                        bool calc_shift,
                        vw::Vector3 & shift,
                        vw::cartography::GeoReference const& geo,
-                       bool verbose, DoubleMatrix & data){
+                       bool verbose, std::mt19937 & generator, DoubleMatrix & data){
 
   data.conservativeResize(DIM+1, num_points_to_load);
 
@@ -105,7 +105,7 @@ vw::int64 load_las_aux(std::string const& file_name,
     if (points_count >= num_points_to_load)
       break;
 
-    double r = (double)std::rand()/(double)RAND_MAX;
+    double r = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
     if (r > load_ratio)
       continue;
 
@@ -150,11 +150,11 @@ void load_las(std::string const& file_name,
              bool calc_shift,
              vw::Vector3 & shift,
              vw::cartography::GeoReference const& geo,
-             bool verbose, DoubleMatrix & data){
+             bool verbose, std::mt19937 & generator, DoubleMatrix & data){
 
   vw::int64 num_total_points = load_las_aux(file_name, num_points_to_load,
                                           lonlat_box, calc_shift, shift,
-                                          geo, verbose, data);
+                                          geo, verbose, generator, data);
 
   int num_loaded_points = data.cols();
   if (!lonlat_box.empty()                    &&
@@ -167,11 +167,377 @@ void load_las(std::string const& file_name,
     if (verbose)
       vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
     load_las_aux(file_name, num_points_to_load, lonlat_box,
-		 calc_shift, shift, geo, verbose, data);
+		 calc_shift, shift, geo, verbose, generator, data);
   }
 
 }
 
+std::string bucketed_cloud_index(std::string const& cloud_file){
+  return cloud_file + ".index";
+}
+
+const std::string BUCKETED_CLOUD_MAGIC = "asp_bucketed_cloud";
+
+void BucketedCloudIndex::set_source(std::string const& source_file_in,
+                                    vw::cartography::GeoReference const& geo,
+                                    CsvConv const& csv_conv){
+  source_file = source_file_in;
+  source_size = boost::filesystem::file_size(source_file);
+  source_time = boost::filesystem::last_write_time(source_file);
+  csv_format  = csv_conv.get_format_str();
+  csv_proj4   = csv_conv.get_proj4_str();
+  datum       = geo.datum().proj4_str();
+}
+
+bool BucketedCloudIndex::same_source(BucketedCloudIndex const& other) const{
+  return (source_file == other.source_file && source_size == other.source_size &&
+          source_time == other.source_time && csv_format  == other.csv_format  &&
+          csv_proj4   == other.csv_proj4   && datum       == other.datum);
+}
+
+// Read a line of the form "<label> <value>", where the value may have
+// spaces or be empty.
+bool read_index_line(std::istream & ifs, std::string const& label, std::string & value){
+  std::string curr_label;
+  if (!(ifs >> curr_label) || curr_label != label)
+    return false;
+  ifs.get();
+  return bool(std::getline(ifs, value));
+}
+
+bool BucketedCloudIndex::read(std::string const& index_file){
+
+  std::ifstream ifs(index_file.c_str());
+  std::string magic, label;
+  if (!(ifs >> magic) || magic != BUCKETED_CLOUD_MAGIC)
+    return false;
+
+  size_t num_buckets = 0;
+  if (!read_index_line(ifs, "source_file", source_file)            ||
+      !(ifs >> label >> source_size >> label >> source_time)        ||
+      !read_index_line(ifs, "csv_format", csv_format)              ||
+      !read_index_line(ifs, "csv_proj4",  csv_proj4)               ||
+      !read_index_line(ifs, "datum",      datum)                   ||
+      !(ifs >> label >> is_lola_rdr_format >> label >> mean_longitude) ||
+      !(ifs >> label >> num_buckets))
+    return false;
+
+  offsets.resize(num_buckets);
+  counts.resize(num_buckets);
+  boxes.resize(num_buckets);
+  for (size_t b = 0; b < num_buckets; b++) {
+    double min_x, min_y, max_x, max_y;
+    if (!(ifs >> offsets[b] >> counts[b] >> min_x >> min_y >> max_x >> max_y))
+      return false;
+    boxes[b] = vw::BBox2(vw::Vector2(min_x, min_y), vw::Vector2(max_x, max_y));
+  }
+  return true;
+}
+
+void BucketedCloudIndex::write(std::string const& index_file) const{
+
+  std::ofstream ofs(index_file.c_str());
+  ofs.precision(17);
+  ofs << BUCKETED_CLOUD_MAGIC << "\n";
+  ofs << "source_file " << source_file << "\n";
+  ofs << "source_size " << source_size << "\n";
+  ofs << "source_time " << source_time << "\n";
+  ofs << "csv_format "  << csv_format  << "\n";
+  ofs << "csv_proj4 "   << csv_proj4   << "\n";
+  ofs << "datum "       << datum       << "\n";
+  ofs << "is_lola_rdr_format " << is_lola_rdr_format << "\n";
+  ofs << "mean_longitude "     << mean_longitude     << "\n";
+  ofs << "num_buckets " << offsets.size() << "\n";
+  for (size_t b = 0; b < offsets.size(); b++) {
+    ofs << offsets[b] << " " << counts[b] << " "
+        << boxes[b].min().x() << " " << boxes[b].min().y() << " "
+        << boxes[b].max().x() << " " << boxes[b].max().y() << "\n";
+  }
+  ofs.close();
+  if (!ofs.good())
+    vw_throw(vw::IOErr() << "Failed writing: " << index_file << "\n");
+}
+
+bool is_bucketed_cloud(std::string const& file){
+  std::ifstream ifs(bucketed_cloud_index(file).c_str());
+  std::string magic;
+  return (ifs >> magic) && magic == BUCKETED_CLOUD_MAGIC;
+}
+
+bool bucketed_cloud_is_current(std::string const& cloud_file,
+                               std::string const& source_file,
+                               vw::cartography::GeoReference const& geo,
+                               CsvConv const& csv_conv){
+  BucketedCloudIndex index, current;
+  if (!boost::filesystem::exists(cloud_file) ||
+      !index.read(bucketed_cloud_index(cloud_file)))
+    return false;
+
+  current.set_source(source_file, geo, csv_conv);
+  return index.same_source(current);
+}
+
+// Move a fully written file into place
+void publish_bucketed_file(std::string const& temp, std::string const& path){
+  boost::system::error_code ec;
+  boost::filesystem::rename(temp, path, ec);
+  if (ec) {
+    boost::filesystem::remove(temp, ec);
+    vw_throw(vw::IOErr() << "Failed writing: " << path << "\n");
+  }
+}
+
+// The box of one cloud may be offset by 360 degrees from the box
+// of another, so try all three options.
+bool lonlat_box_contains(vw::BBox2 const& box, vw::Vector2 const& lonlat){
+  for (int k = -1; k <= 1; k++) {
+    if (box.contains(lonlat + vw::Vector2(360.0*k, 0)))
+      return true;
+  }
+  return false;
+}
+
+// Return true if the second box is fully inside the first one
+bool lonlat_box_contains_box(vw::BBox2 const& box1, vw::BBox2 const& box2){
+  for (int k = -1; k <= 1; k++) {
+    if (box1.contains(box2 + vw::Vector2(360.0*k, 0)))
+      return true;
+  }
+  return false;
+}
+
+bool lonlat_boxes_intersect(vw::BBox2 const& box1, vw::BBox2 const& box2){
+  for (int k = -1; k <= 1; k++) {
+    vw::BBox2 shifted = box2 + vw::Vector2(360.0*k, 0);
+    if (box1.min().x() <= shifted.max().x() && shifted.min().x() <= box1.max().x() &&
+        box1.min().y() <= shifted.max().y() && shifted.min().y() <= box1.max().y())
+      return true;
+  }
+  return false;
+}
+
+void build_bucketed_cloud(std::string const& source_file,
+                          std::string const& cloud_file,
+                          vw::cartography::GeoReference const& geo,
+                          CsvConv const& csv_conv,
+                          bool verbose){
+
+  if (geo.datum().name() == UNSPECIFIED_DATUM)
+    vw_throw(vw::ArgumentErr() << "A datum is needed to create a bucketed cloud.\n");
+
+  vw::vw_out() << "Writing bucketed cloud: " << cloud_file << std::endl;
+
+  // Load all the points. This is the only time the full cloud must
+  // fit in memory.
+  vw::int64 num_total_points = 0;
+  std::string file_type = get_cloud_type(source_file);
+  if (file_type == "DEM" || file_type == "PC") {
+    vw::DiskImageResourceGDAL rsrc(source_file);
+    num_total_points = vw::int64(rsrc.cols())*rsrc.rows();
+  }else if (file_type == "LAS")
+    num_total_points = las_file_size(source_file);
+  else if (file_type == "CSV")
+    num_total_points = csv_file_size(source_file);
+  num_total_points = std::min(num_total_points, vw::int64(std::numeric_limits<int>::max()));
+
+  DoubleMatrix data;
+  vw::Vector3  shift(0, 0, 0);
+  bool   calc_shift         = false;
+  bool   is_lola_rdr_format = false;
+  double mean_longitude     = 0.0;
+  std::mt19937 generator(0);
+  load_cloud(source_file, (int)num_total_points, vw::BBox2(), calc_shift, shift, geo, csv_conv,
+             is_lola_rdr_format, mean_longitude, verbose, generator, data);
+  vw::int64 num_points = data.cols();
+
+  // Split the lon-lat box of the points into a grid of buckets, with
+  // enough points in each to make reading it worthwhile.
+  const double POINTS_PER_BUCKET = 65536;
+  const int    MAX_GRID_SIZE     = 1024;
+  std::vector<vw::Vector2> lonlat(num_points);
+  vw::BBox2 cloud_box;
+  for (vw::int64 i = 0; i < num_points; i++) {
+    vw::Vector3 xyz(data(0, i), data(1, i), data(2, i));
+    lonlat[i] = subvector(geo.datum().cartesian_to_geodetic(xyz), 0, 2);
+    cloud_box.grow(lonlat[i]);
+  }
+  int grid_size = (int)ceil(sqrt(num_points/POINTS_PER_BUCKET));
+  grid_size = std::max(1, std::min(grid_size, MAX_GRID_SIZE));
+
+  std::vector<int> bucket(num_points);
+  BucketedCloudIndex index;
+  index.counts.resize(grid_size*grid_size, 0);
+  index.offsets.resize(grid_size*grid_size, 0);
+  index.boxes.resize(grid_size*grid_size);
+  for (vw::int64 i = 0; i < num_points; i++) {
+    vw::Vector2 frac = elem_quot(lonlat[i] - cloud_box.min(),
+                                 cloud_box.size() + vw::Vector2(1e-12, 1e-12));
+    int bx = std::min(grid_size - 1, (int)floor(frac.x()*grid_size));
+    int by = std::min(grid_size - 1, (int)floor(frac.y()*grid_size));
+    bucket[i] = by*grid_size + bx;
+    index.counts[bucket[i]]++;
+    index.boxes[bucket[i]].grow(lonlat[i]);
+  }
+  for (size_t b = 1; b < index.offsets.size(); b++)
+    index.offsets[b] = index.offsets[b-1] + index.counts[b-1];
+
+  // Sort the points by bucket, then shuffle each bucket. Use a fixed
+  // seed, so the same reference always gives the same cache.
+  std::vector<vw::int64> order(num_points);
+  std::vector<vw::uint64> fill = index.offsets;
+  for (vw::int64 i = 0; i < num_points; i++)
+    order[fill[bucket[i]]++] = i;
+  std::mt19937 generator(0);
+  for (size_t b = 0; b < index.offsets.size(); b++)
+    std::shuffle(order.begin() + index.offsets[b],
+                 order.begin() + index.offsets[b] + index.counts[b], generator);
+
+  // Remove the old index first, so that a run interrupted past this
+  // point leaves no valid cache. Then write both files under temporary
+  // names and rename them, the index last.
+  std::string index_file = bucketed_cloud_index(cloud_file);
+  boost::system::error_code ec;
+  boost::filesystem::remove(index_file, ec);
+  std::string temp_cloud = boost::filesystem::unique_path(cloud_file + ".%%%%-%%%%.tmp").string();
+  std::string temp_index = boost::filesystem::unique_path(index_file + ".%%%%-%%%%.tmp").string();
+
+  std::ofstream ofs(temp_cloud.c_str(), std::ios::out | std::ios::binary);
+  std::vector<double> buf;
+  const vw::int64 BUF_POINTS = 1000000;
+  for (vw::int64 beg = 0; beg < num_points; beg += BUF_POINTS) {
+    vw::int64 end = std::min(beg + BUF_POINTS, num_points);
+    buf.resize(DIM*(end - beg));
+    for (vw::int64 i = beg; i < end; i++) {
+      for (int row = 0; row < DIM; row++)
+        buf[DIM*(i - beg) + row] = data(row, order[i]);
+    }
+    ofs.write(reinterpret_cast<char const*>(&buf[0]), buf.size()*sizeof(double));
+  }
+  ofs.close();
+  if (!ofs.good()) {
+    boost::filesystem::remove(temp_cloud, ec);
+    vw_throw(vw::IOErr() << "Failed writing: " << cloud_file << "\n");
+  }
+  publish_bucketed_file(temp_cloud, cloud_file);
+
+  index.set_source(source_file, geo, csv_conv);
+  index.is_lola_rdr_format = is_lola_rdr_format;
+  index.mean_longitude     = mean_longitude;
+  index.write(temp_index);
+  publish_bucketed_file(temp_index, index_file);
+
+  if (verbose)
+    vw::vw_out() << "Wrote " << num_points << " points in " << grid_size << " x "
+                 << grid_size << " buckets." << std::endl;
+}
+
+void load_bucketed_cloud(std::string const& cloud_file,
+                         int num_points_to_load,
+                         vw::BBox2 const& lonlat_box,
+                         bool calc_shift,
+                         vw::Vector3 & shift,
+                         vw::cartography::GeoReference const& geo,
+                         bool   & is_lola_rdr_format,
+                         double & mean_longitude,
+                         bool verbose,
+                         DoubleMatrix & data){
+
+  BucketedCloudIndex index;
+  if (!index.read(bucketed_cloud_index(cloud_file)))
+    vw_throw(vw::ArgumentErr() << "Missing or invalid index for bucketed cloud: "
+                               << cloud_file << "\n");
+  is_lola_rdr_format = index.is_lola_rdr_format;
+  mean_longitude     = index.mean_longitude;
+
+  vw::uint64 num_total_points = 0;
+  for (size_t b = 0; b < index.counts.size(); b++)
+    num_total_points += index.counts[b];
+
+  boost::iostreams::mapped_file_source mapped(cloud_file);
+  if (mapped.size() < num_total_points*DIM*sizeof(double))
+    vw_throw(vw::IOErr() << "Bucketed cloud is truncated: " << cloud_file << "\n");
+  double const* points = reinterpret_cast<double const*>(mapped.data());
+
+  // Find the buckets to read, and how many of their points are in the
+  // box. Only the points of the buckets on the edge of the box need
+  // to be checked.
+  std::vector<size_t> buckets;
+  std::vector<vw::uint64> num_in_box;
+  vw::uint64 num_avail = 0;
+  for (size_t b = 0; b < index.counts.size(); b++) {
+    if (index.counts[b] == 0)
+      continue;
+    if (!lonlat_box.empty() && !lonlat_boxes_intersect(lonlat_box, index.boxes[b]))
+      continue;
+
+    vw::uint64 count = index.counts[b];
+    if (!lonlat_box.empty() && !lonlat_box_contains_box(lonlat_box, index.boxes[b])) {
+      count = 0;
+      for (vw::uint64 i = 0; i < index.counts[b]; i++) {
+        double const* p = points + DIM*(index.offsets[b] + i);
+        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(vw::Vector3(p[0], p[1], p[2]));
+        if (lonlat_box_contains(lonlat_box, subvector(llh, 0, 2)))
+          count++;
+      }
+      if (count == 0)
+        continue;
+    }
+
+    buckets.push_back(b);
+    num_in_box.push_back(count);
+    num_avail += count;
+  }
+
+  // Read the same fraction of the points in the box from each bucket.
+  // Points are shuffled within a bucket, so its first points in the
+  // box are a random sample of those.
+  double load_ratio = std::min(1.0, (double)num_points_to_load/std::max(1.0, (double)num_avail));
+  data.conservativeResize(DIM+1, (vw::int64)std::min((vw::uint64)num_points_to_load, num_avail));
+
+  bool shift_was_calc = false;
+  vw::int64 points_count = 0;
+  for (size_t k = 0; k < buckets.size(); k++) {
+    size_t b = buckets[k];
+    vw::uint64 num_to_take = std::min(num_in_box[k],
+                                      (vw::uint64)ceil(load_ratio*num_in_box[k]));
+    bool check_box = (num_in_box[k] < index.counts[b]);
+    vw::uint64 num_taken = 0;
+    for (vw::uint64 i = 0; i < index.counts[b]; i++) {
+
+      if (num_taken >= num_to_take || points_count >= data.cols())
+        break;
+
+      double const* p = points + DIM*(index.offsets[b] + i);
+      vw::Vector3 xyz(p[0], p[1], p[2]);
+
+      // Skip points outside the given box
+      if (check_box){
+        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(xyz);
+        if (!lonlat_box_contains(lonlat_box, subvector(llh, 0, 2)))
+          continue;
+      }
+
+      if (calc_shift && !shift_was_calc){
+        shift = xyz;
+        shift_was_calc = true;
+      }
+
+      for (int row = 0; row < DIM; row++)
+        data(row, points_count) = xyz[row] - shift[row];
+      data(DIM, points_count) = 1;
+
+      points_count++;
+      num_taken++;
+    }
+  }
+
+  data.conservativeResize(Eigen::NoChange, points_count);
+
+  if (verbose)
+    vw::vw_out() << "Read " << buckets.size() << " out of " << index.counts.size()
+                 << " buckets from: " << cloud_file << std::endl;
+}
+
 // Load xyz points from disk into a matrix with 4 columns. Last column is just ones.
 void load_cloud(std::string const& file_name,
                int num_points_to_load,
@@ -183,6 +549,7 @@ void load_cloud(std::string const& file_name,
                bool   & is_lola_rdr_format,
                double & mean_longitude,
                bool verbose,
+               std::mt19937 & generator,
                DoubleMatrix & data){
 
   if (verbose)
@@ -192,21 +559,24 @@ void load_cloud(std::string const& file_name,
   // longitude is available.
   mean_longitude = 0.0;
 
-  std::string file_type = get_cloud_type(file_name);
-  if (file_type == "DEM")
+  std::string file_type = is_bucketed_cloud(file_name) ? "BUCKETED" : get_cloud_type(file_name);
+  if (file_type == "BUCKETED")
+    load_bucketed_cloud(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
+                        geo, is_lola_rdr_format, mean_longitude, verbose, data);
+  else if (file_type == "DEM")
     load_dem(file_name, num_points_to_load, lonlat_box,
-	     calc_shift, shift, verbose, data);
+	     calc_shift, shift, verbose, generator, data);
   else if (file_type == "PC")
     load_pc(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
-	    geo, verbose, data);
+	    geo, verbose, generator, data);
   else if (file_type == "LAS")
     load_las(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
-	     geo, verbose, data);
+	     geo, verbose, generator, data);
   else if (file_type == "CSV"){
     bool verbose = true;
     load_csv(file_name, num_points_to_load, lonlat_box, 
                 calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-                mean_longitude, verbose, data
+                mean_longitude, verbose, generator, data
                 );
   }else
     vw_throw( vw::ArgumentErr() << "Unknown file type: " << file_name << "\n" );
@@ -227,6 +597,7 @@ void load_cloud(std::string const& file_name,
                bool   & is_lola_rdr_format,
                double & mean_longitude,
                bool verbose,
+               std::mt19937 & generator,
                typename PointMatcher<RealT>::DataPoints & data){
   
   data.featureLabels = form_labels<RealT>(DIM);
@@ -234,7 +605,7 @@ void load_cloud(std::string const& file_name,
 
   load_cloud(file_name, num_points_to_load,  lonlat_box,  calc_shift,  
 	    shift,  geo,  csv_conv,  is_lola_rdr_format,  mean_longitude,  
-	    verbose,  data.features);
+	    verbose,  generator, data.features);
   
 }
 
@@ -283,10 +654,11 @@ void calc_extended_lonlat_bbox(vw::cartography::GeoReference const& geo,
   vw::Vector3 shift          = vw::Vector3(0, 0, 0);
   vw::BBox2   dummy_box;
   bool        is_lola_rdr_format;
+  std::mt19937 generator(0);  // local, as this runs for many sources at once
   // Load a sample of points, hopefully enough to estimate the box reliably.
   load_cloud(file_name, num_sample_pts, dummy_box,
              calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-             mean_longitude, verbose, points);
+             mean_longitude, verbose, generator, points);
 
   bool has_transform = (transform != PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1));
 
@@ -494,6 +866,10 @@ double calc_max_displacment(DP const& source, DP const& trans_source){
   return max_obtained_disp;
 }
 
+void voxel_downsample(DP const& in_cloud, double voxel_size, DP & out_cloud){
+  voxel_downsample(in_cloud.features, voxel_size, out_cloud.features);
+  out_cloud.featureLabels = form_labels<double>(DIM);
+}
 
 /// Apply a transformation matrix to a vw::Vector3 in homogenous coordinates
 vw::Vector3 apply_transform(PointMatcher<RealT>::Matrix const& T, vw::Vector3 const& P){
@@ -633,10 +1009,11 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
     bool        is_lola_rdr_format;
     double      mean_longitude;
     DP          point_cloud;
+    std::mt19937 generator(0); // all points are loaded, so not used
     load_cloud(input_file, std::numeric_limits<int>::max(),
 	       empty_box, calc_shift, shift,
 	       geo, csv_conv, is_lola_rdr_format,
-	       mean_longitude, verbose, point_cloud);
+	       mean_longitude, verbose, generator, point_cloud);
 
     std::ofstream outfile( output_file.c_str() );
     outfile.precision(16);
@@ -703,10 +1080,10 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
 
 
 
-InterpolationReadyDem load_interpolation_ready_dem(std::string                  const& dem_path,
-                                                   vw::cartography::GeoReference     & georef) {
+DemHeightLookup::DemHeightLookup(std::string const& dem_path){
+
   // Load the georeference from the DEM
-  bool has_georef = vw::cartography::read_georeference( georef, dem_path );
+  bool has_georef = vw::cartography::read_georeference(m_georef, dem_path);
   if (!has_georef)
     vw::vw_throw(vw::ArgumentErr() << "DEM: " << dem_path << " does not have a georeference.\n");
 
@@ -718,34 +1095,91 @@ InterpolationReadyDem load_interpolation_ready_dem(std::string
     if (dem_rsrc->has_nodata_read())
       nodata = dem_rsrc->nodata_read();
   }
-  
-  // Set up interpolation + mask view of the DEM
-  vw::ImageViewRef< vw::PixelMask<float> > masked_dem = create_mask(dem, nodata);
-  return InterpolationReadyDem(interpolate(masked_dem));
+  m_dem = create_mask(dem, nodata);
+
+  m_num_tiles_x = (m_dem.cols() + TILE_SIZE - 1)/TILE_SIZE;
+  m_num_tiles_y = (m_dem.rows() + TILE_SIZE - 1)/TILE_SIZE;
+  m_tiles.resize(m_num_tiles_x*m_num_tiles_y);
+  m_recent_pos.resize(m_tiles.size());
+
+  // Keep as many tiles as fit in the cache, but at least a few, so
+  // that the threads working on neighboring tiles do not evict each
+  // other's tiles.
+  const size_t MIN_NUM_TILES = 16;
+  size_t tile_bytes = size_t(TILE_SIZE)*TILE_SIZE*sizeof(vw::PixelMask<float>);
+  m_max_num_tiles = std::max(MIN_NUM_TILES, vw::vw_settings().system_cache_size()/tile_bytes);
 }
 
+bool DemHeightLookup::find_pixel(vw::cartography::GeoReference const& georef,
+                                 vw::Vector3 const& xyz, vw::Vector2 & pix,
+                                 double & height) const {
+
+  vw::Vector3 llh = georef.datum().cartesian_to_geodetic(xyz); // lon-lat-height
+  height = llh[2];
 
-bool interp_dem_height(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
-                       vw::cartography::GeoReference const & georef,
-                       vw::Vector3                   const & lonlat,
-                       double                              & dem_height) {
   // Convert the lon/lat location into a pixel in the DEM.
-  vw::Vector2 pix;
   try {
-    pix = georef.lonlat_to_pixel(subvector(lonlat, 0, 2));
+    pix = georef.lonlat_to_pixel(subvector(llh, 0, 2));
   }catch(...){
     return false;
   }
-  
-  double c = pix[0], r = pix[1];
 
-  // Quit if the pixel falls outside the DEM.
-  if (c < 0 || c >= dem.cols()-1 || // TODO: This ought to be an image class function
-      r < 0 || r >= dem.rows()-1 )
+  // Quit if the pixel falls outside the DEM, or on its last row or column
+  double c = pix[0], r = pix[1];
+  if (c < 0 || c >= m_dem.cols()-1 || r < 0 || r >= m_dem.rows()-1)
     return false;
 
-  // Interpolate the DEM height at the pixel location
-  vw::PixelMask<float> v = dem(c, r);
+  return true;
+}
+
+int DemHeightLookup::tile_index(vw::Vector2 const& pix) const {
+  int tx = int(pix[0])/TILE_SIZE, ty = int(pix[1])/TILE_SIZE;
+  return ty*m_num_tiles_x + tx;
+}
+
+boost::shared_ptr<DemHeightLookup::Tile> DemHeightLookup::get_tile(int tile_index) const {
+
+  {
+    vw::Mutex::Lock lock(m_tile_mutex);
+    boost::shared_ptr<Tile> tile = m_tiles[tile_index];
+    if (tile) {
+      // Mark as the most recently used
+      m_recent_tiles.splice(m_recent_tiles.begin(), m_recent_tiles, m_recent_pos[tile_index]);
+      return tile;
+    }
+  }
+
+  // Read the tile without holding the lock, so that the other threads
+  // can use the tiles in memory meanwhile.
+  int tx = tile_index % m_num_tiles_x, ty = tile_index / m_num_tiles_x;
+  vw::BBox2i box(tx*TILE_SIZE, ty*TILE_SIZE, TILE_SIZE, TILE_SIZE);
+  box.crop(vw::bounding_box(m_dem));
+  boost::shared_ptr<Tile> tile(new Tile(crop(m_dem, box)));
+
+  vw::Mutex::Lock lock(m_tile_mutex);
+  if (m_tiles[tile_index]) {
+    // Another thread read it in the meantime
+    m_recent_tiles.splice(m_recent_tiles.begin(), m_recent_tiles, m_recent_pos[tile_index]);
+    return m_tiles[tile_index];
+  }
+  m_tiles[tile_index] = tile;
+  m_recent_tiles.push_front(tile_index);
+  m_recent_pos[tile_index] = m_recent_tiles.begin();
+
+  // Drop the least recently used tiles
+  while (m_recent_tiles.size() > m_max_num_tiles) {
+    m_tiles[m_recent_tiles.back()].reset();
+    m_recent_tiles.pop_back();
+  }
+
+  return tile;
+}
+
+bool DemHeightLookup::dem_height(Tile const& tile, int tile_index, vw::Vector2 const& pix,
+                                 double & dem_height) const {
+
+  int tx = tile_index % m_num_tiles_x, ty = tile_index / m_num_tiles_x;
+  vw::PixelMask<float> const& v = tile(int(pix[0]) - tx*TILE_SIZE, int(pix[1]) - ty*TILE_SIZE);
   if (!is_valid(v))
     return false;
 
@@ -753,4 +1187,214 @@ bool interp_dem_height(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
   return true;
 }
 
+size_t DemHeightLookup::num_tiles_in_memory() const {
+  vw::Mutex::Lock lock(m_tile_mutex);
+  return m_recent_tiles.size();
+}
+
+DemHeightLookup::GeoRefPtr DemHeightLookup::acquire_georef() const {
+  vw::Mutex::Lock lock(m_georef_mutex);
+  if (m_free_georefs.empty())
+    return GeoRefPtr(new vw::cartography::GeoReference(m_georef));
+  GeoRefPtr georef = m_free_georefs.back();
+  m_free_georefs.pop_back();
+  return georef;
+}
+
+void DemHeightLookup::release_georef(GeoRefPtr georef) const {
+  vw::Mutex::Lock lock(m_georef_mutex);
+  m_free_georefs.push_back(georef);
+}
+
+bool DemHeightLookup::height_above_dem(vw::Vector3 const& xyz, double & height) const {
+
+  // The Ceres threads call this for one point at a time, so they
+  // share a few copies of the georeference rather than each residual
+  // having its own.
+  GeoRefPtr georef = acquire_georef();
+  vw::Vector2 pix;
+  bool inside = find_pixel(*georef, xyz, pix, height);
+  release_georef(georef);
+
+  if (!inside)
+    return false;
+
+  int index = tile_index(pix);
+  double dem_ht;
+  if (!dem_height(*get_tile(index), index, pix, dem_ht))
+    return false;
+
+  height -= dem_ht;
+  return true;
+}
+
+/// Find the DEM pixels below a range of points in a batch, and the
+/// heights of the points. Points outside the DEM get a tile index of -1.
+class DemPixelTask: public vw::Task, private boost::noncopyable {
+  DemHeightLookup          const& m_dem;
+  vw::cartography::GeoReference   m_georef; // a copy, as its projection is not thread-safe
+  DP                       const& m_point_cloud;
+  vw::Vector3                     m_shift;
+  int                             m_batch_beg, m_beg, m_end;
+  std::vector<vw::Vector2>      & m_pixels;
+  std::vector<double>           & m_heights;
+  std::vector<int>              & m_tile_indices;
+  std::string                   & m_error;
+public:
+  DemPixelTask(DemHeightLookup const& dem, DP const& point_cloud, vw::Vector3 const& shift,
+               int batch_beg, int beg, int end,
+               std::vector<vw::Vector2> & pixels, std::vector<double> & heights,
+               std::vector<int> & tile_indices, std::string & error):
+    m_dem(dem), m_georef(dem.georef()), m_point_cloud(point_cloud), m_shift(shift),
+    m_batch_beg(batch_beg), m_beg(beg), m_end(end),
+    m_pixels(pixels), m_heights(heights), m_tile_indices(tile_indices), m_error(error){}
+
+  virtual void operator()() {
+    try {
+      for (int i = m_beg; i < m_end; i++) {
+        vw::Vector3 xyz;
+        for (int row = 0; row < DIM; row++)
+          xyz[row] = m_point_cloud.features(row, i) + m_shift[row];
+        int k = i - m_batch_beg;
+        if (m_dem.find_pixel(m_georef, xyz, m_pixels[k], m_heights[i]))
+          m_tile_indices[k] = m_dem.tile_index(m_pixels[k]);
+        else
+          m_tile_indices[k] = -1;
+      }
+    }catch(std::exception const& e){
+      m_error = e.what();
+    }
+  }
+};
+
+/// Look up the DEM at a range of the pixels of a batch, sorted by
+/// tile. Each tile is fetched once for all its pixels in the range,
+/// so the tile cache is locked once per tile rather than per pixel.
+class DemLookupTask: public vw::Task, private boost::noncopyable {
+  DemHeightLookup          const& m_dem;
+  std::vector<int>         const& m_order;
+  std::vector<vw::Vector2> const& m_pixels;
+  std::vector<int>         const& m_tile_indices;
+  int                             m_batch_beg, m_beg, m_end;
+  std::vector<double>           & m_heights;
+  std::vector<vw::uint8>        & m_is_valid;
+  std::string                   & m_error;
+public:
+  DemLookupTask(DemHeightLookup const& dem, std::vector<int> const& order,
+                std::vector<vw::Vector2> const& pixels, std::vector<int> const& tile_indices,
+                int batch_beg, int beg, int end,
+                std::vector<double> & heights, std::vector<vw::uint8> & is_valid,
+                std::string & error):
+    m_dem(dem), m_order(order), m_pixels(pixels), m_tile_indices(tile_indices),
+    m_batch_beg(batch_beg), m_beg(beg), m_end(end),
+    m_heights(heights), m_is_valid(is_valid), m_error(error){}
+
+  virtual void operator()() {
+    try {
+      boost::shared_ptr<DemHeightLookup::Tile> tile;
+      int curr_tile_index = -1;
+      for (int j = m_beg; j < m_end; j++) {
+        int k = m_order[j];
+        if (m_tile_indices[k] != curr_tile_index) {
+          curr_tile_index = m_tile_indices[k];
+          tile = m_dem.get_tile(curr_tile_index);
+        }
+        double dem_height;
+        if (m_dem.dem_height(*tile, curr_tile_index, m_pixels[k], dem_height)) {
+          m_heights [m_batch_beg + k] -= dem_height;
+          m_is_valid[m_batch_beg + k] = 1;
+        }
+      }
+    }catch(std::exception const& e){
+      m_error = e.what();
+    }
+  }
+};
+
+/// Sort indices of points in a batch by the DEM tile they fall in.
+struct TileIndexLess {
+  std::vector<int> const& m_tile_indices;
+  TileIndexLess(std::vector<int> const& tile_indices): m_tile_indices(tile_indices) {}
+  bool operator()(int a, int b) const { return m_tile_indices[a] < m_tile_indices[b]; }
+};
+
+/// Run the given tasks on a work queue, or one after another in this
+/// thread if just one thread is to be used. Throw the first error.
+void run_dem_tasks(std::vector< boost::shared_ptr<vw::Task> > const& tasks,
+                   std::vector<std::string> const& errors, int num_threads) {
+  if (num_threads <= 1) {
+    for (size_t it = 0; it < tasks.size(); it++)
+      (*tasks[it])();
+  }else{
+    vw::FifoWorkQueue queue(num_threads);
+    for (size_t it = 0; it < tasks.size(); it++)
+      queue.add_task(tasks[it]);
+    queue.join_all();
+  }
+  for (size_t it = 0; it < errors.size(); it++) {
+    if (errors[it] != "")
+      vw::vw_throw(vw::ArgumentErr() << errors[it]);
+  }
+}
+
+void DemHeightLookup::heights_above_dem(DP const& point_cloud, vw::Vector3 const& shift,
+                                        int num_threads,
+                                        std::vector<double> & heights,
+                                        std::vector<vw::uint8> & is_valid) const {
+
+  // Process this many points at a time, to limit the extra memory used
+  const int BATCH_SIZE = 1000000;
+
+  const int num_pts = point_cloud.features.cols();
+  heights.resize(num_pts);
+  is_valid.assign(num_pts, 0);
+  if (num_threads < 1)
+    num_threads = 1;
+
+  std::vector<vw::Vector2> pixels;
+  std::vector<int> tile_indices, order;
+  for (int batch_beg = 0; batch_beg < num_pts; batch_beg += BATCH_SIZE) {
+    int batch_end = std::min(batch_beg + BATCH_SIZE, num_pts);
+    int batch_len = batch_end - batch_beg;
+    pixels.resize(batch_len);
+    tile_indices.resize(batch_len);
+    int chunk = (batch_len + num_threads - 1)/num_threads;
+
+    // Find the pixels. The heights above the datum go straight to the output.
+    std::vector<std::string> errors(num_threads);
+    std::vector< boost::shared_ptr<vw::Task> > tasks;
+    for (int t = 0; t < num_threads; t++) {
+      int beg = batch_beg + t*chunk, end = std::min(beg + chunk, batch_end);
+      if (beg >= end)
+        break;
+      tasks.push_back(boost::shared_ptr<vw::Task>
+                      (new DemPixelTask(*this, point_cloud, shift, batch_beg, beg, end,
+                                        pixels, heights, tile_indices, errors[t])));
+    }
+    run_dem_tasks(tasks, errors, num_threads);
+
+    // Order the points inside the DEM by tile, so that each thread
+    // works on a few tiles at a time rather than jumping all over the DEM.
+    order.clear();
+    for (int k = 0; k < batch_len; k++) {
+      if (tile_indices[k] >= 0)
+        order.push_back(k);
+    }
+    std::sort(order.begin(), order.end(), TileIndexLess(tile_indices));
+
+    int num_inside = order.size();
+    chunk = (num_inside + num_threads - 1)/num_threads;
+    tasks.clear();
+    for (int t = 0; t < num_threads; t++) {
+      int beg = t*chunk, end = std::min(beg + chunk, num_inside);
+      if (beg >= end)
+        break;
+      tasks.push_back(boost::shared_ptr<vw::Task>
+                      (new DemLookupTask(*this, order, pixels, tile_indices, batch_beg,
+                                         beg, end, heights, is_valid, errors[t])));
+    }
+    run_dem_tasks(tasks, errors, num_threads);
+  }
+}
+
 }
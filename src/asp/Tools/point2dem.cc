@@ -36,6 +36,7 @@
 #include <vw/Cartography/PointImageManipulation.h>
 
 #include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <limits>
 
@@ -193,6 +194,8 @@ void parse_input_clouds_textures(std::vector<std::string> const& files,
 /// Convert any LAS or CSV files to ASP tif files. We do some binning
 /// to make the spatial data more localized, to improve performance.
 /// - We will later wipe these temporary tifs.
+/// - CSV files are parsed in parallel, but still go through a temporary
+///   tif, as the rasterizer reads the cloud as an image.
 void las_or_csv_or_pcd_to_tifs(Options& opt,
 			cartography::Datum const& datum,
 			std::vector<std::string> & tmp_tifs){
@@ -933,6 +936,18 @@ namespace asp{
 
 
 
+/// Remove a temporary file when going out of scope, also if an
+/// exception was thrown.
+struct TmpFileRemover: private boost::noncopyable {
+  std::string file;
+  ~TmpFileRemover() {
+    if (file == "")
+      return;
+    boost::system::error_code ec;
+    fs::remove(file, ec);
+  }
+};
+
 /// Do more work!
 void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
                                 Options& opt,
@@ -984,8 +999,74 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
     opt.rounding_error = 0.0;
   }
 
-  ImageViewRef< PixelGray<float> > rasterizer_fsaa
-    = generate_fsaa_raster( rasterizer, opt );
+  // Find which products can be rasterized together in a single pass
+  // over the cloud, so that it is read and filtered only once. The
+  // orthoimage with hole-filling changes the cloud, so it still needs
+  // its own pass. The heights always go in the first plane.
+  int num_channels = asp::num_channels(opt.pointcloud_files);
+  bool fuse_error   = opt.do_error && (num_channels == 4 || num_channels == 6);
+  bool fuse_ortho   = opt.do_ortho && opt.ortho_hole_fill_len <= 0;
+  int  num_products = int(!opt.no_dem) + int(fuse_error) + int(fuse_ortho);
+  bool single_pass  = (!opt.use_surface_sampling && num_products > 1);
+
+  // Declared before the image of the products, so that the file is
+  // closed before it is removed.
+  TmpFileRemover fused_file;
+  boost::shared_ptr< DiskImageView< PixelGray<float> > > fused_image;
+  int error_plane = -1, ortho_plane = -1;
+  if (single_pass) {
+    std::vector< ImageViewRef<float> > textures;
+    textures.push_back(channel_cast<float>(select_channel(rasterizer.get_point_image(), 2)));
+
+    if (fuse_error) {
+      error_plane = textures.size();
+      if (num_channels == 4){
+        ImageViewRef<Vector4> point_disk_image
+          = asp::form_point_cloud_composite<Vector4>
+          (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
+        textures.push_back(channel_cast<float>(select_channel(point_disk_image, 3)));
+      }else{
+        ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>
+          (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
+        ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
+        for (int ch_index = 0; ch_index < 3; ch_index++)
+          textures.push_back(channel_cast<float>(select_channel(ned_err, ch_index)));
+      }
+    }
+
+    if (fuse_ortho) {
+      ortho_plane = textures.size();
+      ImageViewRef< PixelGray<float> > texture
+        = asp::form_point_cloud_composite< PixelGray<float> >
+        (opt.texture_files, asp::OrthoRasterizerView::max_subblock_size());
+      textures.push_back(select_channel(texture, 0));
+    }
+
+    // Each output plane holds one product channel. The products are
+    // then written from this file, without going back to the cloud.
+    rasterizer.set_textures(textures);
+    fused_file.file = opt.out_prefix + "-products.tmp.tif";
+    vw_out() << "Rasterizing " << num_products << " products in a single pass.\n";
+    vw_out() << "Writing: " << fused_file.file << "\n";
+    Stopwatch sw1;
+    sw1.start();
+    bool has_georef = false, has_nodata = true;
+    block_write_gdal_image(fused_file.file, rasterizer, has_georef, georef,
+                           has_nodata, opt.nodata_value, opt,
+                           TerminalProgressCallback("asp", "Rasterizing: "));
+    sw1.stop();
+    vw_out(DebugMessage,"asp") << "Single-pass render time: " << sw1.elapsed_seconds() << ".\n";
+    fused_image.reset(new DiskImageView< PixelGray<float> >(fused_file.file));
+
+    // Go back to just the heights, in case the cloud is rasterized again
+    rasterizer.set_texture(select_channel(rasterizer.get_point_image(), 2));
+  }
+
+  ImageViewRef< PixelGray<float> > rasterizer_fsaa;
+  if (single_pass)
+    rasterizer_fsaa = generate_fsaa_raster(select_plane(*fused_image, 0), opt);
+  else
+    rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
 
   // Write out the DEM. We've set the texture to be the height.
   Vector2 tile_size(vw_settings().default_tile_size(),
@@ -1030,17 +1111,19 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 
   // Write triangulation error image if requested
   if ( opt.do_error ) {
-    int num_channels = asp::num_channels(opt.pointcloud_files);
-
     int hole_fill_len = 0;
     if (num_channels == 4){
       // The error is a scalar.
-      ImageViewRef<Vector4> point_disk_image
-        = asp::form_point_cloud_composite<Vector4>
-        (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
-      ImageViewRef<double> error_channel = select_channel(point_disk_image,3);
-      rasterizer.set_texture( error_channel );
-      rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+      if (single_pass) {
+        rasterizer_fsaa = generate_fsaa_raster(select_plane(*fused_image, error_plane), opt);
+      }else{
+        ImageViewRef<Vector4> point_disk_image
+          = asp::form_point_cloud_composite<Vector4>
+          (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
+        ImageViewRef<double> error_channel = select_channel(point_disk_image,3);
+        rasterizer.set_texture( error_channel );
+        rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+      }
       save_image(opt,
 		 asp::round_image_pixels_skip_nodata(rasterizer_fsaa,
 						     opt.rounding_error,
@@ -1048,14 +1131,22 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 		 georef, hole_fill_len, "IntersectionErr");
     }else if (num_channels == 6){
       // The error is a 3D vector. Convert it to NED coordinate system, and rasterize it.
-      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>
-        (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
-      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
+      ImageViewRef<Vector3> ned_err;
+      if (!single_pass) {
+        ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>
+          (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
+        ned_err = asp::error_to_NED(point_disk_image, georef);
+      }
       std::vector< ImageViewRef< PixelGray<float> > >  rasterized(3);
       for (int ch_index = 0; ch_index < 3; ch_index++){
-        ImageViewRef<double> ch = select_channel(ned_err, ch_index);
-        rasterizer.set_texture(ch);
-        rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+        if (single_pass) {
+          rasterizer_fsaa
+            = generate_fsaa_raster(select_plane(*fused_image, error_plane + ch_index), opt);
+        }else{
+          ImageViewRef<double> ch = select_channel(ned_err, ch_index);
+          rasterizer.set_texture(ch);
+          rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+        }
         rasterized[ch_index] =
           block_cache(rasterizer_fsaa, tile_size, opt.num_threads);
       }
@@ -1092,7 +1183,10 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
   // Write DRG if the user requested and provided a texture file.
   // This must be at the end, as we may be messing with the point
   // image in irreversible ways.
-  if (opt.do_ortho) {
+  if (opt.do_ortho && fuse_ortho && single_pass) {
+    rasterizer_fsaa = generate_fsaa_raster(select_plane(*fused_image, ortho_plane), opt);
+    asp::save_image(opt, rasterizer_fsaa, georef, 0, "DRG");
+  } else if (opt.do_ortho) {
     
     Stopwatch sw3;
     sw3.start();
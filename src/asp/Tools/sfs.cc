@@ -37,6 +37,7 @@
 #include <vw/Image/AntiAliasing.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <vw/Core/CmdUtils.h>
@@ -45,6 +46,7 @@
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/RPCModelGen.h>
+#include <asp/Tools/sfs.h>
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
 #include <iostream>
@@ -119,23 +121,28 @@ namespace vw { namespace camera {
   // function of an ISIS camera around a current DEM. The algorithm
   // works by tabulation of point_to_pixel and pixel_to_vector values
   // at the mean dem height.
+  // The tables are fully computed before the optimization starts and
+  // are read-only afterwards, so that the approximate model can be
+  // used from multiple threads without locking. Only the fallbacks to
+  // the exact ISIS model are serialized with the camera mutex.
   class ApproxCameraModel: public CameraModel {
     boost::shared_ptr<CameraModel>  m_exact_camera;
-    mutable Vector3 m_mean_dir; // mean vector from camera to ground
+    Vector3 m_mean_dir; // mean vector from camera to ground
     BBox2i m_img_bbox;
     GeoReference m_geo;
     double m_mean_ht;
-    mutable ImageView< PixelMask<Vector3> > m_pixel_to_vec_mat;
-    mutable ImageView< PixelMask<Vector2> > m_point_to_pix_mat;
-    //ImageView< PixelMask<Vector3> > m_camera_center_mat;
+    ImageView< PixelMask<Vector3> > m_pixel_to_vec_mat;
+    ImageView< PixelMask<Vector2> > m_point_to_pix_mat;
+    ImageView< PixelMask<Vector3> > m_camera_center_mat;
     double m_approx_table_gridx, m_approx_table_gridy;
-    mutable BBox2 m_point_box, m_crop_box;
+    double m_camera_center_gridx, m_camera_center_gridy;
+    BBox2 m_point_box, m_crop_box, m_camera_center_box;
     bool m_use_rpc_approximation, m_use_semi_approx;
     vw::Mutex& m_camera_mutex;
     Vector2 m_uncompValue;
-    mutable int m_begX, m_endX, m_begY, m_endY;
-    mutable bool m_compute_mean, m_stop_growing_range;
-    mutable int m_count;
+    int m_begX, m_endX, m_begY, m_endY;
+    bool m_compute_mean;
+    int m_count;
     boost::shared_ptr<asp::RPCModel> m_rpc_model;
     bool m_model_is_valid;
     
@@ -346,7 +353,7 @@ namespace vw { namespace camera {
       return true;
     }
     
-    void comp_entries_in_table() const{
+    void comp_entries_in_table() {
       for (int x = m_begX; x <= m_endX; x++) {
 	for (int y = m_begY; y <= m_endY; y++) {
 	  
@@ -424,7 +431,7 @@ namespace vw { namespace camera {
       int big = 1e+8;
       m_uncompValue = Vector2(-big, -big);
       m_compute_mean = true; // We'll set this to false when we finish estimating the mean
-      m_stop_growing_range = false; // stop when it does not help
+      m_camera_center_gridx = 0; m_camera_center_gridy = 0;
       
       if (dynamic_cast<IsisCameraModel*>(exact_camera.get()) == NULL)
 	vw_throw( ArgumentErr()
@@ -551,27 +558,6 @@ namespace vw { namespace camera {
       m_crop_box.crop(m_img_bbox);
 #endif
 
-#if 0 // takes too much memory
-      // Tabulate the camera_center function
-      m_camera_center_mat.set_size(m_crop_box.width(), m_crop_box.height());
-      for (int col = 0; col < m_crop_box.width(); col++) {
-	for (int row = 0; row < m_crop_box.height(); row++) {
-	  bool success = true;
-	  Vector3 ctr;
-	  try {
-	    ctr = m_exact_camera->camera_center(m_crop_box.min() + Vector2(col, row));
-	  }catch(...){
-	    success = false;
-	  }
-	  if (success) {
-	    m_camera_center_mat(col, row) = ctr;
-	    m_camera_center_mat(col, row).validate();
-	  }else{
-	    m_camera_center_mat(col, row).invalidate();
-	  }
-	}
-      }
-#endif
       return;
     }
 
@@ -634,51 +620,6 @@ namespace vw { namespace camera {
 	bool out_of_comp_range = (x < m_begX || x >= m_endX-1 ||
 				  y < m_begY || y >= m_endY-1);
 
-	// If we are not out of range, but we need to expand the computed table, do that
-	if (!m_stop_growing_range && !out_of_range && out_of_comp_range) {
-	  vw::Mutex::Lock lock(m_camera_mutex);
-	  g_num_locks++;
-          if (g_warning_count < g_max_warning_count) {
-            g_warning_count++;
-            vw_out(WarningMessage) << "Pixel outside of computed range. "
-                                   << "Growing the computed table." << std::endl;
-            vw_out(WarningMessage) << "Start table: " << m_begX << ' ' << m_begY << ' '
-                                   << m_endX << ' ' << m_endY << std::endl;
-          }
-          
-	  // If we have to expand, do it by a lot
-	  int extrax = std::max(10, int(0.1*(m_endX - m_begX)));
-	  int extray = std::max(10, int(0.1*(m_endY - m_begY)));
-
-          int old_begX = m_begX, old_begY = m_begY;
-          int old_endX = m_endX, old_endY = m_endY;
-
-	  m_begX = std::min(m_begX, int(floor(x))) - extrax; m_begX = std::max(0, m_begX);
-	  m_begY = std::min(m_begY, int(floor(y))) - extray; m_begY = std::max(0, m_begY);
-	  
-	  m_endX = std::max(m_endX, int(ceil(x))) + extrax;
-	  m_endX = std::min(m_pixel_to_vec_mat.cols()-1, m_endX);
-
-	  m_endY = std::max(m_endY, int(ceil(y))) + extray;
-	  m_endY = std::min(m_pixel_to_vec_mat.rows()-1, m_endY);
-	  
-          if (g_warning_count < g_max_warning_count) {
-            vw_out(WarningMessage) << "Updated table: " << m_begX << ' ' << m_begY << ' '
-                                   << m_endX << ' ' << m_endY << std::endl;
-          }
-	  comp_entries_in_table();
-
-	  // Update this
-	  out_of_comp_range = (x < m_begX || x >= m_endX-1 ||
-			       y < m_begY || y >= m_endY-1);
-
-          // Avoid an infinite loop if we can't grow the table
-          if (old_begX == m_begX && old_begY == m_begY &&
-              old_endX == m_endX && old_endY == m_endY ) {
-            m_stop_growing_range = true;
-          }
-	}
-
 	if (out_of_range || out_of_comp_range){
 	  vw::Mutex::Lock lock(m_camera_mutex);
 	  g_num_locks++;
@@ -740,44 +681,60 @@ namespace vw { namespace camera {
     }
 
     virtual Vector3 camera_center(Vector2 const& pix) const{
-      // It is tricky to approximate the camera center
-      //if (m_use_rpc_approximation){
-	vw::Mutex::Lock lock(m_camera_mutex);
-	g_num_locks++;
-	//vw_out(WarningMessage) << "Invoked the camera center function for pixel: "
-        //                       << pix << std::endl;
-	return this->exact_camera()->camera_center(pix);
-	//return m_rpc_model->camera_center(pix);
-	//}
 
-#if 0
-      // TODO: Is this function invoked? Should just the underlying exact model
-      // camera center be used all the time?
-      InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector3> >, ConstantEdgeExtension >, BilinearInterpolation> camera_center_interp
-	= interpolate(m_camera_center_mat, BilinearInterpolation(),
-		      ConstantEdgeExtension());
-      double lx = pix[0] - m_crop_box.min().x();
-      double ly = pix[1] - m_crop_box.min().y();
-      if (0 <= lx && lx < m_camera_center_mat.cols() - 1 &&
-	  0 <= ly && ly < m_camera_center_mat.rows() - 1 ) {
-	PixelMask<Vector3> ctr = camera_center_interp(lx, ly);
-	if (is_valid(ctr))
-	  return ctr.child();
-      }
-#endif
-      
-      {
-	// Failed to interpolate
-	vw::Mutex::Lock lock(m_camera_mutex);
-	g_num_locks++;
-        if (g_warning_count < g_max_warning_count) {
-          g_warning_count++;
-          vw_out(WarningMessage) << "Invoked the camera center function for pixel: "
-                                 << pix << std::endl;
+      // Look up the tabulated camera center, if available
+      if (m_camera_center_mat.cols() > 0 && m_camera_center_mat.rows() > 0) {
+        InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector3> >, ConstantEdgeExtension >, BilinearInterpolation> camera_center_interp
+          = interpolate(m_camera_center_mat, BilinearInterpolation(),
+                        ConstantEdgeExtension());
+        double lx = (pix[0] - m_camera_center_box.min().x())/m_camera_center_gridx;
+        double ly = (pix[1] - m_camera_center_box.min().y())/m_camera_center_gridy;
+        if (0 <= lx && lx <= m_camera_center_mat.cols() - 1 &&
+            0 <= ly && ly <= m_camera_center_mat.rows() - 1 ) {
+          PixelMask<Vector3> ctr = camera_center_interp(lx, ly);
+          if (is_valid(ctr))
+            return ctr.child();
         }
-	return this->exact_camera()->camera_center(pix);
       }
 
+      // Failed to interpolate
+      vw::Mutex::Lock lock(m_camera_mutex);
+      g_num_locks++;
+      return this->exact_camera()->camera_center(pix);
+    }
+
+    // Tabulate the camera center over the crop box, which must be
+    // final by now. The camera center varies slowly with the pixel, so
+    // a coarse table is enough, and it avoids a locked call to the
+    // exact camera each time the reflectance is computed.
+    void comp_camera_center_table(){
+
+      m_camera_center_mat.set_size(0, 0);
+      m_camera_center_box = crop_box();
+      if (m_use_semi_approx || m_camera_center_box.empty())
+        return;
+
+      const int max_table_size = 256;
+      int numx = std::max(2, std::min(max_table_size, int(m_camera_center_box.width())  + 1));
+      int numy = std::max(2, std::min(max_table_size, int(m_camera_center_box.height()) + 1));
+      m_camera_center_gridx = m_camera_center_box.width()/(numx - 1.0);
+      m_camera_center_gridy = m_camera_center_box.height()/(numy - 1.0);
+      if (m_camera_center_gridx <= 0 || m_camera_center_gridy <= 0)
+        return;
+
+      m_camera_center_mat.set_size(numx, numy);
+      for (int x = 0; x < numx; x++) {
+        for (int y = 0; y < numy; y++) {
+          Vector2 pix = m_camera_center_box.min()
+            + Vector2(x*m_camera_center_gridx, y*m_camera_center_gridy);
+          try {
+            m_camera_center_mat(x, y) = m_exact_camera->camera_center(pix);
+            m_camera_center_mat(x, y).validate();
+          }catch(...){
+            m_camera_center_mat(x, y).invalidate();
+          }
+        }
+      }
     }
 
     virtual Quat camera_pose(Vector2 const& pix) const{
@@ -854,95 +811,6 @@ void compute_image_stats(ImageT const& I, double & mean, double & stdev){
 
 }
 
-// Find the points on a given DEM that are shadowed by other points of
-// the DEM.  Start marching from the point on the DEM on a ray towards
-// the sun in small increments, until hitting the maximum DEM height.
-bool isInShadow(int col, int row, Vector3 & sunPos,
-		ImageView<double> const& dem, double max_dem_height,
-		double gridx, double gridy,
-		cartography::GeoReference const& geo){
-
-  // Here bicubic interpolation won't work. It is easier to interpret
-  // the DEM as piecewise-linear when dealing with rays intersecting
-  // it.
-  InterpolationView<EdgeExtensionView< ImageView<double>,
-    ConstantEdgeExtension >, BilinearInterpolation>
-    interp_dem = interpolate(dem, BilinearInterpolation(),
-			     ConstantEdgeExtension());
-
-  // The xyz position at the center grid point
-  Vector2 dem_llh = geo.pixel_to_lonlat(Vector2(col, row));
-  Vector3 dem_lonlat_height = Vector3(dem_llh(0), dem_llh(1), dem(col, row));
-  Vector3 xyz = geo.datum().geodetic_to_cartesian(dem_lonlat_height);
-
-  // Normalized direction from the view point
-  Vector3 dir = sunPos - xyz;
-  if (dir == Vector3())
-    return false;
-  dir = dir/norm_2(dir);
-
-  // The projection of dir onto the tangent plane at xyz,
-  // that is, the "horizontal" component at the current sphere surface.
-  Vector3 dir2 = dir - dot_prod(dir, xyz)*xyz/dot_prod(xyz, xyz);
-
-  // Ensure that we advance by at most half a grid point each time
-  double delta = 0.5*std::min(gridx, gridy)/std::max(norm_2(dir2), 1e-16);
-
-  // go along the ray. Don't allow the loop to go forever.
-  for (int i = 1; i < 10000000; i++) {
-    Vector3 ray_P = xyz + i * delta * dir;
-    Vector3 ray_llh = geo.datum().cartesian_to_geodetic(ray_P);
-    if (ray_llh[2] > max_dem_height) {
-      // We're above the terrain, no point in continuing
-      return false;
-    }
-
-    // Compensate for any longitude 360 degree offset, e.g., 270 deg vs -90 deg
-    ray_llh[0] += 360.0*round((dem_llh[0] - ray_llh[0])/360.0);
-
-    Vector2 ray_pix = geo.lonlat_to_pixel(Vector2(ray_llh[0], ray_llh[1]));
-
-    if (ray_pix[0] < 0 || ray_pix[0] > dem.cols() - 1 ||
-	ray_pix[1] < 0 || ray_pix[1] > dem.rows() - 1 ) {
-      return false; // got out of the DEM, no point continuing
-    }
-
-    // Dem height at the current point on the ray
-    double dem_h = interp_dem(ray_pix[0], ray_pix[1]);
-
-    if (ray_llh[2] < dem_h) {
-      // The ray goes under the DEM, so we are in shadow.
-      return true;
-    }
-  }
-
-  return false;
-}
-
-void areInShadow(Vector3 & sunPos, ImageView<double> const& dem,
-		 double gridx, double gridy,
-		 cartography::GeoReference const& geo,
-		 ImageView<float> & shadow){
-
-  // Find the max DEM height
-  double max_dem_height = -std::numeric_limits<double>::max();
-  for (int col = 0; col < dem.cols(); col++) {
-    for (int row = 0; row < dem.rows(); row++) {
-      if (dem(col, row) > max_dem_height) {
-	max_dem_height = dem(col, row);
-      }
-    }
-  }
-
-  shadow.set_size(dem.cols(), dem.rows());
-  for (int col = 0; col < dem.cols(); col++) {
-    for (int row = 0; row < dem.rows(); row++) {
-      shadow(col, row) = isInShadow(col, row, sunPos, dem,
-				    max_dem_height, gridx, gridy, geo);
-    }
-  }
-}
-
 struct Options : public vw::cartography::GdalWriteOptions {
   std::string input_dems_str, out_prefix, stereo_session_string, bundle_adjust_prefix;
   std::vector<std::string> input_dems, input_images, input_cameras;
@@ -956,7 +824,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
   int max_iterations, max_coarse_iterations, reflectance_type, coarse_levels, blending_dist,
     blending_power;
   bool float_albedo, float_exposure, float_cameras, float_all_cameras, model_shadows,
-    save_computed_intensity_only,
+    horizon_sweep_shadows, save_computed_intensity_only,
     save_dem_with_nodata, use_approx_camera_models, use_rpc_approximation, use_semi_approx,
     crop_input_images, use_blending_weights, float_dem_at_boundary, fix_dem,
     float_reflectance_model, query, save_sparingly;
@@ -969,7 +837,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
 	    coarse_levels(0), blending_dist(10), blending_power(2),
             float_albedo(false), float_exposure(false), float_cameras(false),
             float_all_cameras(false),
-	    model_shadows(false),
+	    model_shadows(false), horizon_sweep_shadows(false),
 	    save_computed_intensity_only(false),
 	    save_dem_with_nodata(false),
 	    use_approx_camera_models(false),
@@ -1414,6 +1282,7 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
 				    cartography::GeoReference const& geo,
 				    bool model_shadows,
 				    double max_dem_height,
+				    ImageView<float>          const& shadow,
 				    double gridx, double gridy,
 				    ModelParams  const & model_params,
 				    GlobalParams const & global_params,
@@ -1542,9 +1411,14 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
 
 
   if (model_shadows) {
-    bool inShadow = isInShadow(col, row, local_model_params.sunPosition,
-			       dem, max_dem_height, gridx, gridy,
-			       geo);
+    // Use the precomputed shadows, if available
+    bool inShadow;
+    if (shadow.cols() > 0 && shadow.rows() > 0)
+      inShadow = (shadow(col, row) != 0);
+    else
+      inShadow = asp::isInShadow(col, row, local_model_params.sunPosition,
+                                 dem, max_dem_height, gridx, gridy,
+                                 geo);
 
     if (inShadow) {
       // The reflectance is valid, it is just zero
@@ -1561,6 +1435,7 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
                                     cartography::GeoReference const& geo,
 				    bool model_shadows,
 				    double & max_dem_height, // alias
+				    ImageView<float> const& shadow,
 				    double gridx, double gridy,
 				    ModelParams const& model_params,
 				    GlobalParams const& global_params,
@@ -1611,7 +1486,7 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
                                      dem(col, row+1), dem(col, row-1),
                                      use_pq, pval, qval,
 				     col, row, dem,  geo,
-				     model_shadows, max_dem_height,
+				     model_shadows, max_dem_height, shadow,
 				     gridx, gridy,
 				     model_params, global_params,
 				     crop_box, image, blend_weight, camera,
@@ -1665,6 +1540,7 @@ float                                        * g_img_nodata_val;
 std::vector<double>                          * g_exposures;
 std::vector<double>                          * g_adjustments;
 std::vector<double>                          * g_max_dem_height;
+std::vector< std::vector< ImageView<float> > > * g_shadows;
 double                                       * g_gridx;
 double                                       * g_gridy;
 int                                            g_level = -1;
@@ -1741,6 +1617,23 @@ public:
         icam->set_axis_angle_rotation(axis_angle);
       }
 
+      // The DEM changed, so update the points in shadow. The shadows
+      // found by ray-marching during the next iteration, in
+      // isInShadow(), see the same DEM. Ceres writes to it only at the
+      // end of an iteration, with update_state_every_iteration, and not
+      // as it evaluates trial steps. So either way the points in
+      // shadow are those of the DEM at the start of each iteration.
+      if (g_opt->model_shadows && g_opt->horizon_sweep_shadows && !g_opt->fix_dem) {
+        for (size_t image_iter = 0; image_iter < (*g_masked_images)[dem_iter].size();
+             image_iter++) {
+          if (g_opt->skip_images[dem_iter].find(image_iter) !=
+              g_opt->skip_images[dem_iter].end()) continue;
+          asp::horizonSweepShadows((*g_model_params)[image_iter].sunPosition,
+                                   (*g_dem)[dem_iter], *g_gridx, (*g_geo)[dem_iter],
+                                   (*g_shadows)[dem_iter][image_iter]);
+        }
+      }
+
       std::ostringstream os;
       if (!g_final_iter) {
         os << "-iter" << g_iter;
@@ -1835,6 +1728,7 @@ public:
                                        (*g_geo)[dem_iter],
                                        g_opt->model_shadows,
                                        (*g_max_dem_height)[dem_iter],
+                                       (*g_shadows)[dem_iter][image_iter],
                                        *g_gridx, *g_gridy,
                                        (*g_model_params)[image_iter],
                                        *g_global_params,
@@ -1935,7 +1829,7 @@ public:
         // Dump the points in shadow
         ImageView<float> shadow; // don't use int, scaled weirdly by ASP on reading
         Vector3 sunPos = (*g_model_params)[image_iter].sunPosition;
-        areInShadow(sunPos, (*g_dem)[dem_iter], *g_gridx, *g_gridy,  (*g_geo)[dem_iter], shadow);
+        asp::areInShadow(sunPos, (*g_dem)[dem_iter], *g_gridx, *g_gridy,  (*g_geo)[dem_iter], shadow);
 
 	std::string out_shadow_file = iter_str2 + "-shadow.tif";
         vw_out() << "Writing: " << out_shadow_file << std::endl;
@@ -1982,6 +1876,7 @@ calc_intensity_residual(const F* const exposure,
                         bool                                      m_model_shadows,
                         double                                    m_camera_position_step_size,
                         double                            const & m_max_dem_height, // alias
+                        ImageView<float>                  const & m_shadow,         // alias
                         double                                    m_gridx,
                         double                                    m_gridy,
                         GlobalParams                      const & m_global_params,  // alias
@@ -2033,7 +1928,7 @@ calc_intensity_residual(const F* const exposure,
                                      bottom[0], top[0],
                                      use_pq, p, q,
                                      m_col, m_row,  m_dem, m_geo,
-                                     m_model_shadows, m_max_dem_height,
+                                     m_model_shadows, m_max_dem_height, m_shadow,
                                      m_gridx, m_gridy,
                                      m_model_params,  m_global_params,
                                      m_crop_box, m_image, m_blend_weight, &adj_cam_copy,
@@ -2070,6 +1965,7 @@ struct IntensityError {
 		 bool model_shadows,
 		 double camera_position_step_size,
 		 double const& max_dem_height, // note: this is an alias
+		 ImageView<float> const& shadow, // alias
 		 double gridx, double gridy,
 		 GlobalParams const& global_params,
 		 ModelParams const& model_params,
@@ -2081,6 +1977,7 @@ struct IntensityError {
     m_model_shadows(model_shadows),
     m_camera_position_step_size(camera_position_step_size),
     m_max_dem_height(max_dem_height),
+    m_shadow(shadow),
     m_gridx(gridx), m_gridy(gridy),
     m_global_params(global_params),
     m_model_params(model_params),
@@ -2115,6 +2012,7 @@ struct IntensityError {
                                    m_model_shadows,  
                                    m_camera_position_step_size,  
                                    m_max_dem_height,  // alias
+                                   m_shadow,          // alias
                                    m_gridx, m_gridy,  
                                    m_global_params,   // alias
                                    m_model_params,    // alias
@@ -2133,6 +2031,7 @@ struct IntensityError {
 				     bool model_shadows,
 				     double camera_position_step_size,
 				     double const& max_dem_height, // alias
+				     ImageView<float> const& shadow, // alias
 				     double gridx, double gridy,
 				     GlobalParams const& global_params,
 				     ModelParams const& model_params,
@@ -2145,7 +2044,7 @@ struct IntensityError {
 	    (new IntensityError(col, row, dem, geo,
 				model_shadows,
 				camera_position_step_size,
-				max_dem_height,
+				max_dem_height, shadow,
 				gridx, gridy,
 				global_params, model_params,
 				crop_box, image, blend_weight, camera)));
@@ -2157,6 +2056,7 @@ struct IntensityError {
   bool                                      m_model_shadows;
   double                                    m_camera_position_step_size;
   double                            const & m_max_dem_height; // alias
+  ImageView<float>                  const & m_shadow;         // alias
   double                                    m_gridx, m_gridy;
   GlobalParams                      const & m_global_params;  // alias
   ModelParams                       const & m_model_params;   // alias
@@ -2176,6 +2076,7 @@ struct IntensityErrorFixedMost {
                           bool model_shadows,
                           double camera_position_step_size,
                           double const& max_dem_height, // note: this is an alias
+                          ImageView<float> const& shadow, // alias
                           double gridx, double gridy,
                           GlobalParams const& global_params,
                           ModelParams const& model_params,
@@ -2189,6 +2090,7 @@ struct IntensityErrorFixedMost {
     m_model_shadows(model_shadows),
     m_camera_position_step_size(camera_position_step_size),
     m_max_dem_height(max_dem_height),
+    m_shadow(shadow),
     m_gridx(gridx), m_gridy(gridy),
     m_global_params(global_params),
     m_model_params(model_params),
@@ -2222,6 +2124,7 @@ struct IntensityErrorFixedMost {
                                    m_model_shadows,  
                                    m_camera_position_step_size,  
                                    m_max_dem_height,  // alias
+                                   m_shadow,          // alias
                                    m_gridx, m_gridy,  
                                    m_global_params,  // alias
                                    m_model_params,  // alias
@@ -2242,6 +2145,7 @@ struct IntensityErrorFixedMost {
 				     bool model_shadows,
 				     double camera_position_step_size,
 				     double const& max_dem_height, // alias
+				     ImageView<float> const& shadow, // alias
 				     double gridx, double gridy,
 				     GlobalParams const& global_params,
 				     ModelParams const& model_params,
@@ -2254,7 +2158,7 @@ struct IntensityErrorFixedMost {
 	    (new IntensityErrorFixedMost(col, row, dem, albedo, reflectance_model_coeffs, geo,
 				model_shadows,
 				camera_position_step_size,
-				max_dem_height,
+				max_dem_height, shadow,
 				gridx, gridy,
 				global_params, model_params,
 				crop_box, image, blend_weight, camera)));
@@ -2268,6 +2172,7 @@ struct IntensityErrorFixedMost {
   bool                                      m_model_shadows;
   double                                    m_camera_position_step_size;
   double                            const & m_max_dem_height; // alias
+  ImageView<float>                  const & m_shadow;         // alias
   double                                    m_gridx, m_gridy;
   GlobalParams                      const & m_global_params;  // alias
   ModelParams                       const & m_model_params;   // alias
@@ -2286,6 +2191,7 @@ struct IntensityErrorPQ {
                    bool model_shadows,
                    double camera_position_step_size,
                    double const& max_dem_height, // note: this is an alias
+                   ImageView<float> const& shadow, // alias
                    double gridx, double gridy,
                    GlobalParams const& global_params,
                    ModelParams const& model_params,
@@ -2297,6 +2203,7 @@ struct IntensityErrorPQ {
     m_model_shadows(model_shadows),
     m_camera_position_step_size(camera_position_step_size),
     m_max_dem_height(max_dem_height),
+    m_shadow(shadow),
     m_gridx(gridx), m_gridy(gridy),
     m_global_params(global_params),
     m_model_params(model_params),
@@ -2327,6 +2234,7 @@ struct IntensityErrorPQ {
                                    m_model_shadows,  
                                    m_camera_position_step_size,  
                                    m_max_dem_height,  // alias
+                                   m_shadow,          // alias
                                    m_gridx, m_gridy,  
                                    m_global_params,   // alias
                                    m_model_params,    // alias
@@ -2345,6 +2253,7 @@ struct IntensityErrorPQ {
 				     bool model_shadows,
 				     double camera_position_step_size,
 				     double const& max_dem_height, // alias
+				     ImageView<float> const& shadow, // alias
 				     double gridx, double gridy,
 				     GlobalParams const& global_params,
 				     ModelParams const& model_params,
@@ -2357,7 +2266,7 @@ struct IntensityErrorPQ {
 	    (new IntensityErrorPQ(col, row, dem, geo,
                                   model_shadows,
                                   camera_position_step_size,
-                                  max_dem_height,
+                                  max_dem_height, shadow,
                                   gridx, gridy,
                                   global_params, model_params,
                                   crop_box, image, blend_weight, camera)));
@@ -2369,6 +2278,7 @@ struct IntensityErrorPQ {
   bool                                      m_model_shadows;
   double                                    m_camera_position_step_size;
   double                            const & m_max_dem_height; // alias
+  ImageView<float>                  const & m_shadow;         // alias
   double                                    m_gridx, m_gridy;
   GlobalParams                      const & m_global_params;  // alias
   ModelParams                       const & m_model_params;   // alias
@@ -2663,6 +2573,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Float the camera pose for each image, including the first one. Experimental.")
     ("model-shadows",   po::bool_switch(&opt.model_shadows)->default_value(false)->implicit_value(true),
      "Model the fact that some points on the DEM are in the shadow (occluded from the Sun).")
+    ("horizon-sweep-shadows",   po::bool_switch(&opt.horizon_sweep_shadows)->default_value(false)->implicit_value(true),
+     "With --model-shadows, find the points in shadow by sweeping along the Sun azimuth direction, once per image and iteration, rather than by marching a ray from each DEM point. Much faster on large DEMs and at low Sun angles.")
     ("save-computed-intensity-only",   po::bool_switch(&opt.save_computed_intensity_only)->default_value(false)->implicit_value(true),
      "Do not run any optimization. Simply compute the intensity for a given DEM with exposures, camera positions, etc, coming from a previous SfS run. Useful with --model-shadows.")
     ("shadow-thresholds", po::value(&opt.shadow_thresholds)->default_value(""),
@@ -3020,6 +2932,22 @@ void run_sfs_level(// Fixed inputs
   }
   g_max_dem_height = &max_dem_height;
 
+  // Points in shadow for each clip and image, when found with the
+  // horizon sweep. These are updated in the callback as the DEM changes.
+  std::vector< std::vector< ImageView<float> > > shadows(num_dems);
+  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+    shadows[dem_iter].resize(num_images);
+    if (!opt.model_shadows || !opt.horizon_sweep_shadows)
+      continue;
+    for (int image_iter = 0; image_iter < num_images; image_iter++) {
+      if (opt.skip_images[dem_iter].find(image_iter) != opt.skip_images[dem_iter].end())
+        continue;
+      asp::horizonSweepShadows(model_params[image_iter].sunPosition, dems[dem_iter],
+                               gridx, geo[dem_iter], shadows[dem_iter][image_iter]);
+    }
+  }
+  g_shadows = &shadows;
+
   // See if a given image is used in at least one clip or skipped in
   // all of them
   std::vector<bool> use_image(num_images, false);
@@ -3086,6 +3014,7 @@ void run_sfs_level(// Fixed inputs
                                        opt.model_shadows,
                                        opt.camera_position_step_size,
                                        max_dem_height[dem_iter],
+                                       shadows[dem_iter][image_iter],
                                        gridx, gridy,
                                        global_params, model_params[image_iter],
                                        crop_boxes[dem_iter][image_iter],
@@ -3108,6 +3037,7 @@ void run_sfs_level(// Fixed inputs
                                          opt.model_shadows,
                                          opt.camera_position_step_size,
                                          max_dem_height[dem_iter],
+                                         shadows[dem_iter][image_iter],
                                          gridx, gridy,
                                          global_params, model_params[image_iter],
                                          crop_boxes[dem_iter][image_iter],
@@ -3134,6 +3064,7 @@ void run_sfs_level(// Fixed inputs
                                               opt.model_shadows,
                                               opt.camera_position_step_size,
                                               max_dem_height[dem_iter],
+                                              shadows[dem_iter][image_iter],
                                               gridx, gridy,
                                               global_params, model_params[image_iter],
                                               crop_boxes[dem_iter][image_iter],
@@ -3729,6 +3660,10 @@ int main(int argc, char* argv[]) {
           }
           cam_ptr->crop_box().crop(img_bbox);
           vw_out() << "Crop box dimensions: " << cam_ptr->crop_box() << std::endl;
+
+          // Now that the crop box is known, finish building the model,
+          // as it must not change once the optimization starts.
+          cam_ptr->comp_camera_center_table();
 	
           // Copy the crop box
           if (opt.crop_input_images)
@@ -3891,8 +3826,12 @@ int main(int argc, char* argv[]) {
 	  ImageView< PixelMask<double> > reflectance, intensity;
 	  ImageView<double> weight;
           ImageView<Vector2> pq; // no need for these just for initialization
+          ImageView<float> shadow;
+          if (opt.model_shadows && opt.horizon_sweep_shadows)
+            asp::horizonSweepShadows(model_params[image_iter].sunPosition, dems[0][dem_iter],
+                                     gridx, geos[0][dem_iter], shadow);
           computeReflectanceAndIntensity(dems[0][dem_iter], pq, geos[0][dem_iter],
-					 opt.model_shadows, max_dem_height[dem_iter],
+					 opt.model_shadows, max_dem_height[dem_iter], shadow,
 					 gridx, gridy,
 					 model_params[image_iter],
 					 global_params,
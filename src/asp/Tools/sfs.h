@@ -0,0 +1,282 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#ifndef __ASP_TOOLS_SFS_H__
+#define __ASP_TOOLS_SFS_H__
+
+/**
+  This file breaks out the finding of the DEM points in shadow in sfs.cc.
+*/
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Interpolation.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace asp {
+
+// Find the points on a given DEM that are shadowed by other points of
+// the DEM.  Start marching from the point on the DEM on a ray towards
+// the sun in small increments, until hitting the maximum DEM height.
+inline bool isInShadow(int col, int row, vw::Vector3 & sunPos,
+                       vw::ImageView<double> const& dem, double max_dem_height,
+                       double gridx, double gridy,
+                       vw::cartography::GeoReference const& geo){
+
+  // Here bicubic interpolation won't work. It is easier to interpret
+  // the DEM as piecewise-linear when dealing with rays intersecting
+  // it.
+  vw::InterpolationView<vw::EdgeExtensionView< vw::ImageView<double>,
+    vw::ConstantEdgeExtension >, vw::BilinearInterpolation>
+    interp_dem = vw::interpolate(dem, vw::BilinearInterpolation(),
+                                 vw::ConstantEdgeExtension());
+
+  // The xyz position at the center grid point
+  vw::Vector2 dem_llh = geo.pixel_to_lonlat(vw::Vector2(col, row));
+  vw::Vector3 dem_lonlat_height = vw::Vector3(dem_llh(0), dem_llh(1), dem(col, row));
+  vw::Vector3 xyz = geo.datum().geodetic_to_cartesian(dem_lonlat_height);
+
+  // Normalized direction from the view point
+  vw::Vector3 dir = sunPos - xyz;
+  if (dir == vw::Vector3())
+    return false;
+  dir = dir/vw::norm_2(dir);
+
+  // The projection of dir onto the tangent plane at xyz,
+  // that is, the "horizontal" component at the current sphere surface.
+  vw::Vector3 dir2 = dir - vw::dot_prod(dir, xyz)*xyz/vw::dot_prod(xyz, xyz);
+
+  // Ensure that we advance by at most half a grid point each time
+  double delta = 0.5*std::min(gridx, gridy)/std::max(vw::norm_2(dir2), 1e-16);
+
+  // go along the ray. Don't allow the loop to go forever.
+  for (int i = 1; i < 10000000; i++) {
+    vw::Vector3 ray_P = xyz + i * delta * dir;
+    vw::Vector3 ray_llh = geo.datum().cartesian_to_geodetic(ray_P);
+    if (ray_llh[2] > max_dem_height) {
+      // We're above the terrain, no point in continuing
+      return false;
+    }
+
+    // Compensate for any longitude 360 degree offset, e.g., 270 deg vs -90 deg
+    ray_llh[0] += 360.0*round((dem_llh[0] - ray_llh[0])/360.0);
+
+    vw::Vector2 ray_pix = geo.lonlat_to_pixel(vw::Vector2(ray_llh[0], ray_llh[1]));
+
+    if (ray_pix[0] < 0 || ray_pix[0] > dem.cols() - 1 ||
+	ray_pix[1] < 0 || ray_pix[1] > dem.rows() - 1 ) {
+      return false; // got out of the DEM, no point continuing
+    }
+
+    // Dem height at the current point on the ray
+    double dem_h = interp_dem(ray_pix[0], ray_pix[1]);
+
+    if (ray_llh[2] < dem_h) {
+      // The ray goes under the DEM, so we are in shadow.
+      return true;
+    }
+  }
+
+  return false;
+}
+
+inline void areInShadow(vw::Vector3 & sunPos, vw::ImageView<double> const& dem,
+                        double gridx, double gridy,
+                        vw::cartography::GeoReference const& geo,
+                        vw::ImageView<float> & shadow){
+
+  // Find the max DEM height
+  double max_dem_height = -std::numeric_limits<double>::max();
+  for (int col = 0; col < dem.cols(); col++) {
+    for (int row = 0; row < dem.rows(); row++) {
+      if (dem(col, row) > max_dem_height) {
+	max_dem_height = dem(col, row);
+      }
+    }
+  }
+
+  shadow.set_size(dem.cols(), dem.rows());
+  for (int col = 0; col < dem.cols(); col++) {
+    for (int row = 0; row < dem.rows(); row++) {
+      shadow(col, row) = isInShadow(col, row, sunPos, dem,
+				    max_dem_height, gridx, gridy, geo);
+    }
+  }
+}
+
+// Sweep through a range of lines parallel to the Sun azimuth, for
+// horizonSweepShadows(). The lines are indexed by their offset in the
+// minor image direction, and traversed along the major image
+// direction, starting from the Sun side. Each line writes to its own
+// set of pixels, so separate ranges of lines can be processed in
+// parallel.
+class HorizonSweepTask: public vw::Task, private boost::noncopyable {
+  vw::ImageView<double> const& m_w;     // height minus sun elevation tangent times distance
+  vw::ImageView<float>       & m_shadow;
+  bool   m_transpose;               // If true, the major direction is along rows
+  bool   m_reverse;                 // If true, traverse the major direction backwards
+  double m_slope;                   // Minor pixel increment per major pixel increment
+  int    m_beg_line, m_end_line;
+
+  // Access by (major, minor) coordinates
+  double w(int major, int minor) const {
+    return m_transpose ? m_w(minor, major) : m_w(major, minor);
+  }
+  
+public:
+  HorizonSweepTask(vw::ImageView<double> const& w, vw::ImageView<float> & shadow,
+                   bool transpose, bool reverse, double slope,
+                   int beg_line, int end_line):
+    m_w(w), m_shadow(shadow), m_transpose(transpose), m_reverse(reverse),
+    m_slope(slope), m_beg_line(beg_line), m_end_line(end_line){}
+
+  void operator()() {
+    int num_major = m_transpose ? m_w.rows() : m_w.cols();
+    int num_minor = m_transpose ? m_w.cols() : m_w.rows();
+
+    std::vector<double> max_w(m_end_line - m_beg_line,
+                              -std::numeric_limits<double>::max());
+    for (int k = 0; k < num_major; k++) {
+      int major = m_reverse ? num_major - 1 - k : k;
+
+      // Line j goes through the minor coordinate j + major*slope. Split
+      // that into an integer and a fractional part in [-0.5, 0.5), so
+      // that each pixel in this column is visited by exactly one line.
+      double base = major*m_slope;
+      int    off  = (int)floor(base + 0.5);
+      double frac = base - off;
+      
+      for (int j = m_beg_line; j < m_end_line; j++) {
+        int minor = j + off;
+        if (minor < 0 || minor >= num_minor)
+          continue;
+
+        // Interpolate linearly across the line, as the ray may pass
+        // between pixels.
+        double val = w(major, minor);
+        if (frac >= 0 && minor + 1 < num_minor)
+          val = (1 - frac)*val + frac*w(major, minor + 1);
+        else if (frac < 0 && minor - 1 >= 0)
+          val = (1 + frac)*val - frac*w(major, minor - 1);
+        
+        double & curr_max = max_w[j - m_beg_line];
+        bool in_shadow = (curr_max > val);
+        if (val > curr_max)
+          curr_max = val;
+
+        if (m_transpose)
+          m_shadow(minor, major) = in_shadow;
+        else
+          m_shadow(major, minor) = in_shadow;
+      }
+    }
+  }
+};
+
+// A faster alternative to areInShadow(). The Sun is far enough that
+// its direction can be taken as constant over the DEM. In a local
+// frame with the vertical axis through the DEM center, a point Q
+// closer to the Sun than P occludes P if it is above the ray from P
+// to the Sun, that is, if
+//   h(Q) - t*a(Q) > h(P) - t*a(P),
+// where h is the height in this frame, a is the horizontal coordinate
+// in the Sun direction, and t is the tangent of the Sun elevation.
+// So, along lines parallel to the Sun azimuth, traversed starting
+// from the Sun side, a point is in shadow if the running maximum of
+// h - t*a is above its own value. This is O(N) per image, while
+// ray-marching is O(N^1.5).
+inline void horizonSweepShadows(vw::Vector3 const& sunPos, vw::ImageView<double> const& dem,
+                                double gridx, vw::cartography::GeoReference const& geo,
+                                vw::ImageView<float> & shadow){
+
+  shadow.set_size(dem.cols(), dem.rows());
+  vw::fill(shadow, 0);
+  if (dem.cols() < 2 || dem.rows() < 2)
+    return;
+
+  // The local frame
+  vw::Vector2 ctr_pix(dem.cols()/2, dem.rows()/2);
+  vw::Vector2 ctr_llh = geo.pixel_to_lonlat(ctr_pix);
+  vw::Vector3 ctr = geo.datum().geodetic_to_cartesian
+    (vw::Vector3(ctr_llh[0], ctr_llh[1], dem(ctr_pix[0], ctr_pix[1])));
+  vw::Vector3 up  = ctr/vw::norm_2(ctr);
+  vw::Vector3 dir = sunPos - ctr;
+  if (dir == vw::Vector3())
+    return;
+  dir = dir/vw::norm_2(dir);
+  vw::Vector3 horiz = dir - vw::dot_prod(dir, up)*up;
+  if (vw::norm_2(horiz) < 1e-12)
+    return; // The Sun is at zenith
+  horiz = horiz/vw::norm_2(horiz);
+  double tan_elev = vw::dot_prod(dir, up)/vw::dot_prod(dir, horiz);
+
+  // The Sun direction in pixel units
+  vw::Vector3 llh = geo.datum().cartesian_to_geodetic(ctr + gridx*horiz);
+  llh[0] += 360.0*round((ctr_llh[0] - llh[0])/360.0);
+  vw::Vector2 pix_dir = geo.lonlat_to_pixel(vw::Vector2(llh[0], llh[1])) - ctr_pix;
+  if (pix_dir == vw::Vector2())
+    return;
+
+  vw::ImageView<double> w(dem.cols(), dem.rows());
+  for (int col = 0; col < dem.cols(); col++) {
+    for (int row = 0; row < dem.rows(); row++) {
+      vw::Vector2 lonlat = geo.pixel_to_lonlat(vw::Vector2(col, row));
+      vw::Vector3 xyz = geo.datum().geodetic_to_cartesian
+        (vw::Vector3(lonlat[0], lonlat[1], dem(col, row))) - ctr;
+      w(col, row) = vw::dot_prod(xyz, up) - tan_elev*vw::dot_prod(xyz, horiz);
+    }
+  }
+
+  // Traverse along the image direction closest to the Sun azimuth.
+  bool   transpose = (std::abs(pix_dir[1]) > std::abs(pix_dir[0]));
+  double major_dir = transpose ? pix_dir[1] : pix_dir[0];
+  double minor_dir = transpose ? pix_dir[0] : pix_dir[1];
+  bool   reverse   = (major_dir > 0); // Start from the Sun side
+  double slope     = minor_dir/major_dir;
+  int    num_major = transpose ? dem.rows() : dem.cols();
+  int    num_minor = transpose ? dem.cols() : dem.rows();
+
+  // The range of line indices covering the image
+  int beg_line = -(int)ceil(std::max(0.0,  slope)*(num_major - 1)) - 1;
+  int end_line = num_minor + (int)ceil(std::max(0.0, -slope)*(num_major - 1)) + 1;
+  
+  vw::FifoWorkQueue queue( vw::vw_settings().default_num_threads() );
+  int lines_per_task = 256;
+  for (int beg = beg_line; beg < end_line; beg += lines_per_task) {
+    boost::shared_ptr<HorizonSweepTask>
+      task(new HorizonSweepTask(w, shadow, transpose, reverse, slope, beg,
+                                std::min(beg + lines_per_task, end_line)));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
+} // end namespace asp
+
+#endif // __ASP_TOOLS_SFS_H__
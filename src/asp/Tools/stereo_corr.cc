@@ -28,6 +28,7 @@
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_stages.h>
 #include <asp/Core/DemDisparity.h>
 #include <asp/Core/LocalHomography.h>
 #include <asp/Sessions/StereoSession.h>
@@ -36,71 +37,16 @@
 
 #include <asp/Core/InterestPointMatching.h>
 #include <vw/Stereo/StereoModel.h>
+#include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
 
 using namespace vw;
 using namespace vw::stereo;
 using namespace asp;
 using namespace std;
 
-/// Returns the properly cast cost mode type
-stereo::CostFunctionType get_cost_mode_value() {
-  switch(stereo_settings().cost_mode) {
-    case 0: return stereo::ABSOLUTE_DIFFERENCE;
-    case 1: return stereo::SQUARED_DIFFERENCE;
-    case 2: return stereo::CROSS_CORRELATION;
-    case 3: return stereo::CENSUS_TRANSFORM;
-    case 4: return stereo::TERNARY_CENSUS_TRANSFORM;
-    default: 
-      vw_throw( ArgumentErr() << "Unknown value " << stereo_settings().cost_mode << " for cost-mode.\n" );
-  };
-}
-
-/// Determine the proper subpixel mode to be used with SGM correlation
-SemiGlobalMatcher::SgmSubpixelMode get_sgm_subpixel_mode() {
-
-  switch(stereo_settings().subpixel_mode) {
-    case  7: return SemiGlobalMatcher::SUBPIXEL_NONE;
-    case  8: return SemiGlobalMatcher::SUBPIXEL_LINEAR;
-    case  9: return SemiGlobalMatcher::SUBPIXEL_POLY4;
-    case 10: return SemiGlobalMatcher::SUBPIXEL_COSINE;
-    case 11: return SemiGlobalMatcher::SUBPIXEL_PARABOLA;
-    case 12: return SemiGlobalMatcher::SUBPIXEL_LC_BLEND;
-    default: return SemiGlobalMatcher::SUBPIXEL_LC_BLEND;
-  };
-}
-
-// Read the search range from D_sub, and scale it to the full image
-void read_search_range_from_dsub(ASPGlobalOptions & opt){
-
-  // No D_sub is generated or should be used for seed mode 0.
-  if (stereo_settings().seed_mode == 0)
-    return;
-
-  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
-                           Rmask(opt.out_prefix + "-rMask.tif");
-
-  DiskImageView<PixelGray<float> > left_sub ( opt.out_prefix+"-L_sub.tif" ),
-                                   right_sub( opt.out_prefix+"-R_sub.tif" );
-
-  std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
-
-  ImageViewRef<PixelMask<Vector2f> > sub_disp;
-  if (!load_sub_disp_image(d_sub_file, sub_disp))
-    return; // File not found
-
-  Vector2 upsample_scale( double(Lmask.cols()) / double(sub_disp.cols()) ,
-                          double(Lmask.rows()) / double(sub_disp.rows()) );
-
-  BBox2i search_range = stereo::get_disparity_range( sub_disp );
-  search_range.min() = floor(elem_prod(search_range.min(),upsample_scale));
-  search_range.max() = ceil (elem_prod(search_range.max(),upsample_scale));
-  stereo_settings().search_range = search_range;
-
-  vw_out() << "\t--> Read search range from D_sub: " << search_range << "\n";
-}
-
-
-
 /// Produces the low-resolution disparity file D_sub
 void produce_lowres_disparity( ASPGlobalOptions & opt ) {
 
@@ -855,234 +801,178 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
 } // End lowres_correlation
 
 
+/// Estimate the relative cost of correlating each tile, as the number
+/// of valid left pixels times the area of the search range. Both are
+/// found from the low-resolution mask and disparity, in the same way
+/// SeededCorrelatorView finds the search range of a tile. The tiles
+/// are given in the coordinates of L.tif.
+std::vector<double> estimate_corr_tile_costs(ASPGlobalOptions const& opt,
+                                             std::vector<BBox2i> const& tiles) {
 
-/// This correlator takes a low resolution disparity image as an input
-/// so that it may narrow its search range for each tile that is processed.
-class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
-  DiskImageView<PixelGray<float> >   m_left_image;
-  DiskImageView<PixelGray<float> >   m_right_image;
-  DiskImageView<vw::uint8> m_left_mask;
-  DiskImageView<vw::uint8> m_right_mask;
-  ImageViewRef<PixelMask<Vector2f> > m_sub_disp;
-  ImageViewRef<PixelMask<Vector2i> > m_sub_disp_spread;
-  ImageView<Matrix3x3> const& m_local_hom;
-
-  // Settings
-  Vector2  m_upscale_factor;
-  BBox2i   m_seed_bbox;
-  Vector2i m_kernel_size;
-  stereo::CostFunctionType m_cost_mode;
-  int      m_corr_timeout;
-  double   m_seconds_per_op;
+  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif");
 
-public:
+  // These are small, so keep them in memory
+  ImageView<vw::uint8> left_mask_sub;
+  std::string mask_sub_file = opt.out_prefix + "-lMask_sub.tif";
+  if (fs::exists(mask_sub_file))
+    left_mask_sub = DiskImageView<vw::uint8>(mask_sub_file);
 
-  // Set these input types here instead of making them template arguments
-  typedef DiskImageView<PixelGray<float> >   ImageType;
-  typedef DiskImageView<vw::uint8>           MaskType;
-  typedef ImageViewRef<PixelMask<Vector2f> > DispSeedImageType;
-  typedef ImageViewRef<PixelMask<Vector2i> > SpreadImageType;
-  typedef ImageType::pixel_type InputPixelType;
-
-  SeededCorrelatorView( ImageType             const& left_image,
-                        ImageType             const& right_image,
-                        MaskType              const& left_mask,
-                        MaskType              const& right_mask,
-                        DispSeedImageType     const& sub_disp,
-                        SpreadImageType       const& sub_disp_spread,
-                        ImageView<Matrix3x3>  const& local_hom,
-                        Vector2i const& kernel_size,
-                        stereo::CostFunctionType cost_mode,
-                        int corr_timeout, double seconds_per_op) :
-    m_left_image(left_image.impl()), m_right_image(right_image.impl()),
-    m_left_mask (left_mask.impl ()), m_right_mask (right_mask.impl ()),
-    m_sub_disp(sub_disp.impl()), m_sub_disp_spread(sub_disp_spread.impl()),
-    m_local_hom(local_hom),
-    m_kernel_size(kernel_size),  m_cost_mode(cost_mode),
-    m_corr_timeout(corr_timeout), m_seconds_per_op(seconds_per_op){
-    m_upscale_factor[0] = double(m_left_image.cols()) / m_sub_disp.cols();
-    m_upscale_factor[1] = double(m_left_image.rows()) / m_sub_disp.rows();
-    m_seed_bbox = bounding_box( m_sub_disp );
+  ImageView<PixelMask<Vector2f> > sub_disp;
+  if (stereo_settings().seed_mode > 0) {
+    ImageViewRef<PixelMask<Vector2f> > sub_disp_ref;
+    if (load_sub_disp_image(opt.out_prefix + "-D_sub.tif", sub_disp_ref))
+      sub_disp = sub_disp_ref;
   }
 
-  // Image View interface
-  typedef PixelMask<Vector2f> pixel_type;
-  typedef pixel_type          result_type;
-  typedef ProceduralPixelAccessor<SeededCorrelatorView> pixel_accessor;
-
-  inline int32 cols  () const { return m_left_image.cols(); }
-  inline int32 rows  () const { return m_left_image.rows(); }
-  inline int32 planes() const { return 1; }
-
-  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
-
-  inline pixel_type operator()(double /*i*/, double /*j*/, int32 /*p*/ = 0) const {
-    vw_throw(NoImplErr() << "SeededCorrelatorView::operator()(...) is not implemented");
-    return pixel_type();
-  }
-
-  /// Does the work
-  typedef CropView<ImageView<pixel_type> > prerasterize_type;
-  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
-
-    bool use_local_homography = stereo_settings().use_local_homography;
-
-    Matrix<double> lowres_hom  = math::identity_matrix<3>();
-    Matrix<double> fullres_hom = math::identity_matrix<3>();
-    ImageViewRef<InputPixelType> right_trans_img;
-    ImageViewRef<vw::uint8     > right_trans_mask;
-
-    bool do_round = true; // round integer disparities after transform
-
-    // User strategies
-    BBox2f local_search_range;
-    if ( stereo_settings().seed_mode > 0 ) {
-
-      // The low-res version of bbox
-      BBox2i seed_bbox( elem_quot(bbox.min(), m_upscale_factor),
-                        elem_quot(bbox.max(), m_upscale_factor) );
-      seed_bbox.expand(1);
-      seed_bbox.crop( m_seed_bbox );
-      // Get the disparity range in d_sub corresponding to this tile.
-      VW_OUT(DebugMessage, "stereo") << "\nGetting disparity range for : " << seed_bbox << "\n";
-      DispSeedImageType disparity_in_box = crop( m_sub_disp, seed_bbox );
-
-      if (!use_local_homography){
-        local_search_range = stereo::get_disparity_range( disparity_in_box );
-      }else{ // use local homography
-        int ts = ASPGlobalOptions::corr_tile_size();
-        lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
-        local_search_range = stereo::get_disparity_range
-          (transform_disparities(do_round, seed_bbox,
-           lowres_hom, disparity_in_box));
-      }
-
-      bool has_sub_disp_spread = ( m_sub_disp_spread.cols() != 0 &&
-                                   m_sub_disp_spread.rows() != 0 );
-      // Sanity check: If m_sub_disp_spread was provided, it better have the same size as sub_disp.
-      if ( has_sub_disp_spread &&
-           m_sub_disp_spread.cols() != m_sub_disp.cols() &&
-           m_sub_disp_spread.rows() != m_sub_disp.rows() ){
-        vw_throw( ArgumentErr() << "stereo_corr: D_sub and D_sub_spread must have equal sizes.\n");
+  BBox2f search_range = stereo_settings().search_range;
+  std::vector<double> costs(tiles.size());
+  for (size_t i = 0; i < tiles.size(); i++) {
+    BBox2i const& bbox = tiles[i];
+
+    // The fraction of valid pixels in the tile
+    double valid_frac = 1.0;
+    if (left_mask_sub.cols() > 0) {
+      Vector2 scale(double(left_mask_sub.cols()) / Lmask.cols(),
+                    double(left_mask_sub.rows()) / Lmask.rows());
+      BBox2i sub_box(floor(elem_prod(bbox.min(), scale)),
+                     ceil (elem_prod(bbox.max(), scale)));
+      sub_box.crop(bounding_box(left_mask_sub));
+      valid_frac = 0.0;
+      if (!sub_box.empty()) {
+        int num_valid = 0;
+        for (int col = sub_box.min().x(); col < sub_box.max().x(); col++)
+          for (int row = sub_box.min().y(); row < sub_box.max().y(); row++)
+            if (left_mask_sub(col, row) > 0)
+              num_valid++;
+        valid_frac = double(num_valid) / (double(sub_box.width()) * sub_box.height());
       }
+    }
 
-      if (has_sub_disp_spread){
-        // Expand the disparity range by m_sub_disp_spread.
-        SpreadImageType spread_in_box = crop( m_sub_disp_spread, seed_bbox );
-
-        if (!use_local_homography){
-          BBox2f spread = stereo::get_disparity_range( spread_in_box );
-          local_search_range.min() -= spread.max();
-          local_search_range.max() += spread.max();
-        }else{
-          DispSeedImageType upper_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
-                                                               disparity_in_box + spread_in_box);
-          DispSeedImageType lower_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
-                                                               disparity_in_box - spread_in_box);
-          BBox2f upper_range = stereo::get_disparity_range(upper_disp);
-          BBox2f lower_range = stereo::get_disparity_range(lower_disp);
-
-          local_search_range = upper_range;
-          local_search_range.grow(lower_range);
-        } //endif use_local_homography
-      } //endif has_sub_disp_spread
-
-      if (use_local_homography){
-        Vector3 upscale(     m_upscale_factor[0],     m_upscale_factor[1], 1 );
-        Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
-        fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
-
-        ImageViewRef< PixelMask<InputPixelType> >
-          right_trans_masked_img
-          = transform (copy_mask( m_right_image.impl(),
-                       create_mask(m_right_mask.impl()) ),
-                         HomographyTransform(fullres_hom),
-                         m_left_image.impl().cols(), m_left_image.impl().rows());
-        right_trans_img  = apply_mask(right_trans_masked_img);
-        right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
-      } //endif use_local_homography
-
-      local_search_range = grow_bbox_to_int(local_search_range);
-      // Expand local_search_range by 1. This is necessary since
-      // m_sub_disp is integer-valued, and perhaps the search
-      // range was supposed to be a fraction of integer bigger.
-      local_search_range.expand(1);
-
-      // Scale the search range to full-resolution
-      local_search_range.min() = floor(elem_prod(local_search_range.min(),m_upscale_factor));
-      local_search_range.max() = ceil (elem_prod(local_search_range.max(),m_upscale_factor));
-
-      // If the user specified a search range limit, apply it here.
-      if ((stereo_settings().search_range_limit.min() != Vector2i()) || 
-          (stereo_settings().search_range_limit.max() != Vector2i())   ) {     
-        local_search_range.crop(stereo_settings().search_range_limit);
-        vw_out() << "\t--> Local search range constrained to: " << local_search_range << "\n";
+    // The full-resolution search range dimensions
+    double search_wid = search_range.width(), search_hgt = search_range.height();
+    if (sub_disp.cols() > 0) {
+      Vector2 scale(double(sub_disp.cols()) / Lmask.cols(),
+                    double(sub_disp.rows()) / Lmask.rows());
+      BBox2i seed_box(floor(elem_prod(bbox.min(), scale)),
+                      ceil (elem_prod(bbox.max(), scale)));
+      seed_box.expand(1);
+      seed_box.crop(bounding_box(sub_disp));
+      if (!seed_box.empty()) {
+        BBox2f local_range = stereo::get_disparity_range(crop(sub_disp, seed_box));
+        search_wid = (local_range.width () + 2) / scale[0];
+        search_hgt = (local_range.height() + 2) / scale[1];
       }
+    }
 
-      VW_OUT(DebugMessage, "stereo") << "SeededCorrelatorView("
-                                     << bbox << ") local search range "
-                                     << local_search_range << " vs "
-                                     << stereo_settings().search_range << "\n";
+    costs[i] = double(bbox.width()) * bbox.height() * valid_frac
+      * (search_wid + 1) * (search_hgt + 1);
+  }
 
-    } else{ // seed mode == 0
-      local_search_range = stereo_settings().search_range;
-      VW_OUT(DebugMessage,"stereo") << "Searching with " << stereo_settings().search_range << "\n";
-    }
+  return costs;
+}
 
-    SemiGlobalMatcher::SgmSubpixelMode sgm_subpixel_mode = get_sgm_subpixel_mode();
-    Vector2i sgm_search_buffer = stereo_settings().sgm_search_buffer;
+/// Correlate one tile and write it to D.tif as soon as it is done,
+/// no matter which other tiles are finished by then.
+class CorrTileTask: public Task, private boost::noncopyable {
+  ImageViewRef<PixelMask<Vector2f> > m_disparity;
+  BBox2i                   m_bbox;
+  double                   m_cost;
+  DiskImageResourceGDAL  & m_rsrc;
+  Mutex                  & m_write_mutex; // GDAL writes are not thread-safe
+  int                    & m_num_done;    // protected by m_write_mutex
+  double                 & m_tile_seconds; // protected by m_write_mutex
+  int                      m_num_tiles;
+  ProgressCallback const & m_progress;
 
-    // Now we are ready to actually perform correlation
-    const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
-    if (use_local_homography){
-      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageViewRef<InputPixelType>, 
-                                                 MaskType,  ImageViewRef<vw::uint8     > > CorrView;
-      CorrView corr_view( m_left_image,   right_trans_img,
-                          m_left_mask,    right_trans_mask,
-                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
-                          stereo_settings().slogW,
-                          local_search_range,
-                          m_kernel_size,  m_cost_mode,
-                          m_corr_timeout, m_seconds_per_op,
-                          stereo_settings().xcorr_threshold,
-                          stereo_settings().min_xcorr_level,
-                          rm_half_kernel,
-                          stereo_settings().corr_max_levels,
-                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
-                          stereo_settings().sgm_collar_size,
-                          sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
-                          stereo_settings().corr_blob_filter_area,
-                          stereo_settings().stereo_debug );
-      return corr_view.prerasterize(bbox);
-    }else{
-      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageType, MaskType, MaskType > CorrView;
-      CorrView corr_view( m_left_image,   m_right_image,
-                          m_left_mask,    m_right_mask,
-                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
-                          stereo_settings().slogW,
-                          local_search_range,
-                          m_kernel_size,  m_cost_mode,
-                          m_corr_timeout, m_seconds_per_op,
-                          stereo_settings().xcorr_threshold,
-                          stereo_settings().min_xcorr_level,
-                          rm_half_kernel,
-                          stereo_settings().corr_max_levels,
-                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
-                          stereo_settings().sgm_collar_size,
-                          sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
-                          stereo_settings().corr_blob_filter_area,
-                          stereo_settings().stereo_debug );
-      return corr_view.prerasterize(bbox);
+public:
+  CorrTileTask(ImageViewRef<PixelMask<Vector2f> > const& disparity,
+               BBox2i const& bbox, double cost,
+               DiskImageResourceGDAL & rsrc, Mutex & write_mutex,
+               int & num_done, double & tile_seconds, int num_tiles,
+               ProgressCallback const& progress):
+    m_disparity(disparity), m_bbox(bbox), m_cost(cost), m_rsrc(rsrc),
+    m_write_mutex(write_mutex), m_num_done(num_done), m_tile_seconds(tile_seconds),
+    m_num_tiles(num_tiles), m_progress(progress) {}
+
+  void operator()() {
+    Stopwatch sw;
+    sw.start();
+    // Cast back to integer results to save on storage space
+    ImageView<PixelMask<Vector2i> > tile
+      = pixel_cast<PixelMask<Vector2i> >(crop(m_disparity, m_bbox));
+    sw.stop();
+
+    Mutex::Lock lock(m_write_mutex);
+    m_rsrc.write(tile.buffer(), m_bbox);
+    m_num_done++;
+    m_tile_seconds += sw.elapsed_seconds();
+    m_progress.report_fractional_progress(m_num_done, m_num_tiles);
+    VW_OUT(DebugMessage, "asp") << "Correlated tile " << m_bbox << " with estimated cost "
+                                << m_cost << " in " << sw.elapsed_seconds() << " seconds.\n";
+  }
+};
+
+/// Write the integer disparity to D.tif. The run time of a tile varies
+/// by orders of magnitude with its search range and with how much of it
+/// is masked, so, rather than going in raster order, the tiles are
+/// queued from the most to the least expensive. Then the slow tiles do
+/// not end up running by themselves at the end.
+void write_disparity_by_tile_cost(ASPGlobalOptions const& opt, std::string const& d_file,
+                                  ImageViewRef<PixelMask<Vector2f> > const& disparity,
+                                  bool has_georef, cartography::GeoReference const& georef) {
+
+  boost::scoped_ptr<DiskImageResourceGDAL>
+    rsrc(vw::cartography::build_gdal_rsrc(d_file,
+                                          pixel_cast<PixelMask<Vector2i> >(disparity), opt));
+  if (has_georef)
+    write_georeference(*rsrc, georef);
+
+  // The tiles match the blocks of the output file
+  std::vector<BBox2i> tiles, tiles_in_image;
+  Vector2i ts = opt.raster_tile_size;
+  BBox2i crop_win = stereo_settings().trans_crop_win;
+  for (int row = 0; row < disparity.rows(); row += ts.y()) {
+    for (int col = 0; col < disparity.cols(); col += ts.x()) {
+      BBox2i bbox(col, row, std::min(ts.x(), disparity.cols() - col),
+                  std::min(ts.y(), disparity.rows() - row));
+      tiles.push_back(bbox);
+      tiles_in_image.push_back(bbox + crop_win.min());
     }
-    
-  } // End function prerasterize_helper
-
-  template <class DestT>
-  inline void rasterize(DestT const& dest, BBox2i bbox) const {
-    vw::rasterize(prerasterize(bbox), dest, bbox);
   }
-}; // End class SeededCorrelatorView
-
+  std::vector<double> costs = estimate_corr_tile_costs(opt, tiles_in_image);
+
+  // Most expensive first
+  std::vector< std::pair<double, int> > order(tiles.size());
+  for (size_t i = 0; i < tiles.size(); i++)
+    order[i] = std::make_pair(-costs[i], int(i));
+  std::sort(order.begin(), order.end());
+
+  Stopwatch sw;
+  sw.start();
+  TerminalProgressCallback tpc("asp", "\t--> Correlation :");
+  Mutex write_mutex;
+  int num_done = 0, num_tiles = tiles.size();
+  double tile_seconds = 0;
+  FifoWorkQueue queue(opt.num_threads);
+  for (size_t i = 0; i < order.size(); i++) {
+    int tile_id = order[i].second;
+    boost::shared_ptr<CorrTileTask>
+      task(new CorrTileTask(disparity, tiles[tile_id], costs[tile_id], *rsrc, write_mutex,
+                            num_done, tile_seconds, num_tiles, tpc));
+    queue.add_task(task);
+  }
+  queue.join_all();
+  tpc.report_finished();
+  sw.stop();
+
+  // How busy the threads were. Idle threads at the end show up here.
+  double wall_seconds = sw.elapsed_seconds();
+  vw_out() << "Correlated " << num_tiles << " tiles in " << wall_seconds
+           << " seconds, with " << tile_seconds << " seconds of tile time on "
+           << opt.num_threads << " threads ("
+           << 100.0*tile_seconds/std::max(1e-6, wall_seconds*opt.num_threads)
+           << "% busy).\n";
+}
 
 /// Main stereo correlation function, called after parsing input arguments.
 void stereo_correlation( ASPGlobalOptions& opt ) {
@@ -1122,52 +1012,10 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   vw_out(DebugMessage) << "\t   Prefilter Size:  " << stereo_settings().slogW << endl;
   vw_out() << "\t--------------------------------------------------\n";
 
-  // Load up for the actual native resolution processing
-  DiskImageView<PixelGray<float> > left_disk_image (opt.out_prefix+"-L.tif"),
-                                   right_disk_image(opt.out_prefix+"-R.tif");
-  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
-                           Rmask(opt.out_prefix + "-rMask.tif");
-  ImageViewRef<PixelMask<Vector2f> > sub_disp;
-  std::string dsub_file   = opt.out_prefix+"-D_sub.tif";
-  std::string spread_file = opt.out_prefix+"-D_sub_spread.tif";
-  
-  if ( stereo_settings().seed_mode > 0 )
-    load_sub_disp_image(dsub_file, sub_disp); // TODO: What if file is missing?
-  ImageViewRef<PixelMask<Vector2i> > sub_disp_spread;
-  if ( stereo_settings().seed_mode == 2 ||  stereo_settings().seed_mode == 3 ){
-    // D_sub_spread is mandatory for seed_mode 2 and 3.
-    sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
-  }else if ( stereo_settings().seed_mode == 1 ){
-    // D_sub_spread is optional for seed_mode 1, we use it only if it is provided.
-    if (fs::exists(spread_file)) {
-      try {
-        sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
-      }
-      catch (...) {}
-    }
-  }
-
-  ImageView<Matrix3x3> local_hom;
-  if ( stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography ){
-    string local_hom_file = opt.out_prefix + "-local_hom.txt";
-    read_local_homographies(local_hom_file, local_hom);
-  }
-
-  stereo::CostFunctionType cost_mode = get_cost_mode_value();
-  Vector2i kernel_size    = stereo_settings().corr_kernel;
-  BBox2i   trans_crop_win = stereo_settings().trans_crop_win;
-  int      corr_timeout   = stereo_settings().corr_timeout;
-  double   seconds_per_op = 0.0;
-  if (corr_timeout > 0)
-    seconds_per_op = calc_seconds_per_op(cost_mode, left_disk_image, right_disk_image, kernel_size);
-
   // Set up the reference to the stereo disparity code
   // - Processing is limited to trans_crop_win for use with parallel_stereo.
   ImageViewRef<PixelMask<Vector2f> > fullres_disparity =
-    crop(SeededCorrelatorView( left_disk_image, right_disk_image, Lmask, Rmask,
-                               sub_disp, sub_disp_spread, local_hom, kernel_size, 
-                               cost_mode, corr_timeout, seconds_per_op ), 
-         trans_crop_win);
+    crop(fullres_correlation(opt), stereo_settings().trans_crop_win);
 
   // With SGM, we must do the entire image chunk as one tile. Otherwise,
   // if it gets done in smaller tiles, there will be artifacts at tile boundaries.
@@ -1219,12 +1067,8 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
                                             TerminalProgressCallback("asp", "\t--> Correlation :") );
 
   } else {
-    // Otherwise cast back to integer results to save on storage space.
-    vw::cartography::block_write_gdal_image(d_file, 
-              pixel_cast<PixelMask<Vector2i> >(fullres_disparity),
-              has_left_georef, left_georef,
-              has_nodata, nodata, opt,
-              TerminalProgressCallback("asp", "\t--> Correlation :") );
+    write_disparity_by_tile_cost(opt, d_file, fullres_disparity,
+                                 has_left_georef, left_georef);
   }
 
   vw_out() << "\n[ " << current_posix_time_string() << " ] : CORRELATION FINISHED \n";
@@ -126,6 +126,8 @@ int main( int argc, char* argv[] ) {
     else
       vw_out() << "collar_size," << stereo_settings().sgm_collar_size << endl;
 
+    vw_out() << "fused_pipeline," << stereo_settings().fused_pipeline << endl;
+
     // This block of code should be in its own executable but I am
     // reluctant to create one just for it. This functionality will be
     // invoked after low-res disparity is computed, whether done in
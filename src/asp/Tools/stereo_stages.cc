@@ -0,0 +1,1015 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file stereo_stages.cc
+///
+
+#include <asp/Tools/stereo_stages.h>
+#include <vw/Stereo/PreFilter.h>
+#include <vw/Stereo/DisparityMap.h>
+#include <vw/Stereo/Algorithms.h>
+#include <vw/Stereo/ParabolaSubpixelView.h>
+#include <vw/Stereo/SubpixelView.h>
+#include <vw/Stereo/EMSubpixelCorrelatorView.h>
+#include <vw/FileIO/DiskImageResource.h>
+#include <vw/FileIO/DiskImageResourceOpenEXR.h>
+#include <vw/Image/BlobIndex.h>
+#include <vw/Image/ErodeView.h>
+#include <asp/Core/LocalHomography.h>
+#include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Sessions/StereoSession.h>
+
+using namespace vw;
+using namespace vw::stereo;
+using namespace asp;
+using namespace std;
+
+/// Returns the properly cast cost mode type
+stereo::CostFunctionType asp::get_cost_mode_value() {
+  switch(stereo_settings().cost_mode) {
+    case 0: return stereo::ABSOLUTE_DIFFERENCE;
+    case 1: return stereo::SQUARED_DIFFERENCE;
+    case 2: return stereo::CROSS_CORRELATION;
+    case 3: return stereo::CENSUS_TRANSFORM;
+    case 4: return stereo::TERNARY_CENSUS_TRANSFORM;
+    default: 
+      vw_throw( ArgumentErr() << "Unknown value " << stereo_settings().cost_mode << " for cost-mode.\n" );
+  };
+}
+
+/// Determine the proper subpixel mode to be used with SGM correlation
+SemiGlobalMatcher::SgmSubpixelMode asp::get_sgm_subpixel_mode() {
+
+  switch(stereo_settings().subpixel_mode) {
+    case  7: return SemiGlobalMatcher::SUBPIXEL_NONE;
+    case  8: return SemiGlobalMatcher::SUBPIXEL_LINEAR;
+    case  9: return SemiGlobalMatcher::SUBPIXEL_POLY4;
+    case 10: return SemiGlobalMatcher::SUBPIXEL_COSINE;
+    case 11: return SemiGlobalMatcher::SUBPIXEL_PARABOLA;
+    case 12: return SemiGlobalMatcher::SUBPIXEL_LC_BLEND;
+    default: return SemiGlobalMatcher::SUBPIXEL_LC_BLEND;
+  };
+}
+
+// Read the search range from D_sub, and scale it to the full image
+void asp::read_search_range_from_dsub(ASPGlobalOptions const& opt){
+
+  // No D_sub is generated or should be used for seed mode 0.
+  if (stereo_settings().seed_mode == 0)
+    return;
+
+  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
+                           Rmask(opt.out_prefix + "-rMask.tif");
+
+  DiskImageView<PixelGray<float> > left_sub ( opt.out_prefix+"-L_sub.tif" ),
+                                   right_sub( opt.out_prefix+"-R_sub.tif" );
+
+  std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
+
+  ImageViewRef<PixelMask<Vector2f> > sub_disp;
+  if (!load_sub_disp_image(d_sub_file, sub_disp))
+    return; // File not found
+
+  Vector2 upsample_scale( double(Lmask.cols()) / double(sub_disp.cols()) ,
+                          double(Lmask.rows()) / double(sub_disp.rows()) );
+
+  BBox2i search_range = stereo::get_disparity_range( sub_disp );
+  search_range.min() = floor(elem_prod(search_range.min(),upsample_scale));
+  search_range.max() = ceil (elem_prod(search_range.max(),upsample_scale));
+  stereo_settings().search_range = search_range;
+
+  vw_out() << "\t--> Read search range from D_sub: " << search_range << "\n";
+}
+
+
+/// This correlator takes a low resolution disparity image as an input
+/// so that it may narrow its search range for each tile that is processed.
+class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
+  DiskImageView<PixelGray<float> >   m_left_image;
+  DiskImageView<PixelGray<float> >   m_right_image;
+  DiskImageView<vw::uint8> m_left_mask;
+  DiskImageView<vw::uint8> m_right_mask;
+  ImageViewRef<PixelMask<Vector2f> > m_sub_disp;
+  ImageViewRef<PixelMask<Vector2i> > m_sub_disp_spread;
+  ImageView<Matrix3x3> m_local_hom;
+
+  // Settings
+  Vector2  m_upscale_factor;
+  BBox2i   m_seed_bbox;
+  Vector2i m_kernel_size;
+  stereo::CostFunctionType m_cost_mode;
+  int      m_corr_timeout;
+  double   m_seconds_per_op;
+
+public:
+
+  // Set these input types here instead of making them template arguments
+  typedef DiskImageView<PixelGray<float> >   ImageType;
+  typedef DiskImageView<vw::uint8>           MaskType;
+  typedef ImageViewRef<PixelMask<Vector2f> > DispSeedImageType;
+  typedef ImageViewRef<PixelMask<Vector2i> > SpreadImageType;
+  typedef ImageType::pixel_type InputPixelType;
+
+  SeededCorrelatorView( ImageType             const& left_image,
+                        ImageType             const& right_image,
+                        MaskType              const& left_mask,
+                        MaskType              const& right_mask,
+                        DispSeedImageType     const& sub_disp,
+                        SpreadImageType       const& sub_disp_spread,
+                        ImageView<Matrix3x3>  const& local_hom,
+                        Vector2i const& kernel_size,
+                        stereo::CostFunctionType cost_mode,
+                        int corr_timeout, double seconds_per_op) :
+    m_left_image(left_image.impl()), m_right_image(right_image.impl()),
+    m_left_mask (left_mask.impl ()), m_right_mask (right_mask.impl ()),
+    m_sub_disp(sub_disp.impl()), m_sub_disp_spread(sub_disp_spread.impl()),
+    m_local_hom(local_hom),
+    m_kernel_size(kernel_size),  m_cost_mode(cost_mode),
+    m_corr_timeout(corr_timeout), m_seconds_per_op(seconds_per_op){
+    m_upscale_factor[0] = double(m_left_image.cols()) / m_sub_disp.cols();
+    m_upscale_factor[1] = double(m_left_image.rows()) / m_sub_disp.rows();
+    m_seed_bbox = bounding_box( m_sub_disp );
+  }
+
+  // Image View interface
+  typedef PixelMask<Vector2f> pixel_type;
+  typedef pixel_type          result_type;
+  typedef ProceduralPixelAccessor<SeededCorrelatorView> pixel_accessor;
+
+  inline int32 cols  () const { return m_left_image.cols(); }
+  inline int32 rows  () const { return m_left_image.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()(double /*i*/, double /*j*/, int32 /*p*/ = 0) const {
+    vw_throw(NoImplErr() << "SeededCorrelatorView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  /// Does the work
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    bool use_local_homography = stereo_settings().use_local_homography;
+
+    Matrix<double> lowres_hom  = math::identity_matrix<3>();
+    Matrix<double> fullres_hom = math::identity_matrix<3>();
+    ImageViewRef<InputPixelType> right_trans_img;
+    ImageViewRef<vw::uint8     > right_trans_mask;
+
+    bool do_round = true; // round integer disparities after transform
+
+    // User strategies
+    BBox2f local_search_range;
+    if ( stereo_settings().seed_mode > 0 ) {
+
+      // The low-res version of bbox
+      BBox2i seed_bbox( elem_quot(bbox.min(), m_upscale_factor),
+                        elem_quot(bbox.max(), m_upscale_factor) );
+      seed_bbox.expand(1);
+      seed_bbox.crop( m_seed_bbox );
+      // Get the disparity range in d_sub corresponding to this tile.
+      VW_OUT(DebugMessage, "stereo") << "\nGetting disparity range for : " << seed_bbox << "\n";
+      DispSeedImageType disparity_in_box = crop( m_sub_disp, seed_bbox );
+
+      if (!use_local_homography){
+        local_search_range = stereo::get_disparity_range( disparity_in_box );
+      }else{ // use local homography
+        int ts = ASPGlobalOptions::corr_tile_size();
+        lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
+        local_search_range = stereo::get_disparity_range
+          (transform_disparities(do_round, seed_bbox,
+           lowres_hom, disparity_in_box));
+      }
+
+      bool has_sub_disp_spread = ( m_sub_disp_spread.cols() != 0 &&
+                                   m_sub_disp_spread.rows() != 0 );
+      // Sanity check: If m_sub_disp_spread was provided, it better have the same size as sub_disp.
+      if ( has_sub_disp_spread &&
+           m_sub_disp_spread.cols() != m_sub_disp.cols() &&
+           m_sub_disp_spread.rows() != m_sub_disp.rows() ){
+        vw_throw( ArgumentErr() << "stereo_corr: D_sub and D_sub_spread must have equal sizes.\n");
+      }
+
+      if (has_sub_disp_spread){
+        // Expand the disparity range by m_sub_disp_spread.
+        SpreadImageType spread_in_box = crop( m_sub_disp_spread, seed_bbox );
+
+        if (!use_local_homography){
+          BBox2f spread = stereo::get_disparity_range( spread_in_box );
+          local_search_range.min() -= spread.max();
+          local_search_range.max() += spread.max();
+        }else{
+          DispSeedImageType upper_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
+                                                               disparity_in_box + spread_in_box);
+          DispSeedImageType lower_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
+                                                               disparity_in_box - spread_in_box);
+          BBox2f upper_range = stereo::get_disparity_range(upper_disp);
+          BBox2f lower_range = stereo::get_disparity_range(lower_disp);
+
+          local_search_range = upper_range;
+          local_search_range.grow(lower_range);
+        } //endif use_local_homography
+      } //endif has_sub_disp_spread
+
+      if (use_local_homography){
+        Vector3 upscale(     m_upscale_factor[0],     m_upscale_factor[1], 1 );
+        Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
+        fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
+
+        ImageViewRef< PixelMask<InputPixelType> >
+          right_trans_masked_img
+          = transform (copy_mask( m_right_image.impl(),
+                       create_mask(m_right_mask.impl()) ),
+                         HomographyTransform(fullres_hom),
+                         m_left_image.impl().cols(), m_left_image.impl().rows());
+        right_trans_img  = apply_mask(right_trans_masked_img);
+        right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
+      } //endif use_local_homography
+
+      local_search_range = grow_bbox_to_int(local_search_range);
+      // Expand local_search_range by 1. This is necessary since
+      // m_sub_disp is integer-valued, and perhaps the search
+      // range was supposed to be a fraction of integer bigger.
+      local_search_range.expand(1);
+
+      // Scale the search range to full-resolution
+      local_search_range.min() = floor(elem_prod(local_search_range.min(),m_upscale_factor));
+      local_search_range.max() = ceil (elem_prod(local_search_range.max(),m_upscale_factor));
+
+      // If the user specified a search range limit, apply it here.
+      if ((stereo_settings().search_range_limit.min() != Vector2i()) || 
+          (stereo_settings().search_range_limit.max() != Vector2i())   ) {     
+        local_search_range.crop(stereo_settings().search_range_limit);
+        vw_out() << "\t--> Local search range constrained to: " << local_search_range << "\n";
+      }
+
+      VW_OUT(DebugMessage, "stereo") << "SeededCorrelatorView("
+                                     << bbox << ") local search range "
+                                     << local_search_range << " vs "
+                                     << stereo_settings().search_range << "\n";
+
+    } else{ // seed mode == 0
+      local_search_range = stereo_settings().search_range;
+      VW_OUT(DebugMessage,"stereo") << "Searching with " << stereo_settings().search_range << "\n";
+    }
+
+    SemiGlobalMatcher::SgmSubpixelMode sgm_subpixel_mode = get_sgm_subpixel_mode();
+    Vector2i sgm_search_buffer = stereo_settings().sgm_search_buffer;
+
+    // Now we are ready to actually perform correlation
+    const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
+    if (use_local_homography){
+      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageViewRef<InputPixelType>, 
+                                                 MaskType,  ImageViewRef<vw::uint8     > > CorrView;
+      CorrView corr_view( m_left_image,   right_trans_img,
+                          m_left_mask,    right_trans_mask,
+                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
+                          stereo_settings().slogW,
+                          local_search_range,
+                          m_kernel_size,  m_cost_mode,
+                          m_corr_timeout, m_seconds_per_op,
+                          stereo_settings().xcorr_threshold,
+                          stereo_settings().min_xcorr_level,
+                          rm_half_kernel,
+                          stereo_settings().corr_max_levels,
+                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
+                          stereo_settings().sgm_collar_size,
+                          sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
+                          stereo_settings().corr_blob_filter_area,
+                          stereo_settings().stereo_debug );
+      return corr_view.prerasterize(bbox);
+    }else{
+      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageType, MaskType, MaskType > CorrView;
+      CorrView corr_view( m_left_image,   m_right_image,
+                          m_left_mask,    m_right_mask,
+                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
+                          stereo_settings().slogW,
+                          local_search_range,
+                          m_kernel_size,  m_cost_mode,
+                          m_corr_timeout, m_seconds_per_op,
+                          stereo_settings().xcorr_threshold,
+                          stereo_settings().min_xcorr_level,
+                          rm_half_kernel,
+                          stereo_settings().corr_max_levels,
+                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
+                          stereo_settings().sgm_collar_size,
+                          sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
+                          stereo_settings().corr_blob_filter_area,
+                          stereo_settings().stereo_debug );
+      return corr_view.prerasterize(bbox);
+    }
+    
+  } // End function prerasterize_helper
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+}; // End class SeededCorrelatorView
+
+template <class Image1T, class Image2T>
+ImageViewRef<PixelMask<Vector2f> >
+refine_disparity(Image1T const& left_image,
+                 Image2T const& right_image,
+                 ImageViewRef< PixelMask<Vector2f> > const& integer_disp,
+                 ASPGlobalOptions const& opt, bool verbose){
+
+  ImageViewRef<PixelMask<Vector2f> > refined_disp = integer_disp;
+
+  PrefilterModeType prefilter_mode = 
+    static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode);
+
+  if ((stereo_settings().subpixel_mode == 0) || 
+      (stereo_settings().subpixel_mode > 6 )   ) {
+    // Do nothing (includes SGM specific subpixel modes)
+    if (verbose)
+      vw_out() << "\t--> Skipping subpixel mode.\n";
+  }
+  else {
+    if (verbose) {
+      if (stereo_settings().pre_filter_mode == 2)
+        vw_out() << "\t--> Using LOG pre-processing filter with "
+                 << stereo_settings().slogW << " sigma blur.\n";
+      else if (stereo_settings().pre_filter_mode == 1)
+        vw_out() << "\t--> Using Subtracted Mean pre-processing filter with "
+                 << stereo_settings().slogW << " sigma blur.\n";
+      else
+        vw_out() << "\t--> NO preprocessing" << endl;
+    }
+  }
+  
+  if (stereo_settings().subpixel_mode == 1) {
+    // Parabola
+    if (verbose)
+      vw_out() << "\t--> Using parabola subpixel mode.\n";
+
+    refined_disp = parabola_subpixel( integer_disp,
+                                      left_image, right_image,
+                                      prefilter_mode, stereo_settings().slogW,
+                                      stereo_settings().subpixel_kernel );
+    
+  } // End parabola cases
+  if (stereo_settings().subpixel_mode == 2) {
+    // Bayes EM
+    if (verbose)
+      vw_out() << "\t--> Using affine adaptive subpixel mode\n";
+
+    refined_disp =
+      bayes_em_subpixel( integer_disp,
+                         left_image, right_image,
+                         prefilter_mode, stereo_settings().slogW,
+                         stereo_settings().subpixel_kernel,
+                         stereo_settings().subpixel_max_levels );
+
+  } // End Bayes EM cases
+  if (stereo_settings().subpixel_mode == 3) {
+    // Fast affine
+    if (verbose)
+      vw_out() << "\t--> Using affine subpixel mode\n";
+
+    refined_disp =
+      affine_subpixel( integer_disp,
+                       left_image, right_image,
+                       prefilter_mode, stereo_settings().slogW,
+                       stereo_settings().subpixel_kernel,
+                       stereo_settings().subpixel_max_levels );
+
+  } // End Fast affine cases
+  if (stereo_settings().subpixel_mode == 4) {
+    // Phase Correlation
+    if (verbose) {
+      vw_out() << "\t--> Using Phase Correlation subpixel mode\n";
+      vw_out() << "\t--> Forcing subpixel pyramid levels to zero\n";
+    }
+    // So far phase correlation has worked poorly with multiple levels.
+    stereo_settings().subpixel_max_levels = 0;
+
+    refined_disp =
+      phase_subpixel( integer_disp,
+                      left_image, right_image,
+                      prefilter_mode, stereo_settings().slogW,
+                      stereo_settings().subpixel_kernel,
+                      stereo_settings().subpixel_max_levels );
+
+  } // End Lucas-Kanade cases
+  if (stereo_settings().subpixel_mode == 5) {
+    // Lucas-Kanade
+    if (verbose)
+      vw_out() << "\t--> Using Lucas-Kanade subpixel mode\n";
+
+    refined_disp =
+      lk_subpixel( integer_disp,
+                   left_image, right_image,
+                   prefilter_mode, stereo_settings().slogW,
+                   stereo_settings().subpixel_kernel,
+                   stereo_settings().subpixel_max_levels );
+
+  } // End Lucas-Kanade cases
+  if (stereo_settings().subpixel_mode == 6) {
+    // Affine and Bayes subpixel refinement always use the LogPreprocessingFilter...
+    if (verbose){
+      vw_out() << "\t--> Using EM Subpixel mode "
+               << stereo_settings().subpixel_mode << endl;
+      vw_out() << "\t--> Mode 3 does internal preprocessing;"
+               << " settings will be ignored. " << endl;
+    }
+
+    typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
+    EMCorrelator em_correlator(channels_to_planes(left_image),
+                               channels_to_planes(right_image),
+                               pixel_cast<PixelMask<Vector2f> >(integer_disp), -1);
+    em_correlator.set_em_iter_max   (stereo_settings().subpixel_em_iter       );
+    em_correlator.set_inner_iter_max(stereo_settings().subpixel_affine_iter   );
+    em_correlator.set_kernel_size   (stereo_settings().subpixel_kernel        );
+    em_correlator.set_pyramid_levels(stereo_settings().subpixel_pyramid_levels);
+
+    DiskImageResourceOpenEXR em_disparity_map_rsrc(opt.out_prefix + "-F6.exr", em_correlator.format());
+
+    block_write_image(em_disparity_map_rsrc, em_correlator,
+                      TerminalProgressCallback("asp", "\t--> EM Refinement :"));
+
+    DiskImageResource *em_disparity_map_rsrc_2 =
+      DiskImageResourceOpenEXR::construct_open(opt.out_prefix + "-F6.exr");
+    DiskImageView<PixelMask<Vector<float, 5> > > em_disparity_disk_image(em_disparity_map_rsrc_2);
+
+    ImageViewRef<Vector<float, 3> > disparity_uncertainty =
+      per_pixel_filter(em_disparity_disk_image,
+                       EMCorrelator::ExtractUncertaintyFunctor());
+    ImageViewRef<float> spectral_uncertainty =
+      per_pixel_filter(disparity_uncertainty,
+                       EMCorrelator::SpectralRadiusUncertaintyFunctor());
+    write_image(opt.out_prefix+"-US.tif", spectral_uncertainty);
+    write_image(opt.out_prefix+"-U.tif", disparity_uncertainty);
+
+    refined_disp =
+      per_pixel_filter(em_disparity_disk_image,
+                       EMCorrelator::ExtractDisparityFunctor());
+  } // End EM subpixel cases 
+  if ((stereo_settings().subpixel_mode < 0) || (stereo_settings().subpixel_mode > 5)){
+    if (verbose) {
+      vw_out() << "\t--> Invalid Subpixel mode selection: " << stereo_settings().subpixel_mode << endl;
+      vw_out() << "\t--> Doing nothing\n";
+    }
+  }
+
+  return refined_disp;
+}
+
+// Perform refinement in each tile. If using local homography,
+// apply the local homography transform for the given tile
+// to the right image before doing refinement in that tile.
+template <class Image1T, class Image2T, class SeedDispT>
+class PerTileRfne: public ImageViewBase<PerTileRfne<Image1T, Image2T, SeedDispT> >{
+  Image1T              m_left_image;
+  Image2T              m_right_image;
+  ImageViewRef<uint8>  m_right_mask;
+  SeedDispT            m_integer_disp;
+  SeedDispT            m_sub_disp;
+  ImageView<Matrix3x3> m_local_hom;
+  ASPGlobalOptions const&       m_opt;
+  Vector2              m_upscale_factor;
+
+public:
+  PerTileRfne( ImageViewBase<Image1T>   const& left_image,
+               ImageViewBase<Image2T>   const& right_image,
+               ImageViewRef <uint8>     const& right_mask,
+               ImageViewBase<SeedDispT> const& integer_disp,
+               ImageViewBase<SeedDispT> const& sub_disp,
+               ImageView    <Matrix3x3> const& local_hom,
+               ASPGlobalOptions const& opt):
+    m_left_image(left_image.impl()), m_right_image(right_image.impl()),
+    m_right_mask(right_mask),
+    m_integer_disp( integer_disp.impl() ), m_sub_disp( sub_disp.impl() ),
+    m_local_hom(local_hom), m_opt(opt){
+
+    m_upscale_factor = Vector2(double(m_left_image.impl().cols()) / m_sub_disp.cols(),
+                               double(m_left_image.impl().rows()) / m_sub_disp.rows());
+  }
+
+  // Image View interface
+  typedef PixelMask<Vector2f>                  pixel_type;
+  typedef pixel_type                           result_type;
+  typedef ProceduralPixelAccessor<PerTileRfne> pixel_accessor;
+
+  inline int32 cols  () const { return m_left_image.cols(); }
+  inline int32 rows  () const { return m_left_image.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "PerTileRfne::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    ImageView<pixel_type> tile_disparity;
+    bool verbose = false;
+    if (stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography){
+
+      int ts = ASPGlobalOptions::corr_tile_size();
+      Matrix<double>  lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
+      Vector3 upscale( m_upscale_factor[0],     m_upscale_factor[1],     1 );
+      Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
+      Matrix<double>  fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
+
+      // Must transform the right image by the local disparity
+      // to be in the same conditions as for stereo correlation.
+      typedef typename Image2T::pixel_type right_pix_type;
+      ImageViewRef< PixelMask<right_pix_type> > right_trans_masked_img
+        = transform (copy_mask( m_right_image.impl(), create_mask(m_right_mask) ),
+                     HomographyTransform(fullres_hom),
+                     m_left_image.impl().cols(), m_left_image.impl().rows());
+      ImageViewRef<right_pix_type> right_trans_img = apply_mask(right_trans_masked_img);
+
+
+      tile_disparity = crop(refine_disparity(m_left_image, right_trans_img,
+                                             m_integer_disp, m_opt, verbose), bbox);
+
+      // Must undo the local homography transform
+      bool do_round = false; // don't round floating point disparities
+      tile_disparity = transform_disparities(do_round, bbox, inverse(fullres_hom),
+                                             tile_disparity);
+
+    }else{
+      tile_disparity = crop(refine_disparity(m_left_image, m_right_image,
+                                             m_integer_disp, m_opt, verbose), bbox);
+    }
+    
+    prerasterize_type disparity = prerasterize_type(tile_disparity,
+                                                    -bbox.min().x(), -bbox.min().y(),
+                                                    cols(), rows() );
+    return disparity;
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+template <class Image1T, class Image2T, class SeedDispT>
+PerTileRfne<Image1T, Image2T, SeedDispT>
+per_tile_rfne( ImageViewBase<Image1T  > const& left,
+               ImageViewBase<Image2T  > const& right,
+               ImageViewRef<uint8     > const& right_mask,
+               ImageViewBase<SeedDispT> const& integer_disp,
+               ImageViewBase<SeedDispT> const& sub_disp,
+               ImageView<Matrix3x3    > const& local_hom,
+               ASPGlobalOptions const& opt) {
+  typedef PerTileRfne<Image1T, Image2T, SeedDispT> return_type;
+  return return_type( left.impl(), right.impl(), right_mask,
+                      integer_disp.impl(), sub_disp.impl(), local_hom, opt );
+}
+
+/// Apply a set of smoothing filters to the subpixel disparity results.
+template <class ImageT, class DispImageT>
+class TextureAwareDisparityFilter: public ImageViewBase<TextureAwareDisparityFilter<ImageT, DispImageT> >{
+  ImageT     m_img;
+  DispImageT m_disp_img;
+  
+  int   m_median_filter_size;     ///< Step 1: Apply a median filter of this size
+  int   m_texture_smooth_range;   ///< Step 2: Compute texture measure of input image with this kernel size
+  float m_texture_max;            ///< Step 3: Perform texture-aware smoothing of the disparity.  m_texture_max
+  int   m_max_smooth_kernel_size; ///<         smooths more pixels, and the smooth_kernel_size increases the smoothing intensity.
+  
+public:
+  TextureAwareDisparityFilter( ImageViewBase<ImageT    > const& img,
+                               ImageViewBase<DispImageT> const& disp_img,
+                               int   median_filter_size,
+                               int   texture_smooth_range,
+                               float texture_max,
+                               int   max_smooth_kernel_size):
+    m_img(img.impl()), m_disp_img(disp_img.impl()),
+    m_median_filter_size(median_filter_size),
+    m_texture_smooth_range(texture_smooth_range),
+    m_texture_max(texture_max),
+    m_max_smooth_kernel_size(max_smooth_kernel_size)
+     {}
+
+  // Image View interface
+  typedef typename DispImageT::pixel_type pixel_type;
+  typedef pixel_type                      result_type;
+  typedef ProceduralPixelAccessor<TextureAwareDisparityFilter> pixel_accessor;
+
+  inline int32 cols  () const { return m_disp_img.cols(); }
+  inline int32 rows  () const { return m_disp_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "TextureAwareDisparityFilter::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    // Figure out the largest kernel expansion we need to support the filtering
+    int max_half_kernel = m_texture_smooth_range;
+    if (m_max_smooth_kernel_size > max_half_kernel)
+      max_half_kernel = m_max_smooth_kernel_size;
+    max_half_kernel += m_median_filter_size; // Don't forget we apply two kernels in succession
+    max_half_kernel /= 2;
+
+    // Rasterize both input image regions
+    BBox2i bbox2 = bbox;
+    bbox2.expand(max_half_kernel);
+    bbox2.crop(bounding_box(m_img)); // Restrict to valid input area
+    ImageView<typename ImageT::pixel_type> input_tile      = crop(m_img,      bbox2);
+    ImageView<pixel_type                 > input_disp_tile = crop(m_disp_img, bbox2);
+
+    ImageView<float> texture_image;
+    vw::stereo::texture_measure(input_tile, texture_image, m_texture_smooth_range);
+    //write_image( "texture_image.tif", texture_image );
+
+
+    ImageView<pixel_type > disp_tile_median;
+    vw::stereo::disparity_median_filter(input_disp_tile, disp_tile_median, m_median_filter_size);
+    
+    ImageView<pixel_type > disp_tile_filtered;
+    vw::stereo::texture_preserving_disparity_filter(disp_tile_median, disp_tile_filtered, texture_image, 
+                                                    m_texture_max, m_max_smooth_kernel_size);
+
+    // Fake the bounds on the returned image region
+    return prerasterize_type(disp_tile_filtered,
+                             -bbox2.min().x(), -bbox2.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+template <class ImageT, class DispImageT>
+TextureAwareDisparityFilter<ImageT, DispImageT>
+texture_aware_disparity_filter( ImageViewBase<ImageT    > const& img,
+                                ImageViewBase<DispImageT> const& disp_img,
+                                int   median_filter_size,
+                                int   texture_smooth_range,
+                                float texture_max,
+                                int   max_smooth_kernel_size) {
+  typedef TextureAwareDisparityFilter<ImageT, DispImageT> return_type;
+  return return_type(img.impl(), disp_img.impl(), median_filter_size, 
+                     texture_smooth_range, texture_max, max_smooth_kernel_size);
+}
+
+
+
+
+
+
+
+// Erode blobs from given image by iterating through tiles, biasing
+// each tile by a factor of blob size, removing blobs in the tile,
+// then shrinking the tile back. The bias is necessary to help avoid
+// fragmenting (and then unnecessarily removing) blobs.
+template <class ImageT>
+class PerTileErode: public ImageViewBase<PerTileErode<ImageT> >{
+  ImageT m_img;
+public:
+  PerTileErode( ImageViewBase<ImageT>   const& img):
+    m_img(img.impl()){}
+
+  // Image View interface
+  typedef typename ImageT::pixel_type pixel_type;
+  typedef pixel_type                  result_type;
+  typedef ProceduralPixelAccessor<PerTileErode> pixel_accessor;
+
+  inline int32 cols  () const { return m_img.cols(); }
+  inline int32 rows  () const { return m_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "PerTileErode::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    int area = stereo_settings().erode_max_size;
+
+    // We look a beyond the current tile, to avoid cutting blobs
+    // if possible. Skinny blobs will be cut though.
+    int bias = 2*int(ceil(sqrt(double(area))));
+
+    BBox2i bbox2 = bbox;
+    bbox2.expand(bias);
+    bbox2.crop(bounding_box(m_img));
+    ImageView<pixel_type> tile_img = crop(m_img, bbox2);
+
+    int tile_size = max(bbox2.width(), bbox2.height()); // don't subsplit
+    BlobIndexThreaded smallBlobIndex(tile_img, area, tile_size);
+    ImageView<pixel_type> clean_tile_img = applyErodeView(tile_img,
+                                                          smallBlobIndex);
+    return prerasterize_type(clean_tile_img,
+                             -bbox2.min().x(), -bbox2.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+template <class ImageT>
+PerTileErode<ImageT>
+per_tile_erode( ImageViewBase<ImageT> const& img) {
+  typedef PerTileErode<ImageT> return_type;
+  return return_type( img.impl() );
+}
+
+// Run several cleanup passes with desired cleanup mode.
+template <class ViewT>
+struct MultipleDisparityCleanUp {
+  typedef ImageViewRef< typename ViewT::pixel_type > result_type;
+
+  inline result_type operator()( ImageViewBase<ViewT> const& input, int N) {
+
+    result_type out = input;
+    for (int i = 0; i < N; i++){
+      int mode = stereo_settings().filter_mode;
+      if (mode == 1){
+        out = stereo::disparity_cleanup_using_mean
+          (out.impl(),
+           stereo_settings().rm_half_kernel.x(),
+           stereo_settings().rm_half_kernel.y(),
+           stereo_settings().max_mean_diff);
+      }else if (mode == 2){
+        out = stereo::disparity_cleanup_using_thresh
+          (out.impl(),
+           stereo_settings().rm_half_kernel.x(),
+           stereo_settings().rm_half_kernel.y(),
+           stereo_settings().rm_threshold,
+           stereo_settings().rm_min_matches/100.0);
+      }else
+        vw_throw( ArgumentErr() << "\nExpecting value of 1 or 2 for filter-mode. "
+                  << "Got: " << mode << "\n" );
+    }
+
+    return out;
+  }
+};
+
+ImageViewRef<PixelMask<Vector2f> >
+asp::fullres_correlation(ASPGlobalOptions const& opt) {
+
+  DiskImageView<PixelGray<float> > left_disk_image (opt.out_prefix+"-L.tif"),
+                                   right_disk_image(opt.out_prefix+"-R.tif");
+  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
+                           Rmask(opt.out_prefix + "-rMask.tif");
+  ImageViewRef<PixelMask<Vector2f> > sub_disp;
+  std::string dsub_file   = opt.out_prefix+"-D_sub.tif";
+  std::string spread_file = opt.out_prefix+"-D_sub_spread.tif";
+  
+  if ( stereo_settings().seed_mode > 0 )
+    load_sub_disp_image(dsub_file, sub_disp); // TODO: What if file is missing?
+  ImageViewRef<PixelMask<Vector2i> > sub_disp_spread;
+  if ( stereo_settings().seed_mode == 2 ||  stereo_settings().seed_mode == 3 ){
+    // D_sub_spread is mandatory for seed_mode 2 and 3.
+    sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
+  }else if ( stereo_settings().seed_mode == 1 ){
+    // D_sub_spread is optional for seed_mode 1, we use it only if it is provided.
+    if (fs::exists(spread_file)) {
+      try {
+        sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
+      }
+      catch (...) {}
+    }
+  }
+
+  ImageView<Matrix3x3> local_hom;
+  if ( stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography ){
+    string local_hom_file = opt.out_prefix + "-local_hom.txt";
+    read_local_homographies(local_hom_file, local_hom);
+  }
+
+  stereo::CostFunctionType cost_mode = get_cost_mode_value();
+  Vector2i kernel_size    = stereo_settings().corr_kernel;
+  int      corr_timeout   = stereo_settings().corr_timeout;
+  double   seconds_per_op = 0.0;
+  if (corr_timeout > 0)
+    seconds_per_op = calc_seconds_per_op(cost_mode, left_disk_image, right_disk_image, kernel_size);
+
+  return SeededCorrelatorView( left_disk_image, right_disk_image, Lmask, Rmask,
+                               sub_disp, sub_disp_spread, local_hom, kernel_size, 
+                               cost_mode, corr_timeout, seconds_per_op );
+}
+
+ImageViewRef<PixelMask<Vector2f> >
+asp::subpixel_refinement(ASPGlobalOptions const& opt,
+                         ImageViewRef<PixelMask<Vector2f> > const& integer_disp) {
+
+  ImageViewRef<PixelGray<float>    > left_image, right_image;
+  ImageViewRef<uint8               > left_mask,  right_mask;
+  ImageViewRef<PixelMask<Vector2f> > sub_disp;
+  ImageView<Matrix3x3> local_hom;
+  string left_image_file  = opt.out_prefix+"-L.tif";
+  string right_image_file = opt.out_prefix+"-R.tif";
+  string left_mask_file   = opt.out_prefix+"-lMask.tif";
+  string right_mask_file  = opt.out_prefix+"-rMask.tif";
+
+  try {
+    left_image   = DiskImageView< PixelGray<float> >(left_image_file );
+    right_image  = DiskImageView< PixelGray<float> >(right_image_file);
+    left_mask    = DiskImageView<uint8>(left_mask_file );
+    right_mask   = DiskImageView<uint8>(right_mask_file);
+
+    if ( stereo_settings().seed_mode > 0 &&
+         stereo_settings().use_local_homography ){
+      if (!load_sub_disp_image(opt.out_prefix+"-D_sub.tif", sub_disp))
+        vw_throw( ArgumentErr() << "D_sub file does not exist, cannot use local homography.\n");
+
+      string local_hom_file = opt.out_prefix + "-local_hom.txt";
+      read_local_homographies(local_hom_file, local_hom);
+    }
+
+  } catch (IOErr const& e) {
+    vw_throw( ArgumentErr() << "\nUnable to start at refinement stage -- could not read input files.\n" 
+                            << e.what() << "\nExiting.\n\n" );
+  }
+
+  bool skip_img_norm = asp::skip_image_normalization(opt);
+  if (skip_img_norm && stereo_settings().subpixel_mode == 2){
+    // Images were not normalized in pre-processing. Must do so now
+    // as bayes_em_subpixel assumes them to be normalized.
+    ImageViewRef< PixelMask< PixelGray<float> > > Limg
+      = copy_mask(left_image, create_mask(left_mask));
+    ImageViewRef< PixelMask< PixelGray<float> > > Rimg
+      = copy_mask(right_image, create_mask(right_mask));
+
+    Vector<float32> left_stats, right_stats;
+    string left_stats_file  = opt.out_prefix+"-lStats.tif";
+    string right_stats_file = opt.out_prefix+"-rStats.tif";
+    vw_out() << "Reading: " << left_stats_file << ' ' << right_stats_file << endl;
+    read_vector(left_stats,  left_stats_file );
+    read_vector(right_stats, right_stats_file);
+    StereoSession::normalize_images(stereo_settings().force_use_entire_range,
+                                    stereo_settings().individually_normalize,
+                                    false, // Use std stretch
+                                    left_stats, right_stats, Limg, Rimg);
+    left_image  = apply_mask(Limg);
+    right_image = apply_mask(Rimg);
+  }
+
+  // The whole goal of this block it to go through the motions of
+  // refining disparity solely for the purpose of printing
+  // the relevant messages.
+  bool verbose = true;
+  ImageView<PixelGray<float>    > left_dummy(1, 1), right_dummy(1, 1);
+  ImageView<PixelMask<Vector2f> > dummy_disp(1, 1);
+  refine_disparity(left_dummy, right_dummy, dummy_disp, opt, verbose);
+
+  return per_tile_rfne(left_image, right_image, right_mask,
+                       integer_disp, sub_disp, local_hom, opt);
+}
+
+ImageViewRef<PixelMask<Vector2f> >
+asp::filter_disparity(ASPGlobalOptions const& opt,
+                      ImageViewRef<PixelMask<Vector2f> > const& refined_disp) {
+
+  typedef ImageViewRef<PixelMask<Vector2f> > input_type;
+
+  // Applying additional clipping from the edge. We make new
+  // mask files to avoid a weird and tricky segfault due to ownership issues.
+  DiskImageView<vw::uint8> left_mask ( opt.out_prefix+"-lMask.tif" );
+  DiskImageView<vw::uint8> right_mask( opt.out_prefix+"-rMask.tif" );
+  int32 mask_buffer = stereo_settings().mask_buffer_size;
+  if (mask_buffer < 0) // If Unset, set to the subpixel kernel size.
+    mask_buffer = max( stereo_settings().subpixel_kernel );
+
+  DiskImageView<PixelGray<float> > left_disk_image (opt.out_prefix+"-L.tif");
+
+  vw_out() << "\t--> Cleaning up disparity map prior to filtering processes ("
+           << stereo_settings().rm_cleanup_passes << " pass).\n";
+
+  // If the user wants to do no filtering at all, that amounts
+  // to doing no passes.
+  if (stereo_settings().filter_mode == 0)
+    stereo_settings().rm_cleanup_passes = 0;
+
+  if ( stereo_settings().rm_cleanup_passes >= 1 ) {
+    // Apply an outlier removal filter
+    return stereo::disparity_mask
+      (MultipleDisparityCleanUp<input_type>()
+       (refined_disp, stereo_settings().rm_cleanup_passes),
+       apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
+       apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024)));
+  }
+
+  if ( stereo_settings().mask_flatfield ) {
+    // No cleanup passes, and the texture-aware filter is not used
+    // together with the flat-field erosion.
+    return stereo::disparity_mask
+      (refined_disp,
+       apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
+       apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024)));
+  }
+
+  return stereo::disparity_mask
+    (texture_aware_disparity_filter(left_disk_image, refined_disp, 
+                                    stereo_settings().median_filter_size,
+                                    stereo_settings().disp_smooth_size+2, // Compute texture a little larger than smooth radius
+                                    stereo_settings().disp_smooth_texture, 
+                                    stereo_settings().disp_smooth_size),
+     apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
+     apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024)));
+}
+
+ImageViewRef<PixelMask<Vector2f> >
+asp::erode_small_blobs(ImageViewRef<PixelMask<Vector2f> > const& disp) {
+  return per_tile_erode(disp);
+}
+
+void asp::fused_pipeline_checks(ASPGlobalOptions const& opt) {
+
+  if (stereo_settings().seed_mode == 0)
+    vw_throw( ArgumentErr() << "The fused pipeline needs the low-resolution disparity. "
+                            << "Set --corr-seed-mode to 1, 2, or 3.\n" );
+
+  // These write to disk, or index blobs in, the whole disparity
+  if (stereo_settings().subpixel_mode == 6)
+    vw_throw( ArgumentErr() << "The fused pipeline does not support --subpixel-mode 6.\n" );
+  if (stereo_settings().mask_flatfield || stereo_settings().enable_fill_holes)
+    vw_throw( ArgumentErr() << "The fused pipeline does not support --mask-flatfield "
+                            << "or --enable-fill-holes.\n" );
+
+  // These sample the disparity before the point cloud is written,
+  // which would make the pipeline run more than once.
+  if (stereo_settings().unalign_disparity                    ||
+      stereo_settings().num_matches_from_disparity     > 0   ||
+      stereo_settings().num_matches_from_disp_triplets > 0   ||
+      stereo_settings().image_lines_per_piecewise_adjustment > 0)
+    vw_throw( ArgumentErr() << "The fused pipeline does not support --unalign-disparity, "
+                            << "matches from disparity, or piecewise adjustments.\n" );
+
+  // With SGM, the image must be correlated as one tile.
+  bool using_sgm = (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW);
+  if (using_sgm) {
+    DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif");
+    if (stereo_settings().corr_tile_size_ovr < std::max(Lmask.cols(), Lmask.rows()))
+      vw_throw( ArgumentErr() << "With SGM, the fused pipeline needs a --corr-tile-size "
+                              << "at least as large as the image.\n" );
+  }
+}
+
+ImageViewRef<PixelMask<Vector2f> >
+asp::fused_disparity(ASPGlobalOptions const& opt) {
+
+  fused_pipeline_checks(opt);
+
+  read_search_range_from_dsub(opt);
+
+  // If the user specified a search range limit, apply it here.
+  if ((stereo_settings().search_range_limit.min() != Vector2i()) || 
+      (stereo_settings().search_range_limit.max() != Vector2i())   ) {     
+    stereo_settings().search_range.crop(stereo_settings().search_range_limit);
+    vw_out() << "\t--> Detected search range constrained to: " << stereo_settings().search_range << "\n";
+  }
+
+  vw_out() << "\t--> Correlating, refining, and filtering the disparity in memory.\n";
+
+  // Refinement reads a margin around each tile of the correlation
+  // output, and filtering a margin around the refined output. Caching
+  // both in the tiles in which stereo_corr and stereo_rfne would write
+  // them means that each tile is computed once, just as when read
+  // back from D.tif and RD.tif.
+  int corr_ts = stereo_settings().corr_tile_size_ovr;
+  int rfne_ts = ASPGlobalOptions::rfne_tile_size();
+  ImageViewRef<PixelMask<Vector2f> > integer_disp
+    = block_cache(fullres_correlation(opt), Vector2i(corr_ts, corr_ts), 1);
+  ImageViewRef<PixelMask<Vector2f> > refined_disp
+    = block_cache(subpixel_refinement(opt, integer_disp), Vector2i(rfne_ts, rfne_ts), 1);
+
+  ImageViewRef<PixelMask<Vector2f> > filtered_disp = filter_disparity(opt, refined_disp);
+  if (stereo_settings().erode_max_size > 0)
+    filtered_disp = erode_small_blobs(filtered_disp);
+
+  return filtered_disp;
+}
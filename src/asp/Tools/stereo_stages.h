@@ -0,0 +1,77 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file stereo_stages.h
+///
+/// The views which produce the full-resolution, refined, and filtered
+/// disparities. stereo_corr, stereo_rfne, and stereo_fltr each build
+/// one of them on top of the file written by the previous stage, while
+/// the fused mode of stereo_tri chains all of them in memory.
+
+#ifndef __ASP_TOOLS_STEREO_STAGES_H__
+#define __ASP_TOOLS_STEREO_STAGES_H__
+
+#include <asp/Tools/stereo.h>
+#include <vw/Stereo/CorrelationView.h>
+#include <vw/Stereo/CostFunctions.h>
+
+namespace asp {
+
+  /// Returns the properly cast cost mode type
+  vw::stereo::CostFunctionType get_cost_mode_value();
+
+  /// Determine the proper subpixel mode to be used with SGM correlation
+  vw::stereo::SemiGlobalMatcher::SgmSubpixelMode get_sgm_subpixel_mode();
+
+  /// Read the search range from D_sub, and scale it to the full image
+  void read_search_range_from_dsub(ASPGlobalOptions const& opt);
+
+  /// Full-resolution correlation of L.tif and R.tif, seeded by D_sub.
+  /// The search range must have been set by now.
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+  fullres_correlation(ASPGlobalOptions const& opt);
+
+  /// Subpixel refinement of the given full-resolution disparity.
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+  subpixel_refinement(ASPGlobalOptions const& opt,
+                      vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& integer_disp);
+
+  /// Outlier removal of the refined disparity, and masking of the
+  /// pixels close to the image edges.
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+  filter_disparity(ASPGlobalOptions const& opt,
+                   vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& refined_disp);
+
+  /// Remove the blobs no larger than --erode-max-size.
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+  erode_small_blobs(vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disp);
+
+  /// Throw if the settings need a stage to see its whole input before
+  /// producing any output, which the fused pipeline can't do.
+  void fused_pipeline_checks(ASPGlobalOptions const& opt);
+
+  /// The filtered disparity computed from L.tif, R.tif, and D_sub
+  /// without writing D.tif, RD.tif, or F.tif. Each stage keeps its
+  /// output in the cache in blocks of the size it would have written,
+  /// so the neighborhoods read by the next stage are not recomputed.
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+  fused_disparity(ASPGlobalOptions const& opt);
+
+} // end namespace asp
+
+#endif//__ASP_TOOLS_STEREO_STAGES_H__
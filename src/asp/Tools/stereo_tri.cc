@@ -26,6 +26,7 @@
 
 #include <asp/Camera/RPCModel.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_stages.h>
 #include <asp/Tools/jitter_adjust.h>
 #include <asp/Tools/ccd_adjust.h>
 
@@ -90,33 +91,46 @@ public:
   /// Compute the 3D coordinate corresponding to a pixel location.
   /// - p is not actually used here, it should always be zero!
   inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
-      
-    // For each input image, de-warp the pixel in to the native camera coordinates
     int num_disp = m_disparity_maps.size();
+    vector<DPixelT> disps(num_disp);
+    for (int c = 0; c < num_disp; c++)
+      disps[c] = m_disparity_maps[c](i,j,p); // Disparity value at this pixel
     vector<Vector2> pixVec(num_disp + 1);
-    pixVec[0] = m_transforms[0]->reverse(Vector2(i,j)); // De-warp "left" pixel
-    for (int c = 0; c < num_disp; c++){
-      Vector2 pix;
-      DPixelT disp = m_disparity_maps[c](i,j,p); // Disparity value at this pixel
-      if (is_valid(disp)) // De-warp the "right" pixel
-        pix = m_transforms[c+1]->reverse( Vector2(i,j) + stereo::DispHelper(disp) );
-      else // Insert flag values
-        pix = Vector2(std::numeric_limits<double>::quiet_NaN(),
-                      std::numeric_limits<double>::quiet_NaN());
-      pixVec[c+1] = pix;
-    }
-
-    // Compute the location of the 3D point observed by each input pixel
-    Vector3 errorVec;
-    pixel_type result;
-    subvector(result,0,3) = m_stereo_model(pixVec, errorVec);
-    subvector(result,3,3) = errorVec;
-    return result; // Contains location and error vector
+    return triangulate(Vector2(i,j), &disps[0], m_transforms, pixVec);
   }
 
-  typedef StereoTXAndErrorView<ImageViewRef<DPixelT>, StereoModelT> prerasterize_type;
+  /// Triangulate a whole tile at once. The disparities are brought in
+  /// memory and traversed a row at a time, and the scratch space is
+  /// allocated once per tile rather than once per pixel.
+  typedef CropView< ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return PreRasterHelper( bbox, m_transforms );
+
+    int num_disp = m_disparity_maps.size();
+    vector< ImageView<DPixelT> > disp_clips(num_disp);
+    for (int c = 0; c < num_disp; c++)
+      disp_clips[c] = crop(m_disparity_maps[c], bbox);
+
+    vector<TXT> transforms = m_transforms;
+    if (m_is_map_projected)
+      transforms = cache_map_projected_transforms(bbox, disp_clips);
+
+    ImageView<pixel_type> points(bbox.width(), bbox.height());
+    vector<DPixelT> disps(num_disp);
+    vector<Vector2> pixVec(num_disp + 1);
+    vector<DPixelT const*> disp_rows(num_disp);
+    for (int row = 0; row < bbox.height(); row++){
+      for (int c = 0; c < num_disp; c++)
+        disp_rows[c] = &disp_clips[c](0, row);
+      pixel_type * point_row = &points(0, row);
+      for (int col = 0; col < bbox.width(); col++){
+        for (int c = 0; c < num_disp; c++)
+          disps[c] = disp_rows[c][col];
+        point_row[col] = triangulate(Vector2(col + bbox.min().x(), row + bbox.min().y()),
+                                     &disps[0], transforms, pixVec);
+      }
+    }
+
+    return prerasterize_type(points, BBox2i(-bbox.min().x(), -bbox.min().y(), cols(), rows()));
   }
   template <class DestT>
   inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
@@ -125,26 +139,43 @@ public:
 
 private:
 
-  /// RPC Map Transform needs to be explicitly copied and told to cache for performance.
-  template <class T>
-  prerasterize_type PreRasterHelper( BBox2i const& bbox, vector<T> const& transforms) const {
-
-    // Code for NON-MAP-PROJECTED session types.
-    if (m_is_map_projected == false) {
-      // We explicitly bring in-memory the disparities for the current box
-      // to speed up processing later, and then we pretend this is the entire
-      // image by virtually enlarging it using a CropView.
-      vector< ImageViewRef<DPixelT> > disparity_cropviews;
-      for (int p = 0; p < (int)m_disparity_maps.size(); p++){
-        ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
-        ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-        disparity_cropviews.push_back(cropview_clip);
-      }
+  /// Find the 3D point and the triangulation error for the given left
+  /// pixel and its disparity to each of the other images. pixVec is
+  /// scratch space with room for one pixel per image.
+  inline pixel_type triangulate(Vector2 const& pix, DPixelT const* disps,
+                                vector<TXT> const& transforms,
+                                vector<Vector2> & pixVec) const {
+
+    // With no valid disparity there are not enough rays, and the stereo
+    // model would return zeros. Skip the transforms and do that here.
+    int num_disp = m_disparity_maps.size();
+    bool has_valid_disp = false;
+    for (int c = 0; c < num_disp; c++)
+      has_valid_disp = has_valid_disp || is_valid(disps[c]);
+    if (!has_valid_disp)
+      return pixel_type();
 
-      return prerasterize_type(disparity_cropviews, transforms, m_stereo_model, m_is_map_projected);
+    // For each input image, de-warp the pixel in to the native camera coordinates
+    pixVec[0] = transforms[0]->reverse(pix); // De-warp "left" pixel
+    for (int c = 0; c < num_disp; c++){
+      if (is_valid(disps[c])) // De-warp the "right" pixel
+        pixVec[c+1] = transforms[c+1]->reverse( pix + stereo::DispHelper(disps[c]) );
+      else // Insert flag values
+        pixVec[c+1] = Vector2(std::numeric_limits<double>::quiet_NaN(),
+                              std::numeric_limits<double>::quiet_NaN());
     }
 
-    // Code for MAP-PROJECTED session types.
+    // Compute the location of the 3D point observed by each input pixel
+    Vector3 errorVec;
+    pixel_type result;
+    subvector(result,0,3) = m_stereo_model(pixVec, errorVec);
+    subvector(result,3,3) = errorVec;
+    return result; // Contains location and error vector
+  }
+
+  /// RPC Map Transform needs to be explicitly copied and told to cache for performance.
+  vector<TXT> cache_map_projected_transforms(BBox2i const& bbox,
+                                             vector< ImageView<DPixelT> > const& disp_clips) const {
 
     // This is to help any transforms (right now just Map2CamTrans)
     // that must cache their side data. Normally this would happen if
@@ -153,10 +184,10 @@ private:
     // the cache in both transforms while the other threads want to do the same.
     // - Without some sort of duplication function in the transform base class we need
     //   to manually copy the Map2CamTrans type which is pretty hacky.
-    vector<T> transforms_copy(transforms.size());
-    for (size_t i=0; i<transforms.size(); ++i) {
+    vector<TXT> transforms_copy(m_transforms.size());
+    for (size_t i=0; i<m_transforms.size(); ++i) {
       vw::cartography::Map2CamTrans* t_ptr 
-          = dynamic_cast<vw::cartography::Map2CamTrans*>(transforms[i].get());
+          = dynamic_cast<vw::cartography::Map2CamTrans*>(m_transforms[i].get());
       if (!t_ptr)
         vw_throw( NoImplErr() << "Need to support new map projection transform in stereo_tri!");
       transforms_copy[i].reset(new vw::cartography::Map2CamTrans(*t_ptr));
@@ -169,18 +200,10 @@ private:
                 << "than the number of images." );
     }
 
-    vector< ImageViewRef<DPixelT> > disparity_cropviews;
-    for (int p = 0; p < (int)m_disparity_maps.size(); p++){
-
-      // We explicitly bring in-memory the disparities for the current
-      // box to speed up processing later, and then we pretend this is
-      // the entire image by virtually enlarging it using a CropView.
-      ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
-      ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-      disparity_cropviews.push_back(cropview_clip);
+    for (size_t p = 0; p < disp_clips.size(); p++){
 
       // Work out what spots in the right image we'll be touching.
-      BBox2i disparity_range = stereo::get_disparity_range(clip);
+      BBox2i disparity_range = stereo::get_disparity_range(disp_clips[p]);
       disparity_range.max() += Vector2i(1,1);
       BBox2i right_bbox = bbox + disparity_range.min();
       right_bbox.max() += disparity_range.size();
@@ -189,8 +212,8 @@ private:
       transforms_copy[p+1]->reverse_bbox(right_bbox); // As a side effect this call makes transforms_copy create a local cache we want later
     }
 
-    return prerasterize_type(disparity_cropviews, transforms_copy, m_stereo_model, m_is_map_projected);
-  } // End function PreRasterHelper() DGMapRPC version
+    return transforms_copy;
+  } // End function cache_map_projected_transforms()
 
 }; // End class StereoTXAndErrorView
 
@@ -568,9 +591,32 @@ namespace asp{
     bool has_nodata = false;
     double nodata = -std::numeric_limits<float>::max(); // smallest float
 
+    // Without a shift the points would not fit in int32
+    bool quantize = stereo_settings().quantize_point_cloud;
+    if (quantize && norm_2(shift) == 0) {
+      vw_out(WarningMessage) << "Cannot quantize a point cloud which is not "
+                             << "shifted closer to the origin. Saving it as is.\n";
+      quantize = false;
+    }
+
+    // ISIS does not support multi-threading
     // TODO: Replace this with with a function call!
-    if ( (opt.session->name() == "isis") || (opt.session->name() == "isismapisis")){
-      // ISIS does not support multi-threading
+    bool single_threaded = ( (opt.session->name() == "isis") ||
+                             (opt.session->name() == "isismapisis") );
+    if (quantize) {
+      if (single_threaded)
+        asp::write_quantized_gdal_image
+          ( point_cloud_file, shift,
+            stereo_settings().point_cloud_rounding_error,
+            point_cloud, has_georef, georef,
+            opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+      else
+        asp::block_write_quantized_gdal_image
+          ( point_cloud_file, shift,
+            stereo_settings().point_cloud_rounding_error,
+            point_cloud, has_georef, georef,
+            opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+    }else if (single_threaded){
       asp::write_approx_gdal_image
         ( point_cloud_file, shift,
           stereo_settings().point_cloud_rounding_error,
@@ -757,9 +803,15 @@ void stereo_triangulation( string          const& output_prefix,
                              << "Will not be able to filter triangulated points by radius.\n";
     } // End try/catch
 
+    // The session hooks only differ from reading F.tif with
+    // --mask-flatfield, which the fused pipeline does not support.
     vector<PVImageT> disparity_maps;
-    for (int p = 0; p < (int)opt_vec.size(); p++){
-      disparity_maps.push_back(opt_vec[p].session->pre_pointcloud_hook(opt_vec[p].out_prefix+"-F.tif"));
+    if (stereo_settings().fused_pipeline) {
+      disparity_maps.push_back(fused_disparity(opt_vec[0]));
+    } else {
+      for (int p = 0; p < (int)opt_vec.size(); p++){
+        disparity_maps.push_back(opt_vec[p].session->pre_pointcloud_hook(opt_vec[p].out_prefix+"-F.tif"));
+      }
     }
 
     std::string unalign_disp = asp::unwarped_disp_file(output_prefix,
@@ -938,19 +990,34 @@ int main( int argc, char* argv[] ) {
                        output_prefix);
     }
 
-    // Keep only those stereo pairs for which filtered disparity exists
-    vector<ASPGlobalOptions> opt_vec_new;
-    for (int p = 0; p < (int)opt_vec.size(); p++){
-      if (fs::exists(opt_vec[p].out_prefix+"-F.tif"))
-        opt_vec_new.push_back(opt_vec[p]);
+    if (stereo_settings().fused_pipeline) {
+      if (opt_vec.size() > 1)
+        vw_throw( ArgumentErr() << "The fused pipeline supports only one stereo pair.\n" );
+    } else {
+      // Keep only those stereo pairs for which filtered disparity exists
+      vector<ASPGlobalOptions> opt_vec_new;
+      for (int p = 0; p < (int)opt_vec.size(); p++){
+        if (fs::exists(opt_vec[p].out_prefix+"-F.tif"))
+          opt_vec_new.push_back(opt_vec[p]);
+      }
+      opt_vec = opt_vec_new;
+      if (opt_vec.empty())
+        vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
     }
-    opt_vec = opt_vec_new;
-    if (opt_vec.empty())
-      vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
 
     // Triangulation uses small tiles.
     //---------------------------------------------------------
     int ts = ASPGlobalOptions::tri_tile_size();
+
+    // In the fused pipeline each tile is also correlated, so use the
+    // correlation tile size, rounded up as GDAL needs, to keep
+    // the threads on different correlation tiles.
+    if (stereo_settings().fused_pipeline) {
+      const int TILE_MULTIPLE = 16;
+      ts = stereo_settings().corr_tile_size_ovr;
+      if (ts % TILE_MULTIPLE != 0)
+        ts = ((ts / TILE_MULTIPLE) + 1) * TILE_MULTIPLE;
+    }
     for (int s = 0; s < (int)opt_vec.size(); s++)
       opt_vec[s].raster_tile_size = Vector2i(ts, ts);
 
@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Camera/PinholeModel.h>
+#include <asp/Tools/bundle_adjust.h>
+#include <asp/Tools/bundle_adjust_cost_functions.h>
+#include <test/Helpers.h>
+
+using namespace vw;
+using namespace vw::test;
+
+// The Jacobians found with the chain rule must agree with the ones
+// found by differentiating the whole residual numerically.
+TEST(BundleAdjustCostFunctions, LinearizedJacobians) {
+
+  // A pinhole camera looking down the z axis at a point in front of it
+  Vector3 point(30, 40, 2000);
+  std::vector<BundleAdjustmentModel::cam_ptr_t> cameras;
+  cameras.push_back(BundleAdjustmentModel::cam_ptr_t
+                    (new camera::PinholeModel(Vector3(10, -20, 0), math::identity_matrix<3>(),
+                                              500, 500, 320, 240)));
+  boost::shared_ptr<ba::ControlNetwork> cnet(new ba::ControlNetwork("test"));
+  ba::ControlPoint cp;
+  cp.set_position(point);
+  cnet->add_control_point(cp);
+  BundleAdjustmentModel ba_model(cameras, cnet);
+
+  // A small adjustment, first translation, then axis-angle rotation
+  double camera[6] = {0.5, -0.3, 0.2, 1e-3, -2e-3, 1.5e-3};
+  double pt[3]     = {point[0] + 0.7, point[1] - 0.4, point[2] + 1.1};
+  Vector2 pixel_sigma(1.0, 2.0);
+  Vector2 observation = ba_model.base_camera(0)->point_to_pixel(point) + Vector2(0.3, -0.2);
+
+  boost::shared_ptr<ceres::CostFunction>
+    cost(BaLinearizedReprojectionError::Create(observation, pixel_sigma, &ba_model, 0, 0));
+
+  double residuals[2], jac_camera[2*6], jac_point[2*3];
+  double const* parameters[2] = {camera, pt};
+  double * jacobians[2] = {jac_camera, jac_point};
+  ASSERT_TRUE(cost->Evaluate(parameters, residuals, jacobians));
+
+  // The residual itself must be the same as the one of the numeric cost function
+  BaReprojectionError<BundleAdjustmentModel>
+    numeric_cost(observation, pixel_sigma, &ba_model, 0, 0);
+  double numeric_residuals[2];
+  ASSERT_TRUE(numeric_cost(camera, pt, numeric_residuals));
+  EXPECT_NEAR(residuals[0], numeric_residuals[0], 1e-8);
+  EXPECT_NEAR(residuals[1], numeric_residuals[1], 1e-8);
+
+  // Central differences of the residual over each parameter
+  double * blocks[2]    = {camera, pt};
+  double * analytic[2]  = {jac_camera, jac_point};
+  int      block_size[2] = {6, 3};
+  for (int b = 0; b < 2; b++) {
+    for (int k = 0; k < block_size[b]; k++) {
+      // The rotation is in radians, the rest in meters
+      double step = (b == 0 && k >= 3) ? 1e-7 : 1e-4;
+      double orig = blocks[b][k];
+      double plus[2], minus[2];
+      blocks[b][k] = orig + step;
+      ASSERT_TRUE(cost->Evaluate(parameters, plus, NULL));
+      blocks[b][k] = orig - step;
+      ASSERT_TRUE(cost->Evaluate(parameters, minus, NULL));
+      blocks[b][k] = orig;
+
+      for (int r = 0; r < 2; r++) {
+        double numeric = (plus[r] - minus[r])/(2.0*step);
+        EXPECT_NEAR(analytic[b][block_size[b]*r + k], numeric,
+                    1e-4*std::max(1.0, std::abs(numeric)))
+          << "block " << b << ", parameter " << k << ", residual " << r;
+      }
+    }
+  }
+}
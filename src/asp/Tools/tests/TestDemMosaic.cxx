@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Tools/dem_mosaic.h>
+#include <test/Helpers.h>
+
+using namespace vw;
+using namespace asp;
+
+typedef PixelGrayA<double> DoubleGrayA;
+
+// The largest difference between the weights of a whole DEM at the
+// pixels of a block, and the weights computed on the block expanded
+// by the given margin, as for one block of a mosaic.
+double max_block_weights_diff(DemWeightOptions const& opt, int bias, double nodata,
+                              ImageView<DoubleGrayA> const& dem,
+                              ImageView<double> const& dem_wts,
+                              BBox2i const& block, int margin) {
+
+  BBox2i region = block;
+  region.expand(margin);
+  region.crop(bounding_box(dem));
+  ImageView<DoubleGrayA> region_dem = crop(dem, region);
+  ImageView<double> region_wts;
+  compute_dem_weights(opt, bias, nodata, region_dem, region_wts);
+
+  double max_diff = 0;
+  for (int col = block.min().x(); col < block.max().x(); col++) {
+    for (int row = block.min().y(); row < block.max().y(); row++) {
+      double diff = std::abs(dem_wts(col, row)
+                             - region_wts(col - region.min().x(), row - region.min().y()));
+      max_diff = std::max(max_diff, diff);
+    }
+  }
+  return max_diff;
+}
+
+TEST( DemMosaic, WeightsDoNotDependOnBlocks ) {
+
+  // The default options, and a bias found as in dem_mosaic
+  DemWeightOptions opt;
+  opt.erode_len          = 2;
+  opt.weights_blur_sigma = 5.0;
+  opt.weights_exp        = 2.0;
+  int bias = opt.erode_len + 2*vw::compute_kernel_size(opt.weights_blur_sigma);
+  int halo = dem_weights_halo(opt, bias);
+
+  // A DEM with a round hole and a missing strip
+  const double nodata = -9999;
+  const int size = 3*halo + 100;
+  ImageView<DoubleGrayA> dem(size, size);
+  Vector2 hole_center(size/2 + 20, size/2 - 30);
+  for (int col = 0; col < size; col++) {
+    for (int row = 0; row < size; row++) {
+      bool valid = (norm_2(Vector2(col, row) - hole_center) > 15 && col > 10);
+      dem(col, row) = DoubleGrayA(valid ? 100.0 + 0.1*col - 0.2*row : nodata);
+    }
+  }
+
+  // The weights of the whole DEM are what the weights cache stores
+  ImageView<double> dem_wts;
+  compute_dem_weights(opt, bias, nodata, dem, dem_wts);
+
+  // A block near the hole and away from the edges, and one at a corner
+  std::vector<BBox2i> blocks;
+  blocks.push_back(BBox2i(size/2 - 32, size/2 - 32, 64, 64));
+  blocks.push_back(BBox2i(0, 0, 64, 64));
+  for (size_t it = 0; it < blocks.size(); it++)
+    EXPECT_NEAR(0.0, max_block_weights_diff(opt, bias, nodata, dem, dem_wts,
+                                            blocks[it], halo), 1e-8);
+
+  // If read past the block only by the bias, the blurred weights see
+  // where the reading stopped.
+  EXPECT_GT(max_block_weights_diff(opt, bias, nodata, dem, dem_wts, blocks[0], bias), 1e-3);
+}
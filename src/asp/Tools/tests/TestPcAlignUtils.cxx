@@ -0,0 +1,194 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Tools/pc_align_utils.h>
+#include <test/Helpers.h>
+
+using namespace vw;
+using namespace vw::test;
+using namespace asp;
+
+// A DEM of 5 x 4 tiles, with a value at each pixel which tells where
+// it is, and one pixel with no data.
+const int    DEM_COLS = 5*DemHeightLookup::TILE_SIZE, DEM_ROWS = 4*DemHeightLookup::TILE_SIZE;
+const int    NODATA_COL = 100, NODATA_ROW = 100;
+const double NODATA = -9999;
+
+double dem_value(int col, int row) {
+  return col + 2000.0*row;
+}
+
+cartography::GeoReference write_test_dem(std::string const& dem_file) {
+
+  cartography::GeoReference georef; // WGS84
+  georef.set_geographic();
+  Matrix3x3 affine;
+  affine(0,0) = 1e-4;
+  affine(1,1) = -1e-4;
+  affine(2,2) = 1;
+  affine(0,2) = -122;
+  affine(1,2) = 37;
+  georef.set_transform(affine);
+
+  ImageView<float> dem(DEM_COLS, DEM_ROWS);
+  for (int col = 0; col < dem.cols(); col++) {
+    for (int row = 0; row < dem.rows(); row++)
+      dem(col, row) = dem_value(col, row);
+  }
+  dem(NODATA_COL, NODATA_ROW) = NODATA;
+
+  bool has_georef = true, has_nodata = true;
+  cartography::GdalWriteOptions opt;
+  block_write_gdal_image(dem_file, dem, has_georef, georef, has_nodata, NODATA, opt,
+                         TerminalProgressCallback("asp", ": "));
+  return georef;
+}
+
+// The point at the given height above the datum at a DEM pixel
+Vector3 point_at(cartography::GeoReference const& georef, Vector2 const& pix, double height) {
+  Vector2 lonlat = georef.pixel_to_lonlat(pix);
+  return georef.datum().geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], height));
+}
+
+TEST( DemHeightLookup, HeightAboveDem ) {
+
+  UnlinkName dem_file("pc_align_dem.tif");
+  cartography::GeoReference georef = write_test_dem(dem_file);
+  DemHeightLookup dem(dem_file);
+  const double height = 50;
+
+  // Pixels on both sides of the boundaries of the tiles. The value of
+  // the DEM pixel at the truncated coordinates must be used.
+  const int T = DemHeightLookup::TILE_SIZE;
+  std::vector<Vector2i> pixels;
+  pixels.push_back(Vector2i(T - 1, 10));
+  pixels.push_back(Vector2i(T,     10));
+  pixels.push_back(Vector2i(10,    T - 1));
+  pixels.push_back(Vector2i(10,    T));
+  pixels.push_back(Vector2i(T - 1, T - 1));
+  pixels.push_back(Vector2i(T,     T));
+  pixels.push_back(Vector2i(4*T,   3*T));
+  for (size_t it = 0; it < pixels.size(); it++) {
+    Vector2i pix = pixels[it];
+    Vector3 xyz = point_at(georef, Vector2(pix[0] + 0.5, pix[1] + 0.5), height);
+    double h;
+    ASSERT_TRUE(dem.height_above_dem(xyz, h));
+    EXPECT_NEAR(height - dem_value(pix[0], pix[1]), h, 1e-4);
+  }
+
+  // A pixel with no data has no height, but its neighbors do
+  double h;
+  EXPECT_FALSE(dem.height_above_dem(point_at(georef, Vector2(NODATA_COL + 0.5, NODATA_ROW + 0.5),
+                                             height), h));
+  ASSERT_TRUE(dem.height_above_dem(point_at(georef, Vector2(NODATA_COL - 0.5, NODATA_ROW - 0.5),
+                                            height), h));
+  EXPECT_NEAR(height - dem_value(NODATA_COL - 1, NODATA_ROW - 1), h, 1e-4);
+
+  // Points off the DEM, or on its last column
+  EXPECT_FALSE(dem.height_above_dem(point_at(georef, Vector2(-1.5, 10.5), height), h));
+  EXPECT_FALSE(dem.height_above_dem(point_at(georef, Vector2(10.5, DEM_ROWS + 2.5), height), h));
+  EXPECT_FALSE(dem.height_above_dem(point_at(georef, Vector2(DEM_COLS - 0.5, 10.5), height), h));
+}
+
+TEST( DemHeightLookup, TileCache ) {
+
+  UnlinkName dem_file("pc_align_dem.tif");
+  cartography::GeoReference georef = write_test_dem(dem_file);
+
+  // With no cache, the fewest tiles are kept
+  size_t cache_size = vw_settings().system_cache_size();
+  vw_settings().set_system_cache_size(0);
+  DemHeightLookup dem(dem_file);
+  vw_settings().set_system_cache_size(cache_size);
+
+  const int T = DemHeightLookup::TILE_SIZE;
+  const size_t MIN_NUM_TILES = 16;
+  for (int ty = 0; ty < DEM_ROWS/T; ty++) {
+    for (int tx = 0; tx < DEM_COLS/T; tx++) {
+      Vector2i pix(tx*T + 7, ty*T + 9);
+      Vector3 xyz = point_at(georef, Vector2(pix[0] + 0.5, pix[1] + 0.5), 0.0);
+      double h;
+      ASSERT_TRUE(dem.height_above_dem(xyz, h));
+      EXPECT_NEAR(-dem_value(pix[0], pix[1]), h, 1e-4);
+    }
+  }
+  EXPECT_EQ(MIN_NUM_TILES, dem.num_tiles_in_memory());
+
+  // The first tiles were dropped, and are read again
+  double h;
+  ASSERT_TRUE(dem.height_above_dem(point_at(georef, Vector2(3.5, 5.5), 0.0), h));
+  EXPECT_NEAR(-dem_value(3, 5), h, 1e-4);
+  EXPECT_EQ(MIN_NUM_TILES, dem.num_tiles_in_memory());
+}
+
+TEST( DemHeightLookup, HeightsAboveDem ) {
+
+  UnlinkName dem_file("pc_align_dem.tif");
+  cartography::GeoReference georef = write_test_dem(dem_file);
+  DemHeightLookup dem(dem_file);
+
+  // Random points over the DEM and a bit past it, and one at the
+  // pixel with no data
+  const int num_pts = 5000;
+  std::mt19937 generator(0);
+  std::uniform_real_distribution<double> col_dist(-10.0, DEM_COLS + 10.0);
+  std::uniform_real_distribution<double> row_dist(-10.0, DEM_ROWS + 10.0);
+  std::uniform_real_distribution<double> height_dist(-100.0, 100.0);
+  DP cloud;
+  cloud.featureLabels = form_labels<RealT>(DIM);
+  cloud.features.resize(DIM + 1, num_pts);
+  Vector3 shift;
+  for (int i = 0; i < num_pts; i++) {
+    Vector2 pix(col_dist(generator), row_dist(generator));
+    if (i == num_pts/2)
+      pix = Vector2(NODATA_COL + 0.5, NODATA_ROW + 0.5);
+    Vector3 xyz = point_at(georef, pix, height_dist(generator));
+    if (i == 0)
+      shift = xyz;
+    for (int row = 0; row < DIM; row++)
+      cloud.features(row, i) = xyz[row] - shift[row];
+    cloud.features(DIM, i) = 1;
+  }
+
+  // The same heights must be found for each point on its own, and
+  // for all points at once with any number of threads.
+  std::vector<double> heights1, heights4;
+  std::vector<uint8> is_valid1, is_valid4;
+  dem.heights_above_dem(cloud, shift, 1, heights1, is_valid1);
+  dem.heights_above_dem(cloud, shift, 4, heights4, is_valid4);
+  ASSERT_EQ(size_t(num_pts), is_valid1.size());
+  ASSERT_EQ(size_t(num_pts), is_valid4.size());
+
+  int num_valid = 0;
+  for (int i = 0; i < num_pts; i++) {
+    Vector3 xyz;
+    for (int row = 0; row < DIM; row++)
+      xyz[row] = cloud.features(row, i) + shift[row];
+    double h = 0;
+    bool valid = dem.height_above_dem(xyz, h);
+    EXPECT_EQ(valid, bool(is_valid1[i]));
+    EXPECT_EQ(valid, bool(is_valid4[i]));
+    if (!valid)
+      continue;
+    num_valid++;
+    EXPECT_NEAR(h, heights1[i], 1e-8);
+    EXPECT_NEAR(h, heights4[i], 1e-8);
+  }
+  EXPECT_FALSE(is_valid1[num_pts/2]);
+  EXPECT_GT(num_valid, num_pts*9/10);
+}
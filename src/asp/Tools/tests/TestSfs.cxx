@@ -0,0 +1,92 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Tools/sfs.h>
+#include <test/Helpers.h>
+#include <random>
+
+using namespace vw;
+using namespace asp;
+
+// The horizon sweep must find nearly the same points in shadow as
+// marching a ray from each DEM point, for the Sun from any direction.
+// They differ only at the edges of shadows, as they interpolate the
+// DEM differently.
+TEST( Sfs, HorizonSweepMatchesRayMarching ) {
+
+  // A DEM on the Moon with a grid size of 10 meters, near the equator
+  const double grid = 10.0;
+  cartography::GeoReference geo;
+  geo.set_well_known_geogcs("D_MOON");
+  double deg_per_pix = grid/(geo.datum().semi_major_axis()*M_PI/180.0);
+  Matrix3x3 affine;
+  affine(0,0) = deg_per_pix;
+  affine(1,1) = -deg_per_pix;
+  affine(2,2) = 1;
+  affine(0,2) = 10.0;
+  affine(1,2) = 0.1;
+  geo.set_transform(affine);
+
+  // Random hills
+  const int cols = 100, rows = 80;
+  ImageView<double> dem(cols, rows);
+  fill(dem, 0.0);
+  std::mt19937 generator(0);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  for (int k = 0; k < 15; k++) {
+    double cx = cols*uniform(generator), cy = rows*uniform(generator);
+    double height = 8*grid*uniform(generator), sigma = 8*uniform(generator) + 2;
+    for (int col = 0; col < cols; col++) {
+      for (int row = 0; row < rows; row++) {
+        double d2 = (col - cx)*(col - cx) + (row - cy)*(row - cy);
+        dem(col, row) += height*exp(-d2/(2*sigma*sigma));
+      }
+    }
+  }
+
+  // The local frame at the DEM center
+  Vector2 ctr_lonlat = geo.pixel_to_lonlat(Vector2(cols/2, rows/2));
+  Vector3 ctr = geo.datum().geodetic_to_cartesian(Vector3(ctr_lonlat[0], ctr_lonlat[1], 0));
+  Vector3 up    = ctr/norm_2(ctr);
+  Vector3 east  = normalize(cross_prod(Vector3(0, 0, 1), up));
+  Vector3 north = cross_prod(up, east);
+
+  // The Sun azimuth, measured from north, and elevation, in degrees
+  double sun_angles[][2] = {{200, 12}, {45, 5}, {100, 20}, {300, 8}, {10, 3}};
+  for (size_t it = 0; it < sizeof(sun_angles)/sizeof(sun_angles[0]); it++) {
+    double az = sun_angles[it][0]*M_PI/180.0, el = sun_angles[it][1]*M_PI/180.0;
+    Vector3 dir = cos(el)*(sin(az)*east + cos(az)*north) + sin(el)*up;
+    Vector3 sun_pos = ctr + 1.5e+11*dir;
+
+    ImageView<float> ray_shadow, sweep_shadow;
+    areInShadow(sun_pos, dem, grid, grid, geo, ray_shadow);
+    horizonSweepShadows(sun_pos, dem, grid, geo, sweep_shadow);
+    ASSERT_EQ(cols, sweep_shadow.cols());
+    ASSERT_EQ(rows, sweep_shadow.rows());
+
+    int num_in_shadow = 0, num_agree = 0;
+    for (int col = 0; col < cols; col++) {
+      for (int row = 0; row < rows; row++) {
+        num_in_shadow += (ray_shadow(col, row) != 0);
+        num_agree     += ((ray_shadow(col, row) != 0) == (sweep_shadow(col, row) != 0));
+      }
+    }
+    EXPECT_GT(num_in_shadow, cols*rows/20) << "Azimuth " << sun_angles[it][0];
+    EXPECT_GT(num_agree, 0.98*cols*rows)   << "Azimuth " << sun_angles[it][0];
+  }
+}